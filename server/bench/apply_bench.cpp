@@ -0,0 +1,362 @@
+// Document::apply_update benchmark on the recorded update corpus
+//
+// Replays each stream of bench/corpus (typing, pasting, formatting, concurrent
+// editors, long histories; see bench/corpus/generate-corpus.js) into a fresh
+// Document, once per encoding, and reports:
+//   apply      updates/s, MB/s and p50/p99/max per Document::apply_update()
+//   memory     heap growth over the replay (glibc mallinfo2, which also sees
+//              libyrs' allocations) and resident set growth
+//   snapshot   size of the final state encoded as v1 and v2, and the time to
+//              encode it directly (ytransaction_state_diff_v1/_v2) and through
+//              Document::get_state_as_update() (read view merge)
+// and checks the final text against the stream's expected.txt.
+//
+// Document::apply_update() tries v1 first, so v2 timings include that failed
+// attempt, as they do in the server.
+//
+// Usage: bench_apply [--corpus DIR] [--stream NAME[,NAME...]] [--encoding v1|v2|both]
+//                    [--repeat R] [--type NAME] [--json]
+// Defaults: bench/corpus/v1, every stream in its manifest, both encodings, 3
+// repeats (the fastest replay is reported), shared type "quill".
+
+#include "document.h"
+#include "epoch.h"
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define LOG_MAGIC "YUPD"
+#define LOG_FORMAT 1
+#define ENCODE_REPEAT 5
+
+struct BenchOptions {
+    std::string corpus = "bench/corpus/v1";
+    std::vector<std::string> streams;   // Empty = every stream in the manifest
+    bool v1 = true;
+    bool v2 = true;
+    int repeat = 3;
+    std::string type = "quill";
+    bool json = false;
+};
+
+// One update log: every record points into data
+struct UpdateLog {
+    std::vector<uint8_t> data;
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> lens;
+    uint64_t bytes;             // Update payload only
+};
+
+struct StreamResult {
+    std::string stream;
+    const char* encoding;
+    size_t updates;
+    uint64_t bytes;
+    double seconds;             // Fastest replay
+    double p50_us;
+    double p99_us;
+    double max_us;
+    int64_t heap_bytes;         // -1 = not measured
+    int64_t rss_bytes;
+    uint32_t state_v1_bytes;
+    uint32_t state_v2_bytes;
+    double encode_v1_us;
+    double encode_v2_us;
+    double get_state_us;
+    bool text_ok;
+    int failed;                 // apply_update() calls that returned false
+};
+
+static BenchOptions g_opts;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bool read_file(const std::string& path, std::vector<uint8_t>* out) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    out->clear();
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out->insert(out->end(), buf, buf + n);
+    fclose(f);
+    return true;
+}
+
+static uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool load_log(const std::string& path, UpdateLog* log) {
+    if (!read_file(path, &log->data)) {
+        fprintf(stderr, "[Bench] Cannot read %s\n", path.c_str());
+        return false;
+    }
+    const std::vector<uint8_t>& d = log->data;
+    if (d.size() < 12 || memcmp(&d[0], LOG_MAGIC, 4) != 0 || read_u32(&d[4]) != LOG_FORMAT) {
+        fprintf(stderr, "[Bench] %s is not a format %d update log\n", path.c_str(), LOG_FORMAT);
+        return false;
+    }
+    uint32_t count = read_u32(&d[8]);
+    size_t pos = 12;
+    log->bytes = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (pos + 4 > d.size()) break;
+        uint32_t len = read_u32(&d[pos]);
+        pos += 4;
+        if (len == 0 || pos + len > d.size()) break;
+        log->offsets.push_back(pos);
+        log->lens.push_back(len);
+        log->bytes += len;
+        pos += len;
+    }
+    if (log->offsets.size() != count || pos != d.size()) {
+        fprintf(stderr, "[Bench] %s is truncated (%zu of %u records)\n", path.c_str(), log->offsets.size(), count);
+        return false;
+    }
+    return true;
+}
+
+// Stream ids from manifest.json: every "id" value, in order
+static std::vector<std::string> manifest_streams(const std::string& dir) {
+    std::vector<std::string> ids;
+    std::vector<uint8_t> data;
+    if (!read_file(dir + "/manifest.json", &data)) return ids;
+    std::string s(data.begin(), data.end());
+    size_t pos = 0;
+    while ((pos = s.find("\"id\"", pos)) != std::string::npos) {
+        size_t open = s.find('"', s.find(':', pos) + 1);
+        size_t close = s.find('"', open + 1);
+        if (open == std::string::npos || close == std::string::npos) break;
+        ids.push_back(s.substr(open + 1, close - open - 1));
+        pos = close + 1;
+    }
+    return ids;
+}
+
+// Bytes allocated from the C heap (libyrs allocates through it too)
+static int64_t heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)) && \
+    !defined(__SANITIZE_ADDRESS__)
+    struct mallinfo2 mi = mallinfo2();
+    return (int64_t)(mi.uordblks + mi.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+static int64_t rss_bytes() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    long size = 0, resident = 0;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return (int64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static double percentile(std::vector<double>& samples, double q) {
+    if (samples.empty()) return 0;
+    size_t k = (size_t)(q * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+// Full state straight from libyrs in the given encoding; returns its size
+static uint32_t encode_state(Document* doc, bool v2, double* us) {
+    uint32_t len = 0;
+    double best = 0;
+    for (int i = 0; i < ENCODE_REPEAT; i++) {
+        double t0 = now_ns();
+        YTransaction* txn = ydoc_read_transaction(doc->get_doc());
+        char* state = v2 ? ytransaction_state_diff_v2(txn, nullptr, 0, &len)
+                         : ytransaction_state_diff_v1(txn, nullptr, 0, &len);
+        ytransaction_commit(txn);
+        double t = now_ns() - t0;
+        if (state) ybinary_destroy(state, len);
+        if (i == 0 || t < best) best = t;
+    }
+    *us = best / 1000.0;
+    return len;
+}
+
+static bool replay(const std::string& stream, const char* encoding, const UpdateLog& log,
+                   const std::string& expected, StreamResult* r) {
+    r->stream = stream;
+    r->encoding = encoding;
+    r->updates = log.offsets.size();
+    r->bytes = log.bytes;
+    r->seconds = 0;
+
+    std::vector<double> calls(log.offsets.size());
+    std::vector<double> best_calls;
+    for (int rep = 0; rep < g_opts.repeat; rep++) {
+        epoch_reclaim();
+        int64_t heap0 = heap_in_use();
+        int64_t rss0 = rss_bytes();
+
+        Document* doc = new Document();
+        if (!doc->init(g_opts.type.c_str())) {
+            fprintf(stderr, "[Bench] Document init failed\n");
+            delete doc;
+            return false;
+        }
+
+        int failed = 0;
+        double start = now_ns();
+        for (size_t i = 0; i < log.offsets.size(); i++) {
+            double t0 = now_ns();
+            if (!doc->apply_update(&log.data[log.offsets[i]], log.lens[i])) failed++;
+            calls[i] = (now_ns() - t0) / 1000.0;
+            // Retired read views are freed as the server's reactors would
+            if ((i & 255) == 255) epoch_reclaim();
+        }
+        double seconds = (now_ns() - start) / 1e9;
+        epoch_reclaim();
+
+        // Measure the last replay's document; the rest are only for timing
+        if (rep == g_opts.repeat - 1) {
+            int64_t heap1 = heap_in_use();
+            r->heap_bytes = heap0 < 0 ? -1 : heap1 - heap0;
+            r->rss_bytes = rss_bytes() - rss0;
+            r->state_v1_bytes = encode_state(doc, false, &r->encode_v1_us);
+            r->state_v2_bytes = encode_state(doc, true, &r->encode_v2_us);
+
+            double best = 0;
+            for (int i = 0; i < ENCODE_REPEAT; i++) {
+                size_t len = 0;
+                double t0 = now_ns();
+                uint8_t* state = doc->get_state_as_update(&len);
+                double t = now_ns() - t0;
+                free(state);
+                if (i == 0 || t < best) best = t;
+            }
+            r->get_state_us = best / 1000.0;
+
+            char* text = doc->get_text_content();
+            r->text_ok = text && expected == text;
+            free(text);
+            r->failed = failed;
+        }
+        if (rep == 0 || seconds < r->seconds) {
+            r->seconds = seconds;
+            best_calls = calls;
+        }
+        delete doc;
+    }
+    epoch_reclaim();
+
+    r->max_us = *std::max_element(best_calls.begin(), best_calls.end());
+    r->p99_us = percentile(best_calls, 0.99);
+    r->p50_us = percentile(best_calls, 0.5);
+    return true;
+}
+
+static bool parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--json") == 0) g_opts.json = true;
+        else if (!has_value) return false;
+        else if (strcmp(a, "--corpus") == 0) g_opts.corpus = argv[++i];
+        else if (strcmp(a, "--type") == 0) g_opts.type = argv[++i];
+        else if (strcmp(a, "--repeat") == 0) g_opts.repeat = atoi(argv[++i]);
+        else if (strcmp(a, "--stream") == 0) {
+            std::string list = argv[++i];
+            size_t pos = 0;
+            while (pos <= list.size()) {
+                size_t comma = list.find(',', pos);
+                if (comma == std::string::npos) comma = list.size();
+                if (comma > pos) g_opts.streams.push_back(list.substr(pos, comma - pos));
+                pos = comma + 1;
+            }
+        } else if (strcmp(a, "--encoding") == 0) {
+            const char* e = argv[++i];
+            g_opts.v1 = strcmp(e, "v1") == 0 || strcmp(e, "both") == 0;
+            g_opts.v2 = strcmp(e, "v2") == 0 || strcmp(e, "both") == 0;
+            if (!g_opts.v1 && !g_opts.v2) return false;
+        } else return false;
+    }
+    return g_opts.repeat > 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_args(argc, argv)) {
+        fprintf(stderr, "Usage: %s [--corpus DIR] [--stream NAME[,NAME...]] [--encoding v1|v2|both]\n"
+                        "          [--repeat R] [--type NAME] [--json]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> streams = g_opts.streams;
+    if (streams.empty()) streams = manifest_streams(g_opts.corpus);
+    if (streams.empty()) {
+        fprintf(stderr, "[Bench] No streams in %s/manifest.json; generate the corpus with 'make corpus'\n",
+                g_opts.corpus.c_str());
+        return 1;
+    }
+
+    epoch_init();
+    std::vector<StreamResult> results;
+    bool ok = true;
+    for (size_t s = 0; s < streams.size(); s++) {
+        std::string dir = g_opts.corpus + "/" + streams[s];
+        std::vector<uint8_t> text;
+        if (!read_file(dir + "/expected.txt", &text)) {
+            fprintf(stderr, "[Bench] Cannot read %s/expected.txt\n", dir.c_str());
+            ok = false;
+            continue;
+        }
+        std::string expected(text.begin(), text.end());
+
+        for (int e = 0; e < 2; e++) {
+            if ((e == 0 && !g_opts.v1) || (e == 1 && !g_opts.v2)) continue;
+            const char* encoding = e == 0 ? "v1" : "v2";
+            UpdateLog log;
+            StreamResult r;
+            if (!load_log(dir + "/updates." + encoding, &log) || !replay(streams[s], encoding, log, expected, &r)) {
+                ok = false;
+                continue;
+            }
+            if (!r.text_ok || r.failed) ok = false;
+            results.push_back(r);
+            if (!g_opts.json) {
+                printf("%-14s %s %7zu updates %8.2f MB: %9.0f updates/s %7.2f MB/s  p50 %7.1f us  p99 %8.1f us  "
+                       "max %9.1f us  heap %+8.2f MB  rss %+8.2f MB  state v1 %8u B v2 %8u B  "
+                       "encode v1 %8.1f us v2 %8.1f us get_state %8.1f us%s\n",
+                       r.stream.c_str(), r.encoding, r.updates, r.bytes / 1e6, r.updates / r.seconds,
+                       r.bytes / 1e6 / r.seconds, r.p50_us, r.p99_us, r.max_us,
+                       r.heap_bytes < 0 ? 0.0 : r.heap_bytes / 1e6, r.rss_bytes / 1e6,
+                       r.state_v1_bytes, r.state_v2_bytes, r.encode_v1_us, r.encode_v2_us, r.get_state_us,
+                       !r.text_ok ? "  TEXT MISMATCH" : r.failed ? "  APPLY FAILED" : "");
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (g_opts.json) {
+        printf("{\"corpus\":\"%s\",\"repeat\":%d,\"streams\":[", g_opts.corpus.c_str(), g_opts.repeat);
+        for (size_t i = 0; i < results.size(); i++) {
+            const StreamResult& r = results[i];
+            printf("%s{\"stream\":\"%s\",\"encoding\":\"%s\",\"updates\":%zu,\"bytes\":%llu,\"seconds\":%.6f,"
+                   "\"updates_per_sec\":%.1f,\"mb_per_sec\":%.3f,\"apply_us\":{\"p50\":%.2f,\"p99\":%.2f,\"max\":%.2f},"
+                   "\"heap_bytes\":%lld,\"rss_bytes\":%lld,\"state_v1_bytes\":%u,\"state_v2_bytes\":%u,"
+                   "\"encode_v1_us\":%.2f,\"encode_v2_us\":%.2f,\"get_state_us\":%.2f,\"text_ok\":%s,\"failed\":%d}",
+                   i ? "," : "", r.stream.c_str(), r.encoding, r.updates, (unsigned long long)r.bytes, r.seconds,
+                   r.updates / r.seconds, r.bytes / 1e6 / r.seconds, r.p50_us, r.p99_us, r.max_us,
+                   (long long)r.heap_bytes, (long long)r.rss_bytes, r.state_v1_bytes, r.state_v2_bytes,
+                   r.encode_v1_us, r.encode_v2_us, r.get_state_us, r.text_ok ? "true" : "false", r.failed);
+        }
+        printf("]}\n");
+    }
+
+    epoch_destroy();
+    return ok ? 0 : 2;
+}
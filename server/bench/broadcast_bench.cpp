@@ -0,0 +1,339 @@
+// server_broadcast() benchmark with in-process fake connections
+//
+// Builds one room of N synced peers per case whose transport is an in-memory
+// sink: request_write() puts the peer on a wake list (as a reactor does) and
+// the drain phase writes its queue out the way the epoll engine does (batches
+// of iovecs, here copied into a buffer), so no socket or event loop is timed.
+// Each case sends M sync updates of a realistic size from one member and
+// measures, per message:
+//   broadcast  server_broadcast(): frame once, filter members, queue to each
+//              (ns per peer, p50/p99/max per call)
+//   drain      dequeue + sink write + free (ns per peer)
+//   allocs     malloc/calloc/realloc calls and bytes per broadcast (the bench
+//              interposes the allocator; not counted under ASan)
+//
+// Usage: bench_broadcast [--peers N[,N...]] [--sizes BYTES[,BYTES...]]
+//                        [--messages M] [--drain-every K] [--json]
+// Defaults: 10..100000 peers; 24 (keystroke), 180 (formatted word) and 4096
+// (paste) byte updates; M scaled to ~2M enqueues per case.
+
+#include "server.h"
+#include "room.h"
+#include "peer.h"
+#include "epoch.h"
+#include "protocol.h"
+#include "ws_frame.h"
+#include <sys/uio.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define BATCH 64
+#define TARGET_ENQUEUES 2000000
+
+// Allocation counting: the executable's malloc family wins symbol resolution
+// over libc's for every library in the process, and forwards to glibc
+static uint64_t g_alloc_calls = 0;
+static uint64_t g_alloc_bytes = 0;
+
+#if !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCS 1
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    __atomic_fetch_add(&g_alloc_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_alloc_bytes, size, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&g_alloc_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_alloc_bytes, count * size, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    __atomic_fetch_add(&g_alloc_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_alloc_bytes, size, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+}
+#else
+#define COUNT_ALLOCS 0
+#endif
+
+struct BenchOptions {
+    std::vector<int> peers;
+    std::vector<size_t> sizes;
+    int messages = 0;           // 0 = scale to TARGET_ENQUEUES
+    int drain_every = 1;
+    bool json = false;
+};
+
+// Fake connection: the wake list stands in for a reactor's flush list
+struct FakeConn {
+    Peer* peer;
+    bool pending;
+};
+
+struct CaseResult {
+    int peers;
+    size_t size;
+    int messages;
+    double broadcast_ns;        // Per peer per message
+    double drain_ns;
+    double p50_us;              // Per server_broadcast() call
+    double p99_us;
+    double max_us;
+    double allocs;              // Per broadcast
+    double alloc_bytes;
+    uint64_t sink_bytes;
+};
+
+static BenchOptions g_opts;
+static std::vector<FakeConn*> g_wake;
+static uint8_t* g_sink = nullptr;
+static size_t g_sink_cap = 0;
+static uint64_t g_sink_bytes = 0;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Called under the peer's lock, like the real transports
+static void fake_request_write(Peer* p) {
+    FakeConn* conn = (FakeConn*)p->conn;
+    if (conn->pending) return;
+    conn->pending = true;
+    g_wake.push_back(conn);
+}
+
+static const PeerTransport g_fake_transport = {
+    "fake",
+    fake_request_write
+};
+
+static void sink_write(const struct iovec* iov, int count) {
+    size_t pos = 0;
+    for (int i = 0; i < count; i++) {
+        if (pos + iov[i].iov_len > g_sink_cap) pos = 0;
+        memcpy(g_sink + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+        g_sink_bytes += iov[i].iov_len;
+    }
+}
+
+// Write out every woken connection's queue
+static void drain_all() {
+    struct iovec iov[BATCH];
+    PendingMessage* batch[BATCH];
+    for (size_t w = 0; w < g_wake.size(); w++) {
+        FakeConn* conn = g_wake[w];
+        conn->pending = false;
+        for (;;) {
+            int count = 0;
+            while (count < BATCH) {
+                PendingMessage* msg = peer_dequeue_message(conn->peer);
+                if (!msg) break;
+                iov[count].iov_base = msg->frame->data;
+                iov[count].iov_len = msg->frame->len;
+                batch[count++] = msg;
+            }
+            if (count == 0) break;
+            sink_write(iov, count);
+            for (int k = 0; k < count; k++) peer_free_message(batch[k]);
+        }
+    }
+    g_wake.clear();
+}
+
+// SYNC_STEP2 carrying size bytes of update, as an editing client sends it
+static std::vector<uint8_t> make_update_message(size_t size) {
+    std::vector<uint8_t> update(size);
+    for (size_t i = 0; i < size; i++) update[i] = (uint8_t)(i * 31 + 7);
+    size_t len = 0;
+    uint8_t* encoded = encode_sync_step2(&update[0], size, &len);
+    std::vector<uint8_t> msg(encoded, encoded + len);
+    protocol_free(encoded);
+    return msg;
+}
+
+static double percentile(std::vector<double>& samples, double q) {
+    size_t k = (size_t)(q * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+static CaseResult run_case(Room* room, const std::vector<Peer*>& peers, size_t size, int messages) {
+    std::vector<uint8_t> msg = make_update_message(size);
+    std::vector<double> calls;
+    calls.reserve(messages);
+    Peer* sender = peers[0];
+
+    // Warm up: frames, queues and the allocator's size classes
+    for (int m = 0; m < 3; m++) {
+        server_broadcast(room, &msg[0], msg.size(), sender);
+        drain_all();
+    }
+
+    g_sink_bytes = 0;
+    double broadcast_ns = 0;
+    double drain_ns = 0;
+    uint64_t alloc_calls = 0;
+    uint64_t alloc_bytes = 0;
+    for (int m = 0; m < messages; m++) {
+        uint64_t calls0 = __atomic_load_n(&g_alloc_calls, __ATOMIC_RELAXED);
+        uint64_t bytes0 = __atomic_load_n(&g_alloc_bytes, __ATOMIC_RELAXED);
+        double t0 = now_ns();
+        server_broadcast(room, &msg[0], msg.size(), sender);
+        double t1 = now_ns();
+        alloc_calls += __atomic_load_n(&g_alloc_calls, __ATOMIC_RELAXED) - calls0;
+        alloc_bytes += __atomic_load_n(&g_alloc_bytes, __ATOMIC_RELAXED) - bytes0;
+        broadcast_ns += t1 - t0;
+        calls.push_back((t1 - t0) / 1000.0);
+
+        if ((m + 1) % g_opts.drain_every == 0 || m + 1 == messages) {
+            double t2 = now_ns();
+            drain_all();
+            drain_ns += now_ns() - t2;
+        }
+    }
+
+    double per = (double)(peers.size() - 1) * messages;
+    CaseResult r;
+    r.peers = (int)peers.size();
+    r.size = size;
+    r.messages = messages;
+    r.broadcast_ns = broadcast_ns / per;
+    r.drain_ns = drain_ns / per;
+    r.max_us = *std::max_element(calls.begin(), calls.end());
+    r.p99_us = percentile(calls, 0.99);
+    r.p50_us = percentile(calls, 0.5);
+    r.allocs = (double)alloc_calls / messages;
+    r.alloc_bytes = (double)alloc_bytes / messages;
+    r.sink_bytes = g_sink_bytes;
+    return r;
+}
+
+static bool parse_list(const char* s, std::vector<long>* out) {
+    out->clear();
+    while (*s) {
+        char* end = nullptr;
+        long v = strtol(s, &end, 10);
+        if (end == s || v <= 0) return false;
+        out->push_back(v);
+        s = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') return false;
+    }
+    return !out->empty();
+}
+
+static bool parse_args(int argc, char* argv[]) {
+    std::vector<long> peers = { 10, 100, 1000, 10000, 100000 };
+    std::vector<long> sizes = { 24, 180, 4096 };
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--json") == 0) g_opts.json = true;
+        else if (!has_value) return false;
+        else if (strcmp(a, "--peers") == 0) { if (!parse_list(argv[++i], &peers)) return false; }
+        else if (strcmp(a, "--sizes") == 0) { if (!parse_list(argv[++i], &sizes)) return false; }
+        else if (strcmp(a, "--messages") == 0) g_opts.messages = atoi(argv[++i]);
+        else if (strcmp(a, "--drain-every") == 0) g_opts.drain_every = atoi(argv[++i]);
+        else return false;
+    }
+    for (size_t i = 0; i < peers.size(); i++) {
+        if (peers[i] < 2) return false;
+        g_opts.peers.push_back((int)peers[i]);
+    }
+    for (size_t i = 0; i < sizes.size(); i++) g_opts.sizes.push_back((size_t)sizes[i]);
+    std::sort(g_opts.peers.begin(), g_opts.peers.end());
+    return g_opts.messages >= 0 && g_opts.drain_every > 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_args(argc, argv)) {
+        fprintf(stderr, "Usage: %s [--peers N[,N...]] [--sizes BYTES[,BYTES...]]\n"
+                        "          [--messages M] [--drain-every K] [--json]\n", argv[0]);
+        return 1;
+    }
+
+    size_t max_size = *std::max_element(g_opts.sizes.begin(), g_opts.sizes.end());
+    g_sink_cap = (max_size + 16 + WS_MAX_HEADER_LEN) * BATCH;
+    g_sink = (uint8_t*)malloc(g_sink_cap);
+
+    server_set_log_messages(false);
+    epoch_init();
+    peers_init();
+    rooms_init("quill");
+
+    // Rooms grow case by case: the next size only adds the missing members
+    Room* room = rooms_get("/bench");
+    std::vector<Peer*> peers;
+    std::vector<FakeConn*> conns;
+    std::vector<CaseResult> results;
+
+    for (size_t c = 0; c < g_opts.peers.size(); c++) {
+        int n = g_opts.peers[c];
+        size_t first = peers.size();
+        while ((int)peers.size() < n) {
+            FakeConn* conn = (FakeConn*)calloc(1, sizeof(FakeConn));
+            Peer* p = peers_add(&g_fake_transport, conn);
+            conn->peer = p;
+            p->room = room;
+            peers.push_back(p);
+            conns.push_back(conn);
+        }
+        room_join_many(room, &peers[first], (int)(peers.size() - first));
+        for (size_t i = first; i < peers.size(); i++) room_set_sync(room, peers[i], PEER_SYNC_DONE);
+        epoch_reclaim();
+
+        for (size_t s = 0; s < g_opts.sizes.size(); s++) {
+            int messages = g_opts.messages;
+            if (messages == 0) messages = std::max(20, std::min(20000, TARGET_ENQUEUES / n));
+            CaseResult r = run_case(room, peers, g_opts.sizes[s], messages);
+            results.push_back(r);
+            if (!g_opts.json) {
+                printf("%7d peers %6zu B x %5d: broadcast %6.1f ns/peer  drain %6.1f ns/peer  "
+                       "p50 %9.1f us  p99 %9.1f us  max %9.1f us",
+                       r.peers, r.size, r.messages, r.broadcast_ns, r.drain_ns, r.p50_us, r.p99_us, r.max_us);
+                if (COUNT_ALLOCS) printf("  %.1f allocs (%.0f B)/broadcast", r.allocs, r.alloc_bytes);
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (g_opts.json) {
+        printf("{\"drain_every\":%d,\"allocs_counted\":%s,\"cases\":[", g_opts.drain_every,
+               COUNT_ALLOCS ? "true" : "false");
+        for (size_t i = 0; i < results.size(); i++) {
+            const CaseResult& r = results[i];
+            printf("%s{\"peers\":%d,\"size\":%zu,\"messages\":%d,\"broadcast_ns_per_peer\":%.2f,"
+                   "\"drain_ns_per_peer\":%.2f,\"broadcast_us\":{\"p50\":%.2f,\"p99\":%.2f,\"max\":%.2f},"
+                   "\"enqueue_p99_ns_per_peer\":%.2f,\"allocs_per_broadcast\":%.2f,"
+                   "\"alloc_bytes_per_broadcast\":%.0f,\"sink_bytes\":%llu}",
+                   i ? "," : "", r.peers, r.size, r.messages, r.broadcast_ns, r.drain_ns,
+                   r.p50_us, r.p99_us, r.max_us, r.p99_us * 1000.0 / (r.peers - 1), r.allocs, r.alloc_bytes,
+                   (unsigned long long)r.sink_bytes);
+        }
+        printf("]}\n");
+    }
+
+    // Members stay in the room: leaving one at a time would copy the table per peer
+    peers_destroy();
+    epoch_destroy();
+    rooms_destroy();
+    for (size_t i = 0; i < conns.size(); i++) free(conns[i]);
+    free(g_sink);
+    return 0;
+}
@@ -0,0 +1,237 @@
+// Protocol codec microbenchmark
+//
+// Times the per-message encode/decode paths every connection runs, in ns per
+// call (best of --rounds rounds of --iterations calls each):
+//   varuint        encode_varuint / decode_varuint over a mix of 1..5 byte values
+//   sync_step1     encode / decode of a 12-client state vector
+//   sync_step2     encode / decode of a keystroke (24 B) and a paste (4096 B) update
+//   awareness      encode / decode of a cursor state (decode allocates the JSON)
+//   mux            encode_mux_message / decode_mux_message around a keystroke
+//   frame          ws_encode_frame_header + ws_parse_frame_header (client, masked)
+//   mask           ws_apply_mask over 4096 B
+//   shared_frame   ws_frame_create + release of a 180 B broadcast
+//
+// Usage: bench_codec [--iterations N] [--rounds R] [--json]
+
+#include "protocol.h"
+#include "ws_frame.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct BenchOptions {
+    int iterations = 200000;
+    int rounds = 5;
+    bool json = false;
+};
+
+struct OpResult {
+    const char* name;
+    double ns;
+};
+
+static BenchOptions g_opts;
+static volatile uint64_t g_sink = 0;    // Keeps results observable
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static std::vector<uint8_t> pattern(size_t size) {
+    std::vector<uint8_t> v(size);
+    for (size_t i = 0; i < size; i++) v[i] = (uint8_t)(i * 31 + 7);
+    return v;
+}
+
+// Best per-call time over the rounds; fn runs one call and returns something to sink
+template <typename Fn>
+static double time_op(Fn fn) {
+    double best = 0;
+    for (int r = 0; r < g_opts.rounds; r++) {
+        uint64_t acc = 0;
+        double t0 = now_ns();
+        for (int i = 0; i < g_opts.iterations; i++) acc += fn(i);
+        double ns = (now_ns() - t0) / g_opts.iterations;
+        g_sink += acc;
+        if (r == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+static std::vector<OpResult> run_all() {
+    std::vector<OpResult> out;
+
+    static const uint32_t VALUES[8] = { 1, 100, 200, 16000, 70000, 2000000, 300000000, 4000000000u };
+    out.push_back({ "varuint_encode", time_op([](int i) -> uint64_t {
+        uint8_t buf[5];
+        return (uint64_t)encode_varuint(VALUES[i & 7], buf) + buf[0];
+    }) });
+    std::vector<uint8_t> encoded_values;
+    std::vector<size_t> value_offsets;
+    for (int k = 0; k < 8; k++) {
+        uint8_t buf[5];
+        value_offsets.push_back(encoded_values.size());
+        encoded_values.insert(encoded_values.end(), buf, buf + encode_varuint(VALUES[k], buf));
+    }
+    out.push_back({ "varuint_decode", time_op([&](int i) -> uint64_t {
+        uint32_t v = 0;
+        size_t off = value_offsets[i & 7];
+        return (uint64_t)decode_varuint(&encoded_values[off], encoded_values.size() - off, &v) + v;
+    }) });
+
+    // State vector: 12 clients with large ids and clocks, as a busy document has
+    std::vector<uint8_t> sv;
+    uint8_t tmp[5];
+    sv.insert(sv.end(), tmp, tmp + encode_varuint(12, tmp));
+    for (uint32_t c = 0; c < 12; c++) {
+        sv.insert(sv.end(), tmp, tmp + encode_varuint(0x3F000000u + c * 7919, tmp));
+        sv.insert(sv.end(), tmp, tmp + encode_varuint(1000 + c * 4000, tmp));
+    }
+    out.push_back({ "sync_step1_encode", time_op([&](int) -> uint64_t {
+        size_t len = 0;
+        uint8_t* msg = encode_sync_step1(&sv[0], sv.size(), &len);
+        uint64_t v = msg[len - 1];
+        protocol_free(msg);
+        return v + len;
+    }) });
+    size_t step1_len = 0;
+    uint8_t* step1 = encode_sync_step1(&sv[0], sv.size(), &step1_len);
+    out.push_back({ "sync_step1_decode", time_op([&](int) -> uint64_t {
+        size_t len = 0;
+        const uint8_t* p = decode_sync_step1(step1, step1_len, &len);
+        return (uint64_t)len + (p ? p[0] : 0);
+    }) });
+    protocol_free(step1);
+
+    static const size_t SIZES[2] = { 24, 4096 };
+    static const char* ENCODE_NAMES[2] = { "sync_step2_encode_24", "sync_step2_encode_4096" };
+    static const char* DECODE_NAMES[2] = { "sync_step2_decode_24", "sync_step2_decode_4096" };
+    for (int s = 0; s < 2; s++) {
+        std::vector<uint8_t> update = pattern(SIZES[s]);
+        out.push_back({ ENCODE_NAMES[s], time_op([&](int) -> uint64_t {
+            size_t len = 0;
+            uint8_t* msg = encode_sync_step2(&update[0], update.size(), &len);
+            uint64_t v = msg[len - 1];
+            protocol_free(msg);
+            return v + len;
+        }) });
+        size_t msg_len = 0;
+        uint8_t* msg = encode_sync_step2(&update[0], update.size(), &msg_len);
+        out.push_back({ DECODE_NAMES[s], time_op([&](int) -> uint64_t {
+            size_t len = 0;
+            const uint8_t* p = decode_sync_step2(msg, msg_len, &len);
+            return (uint64_t)len + (p ? p[0] : 0);
+        }) });
+        protocol_free(msg);
+    }
+
+    const char* state = "{\"user\":{\"name\":\"editor-42\",\"color\":\"#30bced\"},\"cursor\":{\"anchor\":1234,\"head\":1240}}";
+    size_t state_len = strlen(state);
+    out.push_back({ "awareness_encode", time_op([&](int) -> uint64_t {
+        size_t len = 0;
+        uint8_t* msg = encode_awareness(0x3F00ABCDu, state, state_len, &len);
+        uint64_t v = msg[len - 1];
+        protocol_free(msg);
+        return v + len;
+    }) });
+    size_t aw_len = 0;
+    uint8_t* aw = encode_awareness(0x3F00ABCDu, state, state_len, &aw_len);
+    out.push_back({ "awareness_decode", time_op([&](int) -> uint64_t {
+        uint32_t client = 0;
+        char* json = nullptr;
+        size_t json_len = 0;
+        bool ok = decode_awareness(aw, aw_len, &client, &json, &json_len);
+        protocol_free(json);
+        return (uint64_t)ok + client + json_len;
+    }) });
+    protocol_free(aw);
+
+    size_t key_len = 0;
+    std::vector<uint8_t> key_update = pattern(24);
+    uint8_t* key_msg = encode_sync_step2(&key_update[0], key_update.size(), &key_len);
+    out.push_back({ "mux_encode", time_op([&](int) -> uint64_t {
+        size_t len = 0;
+        uint8_t* msg = encode_mux_message(300, key_msg, key_len, &len);
+        uint64_t v = msg[len - 1];
+        protocol_free(msg);
+        return v + len;
+    }) });
+    size_t mux_len = 0;
+    uint8_t* mux = encode_mux_message(300, key_msg, key_len, &mux_len);
+    out.push_back({ "mux_decode", time_op([&](int) -> uint64_t {
+        uint32_t channel = 0;
+        size_t len = 0;
+        const uint8_t* p = decode_mux_message(mux, mux_len, &channel, &len);
+        return (uint64_t)len + channel + (p ? p[0] : 0);
+    }) });
+    protocol_free(mux);
+    protocol_free(key_msg);
+
+    static const uint64_t FRAME_LENS[4] = { 30, 180, 4100, 70000 };
+    out.push_back({ "frame_header", time_op([](int i) -> uint64_t {
+        uint8_t header[WS_MAX_HEADER_LEN];
+        uint8_t mask[4] = { 1, 2, 3, (uint8_t)i };
+        size_t n = ws_encode_frame_header(WS_OP_BINARY, FRAME_LENS[i & 3], mask, header);
+        WsFrameHeader h;
+        int r = ws_parse_frame_header(header, n, &h);
+        return (uint64_t)r + h.payload_len + h.header_len;
+    }) });
+
+    std::vector<uint8_t> masked = pattern(4096);
+    out.push_back({ "mask_4096", time_op([&](int i) -> uint64_t {
+        uint8_t mask[4] = { 0x37, 0xFA, 0x21, (uint8_t)i };
+        ws_apply_mask(&masked[0], masked.size(), mask, 0);
+        return (uint64_t)masked[i & 4095];
+    }) });
+
+    std::vector<uint8_t> broadcast = pattern(180);
+    out.push_back({ "shared_frame_180", time_op([&](int) -> uint64_t {
+        WsSharedFrame* f = ws_frame_create(WS_OP_BINARY, &broadcast[0], broadcast.size());
+        uint64_t v = f->len;
+        ws_frame_release(f);
+        return v;
+    }) });
+
+    return out;
+}
+
+static bool parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--json") == 0) g_opts.json = true;
+        else if (!has_value) return false;
+        else if (strcmp(a, "--iterations") == 0) g_opts.iterations = atoi(argv[++i]);
+        else if (strcmp(a, "--rounds") == 0) g_opts.rounds = atoi(argv[++i]);
+        else return false;
+    }
+    return g_opts.iterations > 0 && g_opts.rounds > 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_args(argc, argv)) {
+        fprintf(stderr, "Usage: %s [--iterations N] [--rounds R] [--json]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<OpResult> results = run_all();
+
+    if (g_opts.json) {
+        printf("{\"iterations\":%d,\"rounds\":%d,\"ns\":{", g_opts.iterations, g_opts.rounds);
+        for (size_t i = 0; i < results.size(); i++) {
+            printf("%s\"%s\":%.2f", i ? "," : "", results[i].name, results[i].ns);
+        }
+        printf("}}\n");
+    } else {
+        printf("codec: best of %d x %d calls\n", g_opts.rounds, g_opts.iterations);
+        for (size_t i = 0; i < results.size(); i++) {
+            printf("  %-24s %9.1f ns\n", results[i].name, results[i].ns);
+        }
+    }
+    return g_sink == 42 ? 1 : 0;
+}
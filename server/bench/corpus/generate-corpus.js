@@ -0,0 +1,197 @@
+/**
+ * Yjs update corpus generator for bench_apply
+ *
+ * Replays every stream in streams.js against real Yjs documents and writes,
+ * per stream, the updates the server would receive in both encodings:
+ *
+ *   v<N>/<stream>/updates.v1    Update log, Yjs v1 encoding
+ *   v<N>/<stream>/updates.v2    Same transactions, Yjs v2 encoding
+ *   v<N>/<stream>/expected.txt  Final text (the benchmark checks it)
+ *   v<N>/<stream>/meta.json     Stream, generator and Yjs versions, sizes
+ *   v<N>/manifest.json          Every stream with its counts
+ *
+ * Update log format (little endian): "YUPD", u32 format (1), u32 count, then
+ * count records of u32 length + bytes.
+ *
+ * Output is deterministic for a given CORPUS_VERSION, seed, scale and Yjs
+ * version; bump CORPUS_VERSION whenever streams.js changes so results from
+ * different corpora are never compared.
+ *
+ * Usage: node generate-corpus.js [--out DIR] [--scale N] [--seed N] [--type NAME] [--only a,b]
+ */
+
+import * as Y from 'yjs';
+import { streams } from './streams.js';
+import fs from 'fs';
+import path from 'path';
+import { createRequire } from 'module';
+import { fileURLToPath } from 'url';
+
+const CORPUS_VERSION = 1;
+const FORMAT_VERSION = 1;
+const LOCAL = 'local';
+const REMOTE = 'remote';
+
+const __dirname = path.dirname(fileURLToPath(import.meta.url));
+const require = createRequire(import.meta.url);
+const YJS_VERSION = require('yjs/package.json').version;
+
+function parseArgs(argv) {
+  const opts = {
+    out: path.join(__dirname, `v${CORPUS_VERSION}`),
+    scale: 1,
+    seed: 20240601,
+    type: 'quill',  // Server's shared type name (rooms_init)
+    only: null
+  };
+  for (let i = 2; i < argv.length; i++) {
+    const value = argv[i + 1];
+    switch (argv[i]) {
+      case '--out': opts.out = path.resolve(value); i++; break;
+      case '--scale': opts.scale = Number(value); i++; break;
+      case '--seed': opts.seed = Number(value); i++; break;
+      case '--type': opts.type = value; i++; break;
+      case '--only': opts.only = value.split(','); i++; break;
+      default:
+        console.error(`Unknown option ${argv[i]}`);
+        process.exit(1);
+    }
+  }
+  return opts;
+}
+
+// mulberry32: small, fast, and the same sequence on every platform
+function makeRng(seed) {
+  let a = seed >>> 0;
+  return () => {
+    a = (a + 0x6d2b79f5) >>> 0;
+    let t = a;
+    t = Math.imul(t ^ (t >>> 15), t | 1);
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+  };
+}
+
+function encodeLog(updates) {
+  const header = Buffer.alloc(12);
+  header.write('YUPD', 0, 'ascii');
+  header.writeUInt32LE(FORMAT_VERSION, 4);
+  header.writeUInt32LE(updates.length, 8);
+  const parts = [header];
+  for (const u of updates) {
+    const len = Buffer.alloc(4);
+    len.writeUInt32LE(u.length, 0);
+    parts.push(len, Buffer.from(u.buffer, u.byteOffset, u.length));
+  }
+  return Buffer.concat(parts);
+}
+
+function generateStream(stream, opts, index) {
+  const rng = makeRng(opts.seed + index * 7919);
+  const v1 = [];
+  const v2 = [];
+  let step = 0;
+  const inflight = [];  // { due, target, update }
+
+  const editors = [];
+  for (let e = 0; e < stream.editors; e++) {
+    const doc = new Y.Doc();
+    doc.clientID = 1000 + e;  // Fixed ids keep the output reproducible
+    const text = doc.getText(opts.type);
+    const ed = { doc, text, cursor: 0 };
+
+    doc.on('update', (update, origin) => {
+      if (origin !== LOCAL) return;
+      v1.push(update);
+      for (const other of editors) {
+        if (other === ed) continue;
+        const delay = Math.floor(rng() * ((stream.latency || 0) + 1));
+        inflight.push({ due: step + delay, target: other, update });
+      }
+    });
+    doc.on('updateV2', (update, origin) => {
+      if (origin === LOCAL) v2.push(update);
+    });
+    ed.edit = (fn) => doc.transact(fn, LOCAL);
+    editors.push(ed);
+  }
+
+  const deliver = (all = false) => {
+    step++;
+    for (let i = 0; i < inflight.length;) {
+      const m = inflight[i];
+      if (all || m.due <= step) {
+        Y.applyUpdate(m.target.doc, m.update, REMOTE);
+        inflight[i] = inflight[inflight.length - 1];
+        inflight.pop();
+      } else {
+        i++;
+      }
+    }
+  };
+
+  stream.run({ editors, rng, scale: opts.scale, deliver: () => deliver(false) });
+  deliver(true);
+
+  const expected = editors[0].text.toString();
+  for (const ed of editors) {
+    if (ed.text.toString() !== expected) {
+      throw new Error(`${stream.id}: editors did not converge`);
+    }
+  }
+  if (v1.length !== v2.length) {
+    throw new Error(`${stream.id}: ${v1.length} v1 updates but ${v2.length} v2 updates`);
+  }
+
+  const dir = path.join(opts.out, stream.id);
+  fs.mkdirSync(dir, { recursive: true });
+  const log1 = encodeLog(v1);
+  const log2 = encodeLog(v2);
+  fs.writeFileSync(path.join(dir, 'updates.v1'), log1);
+  fs.writeFileSync(path.join(dir, 'updates.v2'), log2);
+  fs.writeFileSync(path.join(dir, 'expected.txt'), expected, 'utf8');
+
+  const meta = {
+    id: stream.id,
+    description: stream.description,
+    corpusVersion: CORPUS_VERSION,
+    formatVersion: FORMAT_VERSION,
+    yjsVersion: YJS_VERSION,
+    seed: opts.seed,
+    scale: opts.scale,
+    sharedType: opts.type,
+    editors: stream.editors,
+    updates: v1.length,
+    v1Bytes: log1.length - 12 - 4 * v1.length,
+    v2Bytes: log2.length - 12 - 4 * v2.length,
+    finalLength: expected.length,
+    finalStateV1Bytes: Y.encodeStateAsUpdate(editors[0].doc).length,
+    finalStateV2Bytes: Y.encodeStateAsUpdateV2(editors[0].doc).length
+  };
+  fs.writeFileSync(path.join(dir, 'meta.json'), JSON.stringify(meta, null, 2), 'utf8');
+
+  console.log(`[${stream.id}] ${meta.updates} updates, v1 ${meta.v1Bytes} B, v2 ${meta.v2Bytes} B, ` +
+              `final text ${meta.finalLength} chars, state v1 ${meta.finalStateV1Bytes} B`);
+  return meta;
+}
+
+const opts = parseArgs(process.argv);
+fs.mkdirSync(opts.out, { recursive: true });
+console.log(`Corpus v${CORPUS_VERSION} -> ${opts.out} (yjs ${YJS_VERSION}, seed ${opts.seed}, scale ${opts.scale})`);
+
+const metas = [];
+streams.forEach((stream, index) => {
+  if (opts.only && !opts.only.includes(stream.id)) return;
+  metas.push(generateStream(stream, opts, index));
+});
+
+const manifest = {
+  corpusVersion: CORPUS_VERSION,
+  formatVersion: FORMAT_VERSION,
+  yjsVersion: YJS_VERSION,
+  seed: opts.seed,
+  scale: opts.scale,
+  sharedType: opts.type,
+  streams: metas.map(m => ({ id: m.id, updates: m.updates, v1Bytes: m.v1Bytes, v2Bytes: m.v2Bytes }))
+};
+fs.writeFileSync(path.join(opts.out, 'manifest.json'), JSON.stringify(manifest, null, 2), 'utf8');
@@ -0,0 +1,183 @@
+/**
+ * Update streams for the apply/encode benchmark corpus
+ *
+ * Each stream is a deterministic editing session (seeded PRNG, fixed client
+ * ids). `run(ctx)` drives one or more editors; every local transaction is
+ * captured in both encodings in the order the server would receive it. With
+ * several editors, each sees the others' updates `latency` steps late at most
+ * (one step per deliver() call).
+ * Sizes scale with --scale (1 = the default corpus).
+ */
+
+const WORDS = (
+  'the of and to in is that for it as with was on be by this are or from at an which but not have ' +
+  'document editor cursor paragraph section update server client merge state vector history table ' +
+  'review draft comment heading list quote code link image sync awareness offline replica change ' +
+  'collaborative realtime conflict free replicated data type insert delete format bold italic'
+).split(' ');
+
+function word(rng) {
+  return WORDS[Math.floor(rng() * WORDS.length)];
+}
+
+function sentence(rng, words) {
+  const out = [];
+  for (let i = 0; i < words; i++) out.push(word(rng));
+  const s = out.join(' ');
+  return s.charAt(0).toUpperCase() + s.slice(1) + '. ';
+}
+
+// Text of roughly `bytes` characters, split into paragraphs
+function block(rng, bytes) {
+  let s = '';
+  while (s.length < bytes) {
+    s += sentence(rng, 6 + Math.floor(rng() * 14));
+    if (rng() < 0.2) s += '\n';
+  }
+  return s.slice(0, bytes);
+}
+
+const FORMATS = [
+  { bold: true }, { italic: true }, { underline: true }, { bold: null }, { italic: null },
+  { link: 'https://example.com/doc' }, { color: '#c0392b' }
+];
+
+// One keystroke at the editor's cursor: mostly characters, some backspaces and jumps
+function keystroke(ed, rng) {
+  const len = ed.text.length;
+  const r = rng();
+  if (r < 0.08 && ed.cursor > 0) {
+    ed.edit(() => ed.text.delete(ed.cursor - 1, 1));
+    ed.cursor--;
+  } else if (r < 0.11) {
+    ed.cursor = Math.floor(rng() * (len + 1));
+  } else {
+    const ch = rng() < 0.16 ? ' ' : rng() < 0.01 ? '\n' : String.fromCharCode(97 + Math.floor(rng() * 26));
+    ed.edit(() => ed.text.insert(ed.cursor, ch));
+    ed.cursor++;
+  }
+  ed.cursor = Math.min(ed.cursor, ed.text.length);
+}
+
+export const streams = [
+  {
+    id: 'typing',
+    description: 'One editor typing character by character, with backspaces and cursor jumps',
+    editors: 1,
+    run({ editors, rng, scale }) {
+      const ed = editors[0];
+      for (let i = 0; i < 20000 * scale; i++) keystroke(ed, rng);
+    }
+  },
+
+  {
+    id: 'pasting',
+    description: 'Typing bursts mixed with large pastes, selection deletes and cut/paste moves',
+    editors: 1,
+    run({ editors, rng, scale }) {
+      const ed = editors[0];
+      for (let i = 0; i < 3000 * scale; i++) {
+        const len = ed.text.length;
+        const r = rng();
+        if (r < 0.7) {
+          const burst = 3 + Math.floor(rng() * 20);
+          for (let k = 0; k < burst; k++) keystroke(ed, rng);
+        } else if (r < 0.82) {
+          const text = block(rng, 500 + Math.floor(rng() * 16000));
+          const at = Math.floor(rng() * (len + 1));
+          ed.edit(() => ed.text.insert(at, text));
+          ed.cursor = at + text.length;
+        } else if (r < 0.92 && len > 0) {
+          const at = Math.floor(rng() * len);
+          const n = Math.min(len - at, 1 + Math.floor(rng() * 2048));
+          ed.edit(() => ed.text.delete(at, n));
+          ed.cursor = at;
+        } else if (len > 0) {
+          const at = Math.floor(rng() * len);
+          const n = Math.min(len - at, 1 + Math.floor(rng() * 1024));
+          const moved = ed.text.toString().slice(at, at + n);
+          ed.edit(() => {
+            ed.text.delete(at, n);
+            const to = Math.floor(rng() * (ed.text.length + 1));
+            ed.text.insert(to, moved);
+          });
+        }
+        ed.cursor = Math.min(ed.cursor, ed.text.length);
+      }
+    }
+  },
+
+  {
+    id: 'formatting',
+    description: 'Rich-text session: typing with frequent bold/italic/link formatting and unformatting',
+    editors: 1,
+    run({ editors, rng, scale }) {
+      const ed = editors[0];
+      ed.edit(() => ed.text.insert(0, block(rng, 4000)));
+      ed.cursor = ed.text.length;
+      for (let i = 0; i < 10000 * scale; i++) {
+        const len = ed.text.length;
+        if (rng() < 0.3 && len > 0) {
+          const at = Math.floor(rng() * len);
+          const n = Math.min(len - at, 1 + Math.floor(rng() * 80));
+          const attrs = FORMATS[Math.floor(rng() * FORMATS.length)];
+          ed.edit(() => ed.text.format(at, n, attrs));
+        } else if (rng() < 0.1) {
+          const attrs = FORMATS[Math.floor(rng() * 3)];
+          const at = Math.floor(rng() * (len + 1));
+          ed.edit(() => ed.text.insert(at, word(rng) + ' ', attrs));
+        } else {
+          keystroke(ed, rng);
+        }
+      }
+    }
+  },
+
+  {
+    id: 'concurrent',
+    description: 'Six editors typing and formatting concurrently, each seeing the others late',
+    editors: 6,
+    latency: 30,  // Remote updates arrive 0..30 steps after they were made
+    run({ editors, rng, scale, deliver }) {
+      for (let i = 0; i < 20000 * scale; i++) {
+        const ed = editors[Math.floor(rng() * editors.length)];
+        if (rng() < 0.05 && ed.text.length > 0) {
+          const at = Math.floor(rng() * ed.text.length);
+          const n = Math.min(ed.text.length - at, 1 + Math.floor(rng() * 40));
+          ed.edit(() => ed.text.format(at, n, FORMATS[Math.floor(rng() * FORMATS.length)]));
+        } else if (rng() < 0.01) {
+          const at = Math.floor(rng() * (ed.text.length + 1));
+          ed.edit(() => ed.text.insert(at, block(rng, 200 + Math.floor(rng() * 2000))));
+        } else {
+          keystroke(ed, rng);
+        }
+        deliver();
+      }
+    }
+  },
+
+  {
+    id: 'long-history',
+    description: 'Long session rewriting a small document: as much deleted as inserted (tombstone heavy)',
+    editors: 1,
+    run({ editors, rng, scale }) {
+      const ed = editors[0];
+      ed.edit(() => ed.text.insert(0, block(rng, 6000)));
+      for (let i = 0; i < 100000 * scale; i++) {
+        const len = ed.text.length;
+        if (len > 8000 || (len > 2000 && rng() < 0.45)) {
+          const at = Math.floor(rng() * len);
+          const n = Math.min(len - at, 1 + Math.floor(rng() * 60));
+          ed.edit(() => ed.text.delete(at, n));
+          ed.cursor = at;
+        } else if (rng() < 0.1) {
+          const at = Math.floor(rng() * (len + 1));
+          ed.edit(() => ed.text.insert(at, sentence(rng, 4 + Math.floor(rng() * 8))));
+        } else {
+          keystroke(ed, rng);
+        }
+        ed.cursor = Math.min(ed.cursor, ed.text.length);
+      }
+    }
+  }
+];
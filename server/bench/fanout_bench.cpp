@@ -0,0 +1,267 @@
+// Broadcast fan-out microbenchmark
+//
+// Queues M messages to N in-memory peers and drains every queue the way the
+// epoll engine does (gather iovecs, one write per batch), comparing:
+//   per-peer  payload copied per peer, header encoded per peer at write time
+//             (the path used before frames were shared)
+//   shared    frame serialized once, peers hold a reference, one iovec each
+//
+// Usage: bench_fanout [--peers N] [--messages M] [--size BYTES]
+//                     [--sink memory|devnull] [--json]
+
+#include "peer.h"
+#include "epoch.h"
+#include "ws_frame.h"
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define BATCH 64
+
+struct BenchOptions {
+    int peers = 1000;
+    int messages = 200;
+    size_t size = 256;
+    bool devnull = false;
+    bool json = false;
+};
+
+struct Result {
+    double enqueue_ns;      // Per peer per message
+    double drain_ns;
+};
+
+// Legacy queue entry: private payload copy, framed when written
+struct CopyMessage {
+    uint8_t* data;
+    size_t len;
+    CopyMessage* next;
+};
+
+struct CopyPeer {
+    omp_lock_t lock;
+    CopyMessage* head;
+    CopyMessage* tail;
+};
+
+static BenchOptions g_opts;
+static int g_devnull = -1;
+static uint8_t* g_sink = nullptr;
+static size_t g_sink_cap = 0;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void noop_request_write(Peer* p) {
+    (void)p;
+}
+
+static const PeerTransport g_fake_transport = {
+    "fake",
+    noop_request_write
+};
+
+// Stand-in for the socket write: copy into a buffer (memory) or writev(/dev/null)
+static void sink_write(const struct iovec* iov, int count) {
+    if (g_devnull >= 0) {
+        ssize_t n = writev(g_devnull, iov, count);
+        (void)n;
+        return;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < count; i++) {
+        if (pos + iov[i].iov_len > g_sink_cap) pos = 0;
+        memcpy(g_sink + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+}
+
+static Result run_copy(const uint8_t* payload) {
+    std::vector<CopyPeer> peers(g_opts.peers);
+    for (size_t i = 0; i < peers.size(); i++) {
+        omp_init_lock(&peers[i].lock);
+        peers[i].head = peers[i].tail = nullptr;
+    }
+
+    double t0 = now_ns();
+    for (int m = 0; m < g_opts.messages; m++) {
+        for (size_t i = 0; i < peers.size(); i++) {
+            CopyMessage* msg = (CopyMessage*)malloc(sizeof(CopyMessage));
+            msg->data = (uint8_t*)malloc(g_opts.size);
+            memcpy(msg->data, payload, g_opts.size);
+            msg->len = g_opts.size;
+            msg->next = nullptr;
+
+            omp_set_lock(&peers[i].lock);
+            if (peers[i].tail) peers[i].tail->next = msg;
+            else peers[i].head = msg;
+            peers[i].tail = msg;
+            omp_unset_lock(&peers[i].lock);
+        }
+    }
+    double t1 = now_ns();
+
+    struct iovec iov[BATCH * 2];
+    uint8_t headers[BATCH][WS_MAX_HEADER_LEN];
+    CopyMessage* batch[BATCH];
+    for (size_t i = 0; i < peers.size(); i++) {
+        for (;;) {
+            int count = 0;
+            int iov_count = 0;
+            omp_set_lock(&peers[i].lock);
+            while (count < BATCH && peers[i].head) {
+                CopyMessage* msg = peers[i].head;
+                peers[i].head = msg->next;
+                batch[count] = msg;
+                size_t hl = ws_encode_frame_header(WS_OP_BINARY, msg->len, nullptr, headers[count]);
+                iov[iov_count].iov_base = headers[count];
+                iov[iov_count++].iov_len = hl;
+                iov[iov_count].iov_base = msg->data;
+                iov[iov_count++].iov_len = msg->len;
+                count++;
+            }
+            if (!peers[i].head) peers[i].tail = nullptr;
+            omp_unset_lock(&peers[i].lock);
+            if (count == 0) break;
+
+            sink_write(iov, iov_count);
+            for (int k = 0; k < count; k++) {
+                free(batch[k]->data);
+                free(batch[k]);
+            }
+        }
+    }
+    double t2 = now_ns();
+
+    for (size_t i = 0; i < peers.size(); i++) omp_destroy_lock(&peers[i].lock);
+
+    double per = (double)g_opts.peers * g_opts.messages;
+    Result r = { (t1 - t0) / per, (t2 - t1) / per };
+    return r;
+}
+
+static Result run_shared(const uint8_t* payload) {
+    std::vector<Peer*> peers(g_opts.peers);
+    for (size_t i = 0; i < peers.size(); i++) {
+        peers[i] = peers_add(&g_fake_transport, nullptr);
+    }
+
+    double t0 = now_ns();
+    for (int m = 0; m < g_opts.messages; m++) {
+        WsSharedFrame* frame = ws_frame_create(WS_OP_BINARY, payload, g_opts.size);
+        for (size_t i = 0; i < peers.size(); i++) {
+            peer_queue_frame(peers[i], PEER_QUEUE_DOC, frame);
+        }
+        ws_frame_release(frame);
+    }
+    double t1 = now_ns();
+
+    struct iovec iov[BATCH];
+    PendingMessage* batch[BATCH];
+    for (size_t i = 0; i < peers.size(); i++) {
+        for (;;) {
+            int count = 0;
+            while (count < BATCH) {
+                PendingMessage* msg = peer_dequeue_message(peers[i]);
+                if (!msg) break;
+                iov[count].iov_base = msg->frame->data;
+                iov[count].iov_len = msg->frame->len;
+                batch[count++] = msg;
+            }
+            if (count == 0) break;
+
+            sink_write(iov, count);
+            for (int k = 0; k < count; k++) peer_free_message(batch[k]);
+        }
+    }
+    double t2 = now_ns();
+
+    for (size_t i = 0; i < peers.size(); i++) peers_remove(peers[i]);
+
+    double per = (double)g_opts.peers * g_opts.messages;
+    Result r = { (t1 - t0) / per, (t2 - t1) / per };
+    return r;
+}
+
+static bool parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--json") == 0) g_opts.json = true;
+        else if (!has_value) return false;
+        else if (strcmp(a, "--peers") == 0) g_opts.peers = atoi(argv[++i]);
+        else if (strcmp(a, "--messages") == 0) g_opts.messages = atoi(argv[++i]);
+        else if (strcmp(a, "--size") == 0) g_opts.size = (size_t)atol(argv[++i]);
+        else if (strcmp(a, "--sink") == 0) g_opts.devnull = strcmp(argv[++i], "devnull") == 0;
+        else return false;
+    }
+    return g_opts.peers > 0 && g_opts.messages > 0 && g_opts.size > 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_args(argc, argv)) {
+        fprintf(stderr, "Usage: %s [--peers N] [--messages M] [--size BYTES]\n"
+                        "          [--sink memory|devnull] [--json]\n", argv[0]);
+        return 1;
+    }
+
+    if (g_opts.devnull) {
+        g_devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    } else {
+        g_sink_cap = (g_opts.size + WS_MAX_HEADER_LEN) * BATCH;
+        g_sink = (uint8_t*)malloc(g_sink_cap);
+    }
+
+    std::vector<uint8_t> payload(g_opts.size);
+    for (size_t i = 0; i < payload.size(); i++) payload[i] = (uint8_t)(i * 31 + 7);
+
+    epoch_init();
+    peers_init();
+
+    // Warm up the allocator and caches, then measure
+    int saved = g_opts.messages;
+    g_opts.messages = saved < 10 ? saved : 10;
+    run_copy(&payload[0]);
+    run_shared(&payload[0]);
+    g_opts.messages = saved;
+
+    Result copy = run_copy(&payload[0]);
+    Result shared = run_shared(&payload[0]);
+
+    peers_destroy();
+    epoch_destroy();
+
+    double copy_total = copy.enqueue_ns + copy.drain_ns;
+    double shared_total = shared.enqueue_ns + shared.drain_ns;
+
+    if (g_opts.json) {
+        printf("{\"peers\":%d,\"messages\":%d,\"size\":%zu,\"sink\":\"%s\","
+               "\"per_peer\":{\"enqueue_ns\":%.1f,\"drain_ns\":%.1f,\"total_ns\":%.1f},"
+               "\"shared\":{\"enqueue_ns\":%.1f,\"drain_ns\":%.1f,\"total_ns\":%.1f},"
+               "\"speedup\":%.2f}\n",
+               g_opts.peers, g_opts.messages, g_opts.size, g_opts.devnull ? "devnull" : "memory",
+               copy.enqueue_ns, copy.drain_ns, copy_total,
+               shared.enqueue_ns, shared.drain_ns, shared_total,
+               copy_total / shared_total);
+    } else {
+        printf("fan-out: %d peers x %d messages x %zu bytes (sink: %s)\n",
+               g_opts.peers, g_opts.messages, g_opts.size, g_opts.devnull ? "devnull" : "memory");
+        printf("  %-9s enqueue %7.1f ns/peer  drain %7.1f ns/peer  total %7.1f ns/peer\n",
+               "per-peer", copy.enqueue_ns, copy.drain_ns, copy_total);
+        printf("  %-9s enqueue %7.1f ns/peer  drain %7.1f ns/peer  total %7.1f ns/peer\n",
+               "shared", shared.enqueue_ns, shared.drain_ns, shared_total);
+        printf("  speedup   %.2fx\n", copy_total / shared_total);
+    }
+
+    if (g_devnull >= 0) close(g_devnull);
+    free(g_sink);
+    return 0;
+}
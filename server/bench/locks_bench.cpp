@@ -0,0 +1,255 @@
+// Peer lock stress benchmark
+//
+// T threads hammer the peer APIs against a shared pool of N in-memory peers,
+// the way reactors, the fan-out path and connection churn meet once work
+// leaves the service thread:
+//   queue      peer_queue_frame() to a random peer (50%)
+//   awareness  peer_queue_awareness() with a random client id (15%)
+//   drain      peer_dequeue_message() up to 8 frames from a random peer (25%)
+//   churn      peers_add() + peers_remove() replacing a random pool slot (5%)
+//   count      peers_count() (5%)
+// Prints throughput and the lock profile (include/lockstat.h) per class and
+// call site. Fewer peers than threads means hot peers; build with LOCKSTAT=0
+// to measure what the profiling itself costs. With --rounds R the run is split
+// into R rounds of T fresh threads, the way a host that starts threads per
+// request uses the locks: the profile's per-thread tables are then released
+// and reused between rounds, and the totals must still add up.
+//
+// Usage: bench_locks [--threads T] [--peers N] [--seconds S] [--rounds R] [--size BYTES] [--json]
+
+#include "peer.h"
+#include "epoch.h"
+#include "lockstat.h"
+#include "ws_frame.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#define DRAIN_BATCH 8
+
+enum BenchOp {
+    OP_QUEUE = 0,
+    OP_AWARENESS,
+    OP_DRAIN,
+    OP_CHURN,
+    OP_COUNT,
+    OP_KINDS
+};
+
+static const char* OP_NAMES[OP_KINDS] = { "queue", "awareness", "drain", "churn", "count" };
+
+struct BenchOptions {
+    int threads = 8;
+    int peers = 256;
+    double seconds = 3;
+    int rounds = 1;
+    size_t size = 256;
+    bool json = false;
+};
+
+struct ThreadResult {
+    uint64_t ops[OP_KINDS];
+};
+
+static BenchOptions g_opts;
+static Peer** g_pool = nullptr;         // Atomic slots; churn swaps peers in and out
+static WsSharedFrame* g_frame = nullptr;
+static volatile bool g_stop = false;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void noop_request_write(Peer* p) {
+    (void)p;
+}
+
+static const PeerTransport g_fake_transport = {
+    "fake",
+    noop_request_write
+};
+
+static uint64_t next_rand(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static BenchOp pick_op(uint64_t r) {
+    int v = (int)(r % 100);
+    if (v < 50) return OP_QUEUE;
+    if (v < 65) return OP_AWARENESS;
+    if (v < 90) return OP_DRAIN;
+    if (v < 95) return OP_CHURN;
+    return OP_COUNT;
+}
+
+static void run_thread(int index, ThreadResult* result) {
+    memset(result, 0, sizeof(*result));
+    uint64_t rng = 0x9E3779B97F4A7C15ull * (uint64_t)(index + 1);
+
+    while (!__atomic_load_n(&g_stop, __ATOMIC_RELAXED)) {
+        uint64_t r = next_rand(&rng);
+        BenchOp op = pick_op(r);
+        int slot = (int)((r >> 8) % (uint64_t)g_opts.peers);
+
+        // Removed peers are retired through the epoch, so a slot's peer stays valid here
+        EpochGuard guard;
+        Peer* p = __atomic_load_n(&g_pool[slot], __ATOMIC_ACQUIRE);
+        switch (op) {
+            case OP_QUEUE:
+                peer_queue_frame(p, PEER_QUEUE_DOC, g_frame);
+                break;
+            case OP_AWARENESS:
+                peer_queue_awareness(p, g_frame, (uint32_t)(r >> 40) % 64 + 1, false);
+                break;
+            case OP_DRAIN:
+                for (int i = 0; i < DRAIN_BATCH; i++) {
+                    PendingMessage* msg = peer_dequeue_message(p);
+                    if (!msg) break;
+                    peer_free_message(msg);
+                }
+                break;
+            case OP_CHURN: {
+                Peer* fresh = peers_add(&g_fake_transport, nullptr);
+                Peer* old = __atomic_exchange_n(&g_pool[slot], fresh, __ATOMIC_ACQ_REL);
+                peers_remove(old);
+                break;
+            }
+            default:
+                peers_count();
+                break;
+        }
+        result->ops[op]++;
+    }
+}
+
+static bool parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--json") == 0) g_opts.json = true;
+        else if (!has_value) return false;
+        else if (strcmp(a, "--threads") == 0) g_opts.threads = atoi(argv[++i]);
+        else if (strcmp(a, "--peers") == 0) g_opts.peers = atoi(argv[++i]);
+        else if (strcmp(a, "--seconds") == 0) g_opts.seconds = atof(argv[++i]);
+        else if (strcmp(a, "--rounds") == 0) g_opts.rounds = atoi(argv[++i]);
+        else if (strcmp(a, "--size") == 0) g_opts.size = (size_t)atol(argv[++i]);
+        else return false;
+    }
+    return g_opts.threads > 0 && g_opts.peers > 0 && g_opts.seconds > 0 && g_opts.rounds > 0 &&
+           g_opts.size > 0;
+}
+
+static void print_class_json(const LockStats& s, bool first) {
+    printf("%s\"%s\":{\"acquisitions\":%llu,\"contended\":%llu,\"wait_us\":%.1f,\"wait_max_us\":%.1f,"
+           "\"hold_p50_ns\":%llu,\"hold_p99_ns\":%llu,\"hold_max_us\":%.1f}",
+           first ? "" : ",", lockstat_class_name(s.cls), (unsigned long long)s.acquisitions,
+           (unsigned long long)s.contended, s.wait_ns / 1000.0, s.wait_max_ns / 1000.0,
+           (unsigned long long)lockstat_quantile_ns(s.hold_hist, 0.5),
+           (unsigned long long)lockstat_quantile_ns(s.hold_hist, 0.99), s.hold_max_ns / 1000.0);
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_args(argc, argv)) {
+        fprintf(stderr, "Usage: %s [--threads T] [--peers N] [--seconds S] [--rounds R] [--size BYTES] [--json]\n",
+                argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> payload(g_opts.size);
+    for (size_t i = 0; i < payload.size(); i++) payload[i] = (uint8_t)(i * 31 + 7);
+    g_frame = ws_frame_create(WS_OP_BINARY, &payload[0], payload.size());
+
+    epoch_init();
+    peers_init();
+    g_pool = (Peer**)calloc(g_opts.peers, sizeof(Peer*));
+    for (int i = 0; i < g_opts.peers; i++) g_pool[i] = peers_add(&g_fake_transport, nullptr);
+
+    std::vector<ThreadResult> results(g_opts.threads);
+    uint64_t ops[OP_KINDS] = { 0 };
+    uint64_t total = 0;
+    double round_seconds = g_opts.seconds / g_opts.rounds;
+    struct timespec ts;
+    ts.tv_sec = (time_t)round_seconds;
+    ts.tv_nsec = (long)((round_seconds - ts.tv_sec) * 1e9);
+    double t0 = now_ns();
+    for (int round = 0; round < g_opts.rounds; round++) {
+        std::vector<std::thread> threads;
+        __atomic_store_n(&g_stop, false, __ATOMIC_RELAXED);
+        for (int i = 0; i < g_opts.threads; i++) {
+            threads.push_back(std::thread(run_thread, round * g_opts.threads + i, &results[i]));
+        }
+        nanosleep(&ts, nullptr);
+        __atomic_store_n(&g_stop, true, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+        for (size_t i = 0; i < results.size(); i++) {
+            for (int k = 0; k < OP_KINDS; k++) {
+                ops[k] += results[i].ops[k];
+                total += results[i].ops[k];
+            }
+        }
+    }
+    double elapsed = (now_ns() - t0) / 1e9;
+
+    LockStats classes[LOCK_CLASS_COUNT];
+    LockStats sites[LOCKSTAT_MAX_SITES];
+    int site_count = lockstat_get(classes, sites, LOCKSTAT_MAX_SITES);
+    std::sort(sites, sites + site_count, [](const LockStats& a, const LockStats& b) {
+        return a.wait_ns > b.wait_ns;
+    });
+
+    if (g_opts.json) {
+        printf("{\"threads\":%d,\"rounds\":%d,\"peers\":%d,\"seconds\":%.2f,\"ops_per_sec\":%.0f,\"ops\":{",
+               g_opts.threads, g_opts.rounds, g_opts.peers, elapsed, total / elapsed);
+        for (int k = 0; k < OP_KINDS; k++) {
+            printf("%s\"%s\":%llu", k ? "," : "", OP_NAMES[k], (unsigned long long)ops[k]);
+        }
+        printf("},\"locks\":{");
+        bool first = true;
+        for (int c = 0; c < LOCK_CLASS_COUNT; c++) {
+            if (classes[c].acquisitions == 0) continue;
+            print_class_json(classes[c], first);
+            first = false;
+        }
+        printf("}}\n");
+    } else {
+        printf("peer locks: %d threads x %d round(s) x %d peers x %zu-byte frames for %.2f s\n",
+               g_opts.threads, g_opts.rounds, g_opts.peers, g_opts.size, elapsed);
+        printf("  %.0f ops/s (", total / elapsed);
+        for (int k = 0; k < OP_KINDS; k++) {
+            printf("%s%s %llu", k ? ", " : "", OP_NAMES[k], (unsigned long long)ops[k]);
+        }
+        printf(")\n");
+        for (int c = 0; c < LOCK_CLASS_COUNT; c++) {
+            const LockStats& s = classes[c];
+            if (s.acquisitions == 0) continue;
+            printf("  %-6s %10llu acq  %6.2f%% contended  wait %8.1f us (max %6.1f)  hold p50 < %llu ns  p99 < %llu ns\n",
+                   lockstat_class_name(c), (unsigned long long)s.acquisitions,
+                   100.0 * s.contended / s.acquisitions, s.wait_ns / 1000.0, s.wait_max_ns / 1000.0,
+                   (unsigned long long)lockstat_quantile_ns(s.hold_hist, 0.5),
+                   (unsigned long long)lockstat_quantile_ns(s.hold_hist, 0.99));
+        }
+        for (int i = 0; i < site_count && i < 5 && sites[i].contended > 0; i++) {
+            printf("  site %-24s %s:%d  %llu contended, %.1f us waited\n", sites[i].func, sites[i].file,
+                   sites[i].line, (unsigned long long)sites[i].contended, sites[i].wait_ns / 1000.0);
+        }
+    }
+
+    for (int i = 0; i < g_opts.peers; i++) peers_remove(g_pool[i]);
+    free(g_pool);
+    ws_frame_release(g_frame);
+    peers_destroy();
+    epoch_destroy();
+    return 0;
+}
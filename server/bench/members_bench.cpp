@@ -0,0 +1,168 @@
+// Room member filter microbenchmark
+//
+// Times the fan-out filter (who receives a broadcast) over N members:
+//   list   linked list of full Peer-sized structs, checking exclude + synced
+//          per node (the layout broadcasts walked before rooms had columns)
+//   soa    RoomPeerSet columns through room_select()
+// Queueing cost is identical for both and measured by bench_fanout.
+//
+// Usage: bench_members [--peers N] [--iterations I] [--synced PERCENT] [--json]
+
+#include "room.h"
+#include "peer.h"
+#include "epoch.h"
+#include <omp.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+struct BenchOptions {
+    int peers = 10000;
+    int iterations = 2000;
+    int synced_percent = 90;
+    bool json = false;
+};
+
+// Same fields and size as Peer before the member table existed
+struct ListPeer {
+    const void* transport;
+    void* conn;
+    bool synced;
+    void* pending_queue;
+    void* pending_tail;
+    omp_lock_t lock;
+    uint32_t client_id;
+    char* awareness_json;
+    size_t awareness_len;
+    ListPeer* next;
+};
+
+static BenchOptions g_opts;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void noop_request_write(Peer* p) {
+    (void)p;
+}
+
+static const PeerTransport g_fake_transport = {
+    "fake",
+    noop_request_write
+};
+
+static bool parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--json") == 0) g_opts.json = true;
+        else if (!has_value) return false;
+        else if (strcmp(a, "--peers") == 0) g_opts.peers = atoi(argv[++i]);
+        else if (strcmp(a, "--iterations") == 0) g_opts.iterations = atoi(argv[++i]);
+        else if (strcmp(a, "--synced") == 0) g_opts.synced_percent = atoi(argv[++i]);
+        else return false;
+    }
+    return g_opts.peers > 1 && g_opts.iterations > 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_args(argc, argv)) {
+        fprintf(stderr, "Usage: %s [--peers N] [--iterations I] [--synced PERCENT] [--json]\n", argv[0]);
+        return 1;
+    }
+
+    int n = g_opts.peers;
+    unsigned seed = 12345;
+    std::vector<bool> synced(n);
+    for (int i = 0; i < n; i++) synced[i] = (int)(rand_r(&seed) % 100) < g_opts.synced_percent;
+
+    // Linked list: nodes allocated in order, linked in shuffled order, with
+    // unrelated allocations in between (a long-running heap after churn)
+    std::vector<ListPeer*> nodes(n);
+    std::vector<void*> noise;
+    for (int i = 0; i < n; i++) {
+        nodes[i] = (ListPeer*)calloc(1, sizeof(ListPeer));
+        nodes[i]->synced = synced[i];
+        noise.push_back(malloc(64 + rand_r(&seed) % 512));
+    }
+    std::vector<ListPeer*> order(nodes);
+    for (int i = n - 1; i > 0; i--) std::swap(order[i], order[rand_r(&seed) % (i + 1)]);
+    for (int i = 0; i + 1 < n; i++) order[i]->next = order[i + 1];
+    ListPeer* head = order[0];
+
+    // Member table for the same population
+    epoch_init();
+    peers_init();
+    rooms_init("quill");
+    Room* room = rooms_get("/bench");
+    std::vector<Peer*> peers(n);
+    for (int i = 0; i < n; i++) {
+        peers[i] = peers_add(&g_fake_transport, nullptr);
+        peers[i]->room = room;
+        room_join(room, peers[i]);
+        if (synced[i]) room_set_sync(room, peers[i], PEER_SYNC_DONE);
+    }
+
+    std::vector<ListPeer*> list_out(n);
+    std::vector<uint32_t> soa_out(n);
+    long list_selected = 0;
+    long soa_selected = 0;
+
+    double t0 = now_ns();
+    for (int it = 0; it < g_opts.iterations; it++) {
+        const ListPeer* exclude = nodes[it % n];
+        int count = 0;
+        for (ListPeer* p = head; p; p = p->next) {
+            if (p != exclude && p->synced) list_out[count++] = p;
+        }
+        list_selected += count;
+    }
+    double t1 = now_ns();
+
+    {
+        EpochGuard guard;
+        RoomPeerSet* members = room_members(room);
+        for (int it = 0; it < g_opts.iterations; it++) {
+            const Peer* exclude = peers[it % n];
+            soa_selected += room_select(members, true, PEER_CLASS_ANY, exclude, &soa_out[0]);
+        }
+    }
+    double t2 = now_ns();
+
+    double per = (double)n * g_opts.iterations;
+    double list_ns = (t1 - t0) / per;
+    double soa_ns = (t2 - t1) / per;
+
+    if (g_opts.json) {
+        printf("{\"peers\":%d,\"iterations\":%d,\"synced_percent\":%d,"
+               "\"list_ns_per_peer\":%.3f,\"soa_ns_per_peer\":%.3f,\"speedup\":%.2f,"
+               "\"selected\":%ld}\n",
+               n, g_opts.iterations, g_opts.synced_percent, list_ns, soa_ns,
+               list_ns / soa_ns, soa_selected / g_opts.iterations);
+    } else {
+        printf("member filter: %d peers, %d%% synced, %d iterations\n",
+               n, g_opts.synced_percent, g_opts.iterations);
+        printf("  list  %7.3f ns/peer  (%ld selected/broadcast)\n",
+               list_ns, list_selected / g_opts.iterations);
+        printf("  soa   %7.3f ns/peer  (%ld selected/broadcast)\n",
+               soa_ns, soa_selected / g_opts.iterations);
+        printf("  speedup %.2fx\n", list_ns / soa_ns);
+    }
+
+    for (int i = 0; i < n; i++) {
+        room_leave(room, peers[i]);
+        peers_remove(peers[i]);
+        free(nodes[i]);
+        free(noise[i]);
+    }
+    peers_destroy();
+    epoch_destroy();
+    rooms_destroy();
+    return 0;
+}
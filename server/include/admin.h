@@ -0,0 +1,41 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include "http_api.h"
+
+// Live introspection of rooms and peers on the local HTTP API.
+//
+// Nothing is paused to answer: rooms come from the append-only registry,
+// members from each room's RCU snapshot (inside an epoch critical section),
+// document figures from Document::get_stats() counters, and each peer's
+// queues from its own lock, held only while its counters are copied. A
+// report is therefore not one consistent cut across rooms, but every number
+// in it was true at some instant during the request.
+//
+// Memory estimates add up what the server holds for a room: the read view's
+// encoded base and tail, cached sync replies, member structs and their queued
+// frames. The live YDoc itself is not included.
+
+// GET /admin/rooms: every room with document, queue and awareness figures
+void admin_handle_rooms(const HttpRequest& req, HttpResponse* resp, void* user);
+
+// GET /admin/room?name=/x&limit=N: one room plus its first N members (default 1000)
+void admin_handle_room(const HttpRequest& req, HttpResponse* resp, void* user);
+
+// GET /admin/peer?id=N: one peer's queues, sync and awareness state
+void admin_handle_peer(const HttpRequest& req, HttpResponse* resp, void* user);
+
+// GET /admin/locks: contention profile per lock class and call site (lockstat.h)
+void admin_handle_locks(const HttpRequest& req, HttpResponse* resp, void* user);
+
+// GET /admin/memory: process RSS, malloc heap figures, and server-wide totals
+// of queued frames, awareness states, documents and pending reclamation
+void admin_handle_memory(const HttpRequest& req, HttpResponse* resp, void* user);
+
+// GET /admin/alloc?limit=N: live bytes, allocation rates and size histograms
+// per allocation tag (allocstat.h), the estimated libyrs heap with its N
+// largest documents (default 20), and the heap not covered by either. Rates
+// are over the interval since the previous request (0 on the first)
+void admin_handle_alloc(const HttpRequest& req, HttpResponse* resp, void* user);
+
+#endif // ADMIN_H
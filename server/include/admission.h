@@ -0,0 +1,83 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Peer;
+struct Room;
+
+// Join-storm admission control for initial syncs.
+//
+// A client's first SYNC_STEP1 takes a sync slot (per room and per process)
+// and holds it until its reply has left the SYNC queue. When no slot is free
+// the request waits in a FIFO; waiters past max_wait_ms are admitted over the
+// limits, so no join waits unbounded. Waiters of the same room that sent the
+// same state vector are admitted together and share one encoded reply.
+// Re-syncs of a peer that already completed its initial sync bypass the queue.
+
+// Peer::admission
+enum AdmissionState {
+    ADMISSION_NONE = 0,         // No SYNC_STEP1 yet
+    ADMISSION_WAITING = 1,      // Queued behind a limit
+    ADMISSION_ACTIVE = 2,       // Holds a slot until its reply is drained
+    ADMISSION_DONE = 3          // Initial sync served
+};
+
+struct AdmissionLimits {
+    int per_room = 8;           // Concurrent initial syncs per room (0 = unlimited)
+    int per_process = 64;       // Concurrent initial syncs overall (0 = unlimited)
+    int max_wait_ms = 2000;     // Longest a join waits before it is admitted anyway
+};
+
+struct AdmissionStats {
+    uint64_t requests;          // Initial syncs submitted
+    uint64_t admitted_now;      // Served without waiting
+    uint64_t queued;            // Had to wait
+    uint64_t shared;            // Served from another waiter's reply
+    uint64_t overdue;           // Admitted over the limits after max_wait_ms
+    uint64_t cancelled;         // Disconnected while waiting
+    uint64_t position_total;    // Sum of queue positions at enqueue (1 = head)
+    int position_max;
+    int depth;                  // Current queue length
+    int active;                 // Slots held right now
+    uint64_t wait_ms_total;
+    uint64_t wait_ms_max;
+};
+
+// Serve one initial sync reply to count peers of the same room that sent the
+// same state vector. Called without admission locks held, inside an epoch
+// critical section (peers may be closed, never freed).
+typedef void (*AdmissionServeFn)(Peer** peers, int count, const uint8_t* sv, size_t sv_len);
+
+// Initialize admission control (registers the sync-drained hook with peers)
+void admission_init(const AdmissionLimits& limits, AdmissionServeFn serve);
+
+// Drop all waiters
+void admission_destroy();
+
+// Handle a peer's SYNC_STEP1: serves it now or queues it
+void admission_submit(Peer* peer, const uint8_t* sv, size_t sv_len);
+
+// Peer is going away: removes it from the queue or frees its slot
+void admission_cancel(Peer* peer);
+
+// Admit waiters that are past their deadline (call periodically from the event loop)
+void admission_tick();
+
+// Current queue length (reported in the WebSocket handshake)
+int admission_queue_depth();
+
+// Where a join to room (nullptr: not created yet) would land if it synced
+// now: 0 when it would be served at once, else its place at the queue tail.
+// *wait_ms gets the estimated wait from the recent wait per queue position,
+// capped at max_wait_ms (0 when served at once).
+int admission_join_position(const Room* room, int* wait_ms);
+
+// Snapshot counters
+void admission_get_stats(AdmissionStats* out);
+
+// Print counters (shutdown)
+void admission_print_stats();
+
+#endif // ADMISSION_H
@@ -0,0 +1,97 @@
+#ifndef ALLOCSTAT_H
+#define ALLOCSTAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Allocation accounting per server subsystem.
+//
+// Server allocations go through tagged_malloc / tagged_calloc / tagged_realloc
+// / tagged_free with the tag of the subsystem that owns the block. Blocks carry
+// no header: a block's size is read back with malloc_usable_size, so live bytes
+// are usable (not requested) sizes, and a block freed with plain free() is still
+// freed correctly, it is only missing from the counts. Counters live in
+// per-thread tables written only by their thread; readers sum them, so a block
+// freed on another thread than the one that allocated it is accounted
+// correctly in the totals. Tables of exited threads are reused
+// (threadstat.h).
+//
+// Per tag: allocations, frees, bytes allocated and freed (live = difference)
+// and a log2 histogram of requested sizes. Rates are derived by readers from
+// two snapshots.
+//
+// libyrs allocates through the same malloc but cannot be tagged; its share is
+// estimated per document from the encoded state size (allocstat_yrs_estimate).
+//
+// Build with ALLOCSTAT=0 to compile the entry points down to plain malloc/free.
+
+enum AllocTag {
+    ALLOC_PEER = 0,             // Peer structs, connections and their receive buffers, room member sets, admission waiters
+    ALLOC_QUEUE = 1,            // Outbound queue entries (PendingMessage)
+    ALLOC_FRAME = 2,            // Shared WebSocket frames of broadcast updates and other outbound messages
+    ALLOC_AWARENESS = 3,        // Awareness frames (stored per peer and broadcast)
+    ALLOC_PROTOCOL = 4,         // Encoded and decoded protocol messages (protocol.h)
+    ALLOC_SNAPSHOT = 5,         // Document read views: encoded bases, tails, shared snapshots, cached sync replies
+    ALLOC_PERSISTENCE = 6,      // Retained change log (CDC records)
+    ALLOC_TAG_COUNT = 7
+};
+
+#define ALLOCSTAT_BUCKETS 16    // Bucket i counts sizes below 32 B << i; the last is open-ended
+
+// libyrs estimate: a materialized document holds about this many bytes per byte
+// of its encoded v1 state, plus a fixed overhead. Calibrate with bench_apply
+// (heap_bytes / state_v1_bytes) for the workload at hand.
+#define ALLOCSTAT_YRS_FACTOR 6
+#define ALLOCSTAT_YRS_DOC_BYTES 4096
+
+// tagged_realloc(ptr, 0) frees ptr and returns nullptr, as glibc's realloc does
+#if defined(CRDT_NO_ALLOCSTAT)
+static inline void* tagged_malloc(size_t size, AllocTag) { return malloc(size); }
+static inline void* tagged_calloc(size_t n, size_t size, AllocTag) { return calloc(n, size); }
+static inline void* tagged_realloc(void* ptr, size_t size, AllocTag) { return realloc(ptr, size); }
+static inline void tagged_free(void* ptr, AllocTag) { free(ptr); }
+static inline void tagged_adopt(void*, AllocTag) {}
+#else
+void* tagged_malloc(size_t size, AllocTag tag);
+void* tagged_calloc(size_t n, size_t size, AllocTag tag);
+void* tagged_realloc(void* ptr, size_t size, AllocTag tag);
+void tagged_free(void* ptr, AllocTag tag);
+
+// Start accounting a block from plain malloc under tag (it is then freed with
+// tagged_free); for buffers handed to a subsystem that keeps them
+void tagged_adopt(void* ptr, AllocTag tag);
+#endif
+
+// Totals for one tag
+struct AllocStats {
+    int tag;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t alloc_bytes;       // Usable bytes ever allocated
+    uint64_t free_bytes;        // Usable bytes ever freed
+    int64_t live_bytes;         // alloc_bytes - free_bytes
+    int64_t live_blocks;        // allocs - frees
+    uint64_t size_hist[ALLOCSTAT_BUCKETS];
+};
+
+const char* allocstat_tag_name(int tag);
+
+// Upper bound of a size histogram bucket in bytes (the last bucket also counts
+// everything larger)
+uint64_t allocstat_bucket_bytes(int bucket);
+
+// Upper bound of the bucket holding the given quantile (0..1) of a histogram
+uint64_t allocstat_quantile_bytes(const uint64_t* hist, double q);
+
+// Totals per tag (indexed by AllocTag), summed over every thread so far
+void allocstat_get(AllocStats tags[ALLOC_TAG_COUNT]);
+
+// Estimated libyrs heap for a document with encoded_bytes of v1 state
+// (0 when the document has no live YDoc)
+uint64_t allocstat_yrs_estimate(uint64_t encoded_bytes, bool materialized);
+
+// Shutdown summary: one line per tag that saw allocations
+void allocstat_print_stats();
+
+#endif // ALLOCSTAT_H
@@ -0,0 +1,50 @@
+#ifndef CDC_H
+#define CDC_H
+
+#include "http_api.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Change-data-capture feed of applied updates and text deltas.
+//
+// Every room's effective update (what was new to its document) and YText
+// delta is appended to one in-memory log as it is applied. Records carry a
+// global sequence number (the consumer cursor) and a per-room sequence; both
+// follow apply order within a room. The log keeps the newest buffer_bytes of
+// records; consumers resume from any cursor still inside it and get
+// "cursor_expired" otherwise (take a snapshot, then resume from "newest").
+// Consumers only ever read the log, on their own threads, so a slow or
+// stalled consumer falls behind or is dropped, never slows editors.
+
+enum CdcRecordType {
+    CDC_UPDATE = 0,             // Yjs v1 update (base64 "update")
+    CDC_TEXT = 1                // Quill-style delta of the shared text ("delta")
+};
+
+// retain and delete lengths in CDC_TEXT deltas count UTF-8 bytes of the text,
+// the YDoc's offset unit, not the UTF-16 code units a Quill editor counts.
+// They match for ASCII text; the stream's hello line says "offsets":"utf8".
+
+struct CdcStats {
+    uint64_t records;           // Appended since start
+    uint64_t evicted;           // Dropped from the head to stay within the buffer
+    uint64_t oldest;            // Oldest retained sequence (0 = empty)
+    uint64_t newest;            // Last appended sequence
+    size_t bytes;               // Retained record bytes
+    int consumers;              // Connected streams
+};
+
+// Register the room observers (after rooms_init, before rooms are created)
+void cdc_init(size_t buffer_bytes);
+
+// Free the log
+void cdc_destroy();
+
+// Snapshot counters
+void cdc_get_stats(CdcStats* out);
+
+// GET /cdc?cursor=N&room=/name&batch_ms=M: newline-delimited JSON records
+// after cursor N (omitted = from now), batched every M ms (default 50)
+void cdc_handle_stream(const HttpRequest& req, HttpStream* stream, void* user);
+
+#endif // CDC_H
@@ -0,0 +1,44 @@
+#ifndef CLONE_H
+#define CLONE_H
+
+#include "http_api.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Server-side document cloning.
+//
+// A clone starts as a new room whose read views sit on the source's encoded
+// state (DocSnapshot): the bytes are shared by reference, not copied, and no
+// YDoc is built. Joining clients are synced straight from the shared bytes.
+// The first write builds the clone's own YDoc; its updates then go to its own
+// view tail, and the shared bytes are dropped once compaction merges that tail
+// into a base of its own. A source that received updates since its last base
+// merges them once, and that state becomes its base, so later clones share it
+// too.
+
+enum CloneResult {
+    CLONE_OK = 0,
+    CLONE_NO_SOURCE,            // Source room does not exist
+    CLONE_EXISTS,               // Target room already exists
+    CLONE_INVALID,              // Snapshot bytes are not a v1 update
+    CLONE_LIMIT                 // Room limit reached (rooms_set_limit)
+};
+
+struct CloneStats {
+    uint64_t clones;            // From rooms
+    uint64_t uploads;           // From uploaded snapshots
+};
+
+// Create room `to` as a copy of room `from`
+CloneResult clone_room(const char* from, const char* to);
+
+// Create room `to` from an encoded v1 state (e.g. a template stored outside the server)
+CloneResult clone_from_snapshot(const uint8_t* state, size_t len, const char* to);
+
+// Snapshot counters
+void clone_get_stats(CloneStats* out);
+
+// POST /clone?from=/template&to=/doc (or the snapshot as the request body, without from)
+void clone_handle_http(const HttpRequest& req, HttpResponse* resp, void* user);
+
+#endif // CLONE_H
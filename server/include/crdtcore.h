@@ -0,0 +1,93 @@
+#ifndef CRDTCORE_H
+#define CRDTCORE_H
+
+/*
+ * libcrdtcore: the server's document core (rooms, Document, read views,
+ * protocol encoding) for hosting collaborative documents in-process.
+ *
+ * Plain C API; every handle is opaque and every buffer returned by the
+ * library is released with crdt_free(). Updates are Yjs v1/v2 update
+ * payloads (no WebSocket or y-websocket framing). All functions are
+ * thread-safe once crdt_init() has returned. Before crdt_init() and after
+ * crdt_shutdown(), calls that take a room fail: CRDT_ERR_INVALID, NULL or 0,
+ * matching their usual failure value. crdt_api_version() and crdt_free()
+ * always work.
+ *
+ * Link with -lcrdtcore (static: also -lyrs -lgomp -lpthread).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped on incompatible changes to this header */
+#define CRDTCORE_API_VERSION 1
+
+#if defined(__GNUC__)
+#define CRDT_API __attribute__((visibility("default")))
+#else
+#define CRDT_API
+#endif
+
+/* Result codes */
+#define CRDT_OK 0
+#define CRDT_ERR_INVALID -1     /* Bad argument or library not initialized */
+#define CRDT_ERR_APPLY -2       /* Update rejected by the document */
+#define CRDT_ERR_STATE -3       /* crdt_init() called twice */
+
+typedef struct crdt_room crdt_room;
+
+/* Called for every update applied to a room, from the applying thread.
+ * The update is always Yjs v1: a v2 update (from crdt_room_apply_update or a
+ * WebSocket client) is re-encoded before subscribers see it. The update
+ * buffer is only valid during the call. Must not unsubscribe itself or apply
+ * updates to the same room. */
+typedef void (*crdt_update_cb)(crdt_room* room, const uint8_t* update, size_t len, void* user);
+
+CRDT_API int crdt_api_version(void);
+
+/* Set up the core; every room's document gets a YText named shared_type
+ * (NULL = "quill"). Not needed inside crdt_server, which does it itself. */
+CRDT_API int crdt_init(const char* shared_type);
+
+/* Free all rooms; no other call may be running */
+CRDT_API void crdt_shutdown(void);
+
+/* Find or create a room (same names as WebSocket request paths; the query
+ * string is ignored). Rooms live until crdt_shutdown(). */
+CRDT_API crdt_room* crdt_room_get(const char* name);
+
+CRDT_API const char* crdt_room_name(const crdt_room* room);
+
+/* Apply an update and hand it to the room's subscribers */
+CRDT_API int crdt_room_apply_update(crdt_room* room, const uint8_t* update, size_t len);
+
+/* Full state as one update (NULL on failure) */
+CRDT_API uint8_t* crdt_room_snapshot(crdt_room* room, size_t* out_len);
+
+/* State vector, and the update a peer with state vector sv is missing */
+CRDT_API uint8_t* crdt_room_state_vector(crdt_room* room, size_t* out_len);
+CRDT_API uint8_t* crdt_room_diff(crdt_room* room, const uint8_t* sv, size_t sv_len, size_t* out_len);
+
+/* Shared text as a NUL-terminated UTF-8 string */
+CRDT_API char* crdt_room_text(crdt_room* room);
+
+/* Subscribe to applied updates, including those from WebSocket clients when
+ * linked into the server. Returns a subscription id (0 on failure). */
+CRDT_API uint64_t crdt_room_subscribe(crdt_room* room, crdt_update_cb cb, void* user);
+
+/* Stop a subscription; a callback already running on another thread may
+ * still finish after this returns */
+CRDT_API int crdt_room_unsubscribe(crdt_room* room, uint64_t subscription);
+
+/* Release a buffer returned by the library */
+CRDT_API void crdt_free(void* ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRDTCORE_H */
@@ -1,13 +1,107 @@
 #ifndef DOCUMENT_H
 #define DOCUMENT_H
 
+#include "ws_frame.h"
+#include <omp.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <vector>
 
 extern "C" {
 #include <libyrs.h>
 }
 
+// Sync reply cache: direct-mapped by the hash of the canonical state vector
+#define DOC_REPLY_BUCKETS 16
+
+// Cached SYNC_STEP2 frame for one state vector, valid for a single document version
+struct SyncReplyEntry {
+    uint64_t hash;
+    uint64_t version;
+    uint64_t* entries;      // Canonical state vector: (client << 32 | clock), sorted
+    uint32_t entry_count;
+    WsSharedFrame* frame;   // nullptr = empty bucket
+};
+
+// Read views: compact once the tail holds this many updates (by the writer
+// that reaches it, or by a reader that merged it first)
+#define DOC_TAIL_COMPACT 64
+
+// Applied update kept in a read view's tail (newest first, shared by later views)
+struct DocTailUpdate {
+    uint8_t* data;
+    uint32_t len;
+    DocTailUpdate* prev;
+};
+
+// Immutable encoded full state, reference counted. Shared by the read view
+// generations built on it and by documents cloned from it.
+struct DocSnapshot {
+    int refs;               // Atomic
+    uint8_t* data;
+    uint32_t len;
+};
+
+// Wrap a malloc'd full state (takes ownership, accounted as ALLOC_SNAPSHOT from
+// here on; one reference)
+DocSnapshot* doc_snapshot_create(uint8_t* data, uint32_t len);
+void doc_snapshot_retain(DocSnapshot* snapshot);
+void doc_snapshot_release(DocSnapshot* snapshot);
+
+// Encoded full state that a generation of read views builds on. Owns every
+// tail node appended while it was current (reachable from newest).
+struct DocBase {
+    const uint8_t* state;       // snapshot's bytes (nullptr = empty document)
+    uint32_t len;
+    DocSnapshot* snapshot;
+    DocTailUpdate* newest;
+};
+
+// Immutable read-optimized version of the document: base state plus the v1
+// updates applied since. A new view is published per applied update and the
+// old one retired through epoch reclamation, so readers never take the
+// document lock; only valid inside an epoch critical section.
+struct DocReadView {
+    uint64_t version;
+    DocBase* base;
+    DocTailUpdate* tail;        // Newest first
+    uint32_t tail_count;
+};
+
+// Decode a v1 state vector into sorted (client << 32 | clock) entries, skipping
+// zero clocks, so vectors that differ only in order or encoding compare equal
+bool doc_canonical_state_vector(const uint8_t* sv, size_t sv_len, std::vector<uint64_t>& out);
+
+// Shared text observer: the YText delta of each committed transaction. Runs
+// inside apply_update with the document lock held, so it must be short and
+// must not call back into the document.
+typedef void (*DocTextObserver)(void* user, const YDelta* delta, uint32_t len);
+
+// Update observer: the effective v1 update of each committed transaction (only
+// what was new to the document), same calling context as DocTextObserver
+typedef void (*DocUpdateObserver)(void* user, const uint8_t* update, uint32_t len);
+
+// Counters and sizes for introspection, read without the document lock
+struct DocStats {
+    uint64_t version;
+    uint64_t applies;           // Successful apply_update calls
+    uint64_t apply_ns_last;     // Including the wait for the document lock
+    uint64_t apply_ns_max;
+    uint64_t apply_ns_total;
+    uint32_t base_bytes;        // Encoded state the current read view builds on
+    uint32_t tail_updates;      // Updates applied on top of it (compacted at DOC_TAIL_COMPACT)
+    uint64_t tail_bytes;
+    bool materialized;          // Has a live YDoc (snapshot copies build it on first write)
+    bool base_shared;           // Base snapshot also held by clones or readers
+    int reply_cached;           // Occupied sync reply buckets
+    uint64_t reply_bytes;       // Their frames
+    uint64_t reply_hits;
+    uint64_t reply_misses;
+};
+
+// All methods are thread-safe: the epoll engine applies updates from several reactors.
+// Writers apply to the live YDoc; state, diff and sync reply reads are served
+// from read views without waiting for them.
 class Document {
 public:
     Document();
@@ -16,18 +110,63 @@ public:
     // Initialize document with shared type name
     bool init(const char* shared_type_name);
 
-    // Apply update from client
+    // Initialize as a copy of a snapshot (retained, never copied). The live YDoc
+    // is only built on the first write or materialize(); until then reads are
+    // served from the shared snapshot.
+    bool init_from_snapshot(const char* shared_type_name, DocSnapshot* snapshot);
+
+    // Build the live YDoc of a snapshot copy now (no-op once built). False if
+    // the snapshot does not apply; the copy then stays read-only.
+    bool materialize();
+    bool is_materialized();
+
+    // Current full state as a snapshot (caller releases). Shares the current
+    // base when no updates were applied since it; otherwise merges them and
+    // makes the result the new base, so later calls share it.
+    DocSnapshot* share_snapshot();
+
+    // Apply update from client (v1, or v2 when v1 decoding fails)
     bool apply_update(const uint8_t* update, size_t len);
 
-    // Get full state as update (for new clients)
+    // Same; when the update was v2 and v1_out is given, *v1_out receives the
+    // same change encoded as v1 (malloc'd, caller frees). It stays nullptr for
+    // a v1 update, whose bytes already are v1.
+    bool apply_update(const uint8_t* update, size_t len, uint8_t** v1_out, size_t* v1_len);
+
+    // Get full state as update (for new clients and HTTP reads)
     uint8_t* get_state_as_update(size_t* out_len);
 
-    // Get state vector (what we have)
+    // Get state vector (what we have): from a compacted view's base, else from
+    // the live YDoc under the document lock
     uint8_t* get_state_vector(size_t* out_len);
 
     // Get state diff based on client's state vector
     uint8_t* get_state_diff(const uint8_t* client_sv, size_t sv_len, size_t* out_len);
 
+    // Framed SYNC_STEP2 answering a client's state vector (sv_len 0 = full state).
+    // Clients whose state vectors decode to the same entries share one frame until
+    // the next applied update. Caller releases the returned reference.
+    WsSharedFrame* get_sync_reply(const uint8_t* client_sv, size_t sv_len);
+
+    // Current read view (call inside an epoch critical section)
+    DocReadView* read_view() { return __atomic_load_n(&m_view, __ATOMIC_ACQUIRE); }
+
+    // Bumped by every applied update
+    uint64_t version() const { return __atomic_load_n(&m_version, __ATOMIC_ACQUIRE); }
+
+    // Sync reply cache counters
+    void get_reply_stats(uint64_t* hits, uint64_t* misses);
+
+    // Counters, read view sizes and reply cache state (only the leaf reply lock)
+    void get_stats(DocStats* out);
+
+    // Observe the shared text (one observer, set before updates are applied;
+    // no YText events are produced without one)
+    void observe_text(DocTextObserver fn, void* user);
+
+    // Observe effective updates (one observer, set before updates are applied)
+    void observe_updates(DocUpdateObserver fn, void* user);
+
     // Get current text content (for debugging)
     char* get_text_content();
 
@@ -37,6 +176,47 @@ public:
 private:
     YDoc* m_doc;
     Branch* m_text;
+    omp_lock_t m_lock;      // Serializes libyrs transactions on m_doc
+
+    char* m_shared_type;        // Snapshot copies: name for the deferred YText
+    DocSnapshot* m_pending;     // Snapshot copies: state the live YDoc starts from
+    bool materialize_locked();
+
+    DocTextObserver m_text_observer;
+    void* m_text_observer_user;
+    YSubscription* m_text_sub;
+    static void on_text_event(void* state, const YTextEvent* event);
+
+    DocUpdateObserver m_update_observer;
+    void* m_update_observer_user;
+    YSubscription* m_update_sub;
+    static void on_update_event(void* state, uint32_t len, const char* update);
+
+    DocReadView* m_view;        // Current read view, atomic pointer
+    omp_lock_t m_view_lock;     // Serializes view publication (taken under m_lock)
+    omp_lock_t m_compact_lock;  // One reader compacts at a time (try-lock)
+
+    uint64_t m_version;
+    uint64_t m_applies;         // Atomic, with the apply timings below
+    uint64_t m_apply_ns_last;
+    uint64_t m_apply_ns_max;
+    uint64_t m_apply_ns_total;
+    SyncReplyEntry m_replies[DOC_REPLY_BUCKETS];
+    int m_reply_count;          // Occupied buckets (lets apply_update skip the cache lock)
+    uint64_t m_reply_hits;
+    uint64_t m_reply_misses;
+    omp_lock_t m_reply_lock;    // Guards m_replies and the counters (leaf lock)
+
+    void clear_replies();
+
+    DocReadView* publish_base_locked(uint8_t* state, uint32_t len, uint64_t version);
+    DocReadView* publish_snapshot_locked(DocSnapshot* snapshot, uint64_t version);
+    DocReadView* append_tail_locked(const uint8_t* data, size_t len, uint64_t version);
+    void compact_tail();
+    void rebase(const DocReadView* view, DocSnapshot* snapshot);
+    uint8_t* encode_live_state(uint32_t* out_len);
+    uint8_t* view_state(const DocReadView* view, uint32_t* out_len);
+    void compact(const DocReadView* view, const uint8_t* state, uint32_t len);
 };
 
 #endif // DOCUMENT_H
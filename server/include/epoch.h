@@ -0,0 +1,48 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdint.h>
+
+// Epoch-based reclamation for lock-free readers.
+//
+// Readers bracket access to shared pointers with epoch_enter()/epoch_exit()
+// (nestable, per thread). Writers unlink an object, then hand it to
+// epoch_retire(); it is freed once every thread that could still see it has
+// left its critical section (two epoch advances later).
+//
+// Each thread keeps its own retire list and frees from it every 64 retires or
+// when it calls epoch_reclaim(), so writers in different rooms share no lock.
+// A thread's record is released at thread exit (its pending objects go to a
+// shared list that the next reclaim frees) and reused by later threads.
+
+// Initialize / tear down (epoch_destroy frees everything still retired)
+void epoch_init();
+void epoch_destroy();
+
+// Enter / leave a read-side critical section (never blocks)
+void epoch_enter();
+void epoch_exit();
+
+// Defer free_fn(ptr) until no reader can hold ptr
+void epoch_retire(void* ptr, void (*free_fn)(void*));
+
+// Try to advance the epoch and free what is safe from this thread's list and
+// from exited threads' leftovers (called by epoch_retire and periodically from
+// event loops; returns at once when there is nothing to free)
+void epoch_reclaim();
+
+// Free everything still retired (shutdown only, no readers may be active)
+void epoch_drain();
+
+// Number of objects waiting for reclamation
+int epoch_pending();
+
+// RAII read-side guard
+struct EpochGuard {
+    EpochGuard() { epoch_enter(); }
+    ~EpochGuard() { epoch_exit(); }
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+#endif // EPOCH_H
@@ -0,0 +1,14 @@
+#ifndef EPOLL_SERVER_H
+#define EPOLL_SERVER_H
+
+#include "server.h"
+
+// Native WebSocket engine: edge-triggered epoll with one reactor thread per core.
+// Each reactor owns a SO_REUSEPORT listener, so the kernel spreads accepts across
+// reactors and a connection is only ever touched by the thread that accepted it.
+// Queued messages are pre-encoded shared frames, flushed with writev in batches.
+
+// Run reactors until *running becomes 0; returns 0 on clean shutdown
+int epoll_server_run(const ServerOptions& opts, volatile int* running);
+
+#endif // EPOLL_SERVER_H
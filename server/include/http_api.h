@@ -0,0 +1,65 @@
+#ifndef HTTP_API_H
+#define HTTP_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Local HTTP endpoint for operational queries (search, admin).
+//
+// One thread serves 127.0.0.1:port, one short request per connection
+// (Connection: close). Handlers run on that thread, never on the WebSocket
+// engines' threads, so slow queries cannot delay editors. Stream routes
+// (change feeds) get a thread each.
+
+struct HttpRequest {
+    const char* method;         // "GET", "POST", ...
+    const char* path;           // Without the query string
+    const char* query;          // After '?', "" when absent
+    const char* headers;        // Header lines after the request line, each ending in "\r\n"
+    const uint8_t* body;
+    size_t body_len;
+};
+
+struct HttpResponse {
+    int status = 200;
+    const char* content_type = "application/json";
+    std::string headers;        // Extra header lines, each ending in "\r\n"
+    std::string body;
+};
+
+typedef void (*HttpHandler)(const HttpRequest& req, HttpResponse* resp, void* user);
+
+// Long-lived response (chunked transfer encoding) owned by a stream handler
+struct HttpStream;
+
+// Runs on a thread of its own for as long as it wants to stream; returning
+// ends the response. At most HTTP_STREAMS_MAX run at once (503 beyond that).
+typedef void (*HttpStreamHandler)(const HttpRequest& req, HttpStream* stream, void* user);
+#define HTTP_STREAMS_MAX 16
+
+// Register a handler for method + exact path (before http_api_start)
+void http_api_route(const char* method, const char* path, HttpHandler fn, void* user);
+void http_api_stream_route(const char* method, const char* path, HttpStreamHandler fn, void* user);
+
+// Send the status line and headers; then write chunks (false once the client is gone)
+bool http_stream_begin(HttpStream* stream, int status, const char* content_type);
+bool http_stream_write(HttpStream* stream, const char* data, size_t len);
+
+// False once the server is shutting down (stream handlers should return)
+bool http_stream_running(const HttpStream* stream);
+
+// Start / stop the listener thread (port 0 = disabled)
+bool http_api_start(int port);
+void http_api_stop();
+
+// Decoded value of a query parameter ("a=1&b=x%20y"); false when absent
+bool http_query_param(const char* query, const char* name, std::string* out);
+
+// Value of a request header (case-insensitive name, trimmed); false when absent
+bool http_header(const HttpRequest& req, const char* name, std::string* out);
+
+// Append s as a JSON string literal (with quotes)
+void http_json_string(std::string* out, const char* s, size_t len);
+
+#endif // HTTP_API_H
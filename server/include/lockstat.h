@@ -0,0 +1,100 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <omp.h>
+#include <stdint.h>
+
+// Contention profiling for the peer and room locks.
+//
+// A ProfiledLock is an omp_lock_t tagged with its class. LOCK_ACQUIRE tags
+// the call site too (file, function, line; registered on first use) and tries
+// the lock first: only when that fails is the wait timed. Hold time is timed
+// on every LOCKSTAT_HOLD_SAMPLE-th acquisition per thread, so most uncontended
+// acquisitions read no clock at all. Counters live in per-thread tables written
+// only by their thread; readers sum them, so there are no shared writes on the
+// hot path. Tables of exited threads are reused (threadstat.h).
+//
+// Per site and class: acquisitions, contended acquisitions, total and maximum
+// wait, a log2 histogram of wait (every contended acquisition) and one of hold
+// time (sampled). Hold time is charged to the site that acquired the lock.
+//
+// Build with LOCKSTAT=0 to compile the macros down to plain omp_set_lock /
+// omp_unset_lock (the class and site fields are then unused).
+
+enum LockClass {
+    LOCK_CLASS_PEERS = 0,       // g_peers_lock: connect/disconnect bookkeeping
+    LOCK_CLASS_PEER = 1,        // Peer::lock: queues and awareness state
+    LOCK_CLASS_ROOMS = 2,       // Room registry
+    LOCK_CLASS_MEMBERS = 3,     // Room::members_lock: join/leave
+    LOCK_CLASS_COUNT = 4
+};
+
+#define LOCKSTAT_MAX_SITES 64
+#define LOCKSTAT_BUCKETS 20     // Bucket i counts times below 64 ns << i; the last is open-ended
+#define LOCKSTAT_HOLD_SAMPLE 16 // Time the hold of one acquisition in this many (power of two)
+
+// One LOCK_ACQUIRE call site (a function-local static)
+struct LockSite {
+    const char* file;
+    const char* func;
+    int line;
+    int id;                     // Table slot from 1, 0 until first use
+};
+
+struct ProfiledLock {
+    omp_lock_t lock;
+    int cls;                    // LockClass
+    LockSite* holder;           // Site of the current owner (owner only)
+    uint64_t acquired_ns;       // When the owner got it, 0 if not sampled (owner only)
+};
+
+void profiled_lock_init(ProfiledLock* l, LockClass cls);
+void profiled_lock_destroy(ProfiledLock* l);
+void profiled_lock_acquire(ProfiledLock* l, LockSite* site);
+void profiled_lock_release(ProfiledLock* l);
+
+#if defined(CRDT_NO_LOCKSTAT)
+#define LOCK_ACQUIRE(l) omp_set_lock(&(l)->lock)
+#define LOCK_RELEASE(l) omp_unset_lock(&(l)->lock)
+#else
+#define LOCK_ACQUIRE(l) do { \
+        static LockSite lockstat_site_ = { __FILE__, __func__, __LINE__, 0 }; \
+        profiled_lock_acquire((l), &lockstat_site_); \
+    } while (0)
+#define LOCK_RELEASE(l) profiled_lock_release(l)
+#endif
+
+// Totals for one lock class, or one call site (cls set, site fields filled)
+struct LockStats {
+    int cls;
+    const char* file;           // Call site (nullptr for class totals)
+    const char* func;
+    int line;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t wait_max_ns;
+    uint64_t hold_samples;      // Acquisitions whose hold was timed
+    uint64_t hold_ns;           // Over the samples
+    uint64_t hold_max_ns;
+    uint64_t wait_hist[LOCKSTAT_BUCKETS];
+    uint64_t hold_hist[LOCKSTAT_BUCKETS];
+};
+
+const char* lockstat_class_name(int cls);
+
+// Upper bound of a histogram bucket in nanoseconds (the last bucket also
+// counts everything longer)
+uint64_t lockstat_bucket_ns(int bucket);
+
+// Upper bound of the bucket holding the given quantile (0..1) of a histogram
+uint64_t lockstat_quantile_ns(const uint64_t* hist, double q);
+
+// Class totals (indexed by LockClass) and, if sites is non-null, every call
+// site seen so far (up to max_sites). Returns the number of sites written.
+int lockstat_get(LockStats classes[LOCK_CLASS_COUNT], LockStats* sites, int max_sites);
+
+// Shutdown summary: one line per class plus its most waited-on site
+void lockstat_print_stats();
+
+#endif // LOCKSTAT_H
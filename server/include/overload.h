@@ -0,0 +1,101 @@
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include "http_api.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Event-loop lag monitor and overload load shedding.
+//
+// Every service thread (each epoll reactor, the lws service loop) arms a
+// probe timer for probe_ms ahead and reports, when it fires, how late it ran:
+// the time the loop spent on other work before it got back to its timers.
+// Lags go into a per-loop log2 histogram and drive one process-wide level.
+// A level is entered as soon as a probe is that late (or a loop's probe is
+// overdue by that much without having fired) and left once no probe has been
+// that late for cooldown_ms, so a loop near a threshold does not flap.
+//
+// Levels add up: BATCH flushes broadcast queues once per batch_window_ms
+// instead of every loop pass (fewer, larger writes), SHED_AWARENESS stops
+// relaying cursor / presence updates (they are still stored, so joiners see
+// the latest one, and removals still go out), REFUSE_JOINS answers new
+// WebSocket upgrades with 503 until the loops catch up. Document updates
+// are never shed.
+
+enum OverloadLevel {
+    OVERLOAD_NONE = 0,
+    OVERLOAD_BATCH = 1,
+    OVERLOAD_SHED_AWARENESS = 2,
+    OVERLOAD_REFUSE_JOINS = 3
+};
+
+struct OverloadLimits {
+    int probe_ms = 50;          // Probe period per loop
+    int batch_lag_ms = 20;      // Lag that widens batching
+    int awareness_lag_ms = 50;  // Lag that sheds awareness
+    int join_lag_ms = 200;      // Lag that refuses joins
+    int batch_window_ms = 10;   // Flush interval while batching
+    int cooldown_ms = 2000;     // Time under a threshold before its level is left
+    bool shed = true;           // false = measure and report only
+};
+
+#define OVERLOAD_BUCKETS 16     // Bucket i < (128 << i) us, the last is open-ended
+#define OVERLOAD_MAX_LOOPS 64
+
+struct OverloadLoopStats {
+    char name[32];
+    uint64_t probes;
+    uint64_t lag_us_total;
+    uint64_t lag_us_max;
+    uint64_t buckets[OVERLOAD_BUCKETS];
+};
+
+struct OverloadStats {
+    OverloadLevel level;
+    int loops;
+    uint64_t transitions;       // Level changes
+    uint64_t ms_at[4];          // Time spent at each level
+    uint64_t deferred_flushes;  // Loop passes that left queues for the batch window
+    uint64_t awareness_shed;    // Awareness updates not relayed
+    uint64_t joins_refused;     // Upgrades answered 503
+};
+
+// Set limits and reset state (before the loops start)
+void overload_init(const OverloadLimits& limits);
+
+void overload_destroy();
+
+// Register a service thread; returns its loop id (-1 past OVERLOAD_MAX_LOOPS)
+int overload_register_loop(const char* name);
+
+// Monotonic clock the probe deadlines are expressed in
+uint64_t overload_now_us();
+
+// First deadline for a newly registered loop
+uint64_t overload_first_due();
+
+// A loop's probe due at due_us fired now; records the lag, updates the level
+// and returns the next deadline
+uint64_t overload_probe(int loop, uint64_t due_us);
+
+// Current level (NONE when shedding is off)
+OverloadLevel overload_level();
+
+// Flush interval for broadcast queues, 0 = every loop pass
+int overload_batch_window_ms();
+
+// Policy checks at the shedding points; they count what they shed
+bool overload_shed_awareness();
+bool overload_refuse_join();
+void overload_count_deferred_flush();
+
+// Snapshot counters; loops may be null (at most max_loops are copied)
+void overload_get_stats(OverloadStats* out, OverloadLoopStats* loops, int max_loops);
+
+// Shutdown summary (prints nothing when no probe ran)
+void overload_print_stats();
+
+// GET /lag: current level, counters and per-loop histograms as JSON
+void overload_handle_http(const HttpRequest& req, HttpResponse* resp, void* user);
+
+#endif // OVERLOAD_H
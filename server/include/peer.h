@@ -1,33 +1,92 @@
 #ifndef PEER_H
 #define PEER_H
 
-#include <libwebsockets.h>
+#include "lockstat.h"
+#include "ws_frame.h"
 #include <omp.h>
 #include <stdint.h>
 #include <stddef.h>
 
-// Pending message to send to peer
+struct Peer;
+struct Room;
+
+// Transport hooks for a peer connection (lws or native epoll engine)
+struct PeerTransport {
+    const char* name;
+    // Ask the transport to flush the peer's pending queue
+    void (*request_write)(Peer* p);
+};
+
+// Outbound traffic classes. Each has its own FIFO; the writable path drains
+// them with a weighted (deficit round-robin) scheduler, so a large initial
+// sync reply or an awareness burst does not hold back live document updates.
+// Order is kept within a class, not across classes: a joiner may get document
+// updates before its SYNC_STEP2. Yjs keeps updates with missing dependencies
+// as pending structs until the reply brings them, and skips structs it
+// already has, so the end state is the same.
+enum PeerQueueClass {
+    PEER_QUEUE_SYNC = 0,        // Replies to SYNC_STEP1 (can be multi-MB)
+    PEER_QUEUE_DOC = 1,         // Live document updates (never reordered)
+    PEER_QUEUE_AWARENESS = 2,   // Cursor/presence; coalesced per client, droppable
+    PEER_QUEUE_COUNT = 3
+};
+
+// Awareness updates are dropped once this many bytes are queued for the peer
+// (removals and updates that replace a queued entry are always kept)
+#define PEER_AWARENESS_DROP_BYTES (256 * 1024)
+
+// Pending message to send to peer (a reference to a pre-encoded frame)
 struct PendingMessage {
-    uint8_t* data;
-    size_t len;
+    WsSharedFrame* frame;
+    uint32_t coalesce_key;  // Awareness client ID (0 = never coalesce)
     PendingMessage* next;
 };
 
+// One traffic class FIFO
+struct PeerQueue {
+    PendingMessage* head;
+    PendingMessage* tail;
+    int count;
+    size_t bytes;
+    size_t deficit;         // Scheduler credit in bytes
+};
+
 // Peer (connected client)
 struct Peer {
-    struct lws* wsi;
-    bool synced;           // Has received initial state?
-    PendingMessage* pending_queue;
-    omp_lock_t lock;
+    uint32_t id;           // Connection order from 1 (admin and heavy-hitter reports)
+    const PeerTransport* transport;
+    void* conn;            // Transport connection handle (struct lws* or EpollConn*)
+    Room* room;            // Room joined on open (set before the peer is visible)
+    int room_slot;         // Row in the room's member table (guarded by members_lock)
+    bool editor;           // Has applied an update (owning thread only)
+    bool closed;           // Connection gone; guarded by lock, nothing more is queued
+    uint8_t admission;     // AdmissionState (admission.h), guarded by the admission lock
+    PeerQueue queues[PEER_QUEUE_COUNT];     // Guarded by lock
+    int queue_turn;                         // Class the scheduler is visiting
+    size_t queued_bytes;                    // Sum over all classes
+    uint32_t awareness_coalesced;           // Queued awareness replaced by a newer one
+    uint32_t awareness_dropped;             // Awareness skipped under backlog
+    ProfiledLock lock;
     uint32_t client_id;     // Yjs client ID for awareness
-    char* awareness_json;   // Last known awareness state (JSON)
-    size_t awareness_len;
+    WsSharedFrame* awareness_frame;  // Last awareness message as sent, replayed to joiners; guarded by lock
+
+    // Multiplexed connections (owning thread only). The connection peer joins no
+    // room; each subscription is a channel peer with its own room membership,
+    // sync state, awareness and queues, drained through the connection.
+    bool mux;              // Connection speaks the multiplexed protocol
+    uint32_t channel;      // Channel id (channel peers), 0 otherwise
+    Peer* mux_parent;      // Connection peer (channel peers)
+    Peer* mux_children;    // Channel peers (connection peer)
+    Peer* mux_sibling;
+    Peer* mux_cursor;      // Next channel the writer visits
+
     Peer* next;
 };
 
-// Global peer list (thread-safe)
+// Global peer list (thread-safe). Broadcasts walk room snapshots instead,
+// so this lock is only held for connect/disconnect bookkeeping.
 extern Peer* g_peers;
-extern omp_lock_t g_peers_lock;
+extern ProfiledLock g_peers_lock;
 
 // Initialize peer system
 void peers_init();
@@ -35,25 +94,44 @@ void peers_init();
 // Cleanup peer system
 void peers_destroy();
 
-// Add new peer
-Peer* peers_add(struct lws* wsi);
-
-// Remove peer
-void peers_remove(struct lws* wsi);
+// Add new peer served by the given transport connection
+Peer* peers_add(const PeerTransport* transport, void* conn);
 
-// Find peer by wsi
-Peer* peers_find(struct lws* wsi);
+// Remove peer: marks it closed and drops its queue; the struct itself is freed
+// through epoch reclamation because room snapshots may still reference it
+void peers_remove(Peer* peer);
 
 // Get peer count
 int peers_count();
 
-// Queue message for peer
-void peer_queue_message(Peer* p, const uint8_t* data, size_t len);
+// Queue message for peer (frames a private copy; dropped once the peer is closed)
+void peer_queue_message(Peer* p, PeerQueueClass cls, const uint8_t* data, size_t len);
+
+// Queue a shared frame for peer (takes a reference; use for fan-out)
+void peer_queue_frame(Peer* p, PeerQueueClass cls, WsSharedFrame* frame);
+
+// Queue an awareness frame for client_id: replaces a queued frame from the same
+// client, otherwise appends, unless the peer is backlogged (removals always kept)
+void peer_queue_awareness(Peer* p, WsSharedFrame* frame, uint32_t client_id, bool removal);
 
-// Dequeue next message for peer
+// Dequeue next message for peer, picked by the weighted scheduler. For a
+// multiplexed connection, its own queue first, then its channels round-robin.
 PendingMessage* peer_dequeue_message(Peer* p);
 
-// Free message
+// Attach / detach a channel peer to its connection (owning thread only)
+void peer_attach_channel(Peer* parent, Peer* child, uint32_t channel);
+void peer_detach_channel(Peer* parent, Peer* child);
+
+// Find a connection's channel peer by id (owning thread only)
+Peer* peer_find_channel(Peer* parent, uint32_t channel);
+
+// Called (without locks) when a dequeue empties a peer's SYNC queue; nullptr to clear
+void peers_on_sync_drained(void (*fn)(Peer* p));
+
+// Called (without locks, on the writer's thread) for every dequeued frame; nullptr to clear
+void peers_on_dequeue(void (*fn)(Peer* p, size_t len));
+
+// Free message (drops its frame reference)
 void peer_free_message(PendingMessage* msg);
 
 #endif // PEER_H
@@ -17,11 +17,15 @@ size_t encode_varuint(uint32_t value, uint8_t* buffer);
 // Decode varint, returns bytes consumed (0 on error)
 size_t decode_varuint(const uint8_t* data, size_t len, uint32_t* value);
 
+// Free a buffer returned by the encoders or decode_awareness (accounted
+// under ALLOC_PROTOCOL, allocstat.h)
+void protocol_free(void* buf);
+
 // Parse message type from raw data
 MessageType parse_message_type(const uint8_t* data, size_t len);
 
 // Encode SYNC_STEP1 message (state vector request/response)
-// Returns allocated buffer (caller must free), sets out_len
+// Returns allocated buffer (caller must protocol_free), sets out_len
 uint8_t* encode_sync_step1(const uint8_t* state_vector, size_t sv_len, size_t* out_len);
 
 // Decode SYNC_STEP1 message
@@ -29,7 +33,7 @@ uint8_t* encode_sync_step1(const uint8_t* state_vector, size_t sv_len, size_t* o
 const uint8_t* decode_sync_step1(const uint8_t* data, size_t len, size_t* sv_len);
 
 // Encode SYNC_STEP2 message (update)
-// Returns allocated buffer (caller must free), sets out_len
+// Returns allocated buffer (caller must protocol_free), sets out_len
 uint8_t* encode_sync_step2(const uint8_t* update, size_t update_len, size_t* out_len);
 
 // Decode SYNC_STEP2 message
@@ -42,8 +46,54 @@ const uint8_t* decode_sync_step2(const uint8_t* data, size_t len, size_t* update
 uint8_t* encode_awareness(uint32_t client_id, const char* state_json, size_t json_len, size_t* out_len);
 
 // Decode AWARENESS message
-// Allocates state_json (caller must free) when json_len > 0
+// Allocates state_json (caller must protocol_free) when json_len > 0
 // Returns true on success
 bool decode_awareness(const uint8_t* data, size_t len, uint32_t* client_id, char** state_json, size_t* json_len);
 
+// Multiplexed mode (WebSocket subprotocol "crdt-mux"): one connection carries
+// many rooms. Every message is [varuint channel][message]; channel 0 carries
+// control messages, any other channel a y-websocket message for that room.
+// Channel ids are assigned by the server per room (the same for every
+// connection), so a broadcast is framed once for all multiplexed subscribers.
+#define MUX_PROTOCOL_NAME "crdt-mux"
+#define MUX_CONTROL_CHANNEL 0
+
+#define MUX_MAX_PATH 255        // Longest SUBSCRIBE path the server accepts
+#define MUX_MAX_CHANNELS 256    // Subscriptions per connection
+
+enum MuxControlType {
+    MUX_SUBSCRIBE = 0,      // Client: [0][0][varuint path_len][path]
+    MUX_SUBSCRIBED = 1,     // Server: [0][1][varuint channel][varuint path_len][path]
+    MUX_UNSUBSCRIBE = 2,    // Client: [0][2][varuint channel]
+    MUX_REFUSED = 3         // Server: [0][3][varuint reason][varuint path_len][path]
+};
+
+// Why a SUBSCRIBE was refused (MUX_REFUSED, in place of the channel id)
+enum MuxRefuseReason {
+    MUX_REFUSED_OVERLOAD = 1,   // Server is shedding joins; retry with backoff
+    MUX_REFUSED_CHANNELS = 2,   // Connection already has MUX_MAX_CHANNELS subscriptions
+    MUX_REFUSED_PATH = 3,       // Path longer than MUX_MAX_PATH
+    MUX_REFUSED_ROOMS = 4       // Room limit reached and the room does not exist
+};
+
+// Prefix a message with its channel id
+// Returns allocated buffer (caller must protocol_free), sets out_len
+uint8_t* encode_mux_message(uint32_t channel, const uint8_t* msg, size_t msg_len, size_t* out_len);
+
+// Split a multiplexed message; returns pointer to the inner message within data
+// (NULL on error), sets channel and msg_len
+const uint8_t* decode_mux_message(const uint8_t* data, size_t len, uint32_t* channel, size_t* msg_len);
+
+// Encode control messages (complete, including the channel 0 prefix)
+uint8_t* encode_mux_subscribe(const char* path, size_t path_len, size_t* out_len);
+uint8_t* encode_mux_subscribed(uint32_t channel, const char* path, size_t path_len, size_t* out_len);
+uint8_t* encode_mux_unsubscribe(uint32_t channel, size_t* out_len);
+uint8_t* encode_mux_refused(MuxRefuseReason reason, const char* path, size_t path_len, size_t* out_len);
+
+// Decode a control message (inner message of channel 0). path points into msg
+// for SUBSCRIBE/SUBSCRIBED/REFUSED; channel is set for SUBSCRIBED/UNSUBSCRIBE,
+// and holds the MuxRefuseReason for REFUSED.
+bool decode_mux_control(const uint8_t* msg, size_t len, MuxControlType* type,
+                        uint32_t* channel, const char** path, size_t* path_len);
+
 #endif // PROTOCOL_H
@@ -0,0 +1,48 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "http_api.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Server-side rendering of each room's Quill text to HTML and Markdown.
+//
+// Every room keeps a formatted mirror of its shared text, split into lines
+// (a line's block format - header, list, blockquote, code-block, align - is
+// the attribute set of its "\n", as in Quill). YText deltas are applied to the
+// mirror as they are committed and only mark the lines they touched dirty.
+// A render re-renders dirty lines, then joins the per-line output (adding the
+// list / code-block wrappers), and caches the document under the room's
+// canonical state vector. A preview of an unchanged document is one version
+// check; a changed version with the same state vector (duplicate updates)
+// costs a state vector read.
+
+enum RenderFormat {
+    RENDER_HTML = 0,
+    RENDER_MARKDOWN = 1
+};
+
+struct RenderStats {
+    uint32_t rooms;
+    uint64_t lines;
+    uint64_t hits;              // Served from the cached document
+    uint64_t misses;            // Re-assembled
+    uint64_t lines_rendered;    // Dirty lines re-rendered for those misses
+};
+
+// Register the text observer (after rooms_init, before rooms are created)
+void render_init();
+
+// Free the mirrors and caches
+void render_destroy();
+
+// Render a room's text; false when the room does not exist
+bool render_room(const char* room, RenderFormat format, std::string* out);
+
+// Snapshot counters
+void render_get_stats(RenderStats* out);
+
+// GET /render?room=/name&format=html|markdown (text/html or text/markdown)
+void render_handle_http(const HttpRequest& req, HttpResponse* resp, void* user);
+
+#endif // RENDER_H
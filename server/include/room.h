@@ -0,0 +1,149 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include "document.h"
+#include "lockstat.h"
+#include <omp.h>
+#include <stdint.h>
+
+struct Peer;
+struct Room;
+
+// Member sync state (RoomPeerSet::sync column)
+enum PeerSyncState {
+    PEER_SYNC_PENDING = 0,      // Waiting for SYNC_STEP1 / initial state
+    PEER_SYNC_DONE = 1          // Receives document broadcasts
+};
+
+// Member class (RoomPeerSet::peer_class column), combined into masks by filters
+enum PeerClass {
+    PEER_CLASS_VIEWER = 1,      // Has not sent a document update yet
+    PEER_CLASS_EDITOR = 2       // Has applied at least one update
+};
+#define PEER_CLASS_ANY (PEER_CLASS_VIEWER | PEER_CLASS_EDITOR)
+
+// Snapshot of a room's members, stored as parallel columns so the fan-out
+// filter streams through a few contiguous bytes per peer instead of chasing
+// Peer pointers. Join/leave publish a new copy with a higher version and
+// retire the old one through epoch reclamation, so broadcasters walk it
+// without taking any lock (inside epoch_enter/exit). Rows are removed by
+// swapping in the last row (Peer::room_slot tracks each peer's row).
+// sync/peer_class bytes only ever change in the current snapshot, under
+// members_lock.
+struct RoomPeerSet {
+    uint64_t version;
+    int count;
+    Peer** peers;               // Connection handle / queue target
+    uint8_t* sync;              // PeerSyncState
+    uint8_t* peer_class;        // PeerClass
+};
+
+// In-process subscriber to a room's applied updates (crdtcore.h), always as v1.
+// Called on the applying thread without locks, inside an epoch critical section.
+typedef void (*RoomUpdateFn)(Room* room, const uint8_t* update, size_t len, void* user);
+
+struct RoomListener {
+    uint64_t id;
+    RoomUpdateFn fn;
+    void* user;
+};
+
+// Immutable listener list, replaced and retired like RoomPeerSet
+// Text change observer for every room (search index, CDC, rendering); see
+// DocTextObserver for the calling context
+typedef void (*RoomTextFn)(Room* room, const YDelta* delta, uint32_t len);
+#define ROOM_TEXT_OBSERVERS_MAX 4
+
+// Effective update observer for every room (change feed); see DocUpdateObserver
+typedef void (*RoomDocUpdateFn)(Room* room, const uint8_t* update, uint32_t len);
+#define ROOM_UPDATE_OBSERVERS_MAX 4
+
+struct RoomListenerSet {
+    int count;
+    RoomListener items[1];      // count entries
+};
+
+// A document plus the peers editing it; clients pick a room by request path
+struct Room {
+    char* name;
+    uint32_t id;                // Creation order from 1 (multiplexed channel id)
+    Document doc;
+    RoomPeerSet* members;       // Current snapshot, atomic pointer
+    ProfiledLock members_lock;  // Serializes join/leave and listener changes (never held by readers)
+    RoomListenerSet* listeners; // Current listeners, atomic pointer (nullptr = none)
+    int syncs_active;           // Initial syncs holding a slot (admission lock)
+    int syncs_waiting;          // Initial syncs queued (admission lock)
+    Room* next;
+};
+
+// Initialize room registry (every room's document uses shared_type_name)
+void rooms_init(const char* shared_type_name);
+
+// Cap the number of rooms (0 = unlimited, the default). Rooms live until
+// rooms_destroy, so a server facing untrusted clients must set one: every
+// distinct request path would otherwise keep a Room and its document.
+void rooms_set_limit(int max_rooms);
+
+// Free all rooms (no peers may remain)
+void rooms_destroy();
+
+// Observe the text / effective updates of every room (register at startup, before rooms exist)
+bool rooms_add_text_observer(RoomTextFn fn);
+bool rooms_add_update_observer(RoomDocUpdateFn fn);
+
+// Find or create the room for a request path (query string ignored, "" -> "/");
+// nullptr when the room does not exist and the limit is reached
+Room* rooms_get(const char* path);
+
+// Whether rooms_get(path) would currently succeed (checked before accepting a
+// connection; a concurrent join can still take the last free room)
+bool rooms_admit(const char* path);
+
+// Existing room for a path (same normalization), nullptr when there is none
+Room* rooms_find(const char* path);
+
+// Create a room starting from a snapshot, which it shares until its first
+// write (see Document::init_from_snapshot); nullptr if the path exists or
+// the limit is reached
+Room* rooms_clone(const char* path, DocSnapshot* snapshot);
+
+// Get room count
+int rooms_count();
+
+// Rooms refused because the limit was reached
+uint64_t rooms_refused();
+
+// Call fn for every room (registry is append-only while running)
+void rooms_for_each(void (*fn)(Room* room, void* user), void* user);
+
+// Add / remove a peer, publishing a new member snapshot
+void room_join(Room* room, Peer* peer);
+void room_leave(Room* room, Peer* peer);
+
+// Add count peers with one snapshot copy (bulk setup; joining one at a time
+// copies the member table per peer)
+void room_join_many(Room* room, Peer* const* peers, int count);
+
+// Update a member's sync state / class in place (visible to later broadcasts)
+void room_set_sync(Room* room, Peer* peer, PeerSyncState state);
+void room_set_class(Room* room, Peer* peer, PeerClass peer_class);
+
+// Current member snapshot; only valid inside an epoch critical section
+RoomPeerSet* room_members(Room* room);
+
+// Register / remove an in-process update listener (ids are unique per process).
+// A callback already running on another thread may still finish after removal.
+uint64_t room_add_listener(Room* room, RoomUpdateFn fn, void* user);
+// user_out (optional) receives the removed listener's user pointer.
+bool room_remove_listener(Room* room, uint64_t id, void** user_out);
+
+// Hand an applied update to the room's listeners (cheap when there are none).
+// update must be v1: publish the v1_out of Document::apply_update for v2 input.
+void room_publish_update(Room* room, const uint8_t* update, size_t len);
+
+// Collect rows to send to: sync state >= PEER_SYNC_DONE when synced_only, class
+// in class_mask, and not exclude. out must hold set->count entries; returns count.
+int room_select(const RoomPeerSet* set, bool synced_only, uint8_t class_mask,
+                const Peer* exclude, uint32_t* out);
+
+#endif // ROOM_H
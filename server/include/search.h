@@ -0,0 +1,56 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "http_api.h"
+#include <stddef.h>
+#include <stdint.h>
+
+struct Room;
+
+// Incremental full-text index over every room's shared text.
+//
+// Each room keeps a mirror of its text and its tokens (lowercased ASCII
+// alphanumerics; UTF-8 bytes >= 0x80 count as word characters). A YText
+// delta re-tokenizes only the span it touched, widened to the neighbouring
+// words, and shifts the tokens after it, so indexing cost follows edit size.
+// Postings map each term to (room id, term frequency) pairs, gap + varint
+// encoded, with a small sorted change buffer merged in once it fills up.
+// Positions are byte offsets into the text, kept per room with its tokens.
+//
+// Queries copy the compressed postings of their terms under the index lock
+// and decode and intersect them outside it, so editors applying updates
+// wait at most for that copy.
+
+struct SearchHit {
+    uint32_t room_id;
+    const char* room;           // Room name (rooms live until shutdown)
+    uint32_t score;             // Sum of query term frequencies
+    uint32_t position;          // Byte offset of the first query term
+};
+
+struct SearchStats {
+    uint32_t rooms;
+    uint32_t terms;
+    uint64_t tokens;
+    uint64_t postings_bytes;    // Compressed postings plus change buffers
+    uint64_t deltas;            // Text deltas indexed
+    uint64_t reindexed_bytes;   // Text re-tokenized for those deltas
+};
+
+// Register the text observer (after rooms_init, before rooms are created)
+void search_init();
+
+// Free the index
+void search_destroy();
+
+// Rooms containing every term of the query, best first; returns the number of
+// hits written (up to max_hits) and the total match count
+int search_query(const char* query, size_t len, SearchHit* hits, int max_hits, int* total);
+
+// Snapshot counters
+void search_get_stats(SearchStats* out);
+
+// GET /search?q=terms&limit=N (JSON)
+void search_handle_http(const HttpRequest& req, HttpResponse* resp, void* user);
+
+#endif // SEARCH_H
@@ -1,19 +1,76 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include "admission.h"
+#include "overload.h"
 #include <cstdint>
 #include <cstddef>
 
-// Forward declaration to avoid requiring libwebsockets in every includer
-struct lws;
+// Forward declarations to avoid requiring libwebsockets in every includer
+struct Peer;
+struct Room;
 
-// Run server on specified port
-int server_run(int port);
+// Transport engine used to accept and serve WebSocket connections
+enum ServerEngine {
+    ENGINE_LWS = 0,    // libwebsockets, single service thread
+    ENGINE_EPOLL = 1   // Native edge-triggered epoll, one reactor per core
+};
+
+struct ServerOptions {
+    int port = 9000;
+    ServerEngine engine = ENGINE_LWS;
+    int threads = 0;            // epoll reactors (0 = one per online CPU)
+    size_t rx_buffer_size = 64 * 1024;  // Pre-sized per-connection receive buffer (epoll)
+    bool log_messages = true;   // Per-message logging (disable for load tests)
+    int max_rooms = 10000;      // Rooms live until shutdown; joins to new paths past this are refused (0 = unlimited)
+
+    // Native TLS (wss://), enabled when both paths are set
+    const char* tls_cert = nullptr;     // PEM certificate chain
+    const char* tls_key = nullptr;      // PEM private key
+    bool tls_ktls = true;               // Offload record crypto to kernel TLS when available
+    long tls_session_timeout = 86400;   // Session ticket / cache lifetime (seconds)
+
+    // Initial sync admission (join storms)
+    AdmissionLimits admission;
+
+    // Event-loop lag probes and overload shedding (GET /lag)
+    OverloadLimits overload;
+
+    // Heavy-hitter window in seconds, 0 = off (GET /admin/top)
+    int talkers_window = 10;
+
+    // Local HTTP API on 127.0.0.1 (0 = off) and the endpoints it serves
+    int http_port = 0;
+    bool search_index = false;    // Full-text index of every room (GET /search)
+    bool render_preview = false;  // Cached HTML / Markdown of every room (GET /render)
+    size_t cdc_buffer = 0;        // Change feed buffer in bytes, 0 = off (GET /cdc)
+
+    bool tls_enabled() const { return tls_cert && tls_key; }
+};
+
+// Run server with the given options
+int server_run(const ServerOptions& opts);
 
 // Shutdown server
 void server_shutdown();
 
-// Broadcast message to all peers except sender
-void server_broadcast(const uint8_t* data, size_t len, struct lws* exclude);
+// Broadcast message to all synced peers in a room except sender
+void server_broadcast(Room* room, const uint8_t* data, size_t len, Peer* exclude);
+
+// Per-message logging (server_run applies ServerOptions::log_messages; benchmarks
+// that call server_broadcast directly turn it off)
+void server_set_log_messages(bool enabled);
+
+// Transport-independent connection events (called by lws and epoll engines)
+// path is the WebSocket request path, which selects the room; a multiplexed
+// connection (MUX_PROTOCOL_NAME) joins no room and subscribes over channel 0.
+// Returns false when the room limit refused the path: the peer has been
+// removed and the transport closes the connection without server_on_close.
+bool server_on_open(Peer* peer, const char* path, bool mux);
+void server_on_close(Peer* peer);
+void server_on_message(Peer* peer, const uint8_t* data, size_t len);
+
+// Periodic housekeeping from the event loops (admission deadlines)
+void server_on_tick();
 
 #endif // SERVER_H
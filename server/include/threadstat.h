@@ -0,0 +1,71 @@
+#ifndef THREADSTAT_H
+#define THREADSTAT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Per-thread counter tables shared by the profilers (lockstat.h, allocstat.h).
+//
+// Each thread writes only its own table, with plain read-modify-writes
+// published by relaxed stores; readers walk the list and sum every table.
+// Tables are linked once and never unlinked. A thread releases its table when
+// it exits and the next new thread claims it, adding on top of the counts
+// already there: totals keep a finished thread's counts, and the list grows
+// to the peak number of threads, not to the number ever started.
+
+// Runs release at thread exit; the profiler sets it when the thread first
+// attaches, and release hands the table back with threadstat_release
+struct ThreadStatOwner {
+    void (*release)();
+    ~ThreadStatOwner() {
+        if (release) release();
+    }
+};
+
+// Claim a table for the calling thread: a released one, else a new zeroed one
+// linked at *head. T needs `int owned` and `T* next` members; the caller
+// caches the result in a thread_local.
+template <typename T>
+static T* threadstat_attach(T** head) {
+    T* t = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    for (; t; t = t->next) {
+        int free_slot = 0;
+        if (__atomic_load_n(&t->owned, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&t->owned, &free_slot, 1, false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            return t;
+        }
+    }
+    t = (T*)calloc(1, sizeof(T));
+    t->owned = 1;
+    T* first = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    do {
+        t->next = first;
+    } while (!__atomic_compare_exchange_n(head, &first, t, false,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    return t;
+}
+
+// Hand a table back; its counts are published to the next owner
+template <typename T>
+static void threadstat_release(T* t) {
+    if (t) __atomic_store_n(&t->owned, 0, __ATOMIC_RELEASE);
+}
+
+// Owner-only counters: plain read-modify-write, published for concurrent readers
+static inline void threadstat_bump(uint64_t* counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static inline void threadstat_raise_max(uint64_t* counter, uint64_t v) {
+    if (v > *counter) __atomic_store_n(counter, v, __ATOMIC_RELAXED);
+}
+
+// Log2 histogram bucket of value >> shift, the last bucket collecting the rest
+static inline int threadstat_bucket(uint64_t value, int shift, int buckets) {
+    uint64_t v = value >> shift;
+    int b = v ? 64 - __builtin_clzll((unsigned long long)v) : 0;
+    return b < buckets ? b : buckets - 1;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include "server.h"
+
+// OpenSSL types (avoid pulling <openssl/ssl.h> into every includer)
+struct ssl_ctx_st;
+struct ssl_st;
+
+// Apply session resumption and kTLS settings to a server SSL_CTX
+// (called for the lws vhost context and the epoll engine's shared context)
+void tls_configure_server_ctx(struct ssl_ctx_st* ctx, const ServerOptions& opts);
+
+// Create the epoll engine's server context from opts.tls_cert / opts.tls_key
+// Returns nullptr (and logs) on failure
+struct ssl_ctx_st* tls_create_server_ctx(const ServerOptions& opts);
+
+void tls_destroy_server_ctx(struct ssl_ctx_st* ctx);
+
+// True when OpenSSL handed record encryption for writes to the kernel
+bool tls_ktls_send_enabled(struct ssl_st* ssl);
+
+// Count a completed handshake (resumed / kTLS) for the shutdown summary
+void tls_record_handshake(struct ssl_st* ssl);
+
+// Print handshake counters
+void tls_print_stats();
+
+#endif // TLS_H
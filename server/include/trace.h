@@ -0,0 +1,35 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// USDT (user-level statically defined tracing) probes, provider "crdt".
+//
+// Compiled in when systemtap's <sys/sdt.h> is installed (the Makefile then
+// defines CRDT_USDT; build with USDT=0 to leave them out). A probe is one nop
+// plus an ELF note; perf / bpftrace turn it into a breakpoint only while
+// attached, so a detached probe costs the nop and keeping its arguments in
+// registers. Without CRDT_USDT the arguments are not even evaluated.
+// Arguments are integers or pointers, in the order listed:
+//
+//   receive(peer_id, msg_type, len)         Protocol message from a peer
+//   apply_start(room_id, len)               Before Document::apply_update
+//   apply_end(room_id, len, ok)             After it (pair with apply_start per thread)
+//   broadcast(room_id, len, fanout, awareness)  Frame queued to fanout peers
+//   enqueue(peer_id, queue_class, len, queued_bytes)  After the frame is queued
+//   write(peer_id, bytes)                   Socket write (epoll: one writev batch)
+//   connect(peer_id, room_id, mux)          Peer opened; mux connections report room_id 0,
+//                                           each subscribed channel its own peer and room
+//   disconnect(peer_id, room_id)            Peer closed
+//   snapshot_start(doc, parts)              Merging a read view's base and tail
+//   snapshot_end(doc, bytes)                Merged state size (0 = failed)
+//
+// Ready-made scripts are in scripts/bpftrace/; list the probes with
+//   bpftrace -l 'usdt:./build/crdt_server:crdt:*'
+
+#if defined(CRDT_USDT)
+#include <sys/sdt.h>
+#define TRACE(name, ...) STAP_PROBEV(crdt, name, __VA_ARGS__)
+#else
+#define TRACE(name, ...) do { } while (0)
+#endif
+
+#endif // TRACE_H
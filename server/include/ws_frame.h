@@ -0,0 +1,75 @@
+#ifndef WS_FRAME_H
+#define WS_FRAME_H
+
+#include "allocstat.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// RFC 6455 WebSocket framing used by the native epoll engine and the load generator
+
+enum WsOpcode {
+    WS_OP_CONTINUATION = 0x0,
+    WS_OP_TEXT = 0x1,
+    WS_OP_BINARY = 0x2,
+    WS_OP_CLOSE = 0x8,
+    WS_OP_PING = 0x9,
+    WS_OP_PONG = 0xA
+};
+
+// Largest possible frame header: 2 + 8 (extended length) + 4 (mask key)
+#define WS_MAX_HEADER_LEN 14
+
+// Length of Sec-WebSocket-Accept value including terminating NUL
+#define WS_ACCEPT_LEN 29
+
+struct WsFrameHeader {
+    bool fin;
+    uint8_t opcode;
+    bool masked;
+    uint8_t mask_key[4];
+    uint64_t payload_len;
+    size_t header_len;
+};
+
+// Parse a frame header
+// Returns 1 when complete, 0 when more bytes are needed, -1 on protocol error
+int ws_parse_frame_header(const uint8_t* data, size_t len, WsFrameHeader* out);
+
+// Encode a final frame header for a payload of payload_len bytes
+// Pass mask_key=null for server frames (unmasked); returns header length
+size_t ws_encode_frame_header(uint8_t opcode, uint64_t payload_len,
+                              const uint8_t* mask_key, uint8_t* out);
+
+// XOR payload with mask key in place (offset = bytes already unmasked)
+void ws_apply_mask(uint8_t* data, size_t len, const uint8_t mask_key[4], size_t offset);
+
+// Compute Sec-WebSocket-Accept for a client key, writes NUL-terminated base64
+void ws_compute_accept(const char* key, size_t key_len, char out[WS_ACCEPT_LEN]);
+
+// Base64 encode (out must hold 4 * ((len + 2) / 3) + 1 bytes), returns length
+size_t ws_base64_encode(const uint8_t* data, size_t len, char* out);
+
+// Bytes reserved in front of WsSharedFrame::data (lws_write needs LWS_PRE)
+#define WS_FRAME_HEADROOM 16
+
+// Server-to-client frame serialized once (unmasked header + payload) and shared
+// by every peer it is queued to. Engines write data/len as-is; the last
+// release frees it.
+struct WsSharedFrame {
+    int refs;               // Atomic reference count
+    int tag;                // AllocTag the frame is accounted under
+    uint8_t* data;          // Frame header followed by payload
+    size_t len;             // Header + payload bytes
+    size_t header_len;
+};
+
+// Build a final frame around a copy of payload (refs = 1)
+WsSharedFrame* ws_frame_create(uint8_t opcode, const uint8_t* payload, size_t payload_len);
+
+// Same, accounted under another subsystem than ALLOC_FRAME (allocstat.h)
+WsSharedFrame* ws_frame_create_tagged(uint8_t opcode, const uint8_t* payload, size_t payload_len, AllocTag tag);
+
+void ws_frame_retain(WsSharedFrame* frame);
+void ws_frame_release(WsSharedFrame* frame);
+
+#endif // WS_FRAME_H
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Attach one of the bpftrace scripts in this directory to a running server.
+#
+# Usage: scripts/bpftrace/run.sh SCRIPT.bt [binary]
+# binary defaults to build/crdt_server; the server must have been built with
+# USDT probes (sys/sdt.h installed, see include/trace.h). Needs root.
+
+set -e
+cd "$(dirname "$0")/../.."
+
+SCRIPT=scripts/bpftrace/${1:?usage: $0 SCRIPT.bt [binary]}
+BINARY=$(realpath "${2:-build/crdt_server}")
+PID=$(pgrep -f -n "^$BINARY( |$)" || pgrep -n -x crdt_server || true)
+
+if ! readelf -n "$BINARY" 2>/dev/null | grep -q stapsdt; then
+    echo "$BINARY has no USDT probes (rebuild with sys/sdt.h installed)" >&2
+    exit 1
+fi
+
+# The scripts name ./build/crdt_server; point them at the binary given
+PROGRAM=$(sed "s|usdt:./build/crdt_server:|usdt:$BINARY:|" "$SCRIPT")
+if [ -n "$PID" ]; then
+    exec bpftrace -p "$PID" -e "$PROGRAM"
+fi
+exec bpftrace -e "$PROGRAM"
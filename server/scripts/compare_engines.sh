@@ -0,0 +1,45 @@
+#!/bin/bash
+# Run the same load against the lws and epoll engines and print both results.
+#
+# Usage: scripts/compare_engines.sh [loadgen args...]
+# Defaults: 500 clients, 4 writers at 100 updates/s each, 15 seconds.
+# Env: PORT (default 9100), THREADS (epoll reactors, default: one per core),
+#      BUILD_DIR (default build)
+
+set -e
+cd "$(dirname "$0")/.."
+
+BUILD_DIR=${BUILD_DIR:-build}
+PORT=${PORT:-9100}
+SERVER=$BUILD_DIR/crdt_server
+LOADGEN=$BUILD_DIR/crdt_loadgen
+export LD_LIBRARY_PATH=/usr/local/lib:$LD_LIBRARY_PATH
+
+if [ $# -eq 0 ]; then
+    set -- --clients 500 --writers 4 --rate 100 --duration 15
+fi
+
+run_engine() {
+    local engine=$1
+    shift
+    local extra=()
+    if [ "$engine" = "epoll" ] && [ -n "$THREADS" ]; then
+        extra=(--threads "$THREADS")
+    fi
+
+    "$SERVER" "$PORT" --engine "$engine" --quiet "${extra[@]}" > /dev/null 2>&1 &
+    local pid=$!
+    sleep 1
+
+    "$LOADGEN" --port "$PORT" --label "$engine" "$@" || true
+
+    kill -INT $pid 2>/dev/null || true
+    wait $pid 2>/dev/null || true
+    sleep 1
+}
+
+echo "Load: $*"
+echo
+run_engine lws "$@"
+echo
+run_engine epoll "$@"
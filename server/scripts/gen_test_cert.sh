@@ -0,0 +1,18 @@
+#!/bin/bash
+# Generate a self-signed certificate for local wss:// testing.
+#
+# Usage: scripts/gen_test_cert.sh [out_dir]   (default: certs)
+# Produces out_dir/server.crt and out_dir/server.key valid for localhost/127.0.0.1.
+
+set -e
+
+OUT=${1:-certs}
+mkdir -p "$OUT"
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 365 \
+    -keyout "$OUT/server.key" -out "$OUT/server.crt" \
+    -subj "/CN=localhost" \
+    -addext "subjectAltName=DNS:localhost,IP:127.0.0.1" 2>/dev/null
+
+echo "Wrote $OUT/server.crt and $OUT/server.key"
+echo "Run: ./build/crdt_server 9443 --tls-cert $OUT/server.crt --tls-key $OUT/server.key"
@@ -0,0 +1,263 @@
+#!/bin/bash
+# Compare the benchmark suites of two builds and fail on a significant regression.
+#
+# BASE and HEAD are build directories (holding crdt_server, crdt_loadgen and
+# bench_*) or git revisions, which are checked out into temporary worktrees and
+# built with `make all loadgen bench`. Each trial runs every suite once per
+# build, alternating which build goes first, with the benchmarks pinned to
+# BENCH_CPUS and the end-to-end load split between SERVER_CPUS and LOADGEN_CPUS.
+# Every metric of every trial is appended to $OUT/samples.tsv, and
+# crdt_perfstat compares the builds metric by metric (Mann-Whitney U test and
+# Hodges-Lehmann shift, see tools/perfstat.cpp) into $OUT/report.md.
+#
+# Suites (SUITES, default all):
+#   apply      bench_apply over the update corpus (skipped if bench/corpus/v1 is missing)
+#   fanout     bench_fanout (1000 peers, 256 B) and bench_members (10000 peers)
+#   broadcast  bench_broadcast (1000 and 10000 peers, 180 B)
+#   codec      bench_codec
+#   load       crdt_server + crdt_loadgen (LOAD_ARGS, default 200 clients, 4 writers
+#              at 100 updates/s for 10 s)
+#
+# Usage: scripts/perf_compare.sh BASE HEAD
+# Env: TRIALS (default 10), SUITES, ALPHA (0.05), THRESHOLD (percent, default 3),
+#      BENCH_CPUS, SERVER_CPUS, LOADGEN_CPUS (taskset lists; by default the last
+#      CPU for benchmarks, and the upper and lower halves above CPU 0 for the load),
+#      LOAD_ARGS, PORT (9300), CORPUS (bench/corpus/v1), MAKE_ARGS (extra make
+#      arguments when building revisions), BUILD_DIR (build; for crdt_perfstat),
+#      OUT (perf-<timestamp>)
+# Exit: 0 no regression, 1 regression, 2 setup failure.
+
+set -u
+CALLER_DIR=$PWD
+cd "$(dirname "$0")/.."
+
+if [ $# -ne 2 ]; then
+    sed -n '2,/^# Exit/p' "$0" | sed 's/^# \{0,1\}//'
+    exit 2
+fi
+
+TRIALS=${TRIALS:-10}
+SUITES=${SUITES:-apply fanout broadcast codec load}
+ALPHA=${ALPHA:-0.05}
+THRESHOLD=${THRESHOLD:-3}
+PORT=${PORT:-9300}
+CORPUS=${CORPUS:-bench/corpus/v1}
+MAKE_ARGS=${MAKE_ARGS:-}
+BUILD_DIR=${BUILD_DIR:-build}
+LOAD_ARGS=${LOAD_ARGS:---clients 200 --writers 4 --rate 100 --duration 10}
+OUT=${OUT:-perf-$(date +%Y%m%d-%H%M%S)}
+PERFSTAT=$BUILD_DIR/crdt_perfstat
+export LD_LIBRARY_PATH=/usr/local/lib:${LD_LIBRARY_PATH:-}
+
+NCPU=$(nproc)
+BENCH_CPUS=${BENCH_CPUS:-$((NCPU - 1))}
+if [ "$NCPU" -ge 4 ]; then
+    SERVER_CPUS=${SERVER_CPUS:-$((NCPU / 2))-$((NCPU - 1))}
+    LOADGEN_CPUS=${LOADGEN_CPUS:-1-$((NCPU / 2 - 1))}
+else
+    SERVER_CPUS=${SERVER_CPUS:-}
+    LOADGEN_CPUS=${LOADGEN_CPUS:-}
+fi
+
+if [ ! -x "$PERFSTAT" ]; then
+    echo "[Perf] $PERFSTAT not found (make perfstat)"
+    exit 2
+fi
+mkdir -p "$OUT"
+OUT=$(cd "$OUT" && pwd)
+SAMPLES=$OUT/samples.tsv
+: > "$SAMPLES"
+
+WORKTREES=()
+SERVER_PID=
+cleanup() {
+    [ -n "$SERVER_PID" ] && kill -INT "$SERVER_PID" 2>/dev/null && wait "$SERVER_PID" 2>/dev/null
+    for wt in "${WORKTREES[@]}"; do
+        git worktree remove --force "$wt" 2>/dev/null
+    done
+}
+trap cleanup EXIT
+trap 'exit 2' INT TERM
+
+# Run a command on a CPU list (unpinned when the list is empty). Only called in
+# a subshell ($(...) or &), so exec keeps $! the command's own PID
+pin() {
+    local cpus=$1
+    shift
+    if [ -n "$cpus" ] && command -v taskset > /dev/null; then
+        exec taskset -c "$cpus" "$@"
+    fi
+    exec "$@"
+}
+
+# Sets PREPARED to the build directory for a spec: an existing build directory
+# as is, otherwise a git revision built in a worktree under $OUT
+prepare() {
+    local spec=$1 name=$2
+    local dir=$spec
+    [ "${dir#/}" = "$dir" ] && dir=$CALLER_DIR/$spec
+    if [ -d "$dir" ]; then
+        PREPARED=$(cd "$dir" && pwd)
+        return 0
+    fi
+    if ! git rev-parse --verify -q "$spec^{commit}" > /dev/null; then
+        echo "[Perf] $spec is neither a build directory nor a git revision"
+        return 1
+    fi
+    local wt=$OUT/src-$name
+    git worktree add -q --detach "$wt" "$spec" || return 1
+    WORKTREES+=("$wt")
+    echo "[Perf] Building $spec ($(git rev-parse --short "$spec")) in $wt"
+    # -k: older revisions may lack some benchmarks; those suites are skipped
+    # shellcheck disable=SC2086
+    make -C "$wt/server" -k -j"$NCPU" BUILD_DIR=build $MAKE_ARGS all loadgen bench \
+        > "$OUT/build-$name.log" 2>&1
+    if [ ! -x "$wt/server/build/crdt_server" ]; then
+        echo "[Perf] Build of $spec failed (see $OUT/build-$name.log)"
+        return 1
+    fi
+    PREPARED=$wt/server/build
+}
+
+# Append one sample: NAME DIRECTION LABEL OUTPUT PATH
+emit() {
+    local name=$1 direction=$2 label=$3 output=$4 path=$5
+    local value
+    value=$(echo "$output" | "$PERFSTAT" get "$path") || return 0
+    printf '%s\t%s\t%s\t%s\n' "$name" "$direction" "$label" "$value" >> "$SAMPLES"
+}
+
+# Suites both builds can run
+has_suite() {
+    local suite=$1 dir=$2
+    case $suite in
+        apply)     [ -x "$dir/bench_apply" ] && [ -f "$CORPUS/manifest.json" ] ;;
+        fanout)    [ -x "$dir/bench_fanout" ] && [ -x "$dir/bench_members" ] ;;
+        broadcast) [ -x "$dir/bench_broadcast" ] ;;
+        codec)     [ -x "$dir/bench_codec" ] ;;
+        load)      [ -x "$dir/crdt_server" ] && [ -x "$dir/crdt_loadgen" ] ;;
+        *)         return 1 ;;
+    esac
+}
+
+run_suite() {
+    local suite=$1 dir=$2 label=$3
+    local out i op stream
+    case $suite in
+        apply)
+            out=$(pin "$BENCH_CPUS" "$dir/bench_apply" --corpus "$CORPUS" --repeat 1 --json 2>/dev/null)
+            for ((i = 0; ; i++)); do
+                stream=$(echo "$out" | "$PERFSTAT" get "streams.$i.stream" "streams.$i.encoding" 2>/dev/null) || break
+                stream=$(echo "$stream" | paste -sd/)
+                emit "apply/$stream/updates_per_sec" higher "$label" "$out" "streams.$i.updates_per_sec"
+                emit "apply/$stream/apply_p99_us" lower "$label" "$out" "streams.$i.apply_us.p99"
+                emit "apply/$stream/heap_bytes" lower "$label" "$out" "streams.$i.heap_bytes"
+                emit "apply/$stream/encode_v1_us" lower "$label" "$out" "streams.$i.encode_v1_us"
+            done
+            ;;
+        fanout)
+            out=$(pin "$BENCH_CPUS" "$dir/bench_fanout" --peers 1000 --messages 200 --size 256 --json)
+            for op in enqueue_ns drain_ns total_ns; do
+                emit "fanout/1000x256B/$op" lower "$label" "$out" "shared.$op"
+            done
+            out=$(pin "$BENCH_CPUS" "$dir/bench_members" --peers 10000 --json)
+            emit "fanout/members_10000/ns_per_peer" lower "$label" "$out" soa_ns_per_peer
+            ;;
+        broadcast)
+            out=$(pin "$BENCH_CPUS" "$dir/bench_broadcast" --peers 1000,10000 --sizes 180 --json)
+            for i in 0 1; do
+                local peers
+                peers=$(echo "$out" | "$PERFSTAT" get "cases.$i.peers") || continue
+                emit "broadcast/${peers}x180B/broadcast_ns_per_peer" lower "$label" "$out" "cases.$i.broadcast_ns_per_peer"
+                emit "broadcast/${peers}x180B/drain_ns_per_peer" lower "$label" "$out" "cases.$i.drain_ns_per_peer"
+                emit "broadcast/${peers}x180B/broadcast_p99_us" lower "$label" "$out" "cases.$i.broadcast_us.p99"
+            done
+            ;;
+        codec)
+            out=$(pin "$BENCH_CPUS" "$dir/bench_codec" --json)
+            for op in varuint_encode varuint_decode sync_step1_encode sync_step1_decode \
+                      sync_step2_encode_24 sync_step2_decode_24 sync_step2_encode_4096 sync_step2_decode_4096 \
+                      awareness_encode awareness_decode mux_encode mux_decode frame_header mask_4096 \
+                      shared_frame_180; do
+                emit "codec/$op" lower "$label" "$out" "ns.$op"
+            done
+            ;;
+        load)
+            pin "$SERVER_CPUS" "$dir/crdt_server" "$PORT" --engine epoll --quiet > /dev/null 2>&1 &
+            SERVER_PID=$!
+            sleep 1
+            # shellcheck disable=SC2086
+            out=$(pin "$LOADGEN_CPUS" "$dir/crdt_loadgen" --port "$PORT" --json --label "$label" $LOAD_ARGS 2>/dev/null)
+            kill -INT "$SERVER_PID" 2>/dev/null
+            wait "$SERVER_PID" 2>/dev/null
+            SERVER_PID=
+            sleep 1
+            emit "load/deliver_per_s" higher "$label" "$out" deliver_per_s
+            emit "load/latency_p50_ms" lower "$label" "$out" latency_ms.p50
+            emit "load/latency_p99_ms" lower "$label" "$out" latency_ms.p99
+            ;;
+    esac
+}
+
+prepare "$1" base || exit 2
+BASE_DIR=$PREPARED
+prepare "$2" head || exit 2
+HEAD_DIR=$PREPARED
+
+# Frequency scaling and turbo make trial-to-trial noise larger than most regressions
+for gov in /sys/devices/system/cpu/cpu*/cpufreq/scaling_governor; do
+    if [ -r "$gov" ] && [ "$(cat "$gov")" != "performance" ]; then
+        echo "[Perf] Warning: CPU governor is $(cat "$gov"), not performance (cpupower frequency-set -g performance)"
+        break
+    fi
+done
+if [ "$(cat /sys/devices/system/cpu/intel_pstate/no_turbo 2>/dev/null)" = "0" ]; then
+    echo "[Perf] Warning: turbo boost is enabled"
+fi
+
+suites=()
+for suite in $SUITES; do
+    if has_suite "$suite" "$BASE_DIR" && has_suite "$suite" "$HEAD_DIR"; then
+        suites+=("$suite")
+    else
+        echo "[Perf] Skipping $suite: not available in both builds"
+    fi
+done
+if [ ${#suites[@]} -eq 0 ]; then
+    echo "[Perf] No suite to run"
+    exit 2
+fi
+
+echo "[Perf] base $BASE_DIR"
+echo "[Perf] head $HEAD_DIR"
+echo "[Perf] $TRIALS trials of: ${suites[*]} (bench CPUs ${BENCH_CPUS:-any}," \
+     "server ${SERVER_CPUS:-any}, loadgen ${LOADGEN_CPUS:-any}) -> $OUT"
+for ((trial = 1; trial <= TRIALS; trial++)); do
+    for suite in "${suites[@]}"; do
+        # Alternate the order so drift over the run does not favour either build
+        if [ $((trial % 2)) -eq 1 ]; then
+            run_suite "$suite" "$BASE_DIR" base
+            run_suite "$suite" "$HEAD_DIR" head
+        else
+            run_suite "$suite" "$HEAD_DIR" head
+            run_suite "$suite" "$BASE_DIR" base
+        fi
+    done
+    echo "[Perf] Trial $trial/$TRIALS done"
+done
+
+{
+    echo "# Performance comparison"
+    echo
+    echo "- base: \`$1\` ($BASE_DIR)"
+    echo "- head: \`$2\` ($HEAD_DIR)"
+    echo "- $TRIALS trials, suites: ${suites[*]}"
+    echo "- $(uname -sr), $NCPU CPUs, $(grep -m1 'model name' /proc/cpuinfo | cut -d: -f2 | sed 's/^ //')"
+    echo "- Pinning: bench ${BENCH_CPUS:-none}, server ${SERVER_CPUS:-none}, loadgen ${LOADGEN_CPUS:-none}"
+    echo
+} > "$OUT/report.md"
+"$PERFSTAT" compare --alpha "$ALPHA" --threshold "$THRESHOLD" < "$SAMPLES" >> "$OUT/report.md"
+status=$?
+cat "$OUT/report.md"
+[ $status -eq 1 ] && echo "[Perf] FAIL: regression in head (see $OUT/report.md)"
+exit $status
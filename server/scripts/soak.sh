@@ -0,0 +1,192 @@
+#!/bin/bash
+# Soak test: run the server under churning load for hours and fail if memory
+# or latency drift.
+#
+# The load generator keeps a steady edit load and churns connections, rooms,
+# awareness and large pastes on top of it (see tools/loadgen.cpp). Every
+# INTERVAL seconds one sample is appended to $OUT/samples.csv:
+#   - the server's RSS, malloc heap in use, peers, rooms, queued frames,
+#     awareness states, document bytes and pending reclamation (GET /admin/memory)
+#   - that interval's delivery latency percentiles and churn counters (loadgen)
+# After WARMUP seconds, a least-squares slope per hour is fitted to RSS, heap
+# and p99. The run fails when any slope exceeds its limit.
+#
+# Usage: scripts/soak.sh [loadgen args...]
+# Default load: 200 clients in 8 rooms, 8 writers at 20 updates/s with every
+#   100th update a 16 KiB paste, trimmed so documents stay small; 2 reconnects/s;
+#   1 awareness update/s per client.
+# Env: DURATION (seconds, default 14400), INTERVAL (60), WARMUP (600),
+#      MAX_RSS_SLOPE / MAX_HEAP_SLOPE (MB per hour, default 16),
+#      MAX_P99_SLOPE (ms per hour, default 5), MAX_RSS_MB (abort above, 0 = off),
+#      ENGINE (epoll), THREADS, PORT (9200), HTTP_PORT (9201),
+#      BUILD_DIR (build), OUT (soak-<timestamp>)
+# Exit: 0 pass, 1 drift past a limit (or too few samples to fit one), 2 server
+#       died or could not start, or the load generator stopped early or failed.
+
+set -u
+cd "$(dirname "$0")/.."
+
+DURATION=${DURATION:-14400}
+INTERVAL=${INTERVAL:-60}
+WARMUP=${WARMUP:-600}
+MAX_RSS_SLOPE=${MAX_RSS_SLOPE:-16}
+MAX_HEAP_SLOPE=${MAX_HEAP_SLOPE:-16}
+MAX_P99_SLOPE=${MAX_P99_SLOPE:-5}
+MAX_RSS_MB=${MAX_RSS_MB:-0}
+ENGINE=${ENGINE:-epoll}
+PORT=${PORT:-9200}
+HTTP_PORT=${HTTP_PORT:-9201}
+BUILD_DIR=${BUILD_DIR:-build}
+OUT=${OUT:-soak-$(date +%Y%m%d-%H%M%S)}
+SERVER=$BUILD_DIR/crdt_server
+LOADGEN=$BUILD_DIR/crdt_loadgen
+export LD_LIBRARY_PATH=/usr/local/lib:${LD_LIBRARY_PATH:-}
+
+if [ $# -eq 0 ]; then
+    set -- --clients 200 --writers 8 --rate 20 --size 64 --rooms 8 --churn 2 --awareness 1 \
+           --paste-every 100 --paste-size 16384 --trim
+fi
+
+mkdir -p "$OUT"
+SAMPLES=$OUT/samples.csv
+LOADGEN_OUT=$OUT/loadgen.jsonl
+
+# First number for "key": in a JSON document (flat keys are unique in our output)
+json_num() {
+    echo "$1" | grep -o "\"$2\":[0-9.eE+-]*" | head -1 | cut -d: -f2
+}
+
+server_alive() {
+    kill -0 "$SERVER_PID" 2>/dev/null
+}
+
+cleanup() {
+    [ -n "${LOADGEN_PID:-}" ] && kill -INT "$LOADGEN_PID" 2>/dev/null
+    [ -n "${SERVER_PID:-}" ] && kill -INT "$SERVER_PID" 2>/dev/null
+    wait 2>/dev/null
+}
+trap cleanup EXIT
+trap 'exit 2' INT TERM
+
+extra=()
+if [ -n "${THREADS:-}" ]; then
+    extra=(--threads "$THREADS")
+fi
+"$SERVER" "$PORT" --engine "$ENGINE" --quiet --http-port "$HTTP_PORT" "${extra[@]}" > "$OUT/server.log" 2>&1 &
+SERVER_PID=$!
+sleep 1
+if ! server_alive || ! curl -sf "http://127.0.0.1:$HTTP_PORT/admin/memory" > /dev/null; then
+    echo "[Soak] Server did not start (see $OUT/server.log)"
+    exit 2
+fi
+
+echo "[Soak] $DURATION s, sample every $INTERVAL s, warmup $WARMUP s -> $OUT"
+echo "[Soak] Load: $*"
+# A few seconds past the last sample, so the server is still under load when it is taken
+SAMPLE_COUNT=$((DURATION / INTERVAL))
+"$LOADGEN" --port "$PORT" --duration $((DURATION + 5)) --report-every "$INTERVAL" --json --label soak "$@" \
+    > "$LOADGEN_OUT" 2> "$OUT/loadgen.log" &
+LOADGEN_PID=$!
+
+echo "t_s,rss_mb,heap_mb,peers,rooms,queued_messages,queued_kb,awareness_states,awareness_kb,doc_kb," \
+     "epoch_pending,sent,delivered,awareness,reconnects,errors,p50_ms,p99_ms,max_ms" | tr -d ' ' > "$SAMPLES"
+
+status=0
+sample=0
+while [ $sample -lt $SAMPLE_COUNT ]; do
+    # Wait for the load generator's next interval report, then sample the server
+    sample=$((sample + 1))
+    deadline=$((SECONDS + INTERVAL + 60))
+    while [ "$(wc -l < "$LOADGEN_OUT")" -lt "$sample" ] && kill -0 "$LOADGEN_PID" 2>/dev/null \
+          && [ $SECONDS -lt $deadline ]; do
+        sleep 1
+    done
+    if ! server_alive; then
+        echo "[Soak] Server exited during the run (see $OUT/server.log)"
+        status=2
+        break
+    fi
+    line=$(sed -n "${sample}p" "$LOADGEN_OUT")
+    if [ -z "$line" ] || ! echo "$line" | grep -q '"interval"'; then
+        # It runs past the last sample, so finishing here means it stopped early
+        echo "[Soak] Load generator stopped after $((sample - 1)) of $SAMPLE_COUNT samples (see $OUT/loadgen.log)"
+        status=2
+        break
+    fi
+
+    mem=$(curl -sf "http://127.0.0.1:$HTTP_PORT/admin/memory")
+    if [ -z "$mem" ]; then
+        echo "[Soak] /admin/memory did not answer"
+        status=2
+        break
+    fi
+    t=$(json_num "$line" t_s)
+    rss=$(json_num "$mem" rss_bytes)
+    heap=$(json_num "$mem" in_use_bytes)
+    row=$(awk -v t="$t" -v rss="$rss" -v heap="${heap:-0}" \
+        -v peers="$(json_num "$mem" peers)" -v rooms="$(json_num "$mem" rooms)" \
+        -v qm="$(json_num "$mem" queued_messages)" -v qb="$(json_num "$mem" queued_bytes)" \
+        -v as="$(json_num "$mem" awareness_states)" -v ab="$(json_num "$mem" awareness_bytes)" \
+        -v db="$(json_num "$mem" doc_bytes)" -v ep="$(json_num "$mem" epoch_pending)" \
+        -v sent="$(json_num "$line" sent)" -v dl="$(json_num "$line" delivered)" \
+        -v aw="$(json_num "$line" awareness)" -v rc="$(json_num "$line" reconnects)" \
+        -v err="$(json_num "$line" errors)" -v p50="$(json_num "$line" p50)" \
+        -v p99="$(json_num "$line" p99)" -v max="$(json_num "$line" max)" \
+        'BEGIN { printf "%.0f,%.2f,%.2f,%d,%d,%d,%.1f,%d,%.1f,%.1f,%d,%d,%d,%d,%d,%d,%.3f,%.3f,%.3f\n",
+                 t, rss / 1048576, heap / 1048576, peers, rooms, qm, qb / 1024, as, ab / 1024, db / 1024, ep,
+                 sent, dl, aw, rc, err, p50, p99, max }')
+    echo "$row" >> "$SAMPLES"
+    echo "$row" | awk -F, '{ printf "[Soak] %6ds rss %8.1f MB heap %8.1f MB peers %5d queued %7.1f KB awareness %5d doc %8.1f KB p99 %8.3f ms reconnects %d errors %d\n",
+                             $1, $2, $3, $4, $7, $8, $10, $18, $15, $16 }'
+
+    if [ "$MAX_RSS_MB" != "0" ] && awk -v r="$(echo "$row" | cut -d, -f2)" -v m="$MAX_RSS_MB" 'BEGIN { exit !(r > m) }'; then
+        echo "[Soak] RSS above MAX_RSS_MB=$MAX_RSS_MB, stopping"
+        status=1
+        break
+    fi
+done
+
+[ $status -ne 0 ] && kill -INT "$LOADGEN_PID" 2>/dev/null
+wait "$LOADGEN_PID" 2>/dev/null
+loadgen_status=$?
+LOADGEN_PID=
+if [ $status -eq 0 ] && [ $loadgen_status -ne 0 ]; then
+    echo "[Soak] Load generator exited with status $loadgen_status (see $OUT/loadgen.log)"
+    status=2
+fi
+
+# Least-squares slopes per hour over the samples after warmup (all but the
+# first sample when the run is too short for that)
+awk -F, -v warmup="$WARMUP" -v max_rss="$MAX_RSS_SLOPE" -v max_heap="$MAX_HEAP_SLOPE" -v max_p99="$MAX_P99_SLOPE" '
+    NR == 1 { next }
+    { t[NR] = $1 / 3600; rss[NR] = $2; heap[NR] = $3; p99[NR] = $18; q[NR] = $7 / 1024; n_all++; last = NR }
+    function slope(y, from,    i, n, sx, sy, sxx, sxy) {
+        for (i = from; i <= last; i++) {
+            if (!(i in t)) continue
+            n++; sx += t[i]; sy += y[i]; sxx += t[i] * t[i]; sxy += t[i] * y[i]
+        }
+        if (n < 2 || n * sxx - sx * sx == 0) return 0
+        return (n * sxy - sx * sy) / (n * sxx - sx * sx)
+    }
+    END {
+        if (n_all < 3) { print "[Soak] FAIL: too few samples to fit a slope"; exit 1 }
+        from = 0
+        for (i = 2; i <= last; i++) if (t[i] * 3600 >= warmup) { from = i; break }
+        if (from == 0 || last - from + 1 < 3) { from = 3; print "[Soak] Run shorter than warmup + 3 samples; fitting all but the first sample" }
+        s_rss = slope(rss, from); s_heap = slope(heap, from); s_p99 = slope(p99, from); s_q = slope(q, from)
+        printf "[Soak] Slopes over %d samples: rss %+.2f MB/h (limit %s), heap %+.2f MB/h (limit %s), p99 %+.3f ms/h (limit %s), queued %+.2f MB/h\n",
+               last - from + 1, s_rss, max_rss, s_heap, max_heap, s_p99, max_p99, s_q
+        fail = 0
+        if (s_rss > max_rss) { print "[Soak] FAIL: RSS grows faster than the limit"; fail = 1 }
+        if (s_heap > max_heap) { print "[Soak] FAIL: heap grows faster than the limit"; fail = 1 }
+        if (s_p99 > max_p99) { print "[Soak] FAIL: p99 latency drifts faster than the limit"; fail = 1 }
+        exit fail
+    }' "$SAMPLES" | tee "$OUT/summary.txt"
+slope_status=${PIPESTATUS[0]}
+
+tail -1 "$LOADGEN_OUT" >> "$OUT/summary.txt"
+if [ $status -eq 0 ] && [ "$slope_status" -ne 0 ]; then
+    status=1
+fi
+[ $status -eq 0 ] && echo "[Soak] PASS" | tee -a "$OUT/summary.txt"
+exit $status
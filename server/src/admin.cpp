@@ -0,0 +1,556 @@
+#include "admin.h"
+#include "admission.h"
+#include "allocstat.h"
+#include "epoch.h"
+#include "lockstat.h"
+#include "peer.h"
+#include "room.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define ADMIN_DEFAULT_LIMIT 1000
+#define ADMIN_ALLOC_DOC_LIMIT 20
+
+static const char* QUEUE_NAMES[PEER_QUEUE_COUNT] = { "sync", "doc", "awareness" };
+
+// Per-peer figures copied under the peer's lock
+struct PeerSnapshot {
+    uint32_t id;
+    uint32_t client_id;
+    const char* transport;
+    bool closed;
+    bool editor;
+    bool mux;
+    uint32_t channel;
+    uint8_t admission;
+    bool has_awareness;
+    size_t awareness_bytes;
+    int counts[PEER_QUEUE_COUNT];
+    size_t bytes[PEER_QUEUE_COUNT];
+    size_t queued_bytes;
+    uint32_t awareness_coalesced;
+    uint32_t awareness_dropped;
+};
+
+static void snapshot_peer(Peer* p, PeerSnapshot* out) {
+    out->id = p->id;
+    out->transport = p->transport ? p->transport->name : "";
+    out->mux = p->mux;
+    out->channel = p->channel;
+    out->editor = __atomic_load_n(&p->editor, __ATOMIC_RELAXED);
+    out->admission = __atomic_load_n(&p->admission, __ATOMIC_RELAXED);
+
+    LOCK_ACQUIRE(&p->lock);
+    out->client_id = p->client_id;
+    out->closed = p->closed;
+    out->has_awareness = p->awareness_frame != nullptr;
+    out->awareness_bytes = p->awareness_frame ? p->awareness_frame->len : 0;
+    for (int c = 0; c < PEER_QUEUE_COUNT; c++) {
+        out->counts[c] = p->queues[c].count;
+        out->bytes[c] = p->queues[c].bytes;
+    }
+    out->queued_bytes = p->queued_bytes;
+    out->awareness_coalesced = p->awareness_coalesced;
+    out->awareness_dropped = p->awareness_dropped;
+    LOCK_RELEASE(&p->lock);
+}
+
+static const char* admission_name(uint8_t state) {
+    switch (state) {
+        case ADMISSION_WAITING: return "waiting";
+        case ADMISSION_ACTIVE: return "active";
+        case ADMISSION_DONE: return "done";
+        default: return "none";
+    }
+}
+
+static void append_peer(std::string* out, const PeerSnapshot& s, Room* room, int sync, int peer_class) {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "{\"id\":%u,\"client\":%u,\"transport\":\"%s\",\"closed\":%s,\"mux\":%s,\"channel\":%u,"
+             "\"room\":",
+             s.id, s.client_id, s.transport, s.closed ? "true" : "false", s.mux ? "true" : "false", s.channel);
+    out->append(buf);
+    if (room) http_json_string(out, room->name, strlen(room->name));
+    else out->append("null");
+
+    snprintf(buf, sizeof(buf), ",\"synced\":%s,\"editor\":%s,\"admission\":\"%s\",\"awareness\":%s,"
+             "\"awareness_bytes\":%zu,\"awareness_coalesced\":%u,\"awareness_dropped\":%u,\"queued_bytes\":%zu,"
+             "\"queues\":{",
+             sync >= PEER_SYNC_DONE ? "true" : "false",
+             (s.editor || peer_class == PEER_CLASS_EDITOR) ? "true" : "false", admission_name(s.admission),
+             s.has_awareness ? "true" : "false", s.awareness_bytes, s.awareness_coalesced, s.awareness_dropped,
+             s.queued_bytes);
+    out->append(buf);
+    for (int c = 0; c < PEER_QUEUE_COUNT; c++) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":{\"messages\":%d,\"bytes\":%zu}", c ? "," : "", QUEUE_NAMES[c],
+                 s.counts[c], s.bytes[c]);
+        out->append(buf);
+    }
+    out->append("}}");
+}
+
+// Room totals over one member snapshot (caller is inside an epoch critical section)
+struct RoomFigures {
+    int members;
+    int synced;
+    int editors;
+    int awareness;              // Members with a stored awareness state
+    uint64_t queued_messages;
+    uint64_t queued_bytes;
+    uint64_t awareness_bytes;
+};
+
+static void room_figures(const RoomPeerSet* set, RoomFigures* out) {
+    memset(out, 0, sizeof(*out));
+    if (!set) return;
+    out->members = set->count;
+    PeerSnapshot s;
+    for (int i = 0; i < set->count; i++) {
+        if (__atomic_load_n(&set->sync[i], __ATOMIC_RELAXED) >= PEER_SYNC_DONE) out->synced++;
+        if (__atomic_load_n(&set->peer_class[i], __ATOMIC_RELAXED) == PEER_CLASS_EDITOR) out->editors++;
+        snapshot_peer(set->peers[i], &s);
+        if (s.has_awareness) out->awareness++;
+        out->awareness_bytes += s.awareness_bytes;
+        for (int c = 0; c < PEER_QUEUE_COUNT; c++) out->queued_messages += s.counts[c];
+        out->queued_bytes += s.queued_bytes;
+    }
+}
+
+static void append_room(std::string* out, Room* room) {
+    DocStats d;
+    room->doc.get_stats(&d);
+
+    RoomFigures f;
+    {
+        EpochGuard guard;
+        room_figures(room_members(room), &f);
+    }
+
+    uint64_t memory = (uint64_t)d.base_bytes + d.tail_bytes + d.reply_bytes + f.queued_bytes +
+                      f.awareness_bytes + (uint64_t)f.members * sizeof(Peer);
+    char buf[512];
+    out->append("{\"name\":");
+    http_json_string(out, room->name, strlen(room->name));
+    snprintf(buf, sizeof(buf),
+             ",\"id\":%u,\"members\":%d,\"synced\":%d,\"editors\":%d,\"awareness\":%d,"
+             "\"syncs_active\":%d,\"syncs_waiting\":%d,\"queued_messages\":%llu,\"queued_bytes\":%llu,",
+             room->id, f.members, f.synced, f.editors, f.awareness,
+             __atomic_load_n(&room->syncs_active, __ATOMIC_RELAXED),
+             __atomic_load_n(&room->syncs_waiting, __ATOMIC_RELAXED),
+             (unsigned long long)f.queued_messages, (unsigned long long)f.queued_bytes);
+    out->append(buf);
+    snprintf(buf, sizeof(buf),
+             "\"doc\":{\"version\":%llu,\"bytes\":%llu,\"base_bytes\":%u,\"tail_updates\":%u,\"tail_bytes\":%llu,"
+             "\"materialized\":%s,\"shared_snapshot\":%s,\"applies\":%llu,\"apply_us_last\":%.1f,"
+             "\"apply_us_avg\":%.1f,\"apply_us_max\":%.1f},",
+             (unsigned long long)d.version, (unsigned long long)(d.base_bytes + d.tail_bytes), d.base_bytes,
+             d.tail_updates, (unsigned long long)d.tail_bytes, d.materialized ? "true" : "false",
+             d.base_shared ? "true" : "false", (unsigned long long)d.applies, d.apply_ns_last / 1000.0,
+             d.applies ? d.apply_ns_total / 1000.0 / d.applies : 0.0, d.apply_ns_max / 1000.0);
+    out->append(buf);
+    snprintf(buf, sizeof(buf),
+             "\"reply_cache\":{\"entries\":%d,\"bytes\":%llu,\"hits\":%llu,\"misses\":%llu},"
+             "\"memory_bytes\":%llu}",
+             d.reply_cached, (unsigned long long)d.reply_bytes, (unsigned long long)d.reply_hits,
+             (unsigned long long)d.reply_misses, (unsigned long long)memory);
+    out->append(buf);
+}
+
+static void collect_room(Room* room, void* user) {
+    ((std::vector<Room*>*)user)->push_back(room);
+}
+
+void admin_handle_rooms(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)req;
+    (void)user;
+    std::vector<Room*> rooms;
+    rooms_for_each(collect_room, &rooms);
+
+    std::string& out = resp->body;
+    char buf[96];
+    snprintf(buf, sizeof(buf), "{\"peers\":%d,\"rooms\":[", peers_count());
+    out.append(buf);
+    for (size_t i = 0; i < rooms.size(); i++) {
+        if (i > 0) out.push_back(',');
+        append_room(&out, rooms[i]);
+    }
+    out.append("]}");
+}
+
+void admin_handle_room(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)user;
+    std::string name;
+    if (!http_query_param(req.query, "name", &name)) {
+        resp->status = 400;
+        resp->body = "{\"error\":\"missing name\"}";
+        return;
+    }
+    Room* room = rooms_find(name.c_str());
+    if (!room) {
+        resp->status = 404;
+        resp->body = "{\"error\":\"no such room\"}";
+        return;
+    }
+    int limit = ADMIN_DEFAULT_LIMIT;
+    std::string param;
+    if (http_query_param(req.query, "limit", &param)) {
+        limit = atoi(param.c_str());
+        if (limit < 0) limit = 0;
+    }
+
+    std::string& out = resp->body;
+    out.append("{\"room\":");
+    append_room(&out, room);
+    out.append(",\"peers\":[");
+
+    EpochGuard guard;
+    const RoomPeerSet* set = room_members(room);
+    int count = set ? set->count : 0;
+    PeerSnapshot s;
+    for (int i = 0; i < count && i < limit; i++) {
+        if (i > 0) out.push_back(',');
+        snapshot_peer(set->peers[i], &s);
+        append_peer(&out, s, room, __atomic_load_n(&set->sync[i], __ATOMIC_RELAXED),
+                    __atomic_load_n(&set->peer_class[i], __ATOMIC_RELAXED));
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "],\"truncated\":%s}", count > limit ? "true" : "false");
+    out.append(buf);
+}
+
+void admin_handle_peer(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)user;
+    std::string param;
+    if (!http_query_param(req.query, "id", &param)) {
+        resp->status = 400;
+        resp->body = "{\"error\":\"missing id\"}";
+        return;
+    }
+    uint32_t id = (uint32_t)strtoul(param.c_str(), nullptr, 10);
+
+    // Peers are freed through epoch reclamation, so the one found stays readable
+    EpochGuard guard;
+    Peer* peer = nullptr;
+    LOCK_ACQUIRE(&g_peers_lock);
+    for (Peer* p = g_peers; p; p = p->next) {
+        if (p->id == id) {
+            peer = p;
+            break;
+        }
+    }
+    LOCK_RELEASE(&g_peers_lock);
+    if (!peer) {
+        resp->status = 404;
+        resp->body = "{\"error\":\"no such peer\"}";
+        return;
+    }
+
+    // Its row in the room snapshot holds the sync state and class
+    Room* room = peer->room;
+    int sync = PEER_SYNC_PENDING;
+    int peer_class = PEER_CLASS_VIEWER;
+    const RoomPeerSet* set = room ? room_members(room) : nullptr;
+    for (int i = 0; set && i < set->count; i++) {
+        if (set->peers[i] != peer) continue;
+        sync = __atomic_load_n(&set->sync[i], __ATOMIC_RELAXED);
+        peer_class = __atomic_load_n(&set->peer_class[i], __ATOMIC_RELAXED);
+        break;
+    }
+
+    PeerSnapshot s;
+    snapshot_peer(peer, &s);
+    append_peer(&resp->body, s, room, sync, peer_class);
+
+    // A multiplexed connection lists its channels (their own rows drill down by id)
+    if (peer->mux) {
+        std::string& out = resp->body;
+        out.pop_back();
+        out.append(",\"channels\":[");
+        bool first = true;
+        LOCK_ACQUIRE(&g_peers_lock);
+        for (Peer* p = g_peers; p; p = p->next) {
+            if (__atomic_load_n(&p->mux_parent, __ATOMIC_RELAXED) != peer) continue;
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%s%u", first ? "" : ",", p->id);
+            out.append(buf);
+            first = false;
+        }
+        LOCK_RELEASE(&g_peers_lock);
+        out.append("]}");
+    }
+}
+
+static void append_histogram(std::string* out, const uint64_t* hist) {
+    char buf[32];
+    out->push_back('[');
+    for (int b = 0; b < LOCKSTAT_BUCKETS; b++) {
+        snprintf(buf, sizeof(buf), "%s%llu", b ? "," : "", (unsigned long long)hist[b]);
+        out->append(buf);
+    }
+    out->push_back(']');
+}
+
+static void append_lock_stats(std::string* out, const LockStats& s) {
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "\"class\":\"%s\",\"acquisitions\":%llu,\"contended\":%llu,\"wait_ns\":%llu,\"wait_max_ns\":%llu,"
+             "\"wait_p99_ns\":%llu,\"hold_samples\":%llu,\"hold_ns\":%llu,\"hold_max_ns\":%llu,\"hold_p50_ns\":%llu,\"hold_p99_ns\":%llu",
+             lockstat_class_name(s.cls), (unsigned long long)s.acquisitions, (unsigned long long)s.contended,
+             (unsigned long long)s.wait_ns, (unsigned long long)s.wait_max_ns,
+             (unsigned long long)lockstat_quantile_ns(s.wait_hist, 0.99), (unsigned long long)s.hold_samples,
+             (unsigned long long)s.hold_ns,
+             (unsigned long long)s.hold_max_ns, (unsigned long long)lockstat_quantile_ns(s.hold_hist, 0.5),
+             (unsigned long long)lockstat_quantile_ns(s.hold_hist, 0.99));
+    out->append(buf);
+}
+
+void admin_handle_locks(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)req;
+    (void)user;
+    LockStats classes[LOCK_CLASS_COUNT];
+    std::vector<LockStats> sites(LOCK_CLASS_COUNT + LOCKSTAT_MAX_SITES);
+    sites.resize(lockstat_get(classes, &sites[0], (int)sites.size()));
+    std::sort(sites.begin(), sites.end(), [](const LockStats& a, const LockStats& b) {
+        return a.wait_ns != b.wait_ns ? a.wait_ns > b.wait_ns : a.acquisitions > b.acquisitions;
+    });
+
+    std::string& out = resp->body;
+    char buf[64];
+    out.append("{\"bucket_ns\":[");
+    for (int b = 0; b < LOCKSTAT_BUCKETS; b++) {
+        snprintf(buf, sizeof(buf), "%s%llu", b ? "," : "", (unsigned long long)lockstat_bucket_ns(b));
+        out.append(buf);
+    }
+    out.append("],\"classes\":[");
+    for (int c = 0; c < LOCK_CLASS_COUNT; c++) {
+        if (c > 0) out.push_back(',');
+        out.push_back('{');
+        append_lock_stats(&out, classes[c]);
+        out.append(",\"wait_hist\":");
+        append_histogram(&out, classes[c].wait_hist);
+        out.append(",\"hold_hist\":");
+        append_histogram(&out, classes[c].hold_hist);
+        out.push_back('}');
+    }
+    out.append("],\"sites\":[");
+    for (size_t i = 0; i < sites.size(); i++) {
+        if (i > 0) out.push_back(',');
+        out.append("{\"function\":");
+        http_json_string(&out, sites[i].func, strlen(sites[i].func));
+        out.append(",\"file\":");
+        http_json_string(&out, sites[i].file, strlen(sites[i].file));
+        snprintf(buf, sizeof(buf), ",\"line\":%d,", sites[i].line);
+        out.append(buf);
+        append_lock_stats(&out, sites[i]);
+        out.push_back('}');
+    }
+    out.append("]}");
+}
+
+// VmRSS and VmHWM from /proc/self/status, in bytes
+static void read_rss(uint64_t* rss, uint64_t* peak) {
+    *rss = 0;
+    *peak = 0;
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return;
+    char line[256];
+    unsigned long long kb;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %llu kB", &kb) == 1) *rss = kb * 1024;
+        else if (sscanf(line, "VmHWM: %llu kB", &kb) == 1) *peak = kb * 1024;
+    }
+    fclose(f);
+}
+
+// glibc's view of the heap (libyrs allocates through it too)
+static void append_heap(std::string* out) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "{\"arena_bytes\":%zu,\"in_use_bytes\":%zu,\"free_bytes\":%zu,\"mmap_bytes\":%zu,"
+             "\"releasable_bytes\":%zu}",
+             mi.arena, mi.uordblks + mi.hblkhd, mi.fordblks, mi.hblkhd, mi.keepcost);
+    out->append(buf);
+#else
+    out->append("null");
+#endif
+}
+
+void admin_handle_memory(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)req;
+    (void)user;
+    std::vector<Room*> rooms;
+    rooms_for_each(collect_room, &rooms);
+
+    RoomFigures total;
+    memset(&total, 0, sizeof(total));
+    uint64_t doc_bytes = 0;
+    uint64_t tail_updates = 0;
+    uint64_t reply_bytes = 0;
+    for (size_t i = 0; i < rooms.size(); i++) {
+        DocStats d;
+        rooms[i]->doc.get_stats(&d);
+        doc_bytes += (uint64_t)d.base_bytes + d.tail_bytes;
+        tail_updates += d.tail_updates;
+        reply_bytes += d.reply_bytes;
+
+        RoomFigures f;
+        {
+            EpochGuard guard;
+            room_figures(room_members(rooms[i]), &f);
+        }
+        total.members += f.members;
+        total.awareness += f.awareness;
+        total.queued_messages += f.queued_messages;
+        total.queued_bytes += f.queued_bytes;
+        total.awareness_bytes += f.awareness_bytes;
+    }
+
+    uint64_t rss = 0;
+    uint64_t rss_peak = 0;
+    read_rss(&rss, &rss_peak);
+
+    std::string& out = resp->body;
+    char buf[512];
+    snprintf(buf, sizeof(buf), "{\"rss_bytes\":%llu,\"rss_peak_bytes\":%llu,\"heap\":",
+             (unsigned long long)rss, (unsigned long long)rss_peak);
+    out.append(buf);
+    append_heap(&out);
+    snprintf(buf, sizeof(buf),
+             ",\"peers\":%d,\"rooms\":%d,\"members\":%d,\"queued_messages\":%llu,\"queued_bytes\":%llu,"
+             "\"awareness_states\":%d,\"awareness_bytes\":%llu,\"doc_bytes\":%llu,\"tail_updates\":%llu,"
+             "\"reply_bytes\":%llu,\"epoch_pending\":%d}",
+             peers_count(), (int)rooms.size(), total.members, (unsigned long long)total.queued_messages,
+             (unsigned long long)total.queued_bytes, total.awareness, (unsigned long long)total.awareness_bytes,
+             (unsigned long long)doc_bytes, (unsigned long long)tail_updates, (unsigned long long)reply_bytes,
+             epoch_pending());
+    out.append(buf);
+}
+
+// Previous /admin/alloc snapshot for rates; plain handlers all run on the HTTP
+// thread, so no lock
+static AllocStats g_alloc_prev[ALLOC_TAG_COUNT];
+static uint64_t g_alloc_prev_ns = 0;
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+struct DocEstimate {
+    Room* room;
+    uint64_t encoded_bytes;
+    bool materialized;
+    uint64_t estimate_bytes;
+};
+
+void admin_handle_alloc(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)user;
+    int limit = ADMIN_ALLOC_DOC_LIMIT;
+    std::string param;
+    if (http_query_param(req.query, "limit", &param)) {
+        limit = atoi(param.c_str());
+        if (limit < 0) limit = 0;
+    }
+
+    AllocStats tags[ALLOC_TAG_COUNT];
+    allocstat_get(tags);
+    uint64_t now = monotonic_ns();
+    double interval = g_alloc_prev_ns ? (now - g_alloc_prev_ns) / 1e9 : 0.0;
+
+    std::vector<Room*> rooms;
+    rooms_for_each(collect_room, &rooms);
+    std::vector<DocEstimate> docs(rooms.size());
+    uint64_t yrs_bytes = 0;
+    int materialized = 0;
+    for (size_t i = 0; i < rooms.size(); i++) {
+        DocStats d;
+        rooms[i]->doc.get_stats(&d);
+        docs[i].room = rooms[i];
+        docs[i].encoded_bytes = (uint64_t)d.base_bytes + d.tail_bytes;
+        docs[i].materialized = d.materialized;
+        docs[i].estimate_bytes = allocstat_yrs_estimate(docs[i].encoded_bytes, d.materialized);
+        yrs_bytes += docs[i].estimate_bytes;
+        if (d.materialized) materialized++;
+    }
+    std::sort(docs.begin(), docs.end(), [](const DocEstimate& a, const DocEstimate& b) {
+        return a.estimate_bytes != b.estimate_bytes ? a.estimate_bytes > b.estimate_bytes
+                                                    : a.encoded_bytes > b.encoded_bytes;
+    });
+
+    std::string& out = resp->body;
+    char buf[512];
+    out.append("{\"bucket_bytes\":[");
+    for (int b = 0; b < ALLOCSTAT_BUCKETS; b++) {
+        snprintf(buf, sizeof(buf), "%s%llu", b ? "," : "", (unsigned long long)allocstat_bucket_bytes(b));
+        out.append(buf);
+    }
+    snprintf(buf, sizeof(buf), "],\"rate_interval_s\":%.3f,\"tags\":[", interval);
+    out.append(buf);
+
+    int64_t tagged_bytes = 0;
+    for (int t = 0; t < ALLOC_TAG_COUNT; t++) {
+        const AllocStats& s = tags[t];
+        tagged_bytes += s.live_bytes;
+        double allocs_rate = interval > 0 ? (s.allocs - g_alloc_prev[t].allocs) / interval : 0.0;
+        double bytes_rate = interval > 0 ? (s.alloc_bytes - g_alloc_prev[t].alloc_bytes) / interval : 0.0;
+        snprintf(buf, sizeof(buf),
+                 "%s{\"tag\":\"%s\",\"allocs\":%llu,\"frees\":%llu,\"alloc_bytes\":%llu,\"live_bytes\":%lld,"
+                 "\"live_blocks\":%lld,\"allocs_per_s\":%.1f,\"bytes_per_s\":%.1f,\"size_p50_bytes\":%llu,"
+                 "\"size_p99_bytes\":%llu,\"size_hist\":[",
+                 t ? "," : "", allocstat_tag_name(t), (unsigned long long)s.allocs, (unsigned long long)s.frees,
+                 (unsigned long long)s.alloc_bytes, (long long)s.live_bytes, (long long)s.live_blocks,
+                 allocs_rate, bytes_rate, (unsigned long long)allocstat_quantile_bytes(s.size_hist, 0.5),
+                 (unsigned long long)allocstat_quantile_bytes(s.size_hist, 0.99));
+        out.append(buf);
+        for (int b = 0; b < ALLOCSTAT_BUCKETS; b++) {
+            snprintf(buf, sizeof(buf), "%s%llu", b ? "," : "", (unsigned long long)s.size_hist[b]);
+            out.append(buf);
+        }
+        out.append("]}");
+    }
+    memcpy(g_alloc_prev, tags, sizeof(g_alloc_prev));
+    g_alloc_prev_ns = now;
+
+    snprintf(buf, sizeof(buf),
+             "],\"tagged_live_bytes\":%lld,\"yrs\":{\"documents\":%d,\"materialized\":%d,"
+             "\"estimate_bytes\":%llu,\"factor\":%d,\"doc_bytes\":%d,\"top\":[",
+             (long long)tagged_bytes, (int)rooms.size(), materialized, (unsigned long long)yrs_bytes,
+             ALLOCSTAT_YRS_FACTOR, ALLOCSTAT_YRS_DOC_BYTES);
+    out.append(buf);
+    for (size_t i = 0; i < docs.size() && (int)i < limit; i++) {
+        if (i > 0) out.push_back(',');
+        out.append("{\"name\":");
+        http_json_string(&out, docs[i].room->name, strlen(docs[i].room->name));
+        snprintf(buf, sizeof(buf), ",\"encoded_bytes\":%llu,\"materialized\":%s,\"estimate_bytes\":%llu}",
+                 (unsigned long long)docs[i].encoded_bytes, docs[i].materialized ? "true" : "false",
+                 (unsigned long long)docs[i].estimate_bytes);
+        out.append(buf);
+    }
+    out.append("]},\"heap\":");
+    append_heap(&out);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    // Heap in use that neither tags nor the libyrs estimate cover (null when
+    // malloc is interposed, e.g. under a sanitizer, and reports nothing)
+    struct mallinfo2 mi = mallinfo2();
+    size_t in_use = mi.uordblks + mi.hblkhd;
+    if (in_use > 0) {
+        snprintf(buf, sizeof(buf), ",\"untracked_bytes\":%lld}",
+                 (long long)((int64_t)in_use - tagged_bytes - (int64_t)yrs_bytes));
+        out.append(buf);
+    } else {
+        out.append(",\"untracked_bytes\":null}");
+    }
+#else
+    out.append(",\"untracked_bytes\":null}");
+#endif
+}
@@ -0,0 +1,344 @@
+#include "admission.h"
+#include "allocstat.h"
+#include "peer.h"
+#include "room.h"
+#include "epoch.h"
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+// Queued SYNC_STEP1 (owns a copy of the state vector)
+struct Waiter {
+    Peer* peer;
+    Room* room;
+    uint8_t* sv;
+    size_t sv_len;
+    uint64_t queued_ms;
+    int position;           // Queue length including this one at enqueue
+    Waiter* next;
+    Waiter* batch_next;     // Waiters sharing this one's reply
+};
+
+static omp_lock_t g_lock;
+static Waiter* g_head = nullptr;
+static Waiter* g_tail = nullptr;
+static AdmissionLimits g_limits;
+static AdmissionServeFn g_serve = nullptr;
+static AdmissionStats g_stats;
+static uint64_t g_us_per_position = 0;  // Average of recent waits / queue position
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void set_state(Peer* peer, AdmissionState state) {
+    __atomic_store_n(&peer->admission, (uint8_t)state, __ATOMIC_RELEASE);
+}
+
+static bool process_has_slot() {
+    return g_limits.per_process <= 0 || g_stats.active < g_limits.per_process;
+}
+
+static bool room_has_slot(const Room* room) {
+    return g_limits.per_room <= 0 || room->syncs_active < g_limits.per_room;
+}
+
+static void take_slot(Waiter* w) {
+    g_stats.active++;
+    w->room->syncs_active++;
+    set_state(w->peer, ADMISSION_ACTIVE);
+}
+
+static void unlink_waiter(Waiter* prev, Waiter* w) {
+    if (prev) prev->next = w->next;
+    else g_head = w->next;
+    if (g_tail == w) g_tail = prev;
+    w->next = nullptr;
+    w->room->syncs_waiting--;
+    __atomic_sub_fetch(&g_stats.depth, 1, __ATOMIC_RELAXED);
+}
+
+static void record_wait(const Waiter* w, uint64_t now) {
+    uint64_t waited = now - w->queued_ms;
+    g_stats.wait_ms_total += waited;
+    if (waited > g_stats.wait_ms_max) g_stats.wait_ms_max = waited;
+
+    // Moving average (1/8 weight) for the wait estimate given to new joiners
+    uint64_t per_position = waited * 1000 / (uint64_t)(w->position > 0 ? w->position : 1);
+    g_us_per_position = g_us_per_position == 0 ? per_position
+                                               : (g_us_per_position * 7 + per_position) / 8;
+}
+
+static void free_waiter(Waiter* w) {
+    tagged_free(w->sv, ALLOC_PEER);
+    tagged_free(w, ALLOC_PEER);
+}
+
+// Pop every waiter that may run now (caller holds g_lock). Each returned
+// leader holds a slot; its batch_next chain rides along on the same reply.
+static Waiter* collect_ready() {
+    if (!g_head) return nullptr;
+
+    uint64_t now = now_ms();
+    Waiter* ready = nullptr;
+    Waiter** ready_tail = &ready;
+
+    Waiter* prev = nullptr;
+    Waiter* w = g_head;
+    while (w) {
+        bool overdue = g_limits.max_wait_ms > 0 && now - w->queued_ms >= (uint64_t)g_limits.max_wait_ms;
+
+        // FIFO: once the process is full only overdue waiters (all at the head) move
+        if (!overdue && !process_has_slot()) break;
+
+        if (!overdue && !room_has_slot(w->room)) {
+            prev = w;
+            w = w->next;
+            continue;
+        }
+
+        Waiter* leader = w;
+        w = w->next;
+        unlink_waiter(prev, leader);
+        take_slot(leader);
+        record_wait(leader, now);
+        if (overdue) g_stats.overdue++;
+
+        // Same room and same state vector: one reply serves them all
+        Waiter** batch_tail = &leader->batch_next;
+        Waiter* fprev = prev;
+        Waiter* f = w;
+        while (f) {
+            Waiter* fnext = f->next;
+            if (f->room == leader->room && f->sv_len == leader->sv_len &&
+                memcmp(f->sv, leader->sv, f->sv_len) == 0) {
+                if (f == w) w = fnext;
+                unlink_waiter(fprev, f);
+                set_state(f->peer, ADMISSION_DONE);
+                record_wait(f, now);
+                g_stats.shared++;
+                *batch_tail = f;
+                batch_tail = &f->batch_next;
+            } else {
+                fprev = f;
+            }
+            f = fnext;
+        }
+
+        *ready_tail = leader;
+        ready_tail = &leader->next;
+    }
+
+    return ready;
+}
+
+// Serve collected batches (no locks held, caller is in an epoch critical section)
+static void serve_ready(Waiter* ready) {
+    static thread_local std::vector<Peer*> t_batch;
+
+    while (ready) {
+        Waiter* leader = ready;
+        ready = ready->next;
+
+        t_batch.clear();
+        for (Waiter* w = leader; w; w = w->batch_next) {
+            t_batch.push_back(w->peer);
+        }
+        g_serve(t_batch.data(), (int)t_batch.size(), leader->sv, leader->sv_len);
+
+        Waiter* w = leader;
+        while (w) {
+            Waiter* next = w->batch_next;
+            free_waiter(w);
+            w = next;
+        }
+    }
+}
+
+// SYNC queue of an admitted peer drained: its reply is out, free the slot
+static void on_sync_drained(Peer* peer) {
+    if (__atomic_load_n(&peer->admission, __ATOMIC_ACQUIRE) != ADMISSION_ACTIVE) return;
+
+    EpochGuard guard;
+    omp_set_lock(&g_lock);
+    Waiter* ready = nullptr;
+    if (peer->admission == ADMISSION_ACTIVE) {
+        set_state(peer, ADMISSION_DONE);
+        g_stats.active--;
+        peer->room->syncs_active--;
+        ready = collect_ready();
+    }
+    omp_unset_lock(&g_lock);
+
+    serve_ready(ready);
+}
+
+void admission_init(const AdmissionLimits& limits, AdmissionServeFn serve) {
+    omp_init_lock(&g_lock);
+    g_head = nullptr;
+    g_tail = nullptr;
+    g_limits = limits;
+    g_serve = serve;
+    memset(&g_stats, 0, sizeof(g_stats));
+    peers_on_sync_drained(on_sync_drained);
+}
+
+void admission_destroy() {
+    peers_on_sync_drained(nullptr);
+
+    omp_set_lock(&g_lock);
+    Waiter* w = g_head;
+    while (w) {
+        Waiter* next = w->next;
+        free_waiter(w);
+        w = next;
+    }
+    g_head = nullptr;
+    g_tail = nullptr;
+    __atomic_store_n(&g_stats.depth, 0, __ATOMIC_RELAXED);
+    omp_unset_lock(&g_lock);
+    omp_destroy_lock(&g_lock);
+}
+
+void admission_submit(Peer* peer, const uint8_t* sv, size_t sv_len) {
+    Room* room = peer->room;
+
+    omp_set_lock(&g_lock);
+
+    uint8_t state = peer->admission;
+    if (state == ADMISSION_WAITING) {
+        // Repeated SYNC_STEP1 while queued: the queued one answers it
+        omp_unset_lock(&g_lock);
+        return;
+    }
+    if (state == ADMISSION_NONE) {
+        g_stats.requests++;
+
+        // Immediate only if nobody of this room is already waiting (keeps FIFO per room)
+        if (room->syncs_waiting > 0 || !process_has_slot() || !room_has_slot(room)) {
+            Waiter* w = (Waiter*)tagged_calloc(1, sizeof(Waiter), ALLOC_PEER);
+            w->peer = peer;
+            w->room = room;
+            if (sv_len > 0) {
+                w->sv = (uint8_t*)tagged_malloc(sv_len, ALLOC_PEER);
+                memcpy(w->sv, sv, sv_len);
+                w->sv_len = sv_len;
+            }
+            w->queued_ms = now_ms();
+
+            if (g_tail) g_tail->next = w;
+            else g_head = w;
+            g_tail = w;
+            room->syncs_waiting++;
+            set_state(peer, ADMISSION_WAITING);
+
+            g_stats.queued++;
+            __atomic_add_fetch(&g_stats.depth, 1, __ATOMIC_RELAXED);
+            w->position = g_stats.depth;
+            g_stats.position_total += (uint64_t)g_stats.depth;
+            if (g_stats.depth > g_stats.position_max) g_stats.position_max = g_stats.depth;
+
+            omp_unset_lock(&g_lock);
+            return;
+        }
+
+        g_stats.active++;
+        room->syncs_active++;
+        g_stats.admitted_now++;
+        set_state(peer, ADMISSION_ACTIVE);
+    }
+
+    omp_unset_lock(&g_lock);
+
+    // Admitted now, or a re-sync of an already synced peer
+    g_serve(&peer, 1, sv, sv_len);
+}
+
+void admission_cancel(Peer* peer) {
+    if (__atomic_load_n(&peer->admission, __ATOMIC_ACQUIRE) == ADMISSION_NONE) return;
+
+    EpochGuard guard;
+    omp_set_lock(&g_lock);
+
+    Waiter* ready = nullptr;
+    if (peer->admission == ADMISSION_WAITING) {
+        Waiter* prev = nullptr;
+        Waiter* w = g_head;
+        while (w && w->peer != peer) {
+            prev = w;
+            w = w->next;
+        }
+        if (w) {
+            unlink_waiter(prev, w);
+            free_waiter(w);
+            g_stats.cancelled++;
+        }
+    } else if (peer->admission == ADMISSION_ACTIVE) {
+        g_stats.active--;
+        peer->room->syncs_active--;
+        ready = collect_ready();
+    }
+    set_state(peer, ADMISSION_NONE);
+
+    omp_unset_lock(&g_lock);
+
+    serve_ready(ready);
+}
+
+void admission_tick() {
+    if (__atomic_load_n(&g_stats.depth, __ATOMIC_RELAXED) == 0) return;
+
+    EpochGuard guard;
+    omp_set_lock(&g_lock);
+    Waiter* ready = collect_ready();
+    omp_unset_lock(&g_lock);
+
+    serve_ready(ready);
+}
+
+int admission_queue_depth() {
+    return __atomic_load_n(&g_stats.depth, __ATOMIC_RELAXED);
+}
+
+int admission_join_position(const Room* room, int* wait_ms) {
+    omp_set_lock(&g_lock);
+    int position = 0;
+    *wait_ms = 0;
+    // Same test as admission_submit
+    if ((room && (room->syncs_waiting > 0 || !room_has_slot(room))) || !process_has_slot()) {
+        position = g_stats.depth + 1;
+        uint64_t ms = g_us_per_position * (uint64_t)position / 1000;
+        if (g_limits.max_wait_ms > 0 && ms > (uint64_t)g_limits.max_wait_ms) ms = (uint64_t)g_limits.max_wait_ms;
+        *wait_ms = (int)ms;
+    }
+    omp_unset_lock(&g_lock);
+    return position;
+}
+
+void admission_get_stats(AdmissionStats* out) {
+    omp_set_lock(&g_lock);
+    *out = g_stats;
+    omp_unset_lock(&g_lock);
+}
+
+void admission_print_stats() {
+    AdmissionStats s;
+    admission_get_stats(&s);
+    if (s.requests == 0) return;
+
+    printf("[Admission] Initial syncs: %llu (%llu immediate, %llu queued, %llu shared reply, "
+           "%llu overdue, %llu cancelled)\n",
+           (unsigned long long)s.requests, (unsigned long long)s.admitted_now,
+           (unsigned long long)s.queued, (unsigned long long)s.shared,
+           (unsigned long long)s.overdue, (unsigned long long)s.cancelled);
+    if (s.queued > 0) {
+        printf("[Admission] Queue position avg %.1f max %d, wait avg %.1f ms max %llu ms\n",
+               (double)s.position_total / s.queued, s.position_max,
+               (double)s.wait_ms_total / s.queued, (unsigned long long)s.wait_ms_max);
+    }
+}
@@ -0,0 +1,164 @@
+#include "allocstat.h"
+#include "threadstat.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+struct TagCounters {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t alloc_bytes;
+    uint64_t free_bytes;
+    uint64_t size_hist[ALLOCSTAT_BUCKETS];
+};
+
+// Per-thread table (threadstat.h)
+struct AllocThreadCounters {
+    TagCounters tags[ALLOC_TAG_COUNT];
+    int owned;
+    AllocThreadCounters* next;
+};
+
+static AllocThreadCounters* g_threads = nullptr;
+
+static const char* TAG_NAMES[ALLOC_TAG_COUNT] = {
+    "peer", "queue", "frame", "awareness", "protocol", "snapshot", "persistence"
+};
+
+#if !defined(CRDT_NO_ALLOCSTAT)
+static thread_local AllocThreadCounters* t_counters = nullptr;
+static thread_local ThreadStatOwner t_owner;
+
+static void release_counters() {
+    threadstat_release(t_counters);
+    t_counters = nullptr;
+}
+
+static AllocThreadCounters* get_counters() {
+    if (!t_counters) {
+        t_counters = threadstat_attach(&g_threads);
+        t_owner.release = release_counters;
+    }
+    return t_counters;
+}
+
+static int bucket_of(size_t size) {
+    return threadstat_bucket(size, 5, ALLOCSTAT_BUCKETS);
+}
+
+static void count_alloc(void* ptr, size_t requested, AllocTag tag) {
+    TagCounters* c = &get_counters()->tags[tag];
+    threadstat_bump(&c->allocs, 1);
+    threadstat_bump(&c->alloc_bytes, malloc_usable_size(ptr));
+    threadstat_bump(&c->size_hist[bucket_of(requested)], 1);
+}
+
+static void count_free(size_t usable, AllocTag tag) {
+    TagCounters* c = &get_counters()->tags[tag];
+    threadstat_bump(&c->frees, 1);
+    threadstat_bump(&c->free_bytes, usable);
+}
+
+void* tagged_malloc(size_t size, AllocTag tag) {
+    void* ptr = malloc(size);
+    if (ptr) count_alloc(ptr, size, tag);
+    return ptr;
+}
+
+void* tagged_calloc(size_t n, size_t size, AllocTag tag) {
+    void* ptr = calloc(n, size);
+    if (ptr) count_alloc(ptr, n * size, tag);
+    return ptr;
+}
+
+void* tagged_realloc(void* ptr, size_t size, AllocTag tag) {
+    // realloc(ptr, 0) may free ptr and return nullptr; make it always a free
+    if (size == 0 && ptr) {
+        tagged_free(ptr, tag);
+        return nullptr;
+    }
+    size_t old = ptr ? malloc_usable_size(ptr) : 0;
+    void* next = realloc(ptr, size);
+    if (!next) return nullptr;
+    // A resize is one free and one allocation, so growth shows in the rate
+    if (ptr) count_free(old, tag);
+    count_alloc(next, size, tag);
+    return next;
+}
+
+void tagged_free(void* ptr, AllocTag tag) {
+    if (!ptr) return;
+    count_free(malloc_usable_size(ptr), tag);
+    free(ptr);
+}
+
+void tagged_adopt(void* ptr, AllocTag tag) {
+    if (ptr) count_alloc(ptr, malloc_usable_size(ptr), tag);
+}
+#endif
+
+const char* allocstat_tag_name(int tag) {
+    return tag >= 0 && tag < ALLOC_TAG_COUNT ? TAG_NAMES[tag] : "unknown";
+}
+
+uint64_t allocstat_bucket_bytes(int bucket) {
+    return 32ull << bucket;
+}
+
+uint64_t allocstat_quantile_bytes(const uint64_t* hist, double q) {
+    uint64_t total = 0;
+    for (int b = 0; b < ALLOCSTAT_BUCKETS; b++) total += hist[b];
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < ALLOCSTAT_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) return allocstat_bucket_bytes(b);
+    }
+    return allocstat_bucket_bytes(ALLOCSTAT_BUCKETS - 1);
+}
+
+void allocstat_get(AllocStats tags[ALLOC_TAG_COUNT]) {
+    memset(tags, 0, sizeof(AllocStats) * ALLOC_TAG_COUNT);
+    for (int tag = 0; tag < ALLOC_TAG_COUNT; tag++) tags[tag].tag = tag;
+
+    for (AllocThreadCounters* t = __atomic_load_n(&g_threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+        for (int tag = 0; tag < ALLOC_TAG_COUNT; tag++) {
+            const TagCounters* c = &t->tags[tag];
+            AllocStats* out = &tags[tag];
+            out->allocs += __atomic_load_n(&c->allocs, __ATOMIC_RELAXED);
+            out->frees += __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+            out->alloc_bytes += __atomic_load_n(&c->alloc_bytes, __ATOMIC_RELAXED);
+            out->free_bytes += __atomic_load_n(&c->free_bytes, __ATOMIC_RELAXED);
+            for (int b = 0; b < ALLOCSTAT_BUCKETS; b++) {
+                out->size_hist[b] += __atomic_load_n(&c->size_hist[b], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    for (int tag = 0; tag < ALLOC_TAG_COUNT; tag++) {
+        tags[tag].live_bytes = (int64_t)(tags[tag].alloc_bytes - tags[tag].free_bytes);
+        tags[tag].live_blocks = (int64_t)(tags[tag].allocs - tags[tag].frees);
+    }
+}
+
+uint64_t allocstat_yrs_estimate(uint64_t encoded_bytes, bool materialized) {
+    if (!materialized) return 0;
+    return ALLOCSTAT_YRS_DOC_BYTES + ALLOCSTAT_YRS_FACTOR * encoded_bytes;
+}
+
+void allocstat_print_stats() {
+    AllocStats tags[ALLOC_TAG_COUNT];
+    allocstat_get(tags);
+
+    for (int tag = 0; tag < ALLOC_TAG_COUNT; tag++) {
+        const AllocStats& s = tags[tag];
+        if (s.allocs == 0) continue;
+        printf("[Alloc] %s: %llu allocations, %.1f MB total; live %.1f KB in %lld blocks; "
+               "size p50 < %llu B, p99 < %llu B\n",
+               allocstat_tag_name(tag), (unsigned long long)s.allocs, s.alloc_bytes / 1048576.0,
+               s.live_bytes / 1024.0, (long long)s.live_blocks,
+               (unsigned long long)allocstat_quantile_bytes(s.size_hist, 0.5),
+               (unsigned long long)allocstat_quantile_bytes(s.size_hist, 0.99));
+    }
+}
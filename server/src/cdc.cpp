@@ -0,0 +1,341 @@
+#include "cdc.h"
+#include "allocstat.h"
+#include "room.h"
+#include "ws_frame.h"
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+
+#define CDC_DEFAULT_BATCH_MS 50
+#define CDC_MAX_BATCH_MS 1000
+#define CDC_BATCH_BYTES (256 * 1024)    // Record bytes copied per batch
+#define CDC_HEARTBEAT_MS 10000
+
+struct CdcRecord {
+    uint64_t seq;
+    uint64_t room_seq;
+    uint64_t ts_ms;             // Wall clock at apply
+    Room* room;
+    uint8_t type;               // CdcRecordType
+    uint32_t len;
+    uint8_t data[1];            // Update bytes or delta JSON
+};
+
+static omp_lock_t g_lock;       // Guards the log (leaf, taken under Document locks)
+static std::deque<CdcRecord*> g_log;
+static std::vector<uint64_t> g_room_seq;    // Last sequence per room id
+static uint64_t g_next_seq = 1;
+static size_t g_bytes = 0;
+static size_t g_budget = 0;
+static uint64_t g_evicted = 0;
+static std::atomic<int> g_consumers(0);
+
+static uint64_t wall_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void append(Room* room, CdcRecordType type, const uint8_t* data, size_t len) {
+    CdcRecord* r = (CdcRecord*)tagged_malloc(sizeof(CdcRecord) + len, ALLOC_PERSISTENCE);
+    r->ts_ms = wall_ms();
+    r->room = room;
+    r->type = (uint8_t)type;
+    r->len = (uint32_t)len;
+    memcpy(r->data, data, len);
+
+    omp_set_lock(&g_lock);
+    if (room->id >= g_room_seq.size()) g_room_seq.resize(room->id + 1, 0);
+    r->seq = g_next_seq++;
+    r->room_seq = ++g_room_seq[room->id];
+    g_log.push_back(r);
+    g_bytes += sizeof(CdcRecord) + len;
+
+    // Keep the newest records; consumers behind the head get cursor_expired
+    while (g_bytes > g_budget && g_log.size() > 1) {
+        CdcRecord* old = g_log.front();
+        g_log.pop_front();
+        g_bytes -= sizeof(CdcRecord) + old->len;
+        g_evicted++;
+        tagged_free(old, ALLOC_PERSISTENCE);
+    }
+    omp_unset_lock(&g_lock);
+}
+
+static void on_update(Room* room, const uint8_t* update, uint32_t len) {
+    append(room, CDC_UPDATE, update, len);
+}
+
+// Scalar attribute values as JSON (nested values are reported as null)
+static void output_json(std::string* out, const YOutput* value) {
+    if (!value) {
+        out->append("null");
+        return;
+    }
+    char buf[32];
+    switch (value->tag) {
+        case Y_JSON_STR: {
+            const char* s = youtput_read_string(value);
+            http_json_string(out, s ? s : "", s ? strlen(s) : 0);
+            break;
+        }
+        case Y_JSON_BOOL: {
+            const uint8_t* b = youtput_read_bool(value);
+            out->append(b && *b ? "true" : "false");
+            break;
+        }
+        case Y_JSON_INT: {
+            const int64_t* n = youtput_read_long(value);
+            snprintf(buf, sizeof(buf), "%lld", n ? (long long)*n : 0LL);
+            out->append(buf);
+            break;
+        }
+        case Y_JSON_NUM: {
+            const double* n = youtput_read_float(value);
+            snprintf(buf, sizeof(buf), "%.17g", n ? *n : 0.0);
+            out->append(buf);
+            break;
+        }
+        default:
+            out->append("null");
+            break;
+    }
+}
+
+// Serialize now: the delta is only valid inside the observer. Lengths stay in
+// the YDoc's offset unit (UTF-8 bytes), as search and render mirror them
+static void on_text(Room* room, const YDelta* delta, uint32_t len) {
+    static thread_local std::string t_json;
+    std::string& out = t_json;
+    out.clear();
+    out.push_back('[');
+    char buf[48];
+    for (uint32_t i = 0; i < len; i++) {
+        const YDelta& d = delta[i];
+        if (i > 0) out.push_back(',');
+        if (d.tag == Y_EVENT_CHANGE_ADD) {
+            out.append("{\"insert\":");
+            const char* s = d.insert && d.insert->tag == Y_JSON_STR ? youtput_read_string(d.insert) : nullptr;
+            if (s) http_json_string(&out, s, strlen(s));
+            else out.append("null");     // Embed
+        } else if (d.tag == Y_EVENT_CHANGE_DELETE) {
+            snprintf(buf, sizeof(buf), "{\"delete\":%u", d.len);
+            out.append(buf);
+        } else {
+            snprintf(buf, sizeof(buf), "{\"retain\":%u", d.len);
+            out.append(buf);
+        }
+        if (d.attributes_len > 0) {
+            out.append(",\"attributes\":{");
+            for (uint32_t a = 0; a < d.attributes_len; a++) {
+                if (a > 0) out.push_back(',');
+                const char* key = d.attributes[a].key;
+                http_json_string(&out, key, strlen(key));
+                out.push_back(':');
+                output_json(&out, d.attributes[a].value);
+            }
+            out.push_back('}');
+        }
+        out.push_back('}');
+    }
+    out.push_back(']');
+
+    append(room, CDC_TEXT, (const uint8_t*)out.data(), out.size());
+}
+
+void cdc_init(size_t buffer_bytes) {
+    omp_init_lock(&g_lock);
+    g_next_seq = 1;
+    g_bytes = 0;
+    g_budget = buffer_bytes;
+    g_evicted = 0;
+    rooms_add_update_observer(on_update);
+    rooms_add_text_observer(on_text);
+    printf("[CDC] Change feed enabled (%zu MiB buffer)\n", buffer_bytes >> 20);
+}
+
+void cdc_destroy() {
+    omp_set_lock(&g_lock);
+    while (!g_log.empty()) {
+        tagged_free(g_log.front(), ALLOC_PERSISTENCE);
+        g_log.pop_front();
+    }
+    g_room_seq.clear();
+    g_bytes = 0;
+    omp_unset_lock(&g_lock);
+    omp_destroy_lock(&g_lock);
+}
+
+void cdc_get_stats(CdcStats* out) {
+    omp_set_lock(&g_lock);
+    out->records = g_next_seq - 1;
+    out->evicted = g_evicted;
+    out->oldest = g_log.empty() ? 0 : g_log.front()->seq;
+    out->newest = g_next_seq - 1;
+    out->bytes = g_bytes;
+    omp_unset_lock(&g_lock);
+    out->consumers = g_consumers.load();
+}
+
+// Record copied out of the log for encoding without the lock
+struct BatchEntry {
+    uint64_t seq;
+    uint64_t room_seq;
+    uint64_t ts_ms;
+    Room* room;
+    uint8_t type;
+    size_t offset;              // Into the batch data buffer
+    uint32_t len;
+};
+
+enum CollectResult {
+    COLLECT_OK,
+    COLLECT_FULL,               // Hit CDC_BATCH_BYTES, more is waiting
+    COLLECT_EXPIRED             // *next fell off the head of the log
+};
+
+static CollectResult collect(uint64_t* next, const std::string& room_filter,
+                             std::vector<BatchEntry>* entries, std::vector<uint8_t>* data) {
+    entries->clear();
+    data->clear();
+
+    omp_set_lock(&g_lock);
+    uint64_t first = g_log.empty() ? g_next_seq : g_log.front()->seq;
+    if (*next < first) {
+        omp_unset_lock(&g_lock);
+        return COLLECT_EXPIRED;
+    }
+
+    CollectResult result = COLLECT_OK;
+    for (size_t i = (size_t)(*next - first); i < g_log.size(); i++) {
+        if (data->size() >= CDC_BATCH_BYTES) {
+            result = COLLECT_FULL;
+            break;
+        }
+        const CdcRecord* r = g_log[i];
+        *next = r->seq + 1;
+        if (!room_filter.empty() && room_filter != r->room->name) continue;
+
+        BatchEntry e = { r->seq, r->room_seq, r->ts_ms, r->room, r->type, data->size(), r->len };
+        entries->push_back(e);
+        data->insert(data->end(), r->data, r->data + r->len);
+    }
+    omp_unset_lock(&g_lock);
+    return result;
+}
+
+static void encode_batch(const std::vector<BatchEntry>& entries, const std::vector<uint8_t>& data,
+                         std::string* out) {
+    static thread_local std::vector<char> t_base64;
+    char buf[160];
+
+    out->clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        const BatchEntry& e = entries[i];
+        snprintf(buf, sizeof(buf), "{\"seq\":%llu,\"room_seq\":%llu,\"ts\":%llu,\"room\":",
+                 (unsigned long long)e.seq, (unsigned long long)e.room_seq, (unsigned long long)e.ts_ms);
+        out->append(buf);
+        http_json_string(out, e.room->name, strlen(e.room->name));
+
+        const uint8_t* payload = data.data() + e.offset;
+        if (e.type == CDC_UPDATE) {
+            t_base64.resize((e.len + 2) / 3 * 4 + 1);
+            size_t n = ws_base64_encode(payload, e.len, t_base64.data());
+            out->append(",\"type\":\"update\",\"update\":\"");
+            out->append(t_base64.data(), n);
+            out->append("\"}\n");
+        } else {
+            out->append(",\"type\":\"text\",\"delta\":");
+            out->append((const char*)payload, e.len);
+            out->append("}\n");
+        }
+    }
+}
+
+// hello also names the unit of delta lengths (see CDC_TEXT)
+static bool write_control(HttpStream* stream, const char* type, uint64_t cursor) {
+    CdcStats s;
+    cdc_get_stats(&s);
+    bool hello = strcmp(type, "hello") == 0;
+    char line[192];
+    int n = snprintf(line, sizeof(line), "{\"type\":\"%s\",\"cursor\":%llu,\"oldest\":%llu,\"newest\":%llu%s}\n",
+                     type, (unsigned long long)cursor, (unsigned long long)s.oldest,
+                     (unsigned long long)s.newest, hello ? ",\"offsets\":\"utf8\"" : "");
+    return http_stream_write(stream, line, (size_t)n);
+}
+
+void cdc_handle_stream(const HttpRequest& req, HttpStream* stream, void* user) {
+    (void)user;
+    std::string param;
+    std::string room_filter;
+    http_query_param(req.query, "room", &room_filter);
+
+    int batch_ms = CDC_DEFAULT_BATCH_MS;
+    if (http_query_param(req.query, "batch_ms", &param)) {
+        batch_ms = atoi(param.c_str());
+        if (batch_ms < 1) batch_ms = 1;
+        if (batch_ms > CDC_MAX_BATCH_MS) batch_ms = CDC_MAX_BATCH_MS;
+    }
+
+    // Cursor = last sequence the consumer has processed
+    uint64_t next;
+    if (http_query_param(req.query, "cursor", &param)) {
+        next = strtoull(param.c_str(), nullptr, 10) + 1;
+    } else {
+        omp_set_lock(&g_lock);
+        next = g_next_seq;
+        omp_unset_lock(&g_lock);
+    }
+    uint64_t cursor = next - 1;
+
+    std::vector<BatchEntry> entries;
+    std::vector<uint8_t> data;
+    std::string out;
+
+    // Check the cursor before committing to a 200
+    CollectResult result = collect(&next, room_filter, &entries, &data);
+    if (result == COLLECT_EXPIRED) {
+        http_stream_begin(stream, 410, "application/x-ndjson");
+        write_control(stream, "cursor_expired", cursor);
+        return;
+    }
+    if (!http_stream_begin(stream, 200, "application/x-ndjson")) return;
+
+    g_consumers++;
+    write_control(stream, "hello", cursor);
+
+    uint64_t last_write = now_ms();
+    while (http_stream_running(stream)) {
+        if (!entries.empty()) {
+            encode_batch(entries, data, &out);
+            if (!http_stream_write(stream, out.data(), out.size())) break;
+            last_write = now_ms();
+        } else if (now_ms() - last_write >= CDC_HEARTBEAT_MS) {
+            if (!write_control(stream, "heartbeat", next - 1)) break;
+            last_write = now_ms();
+        }
+
+        // Small updates accumulate for one batch window; a full batch goes out at once
+        if (result != COLLECT_FULL) usleep(batch_ms * 1000);
+
+        result = collect(&next, room_filter, &entries, &data);
+        if (result == COLLECT_EXPIRED) {
+            write_control(stream, "cursor_expired", next - 1);
+            break;
+        }
+    }
+    g_consumers--;
+}
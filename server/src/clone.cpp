@@ -0,0 +1,103 @@
+#include "clone.h"
+#include "room.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+
+static std::atomic<uint64_t> g_clones(0);
+static std::atomic<uint64_t> g_uploads(0);
+
+CloneResult clone_room(const char* from, const char* to) {
+    Room* source = rooms_find(from);
+    if (!source) return CLONE_NO_SOURCE;
+    if (rooms_find(to)) return CLONE_EXISTS;
+
+    DocSnapshot* snapshot = source->doc.share_snapshot();
+    Room* room = rooms_clone(to, snapshot);
+    doc_snapshot_release(snapshot);
+    if (!room) return rooms_find(to) ? CLONE_EXISTS : CLONE_LIMIT;
+
+    g_clones++;
+    return CLONE_OK;
+}
+
+CloneResult clone_from_snapshot(const uint8_t* state, size_t len, const char* to) {
+    if (len == 0 || len > UINT32_MAX) return CLONE_INVALID;
+    if (rooms_find(to)) return CLONE_EXISTS;
+
+    // Decodes the whole update, so a malformed one is refused before it is shared
+    uint32_t sv_len = 0;
+    char* sv = yencode_state_vector_from_update_v1((const char*)state, (uint32_t)len, &sv_len);
+    if (!sv) return CLONE_INVALID;
+    ybinary_destroy(sv, sv_len);
+
+    uint8_t* copy = (uint8_t*)malloc(len);
+    memcpy(copy, state, len);
+    DocSnapshot* snapshot = doc_snapshot_create(copy, (uint32_t)len);
+    Room* room = rooms_clone(to, snapshot);
+    doc_snapshot_release(snapshot);
+    if (!room) return rooms_find(to) ? CLONE_EXISTS : CLONE_LIMIT;
+
+    g_uploads++;
+    return CLONE_OK;
+}
+
+void clone_get_stats(CloneStats* out) {
+    out->clones = g_clones.load();
+    out->uploads = g_uploads.load();
+}
+
+void clone_handle_http(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)user;
+    std::string from;
+    std::string to;
+    if (!http_query_param(req.query, "to", &to) || to.empty()) {
+        resp->status = 400;
+        resp->body = "{\"error\":\"missing to\"}";
+        return;
+    }
+
+    CloneResult result;
+    if (http_query_param(req.query, "from", &from)) {
+        result = clone_room(from.c_str(), to.c_str());
+    } else {
+        result = clone_from_snapshot(req.body, req.body_len, to.c_str());
+    }
+
+    switch (result) {
+        case CLONE_OK:
+            break;
+        case CLONE_NO_SOURCE:
+            resp->status = 404;
+            resp->body = "{\"error\":\"no such source room\"}";
+            return;
+        case CLONE_EXISTS:
+            resp->status = 409;
+            resp->body = "{\"error\":\"room exists\"}";
+            return;
+        case CLONE_INVALID:
+            resp->status = 400;
+            resp->body = "{\"error\":\"body is not a v1 update\"}";
+            return;
+        case CLONE_LIMIT:
+            resp->status = 503;
+            resp->body = "{\"error\":\"room limit reached\"}";
+            return;
+    }
+
+    // A fresh clone hands back the snapshot it shares
+    Room* room = rooms_find(to.c_str());
+    DocSnapshot* snapshot = room->doc.share_snapshot();
+    uint32_t shared_bytes = snapshot ? snapshot->len : 0;
+    doc_snapshot_release(snapshot);
+
+    char buf[96];
+    resp->status = 201;
+    resp->body = "{\"room\":";
+    http_json_string(&resp->body, room->name, strlen(room->name));
+    snprintf(buf, sizeof(buf), ",\"id\":%u,\"bytes\":%u,\"materialized\":%s}", room->id, shared_bytes,
+             room->doc.is_materialized() ? "true" : "false");
+    resp->body += buf;
+}
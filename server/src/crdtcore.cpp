@@ -0,0 +1,118 @@
+#include "crdtcore.h"
+#include "room.h"
+#include "peer.h"
+#include "epoch.h"
+#include <stdlib.h>
+
+// C handles are the core's own objects
+static Room* to_room(crdt_room* room) { return reinterpret_cast<Room*>(room); }
+static crdt_room* to_handle(Room* room) { return reinterpret_cast<crdt_room*>(room); }
+
+static bool g_initialized = false;   // Checked by every call that takes a room
+
+// Listener user data for a C subscription
+struct CoreSubscription {
+    crdt_update_cb cb;
+    void* user;
+};
+
+static void on_room_update(Room* room, const uint8_t* update, size_t len, void* user) {
+    CoreSubscription* sub = (CoreSubscription*)user;
+    sub->cb(to_handle(room), update, len, sub->user);
+}
+
+// Shutdown: subscriptions still registered are freed with their room
+static void free_room_subscriptions(Room* room, void* user) {
+    (void)user;
+    RoomListenerSet* set = room->listeners;
+    for (int i = 0; set && i < set->count; i++) {
+        if (set->items[i].fn == on_room_update) free(set->items[i].user);
+    }
+}
+
+int crdt_api_version(void) {
+    return CRDTCORE_API_VERSION;
+}
+
+int crdt_init(const char* shared_type) {
+    if (g_initialized) return CRDT_ERR_STATE;
+
+    epoch_init();
+    peers_init();
+    rooms_init(shared_type ? shared_type : "quill");
+    g_initialized = true;
+    return CRDT_OK;
+}
+
+void crdt_shutdown(void) {
+    if (!g_initialized) return;
+
+    rooms_for_each(free_room_subscriptions, nullptr);
+    peers_destroy();
+    epoch_destroy();
+    rooms_destroy();
+    g_initialized = false;
+}
+
+crdt_room* crdt_room_get(const char* name) {
+    if (!g_initialized || !name) return nullptr;
+    return to_handle(rooms_get(name));
+}
+
+const char* crdt_room_name(const crdt_room* room) {
+    return g_initialized && room ? reinterpret_cast<const Room*>(room)->name : nullptr;
+}
+
+int crdt_room_apply_update(crdt_room* room, const uint8_t* update, size_t len) {
+    if (!g_initialized || !room || !update || len == 0) return CRDT_ERR_INVALID;
+
+    Room* r = to_room(room);
+    uint8_t* v1 = nullptr;      // Set for a v2 update: subscribers take v1
+    size_t v1_len = 0;
+    if (!r->doc.apply_update(update, len, &v1, &v1_len)) return CRDT_ERR_APPLY;
+    room_publish_update(r, v1 ? v1 : update, v1 ? v1_len : len);
+    free(v1);
+    return CRDT_OK;
+}
+
+uint8_t* crdt_room_snapshot(crdt_room* room, size_t* out_len) {
+    if (!g_initialized || !room || !out_len) return nullptr;
+    return to_room(room)->doc.get_state_as_update(out_len);
+}
+
+uint8_t* crdt_room_state_vector(crdt_room* room, size_t* out_len) {
+    if (!g_initialized || !room || !out_len) return nullptr;
+    return to_room(room)->doc.get_state_vector(out_len);
+}
+
+uint8_t* crdt_room_diff(crdt_room* room, const uint8_t* sv, size_t sv_len, size_t* out_len) {
+    if (!g_initialized || !room || !out_len || (!sv && sv_len > 0)) return nullptr;
+    return to_room(room)->doc.get_state_diff(sv, sv_len, out_len);
+}
+
+char* crdt_room_text(crdt_room* room) {
+    if (!g_initialized || !room) return nullptr;
+    return to_room(room)->doc.get_text_content();
+}
+
+uint64_t crdt_room_subscribe(crdt_room* room, crdt_update_cb cb, void* user) {
+    if (!g_initialized || !room || !cb) return 0;
+
+    CoreSubscription* sub = (CoreSubscription*)malloc(sizeof(CoreSubscription));
+    sub->cb = cb;
+    sub->user = user;
+    return room_add_listener(to_room(room), on_room_update, sub);
+}
+
+int crdt_room_unsubscribe(crdt_room* room, uint64_t subscription) {
+    if (!g_initialized || !room) return CRDT_ERR_INVALID;
+
+    void* sub = nullptr;
+    if (!room_remove_listener(to_room(room), subscription, &sub)) return CRDT_ERR_INVALID;
+    epoch_retire(sub, free);
+    return CRDT_OK;
+}
+
+void crdt_free(void* ptr) {
+    free(ptr);
+}
@@ -1,19 +1,105 @@
 #include "document.h"
+#include "allocstat.h"
+#include "protocol.h"
+#include "epoch.h"
+#include "trace.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
 
-Document::Document() : m_doc(nullptr), m_text(nullptr) {}
+DocSnapshot* doc_snapshot_create(uint8_t* data, uint32_t len) {
+    DocSnapshot* snapshot = (DocSnapshot*)tagged_malloc(sizeof(DocSnapshot), ALLOC_SNAPSHOT);
+    tagged_adopt(data, ALLOC_SNAPSHOT);
+    snapshot->refs = 1;
+    snapshot->data = data;
+    snapshot->len = len;
+    return snapshot;
+}
+
+void doc_snapshot_retain(DocSnapshot* snapshot) {
+    __atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_RELAXED);
+}
+
+void doc_snapshot_release(DocSnapshot* snapshot) {
+    if (snapshot && __atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        tagged_free(snapshot->data, ALLOC_SNAPSHOT);
+        tagged_free(snapshot, ALLOC_SNAPSHOT);
+    }
+}
+
+// Free a read view generation: its base state and every tail node appended to it
+static void free_base(void* ptr) {
+    DocBase* base = (DocBase*)ptr;
+    DocTailUpdate* u = base->newest;
+    while (u) {
+        DocTailUpdate* prev = u->prev;
+        tagged_free(u->data, ALLOC_SNAPSHOT);
+        tagged_free(u, ALLOC_SNAPSHOT);
+        u = prev;
+    }
+    doc_snapshot_release(base->snapshot);
+    tagged_free(base, ALLOC_SNAPSHOT);
+}
+
+static void free_view(void* ptr) {
+    tagged_free(ptr, ALLOC_SNAPSHOT);
+}
+
+// Retire a replaced generation (after the document locks are dropped: retiring
+// may reclaim, and that work does not belong inside the writer's critical section)
+static void retire_generation(DocReadView* old) {
+    if (!old) return;
+    epoch_retire(old->base, free_base);
+    epoch_retire(old, free_view);
+}
+
+Document::Document()
+    : m_doc(nullptr), m_text(nullptr), m_shared_type(nullptr), m_pending(nullptr),
+      m_text_observer(nullptr), m_text_observer_user(nullptr),
+      m_text_sub(nullptr), m_update_observer(nullptr), m_update_observer_user(nullptr),
+      m_update_sub(nullptr), m_view(nullptr), m_version(0), m_applies(0), m_apply_ns_last(0),
+      m_apply_ns_max(0), m_apply_ns_total(0), m_reply_count(0),
+      m_reply_hits(0), m_reply_misses(0) {
+    memset(m_replies, 0, sizeof(m_replies));
+    omp_init_lock(&m_lock);
+    omp_init_lock(&m_view_lock);
+    omp_init_lock(&m_compact_lock);
+    omp_init_lock(&m_reply_lock);
+}
 
 Document::~Document() {
+    clear_replies();
+    if (m_view) {
+        free_base(m_view->base);
+        free_view(m_view);
+        m_view = nullptr;
+    }
+    if (m_text_sub) {
+        yunobserve(m_text_sub);
+        m_text_sub = nullptr;
+    }
+    if (m_update_sub) {
+        yunobserve(m_update_sub);
+        m_update_sub = nullptr;
+    }
     if (m_doc) {
         ydoc_destroy(m_doc);
-        m_doc = nullptr;
+        __atomic_store_n(&m_doc, (YDoc*)nullptr, __ATOMIC_RELEASE);
         m_text = nullptr;
     }
+    doc_snapshot_release(m_pending);
+    free(m_shared_type);
+    omp_destroy_lock(&m_reply_lock);
+    omp_destroy_lock(&m_compact_lock);
+    omp_destroy_lock(&m_view_lock);
+    omp_destroy_lock(&m_lock);
 }
 
 bool Document::init(const char* shared_type_name) {
-    m_doc = ydoc_new();
+    __atomic_store_n(&m_doc, ydoc_new(), __ATOMIC_RELEASE);
     if (!m_doc) {
         fprintf(stderr, "[Document] Failed to create YDoc\n");
         return false;
@@ -23,79 +109,480 @@ bool Document::init(const char* shared_type_name) {
     if (!m_text) {
         fprintf(stderr, "[Document] Failed to create YText with name '%s'\n", shared_type_name);
         ydoc_destroy(m_doc);
-        m_doc = nullptr;
+        __atomic_store_n(&m_doc, (YDoc*)nullptr, __ATOMIC_RELEASE);
         return false;
     }
 
+    // First read view generation
+    omp_set_lock(&m_lock);
+    uint32_t state_len = 0;
+    uint8_t* state = encode_live_state(&state_len);
+    omp_set_lock(&m_view_lock);
+    DocReadView* old = publish_base_locked(state, state_len, version());
+    omp_unset_lock(&m_view_lock);
+    omp_unset_lock(&m_lock);
+    retire_generation(old);
+
     printf("[Document] Initialized with shared type '%s'\n", shared_type_name);
     return true;
 }
 
+bool Document::init_from_snapshot(const char* shared_type_name, DocSnapshot* snapshot) {
+    if (!snapshot) return init(shared_type_name);
+
+    m_shared_type = strdup(shared_type_name);
+    doc_snapshot_retain(snapshot);
+    m_pending = snapshot;
+
+    omp_set_lock(&m_view_lock);
+    DocReadView* old = publish_snapshot_locked(snapshot, version());
+    omp_unset_lock(&m_view_lock);
+    retire_generation(old);
+    return true;
+}
+
+// Build the live YDoc from the pending snapshot (caller holds m_lock). Observers
+// are subscribed first, so they see the copied state as one initial change.
+bool Document::materialize_locked() {
+    if (m_doc) return true;
+    if (!m_pending) return false;
+
+    __atomic_store_n(&m_doc, ydoc_new(), __ATOMIC_RELEASE);
+    m_text = m_doc ? ytext(m_doc, m_shared_type) : nullptr;
+    if (!m_text) {
+        fprintf(stderr, "[Document] Failed to create YText with name '%s'\n", m_shared_type);
+        if (m_doc) ydoc_destroy(m_doc);
+        __atomic_store_n(&m_doc, (YDoc*)nullptr, __ATOMIC_RELEASE);
+        return false;
+    }
+    if (m_text_observer) m_text_sub = ytext_observe(m_text, this, on_text_event);
+    if (m_update_observer) m_update_sub = ydoc_observe_updates_v1(m_doc, this, on_update_event);
+
+    YTransaction* txn = ydoc_write_transaction(m_doc, 0, nullptr);
+    uint8_t err = ytransaction_apply(txn, (const char*)m_pending->data, m_pending->len);
+    ytransaction_commit(txn);
+    if (err != 0) {
+        // Writes on an empty YDoc would replace the copied state, so keep the
+        // snapshot (reads stay on it) and refuse them until a retry succeeds
+        fprintf(stderr, "[Document] Failed to apply shared snapshot: error=%d\n", err);
+        if (m_text_sub) {
+            yunobserve(m_text_sub);
+            m_text_sub = nullptr;
+        }
+        if (m_update_sub) {
+            yunobserve(m_update_sub);
+            m_update_sub = nullptr;
+        }
+        ydoc_destroy(m_doc);
+        __atomic_store_n(&m_doc, (YDoc*)nullptr, __ATOMIC_RELEASE);
+        m_text = nullptr;
+        return false;
+    }
+
+    doc_snapshot_release(m_pending);
+    m_pending = nullptr;
+    return true;
+}
+
+bool Document::materialize() {
+    omp_set_lock(&m_lock);
+    bool ok = materialize_locked();
+    omp_unset_lock(&m_lock);
+    return ok;
+}
+
+bool Document::is_materialized() {
+    return __atomic_load_n(&m_doc, __ATOMIC_ACQUIRE) != nullptr;
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
 bool Document::apply_update(const uint8_t* update, size_t len) {
-    if (!m_doc || len == 0) {
+    return apply_update(update, len, nullptr, nullptr);
+}
+
+bool Document::apply_update(const uint8_t* update, size_t len, uint8_t** v1_out, size_t* v1_len) {
+    if (v1_out) {
+        *v1_out = nullptr;
+        *v1_len = 0;
+    }
+    if (len == 0) {
+        return false;
+    }
+    uint64_t start_ns = monotonic_ns();
+
+    omp_set_lock(&m_lock);
+    if (!materialize_locked()) {
+        omp_unset_lock(&m_lock);
         return false;
     }
 
     // Try V1 format first
+    bool v1 = true;
+    uint8_t* v1_diff = nullptr;
+    size_t v1_diff_len = 0;
     YTransaction* txn = ydoc_write_transaction(m_doc, 0, nullptr);
     uint8_t err = ytransaction_apply(txn, (const char*)update, (uint32_t)len);
 
     if (err != 0) {
         // V1 failed, try V2
+        v1 = false;
         ytransaction_commit(txn);
 
         txn = ydoc_write_transaction(m_doc, 0, nullptr);
+        // The state vector before the update; the diff against it afterwards
+        // is the update's effect in v1, which the read view tail stores
+        uint32_t sv_len = 0;
+        char* sv = ytransaction_state_vector_v1(txn, &sv_len);
         err = ytransaction_apply_v2(txn, (const char*)update, (uint32_t)len);
 
         if (err != 0) {
             fprintf(stderr, "[Document] Failed to apply update: V1 error=%d, V2 error=%d\n", err, err);
             ytransaction_commit(txn);
+            if (sv) ybinary_destroy(sv, sv_len);
+            omp_unset_lock(&m_lock);
             return false;
         }
+        if (sv) {
+            uint32_t diff_len = 0;
+            char* diff = ytransaction_state_diff_v1(txn, sv, sv_len, &diff_len);
+            if (diff && diff_len > 0) {
+                v1_diff = (uint8_t*)malloc(diff_len);
+                memcpy(v1_diff, diff, diff_len);
+                v1_diff_len = diff_len;
+            }
+            if (diff) ybinary_destroy(diff, diff_len);
+            ybinary_destroy(sv, sv_len);
+        }
     }
 
     ytransaction_commit(txn);
+    uint64_t next_version = m_version + 1;     // Only writers change it, under m_lock
+
+    // Publish to readers: append the update to the view's tail, as v1 (a v2
+    // update whose diff could not be taken starts a new generation instead)
+    const uint8_t* tail_data = v1 ? update : v1_diff;
+    size_t tail_len = v1 ? len : v1_diff_len;
+    uint8_t* state = nullptr;
+    uint32_t state_len = 0;
+    if (!tail_data) state = encode_live_state(&state_len);
+
+    DocReadView* retired_view = nullptr;       // Tail append: the base stays shared
+    DocReadView* retired_generation = nullptr;
+    uint32_t tail_count = 0;
+    omp_set_lock(&m_view_lock);
+    if (tail_data && m_view) {
+        retired_view = append_tail_locked(tail_data, tail_len, next_version);
+        tail_count = m_view->tail_count;
+    } else {
+        retired_generation = publish_base_locked(state, state_len, next_version);
+    }
+    // The version moves only once a view holding the update is published: a
+    // reader that sees it (get_sync_reply) then diffs against that view or a
+    // newer one, and never caches an older reply under the new version
+    __atomic_store_n(&m_version, next_version, __ATOMIC_RELEASE);
+    omp_unset_lock(&m_view_lock);
+    omp_unset_lock(&m_lock);
+
+    if (retired_view) epoch_retire(retired_view, free_view);
+    retire_generation(retired_generation);
+    if (v1_out) {
+        *v1_out = v1_diff;
+        *v1_len = v1_diff_len;
+    } else {
+        free(v1_diff);
+    }
+
+    // Rooms nobody reads would otherwise keep every update in the tail
+    if (tail_count >= DOC_TAIL_COMPACT) compact_tail();
+
+    // Cached replies predate this update
+    if (__atomic_load_n(&m_reply_count, __ATOMIC_RELAXED) > 0) {
+        clear_replies();
+    }
+
+    uint64_t ns = monotonic_ns() - start_ns;
+    __atomic_add_fetch(&m_applies, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_apply_ns_total, ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_apply_ns_last, ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&m_apply_ns_max, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&m_apply_ns_max, &max, ns, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
     return true;
 }
 
-uint8_t* Document::get_state_as_update(size_t* out_len) {
-    if (!m_doc) {
-        *out_len = 0;
+// Full state at the view's version: the base when the tail is empty, otherwise
+// base and tail merged into one update (nullptr if merging fails)
+uint8_t* Document::view_state(const DocReadView* view, uint32_t* out_len) {
+    static thread_local std::vector<const char*> t_parts;
+    static thread_local std::vector<uint32_t> t_lens;
+
+    *out_len = 0;
+    if (view->tail_count == 0) {
+        if (!view->base->state) return nullptr;
+        uint8_t* state = (uint8_t*)malloc(view->base->len);
+        memcpy(state, view->base->state, view->base->len);
+        *out_len = view->base->len;
+        return state;
+    }
+
+    // Oldest first: base, then the tail reversed
+    uint32_t count = view->tail_count + (view->base->state ? 1 : 0);
+    t_parts.resize(count);
+    t_lens.resize(count);
+    uint32_t i = count;
+    for (const DocTailUpdate* u = view->tail; u; u = u->prev) {
+        i--;
+        t_parts[i] = (const char*)u->data;
+        t_lens[i] = u->len;
+    }
+    if (view->base->state) {
+        t_parts[0] = (const char*)view->base->state;
+        t_lens[0] = view->base->len;
+    }
+
+    TRACE(snapshot_start, this, count);
+    uint32_t merged_len = 0;
+    char* merged = ymerge_updates_v1(t_parts.data(), t_lens.data(), count, &merged_len);
+    TRACE(snapshot_end, this, merged ? merged_len : 0);
+    if (!merged || merged_len == 0) {
+        if (merged) ybinary_destroy(merged, merged_len);
         return nullptr;
     }
 
+    uint8_t* state = (uint8_t*)malloc(merged_len);
+    memcpy(state, merged, merged_len);
+    *out_len = merged_len;
+    ybinary_destroy(merged, merged_len);
+    return state;
+}
+
+// Encode the live YDoc (caller holds m_lock)
+uint8_t* Document::encode_live_state(uint32_t* out_len) {
     YTransaction* txn = ydoc_read_transaction(m_doc);
     uint32_t state_len = 0;
     char* state = ytransaction_state_diff_v1(txn, nullptr, 0, &state_len);
     ytransaction_commit(txn);
 
+    *out_len = 0;
     if (!state || state_len == 0) {
-        *out_len = 0;
+        if (state) ybinary_destroy(state, state_len);
         return nullptr;
     }
 
-    // Copy to uint8_t buffer
     uint8_t* result = (uint8_t*)malloc(state_len);
     memcpy(result, state, state_len);
     *out_len = state_len;
-
     ybinary_destroy(state, state_len);
     return result;
 }
 
-uint8_t* Document::get_state_vector(size_t* out_len) {
-    if (!m_doc) {
-        *out_len = 0;
-        return nullptr;
+// Start a new generation from a full state (caller holds m_view_lock; takes
+// ownership). Returns the replaced view for retire_generation.
+DocReadView* Document::publish_base_locked(uint8_t* state, uint32_t len, uint64_t version) {
+    DocSnapshot* snapshot = state ? doc_snapshot_create(state, len) : nullptr;
+    DocReadView* old = publish_snapshot_locked(snapshot, version);
+    doc_snapshot_release(snapshot);
+    return old;
+}
+
+// Start a new generation sharing a snapshot (caller holds m_view_lock); returns
+// the replaced view for retire_generation
+DocReadView* Document::publish_snapshot_locked(DocSnapshot* snapshot, uint64_t version) {
+    DocBase* base = (DocBase*)tagged_calloc(1, sizeof(DocBase), ALLOC_SNAPSHOT);
+    if (snapshot) {
+        doc_snapshot_retain(snapshot);
+        base->snapshot = snapshot;
+        base->state = snapshot->data;
+        base->len = snapshot->len;
     }
 
-    YTransaction* txn = ydoc_read_transaction(m_doc);
+    DocReadView* view = (DocReadView*)tagged_calloc(1, sizeof(DocReadView), ALLOC_SNAPSHOT);
+    view->version = version;
+    view->base = base;
+
+    DocReadView* old = m_view;
+    __atomic_store_n(&m_view, view, __ATOMIC_RELEASE);
+    return old;
+}
+
+// Append a v1 update to the current view's tail (caller holds m_view_lock);
+// returns the replaced view, whose base stays shared
+DocReadView* Document::append_tail_locked(const uint8_t* data, size_t len, uint64_t version) {
+    DocReadView* old = m_view;
+    DocTailUpdate* u = (DocTailUpdate*)tagged_malloc(sizeof(DocTailUpdate), ALLOC_SNAPSHOT);
+    u->data = (uint8_t*)tagged_malloc(len, ALLOC_SNAPSHOT);
+    memcpy(u->data, data, len);
+    u->len = (uint32_t)len;
+    u->prev = old->tail;
+    old->base->newest = u;
+
+    DocReadView* view = (DocReadView*)tagged_malloc(sizeof(DocReadView), ALLOC_SNAPSHOT);
+    *view = *old;
+    view->version = version;
+    view->tail = u;
+    view->tail_count++;
+    __atomic_store_n(&m_view, view, __ATOMIC_RELEASE);
+    return old;
+}
+
+// Writer side compaction, outside the document locks: merge the current view
+// into a new base. If merging fails, the live document is encoded instead.
+void Document::compact_tail() {
+    EpochGuard guard;
+    DocReadView* view = read_view();
+    if (view->tail_count < DOC_TAIL_COMPACT) return;
+
+    uint32_t len = 0;
+    uint8_t* state = view_state(view, &len);
+    if (!state) {
+        omp_set_lock(&m_lock);
+        view = read_view();     // Writers publish under m_lock: matches the live state
+        state = encode_live_state(&len);
+        omp_unset_lock(&m_lock);
+        if (!state) return;
+    }
+    DocSnapshot* snapshot = doc_snapshot_create(state, len);
+    rebase(view, snapshot);
+    doc_snapshot_release(snapshot);
+}
+
+// Replace a long tail by the merged state a reader just built
+void Document::compact(const DocReadView* view, const uint8_t* state, uint32_t len) {
+    if (view->tail_count < DOC_TAIL_COMPACT || !state) return;
+
+    uint8_t* copy = (uint8_t*)malloc(len);
+    memcpy(copy, state, len);
+    DocSnapshot* snapshot = doc_snapshot_create(copy, len);
+    rebase(view, snapshot);
+    doc_snapshot_release(snapshot);
+}
+
+// Make snapshot (the merged state of view) the base of a new generation if
+// view's base is still current. Updates applied since view are carried over.
+void Document::rebase(const DocReadView* view, DocSnapshot* snapshot) {
+    static thread_local std::vector<const DocTailUpdate*> t_newer;
+
+    if (!omp_test_lock(&m_compact_lock)) return;
+
+    omp_set_lock(&m_view_lock);
+    DocReadView* cur = m_view;
+    DocReadView* replaced = nullptr;
+    if (cur->base == view->base && cur->tail_count >= view->tail_count) {
+        t_newer.clear();
+        const DocTailUpdate* u = cur->tail;
+        for (uint32_t i = view->tail_count; i < cur->tail_count; i++) {
+            t_newer.push_back(u);
+            u = u->prev;
+        }
+
+        DocBase* base = (DocBase*)tagged_calloc(1, sizeof(DocBase), ALLOC_SNAPSHOT);
+        doc_snapshot_retain(snapshot);
+        base->snapshot = snapshot;
+        base->state = snapshot->data;
+        base->len = snapshot->len;
+
+        DocTailUpdate* prev = nullptr;
+        for (size_t i = t_newer.size(); i-- > 0;) {
+            DocTailUpdate* copy = (DocTailUpdate*)tagged_malloc(sizeof(DocTailUpdate), ALLOC_SNAPSHOT);
+            copy->data = (uint8_t*)tagged_malloc(t_newer[i]->len, ALLOC_SNAPSHOT);
+            memcpy(copy->data, t_newer[i]->data, t_newer[i]->len);
+            copy->len = t_newer[i]->len;
+            copy->prev = prev;
+            prev = copy;
+        }
+        base->newest = prev;
+
+        DocReadView* next = (DocReadView*)tagged_calloc(1, sizeof(DocReadView), ALLOC_SNAPSHOT);
+        next->version = cur->version;
+        next->base = base;
+        next->tail = prev;
+        next->tail_count = (uint32_t)t_newer.size();
+
+        __atomic_store_n(&m_view, next, __ATOMIC_RELEASE);
+        replaced = cur;
+    }
+    omp_unset_lock(&m_view_lock);
+    omp_unset_lock(&m_compact_lock);
+    retire_generation(replaced);
+}
+
+uint8_t* Document::get_state_as_update(size_t* out_len) {
+    *out_len = 0;
+    if (!m_view) return nullptr;
+
+    uint32_t len = 0;
+    uint8_t* state = nullptr;
+    {
+        EpochGuard guard;
+        DocReadView* view = read_view();
+        state = view_state(view, &len);
+        compact(view, state, len);
+    }
+
+    if (!state) {
+        // Merge unavailable: fall back to the live document
+        omp_set_lock(&m_lock);
+        if (materialize_locked()) state = encode_live_state(&len);
+        omp_unset_lock(&m_lock);
+    }
+
+    *out_len = len;
+    return state;
+}
+
+DocSnapshot* Document::share_snapshot() {
+    if (!m_view) return nullptr;
+
+    EpochGuard guard;
+    DocReadView* view = read_view();
+    if (view->tail_count == 0) {
+        if (view->base->snapshot) doc_snapshot_retain(view->base->snapshot);
+        return view->base->snapshot;
+    }
+
+    uint32_t len = 0;
+    uint8_t* state = view_state(view, &len);
+    if (!state) return nullptr;
+    DocSnapshot* snapshot = doc_snapshot_create(state, len);
+    rebase(view, snapshot);
+    return snapshot;
+}
+
+uint8_t* Document::get_state_vector(size_t* out_len) {
+    *out_len = 0;
     uint32_t sv_len = 0;
-    char* sv = ytransaction_state_vector_v1(txn, &sv_len);
-    ytransaction_commit(txn);
+    char* sv = nullptr;
+
+    // A compacted view's base is the whole state; past it, the live document
+    // keeps its state vector, so reading it is O(clients) instead of a merge
+    bool from_base = false;
+    if (m_view) {
+        EpochGuard guard;
+        const DocReadView* view = read_view();
+        if (view->tail_count == 0) {
+            from_base = true;
+            if (view->base->state) {
+                sv = yencode_state_vector_from_update_v1((const char*)view->base->state, view->base->len, &sv_len);
+            }
+        }
+    }
+    if (!from_base) {
+        omp_set_lock(&m_lock);
+        if (m_doc) {
+            YTransaction* txn = ydoc_read_transaction(m_doc);
+            sv = ytransaction_state_vector_v1(txn, &sv_len);
+            ytransaction_commit(txn);
+        }
+        omp_unset_lock(&m_lock);
+    }
 
     if (!sv || sv_len == 0) {
-        *out_len = 0;
         return nullptr;
     }
 
@@ -108,18 +595,41 @@ uint8_t* Document::get_state_vector(size_t* out_len) {
 }
 
 uint8_t* Document::get_state_diff(const uint8_t* client_sv, size_t sv_len, size_t* out_len) {
-    if (!m_doc) {
-        *out_len = 0;
-        return nullptr;
-    }
+    *out_len = 0;
+    if (!m_view) return nullptr;
 
-    YTransaction* txn = ydoc_read_transaction(m_doc);
+    // A compacted view is diffed in place; only a tail needs the merge
     uint32_t diff_len = 0;
-    char* diff = ytransaction_state_diff_v1(txn, (const char*)client_sv, (uint32_t)sv_len, &diff_len);
-    ytransaction_commit(txn);
+    char* diff = nullptr;
+    {
+        EpochGuard guard;
+        DocReadView* view = read_view();
+        if (view->tail_count == 0) {
+            if (!view->base->state) return nullptr;
+            diff = ydiff_updates_v1((const char*)view->base->state, view->base->len,
+                                    (const char*)client_sv, (uint32_t)sv_len, &diff_len);
+        } else {
+            uint32_t state_len = 0;
+            uint8_t* state = view_state(view, &state_len);
+            if (state) {
+                compact(view, state, state_len);
+                diff = ydiff_updates_v1((const char*)state, state_len,
+                                        (const char*)client_sv, (uint32_t)sv_len, &diff_len);
+                free(state);
+            }
+        }
+    }
+    if (!diff) {
+        // Merge unavailable: diff the live document's state
+        size_t state_len = 0;
+        uint8_t* state = get_state_as_update(&state_len);
+        if (!state) return nullptr;
+        diff = ydiff_updates_v1((const char*)state, (uint32_t)state_len,
+                                (const char*)client_sv, (uint32_t)sv_len, &diff_len);
+        free(state);
+    }
 
     if (!diff || diff_len == 0) {
-        *out_len = 0;
         return nullptr;
     }
 
@@ -131,11 +641,214 @@ uint8_t* Document::get_state_diff(const uint8_t* client_sv, size_t sv_len, size_
     return result;
 }
 
+bool doc_canonical_state_vector(const uint8_t* sv, size_t sv_len, std::vector<uint64_t>& out) {
+    out.clear();
+    if (sv_len == 0) return true;
+
+    uint32_t count = 0;
+    size_t pos = decode_varuint(sv, sv_len, &count);
+    if (pos == 0 || count > sv_len) return false;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t client = 0;
+        uint32_t clock = 0;
+        size_t n = decode_varuint(sv + pos, sv_len - pos, &client);
+        if (n == 0) return false;
+        pos += n;
+        n = decode_varuint(sv + pos, sv_len - pos, &clock);
+        if (n == 0) return false;
+        pos += n;
+        if (clock != 0) out.push_back(((uint64_t)client << 32) | clock);
+    }
+    if (pos != sv_len) return false;
+
+    std::sort(out.begin(), out.end());
+    return true;
+}
+
+static uint64_t hash_entries(const std::vector<uint64_t>& entries) {
+    // FNV-1a over the canonical entries
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < entries.size(); i++) {
+        uint64_t v = entries[i];
+        for (int b = 0; b < 8; b++) {
+            h ^= (v >> (b * 8)) & 0xFF;
+            h *= 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+void Document::clear_replies() {
+    omp_set_lock(&m_reply_lock);
+    for (int i = 0; i < DOC_REPLY_BUCKETS; i++) {
+        SyncReplyEntry* e = &m_replies[i];
+        if (e->frame) {
+            ws_frame_release(e->frame);
+            tagged_free(e->entries, ALLOC_SNAPSHOT);
+            memset(e, 0, sizeof(*e));
+        }
+    }
+    __atomic_store_n(&m_reply_count, 0, __ATOMIC_RELAXED);
+    omp_unset_lock(&m_reply_lock);
+}
+
+WsSharedFrame* Document::get_sync_reply(const uint8_t* client_sv, size_t sv_len) {
+    static thread_local std::vector<uint64_t> t_entries;
+
+    // Read the version first: apply_update publishes the view holding an update
+    // before the version that counts it, so a reply computed afterwards covers
+    // at least this version and may be cached under it
+    uint64_t version = this->version();
+    bool cacheable = doc_canonical_state_vector(client_sv, sv_len, t_entries);
+    uint64_t hash = cacheable ? hash_entries(t_entries) : 0;
+    SyncReplyEntry* e = &m_replies[hash % DOC_REPLY_BUCKETS];
+
+    if (cacheable) {
+        omp_set_lock(&m_reply_lock);
+        if (e->frame && e->version == version && e->hash == hash &&
+            e->entry_count == t_entries.size() &&
+            (t_entries.empty() ||
+             memcmp(e->entries, t_entries.data(), t_entries.size() * sizeof(uint64_t)) == 0)) {
+            WsSharedFrame* frame = e->frame;
+            ws_frame_retain(frame);
+            m_reply_hits++;
+            omp_unset_lock(&m_reply_lock);
+            return frame;
+        }
+        m_reply_misses++;
+        omp_unset_lock(&m_reply_lock);
+    }
+
+    size_t state_len = 0;
+    uint8_t* state = nullptr;
+    if (sv_len > 0) {
+        state = get_state_diff(client_sv, sv_len, &state_len);
+    }
+    if (!state) {
+        state = get_state_as_update(&state_len);
+    }
+
+    size_t msg_len = 0;
+    uint8_t* msg = encode_sync_step2(state, state_len, &msg_len);
+    WsSharedFrame* frame = msg ? ws_frame_create_tagged(WS_OP_BINARY, msg, msg_len, ALLOC_SNAPSHOT) : nullptr;
+    protocol_free(msg);
+    if (state) free(state);
+
+    if (cacheable && frame) {
+        omp_set_lock(&m_reply_lock);
+        if (this->version() == version) {
+            if (e->frame) {
+                ws_frame_release(e->frame);
+                tagged_free(e->entries, ALLOC_SNAPSHOT);
+            } else {
+                __atomic_add_fetch(&m_reply_count, 1, __ATOMIC_RELAXED);
+            }
+            e->hash = hash;
+            e->version = version;
+            e->entry_count = (uint32_t)t_entries.size();
+            e->entries = (uint64_t*)tagged_malloc((t_entries.size() + 1) * sizeof(uint64_t), ALLOC_SNAPSHOT);
+            if (!t_entries.empty()) {
+                memcpy(e->entries, t_entries.data(), t_entries.size() * sizeof(uint64_t));
+            }
+            ws_frame_retain(frame);
+            e->frame = frame;
+        }
+        omp_unset_lock(&m_reply_lock);
+    }
+
+    return frame;
+}
+
+void Document::get_reply_stats(uint64_t* hits, uint64_t* misses) {
+    omp_set_lock(&m_reply_lock);
+    *hits = m_reply_hits;
+    *misses = m_reply_misses;
+    omp_unset_lock(&m_reply_lock);
+}
+
+void Document::get_stats(DocStats* out) {
+    memset(out, 0, sizeof(*out));
+    out->version = version();
+    out->applies = __atomic_load_n(&m_applies, __ATOMIC_RELAXED);
+    out->apply_ns_last = __atomic_load_n(&m_apply_ns_last, __ATOMIC_RELAXED);
+    out->apply_ns_max = __atomic_load_n(&m_apply_ns_max, __ATOMIC_RELAXED);
+    out->apply_ns_total = __atomic_load_n(&m_apply_ns_total, __ATOMIC_RELAXED);
+    out->materialized = is_materialized();
+
+    {
+        EpochGuard guard;
+        const DocReadView* view = read_view();
+        if (view) {
+            out->base_bytes = view->base->len;
+            out->base_shared = view->base->snapshot &&
+                               __atomic_load_n(&view->base->snapshot->refs, __ATOMIC_RELAXED) > 1;
+            out->tail_updates = view->tail_count;
+            for (const DocTailUpdate* u = view->tail; u; u = u->prev) out->tail_bytes += u->len;
+        }
+    }
+
+    omp_set_lock(&m_reply_lock);
+    for (int i = 0; i < DOC_REPLY_BUCKETS; i++) {
+        if (!m_replies[i].frame) continue;
+        out->reply_cached++;
+        out->reply_bytes += m_replies[i].frame->len;
+    }
+    out->reply_hits = m_reply_hits;
+    out->reply_misses = m_reply_misses;
+    omp_unset_lock(&m_reply_lock);
+}
+
+void Document::on_text_event(void* state, const YTextEvent* event) {
+    Document* doc = (Document*)state;
+    uint32_t len = 0;
+    YDelta* delta = ytext_event_delta(event, &len);
+    if (delta) {
+        doc->m_text_observer(doc->m_text_observer_user, delta, len);
+        ytext_delta_destroy(delta, len);
+    }
+}
+
+void Document::observe_text(DocTextObserver fn, void* user) {
+    if (!m_text && !m_pending) return;
+
+    // Snapshot copies subscribe when they materialize
+    omp_set_lock(&m_lock);
+    if (m_text_sub) {
+        yunobserve(m_text_sub);
+        m_text_sub = nullptr;
+    }
+    m_text_observer = fn;
+    m_text_observer_user = user;
+    if (fn && m_text) m_text_sub = ytext_observe(m_text, this, on_text_event);
+    omp_unset_lock(&m_lock);
+}
+
+void Document::on_update_event(void* state, uint32_t len, const char* update) {
+    Document* doc = (Document*)state;
+    if (len > 0) doc->m_update_observer(doc->m_update_observer_user, (const uint8_t*)update, len);
+}
+
+void Document::observe_updates(DocUpdateObserver fn, void* user) {
+    if (!m_doc && !m_pending) return;
+
+    omp_set_lock(&m_lock);
+    if (m_update_sub) {
+        yunobserve(m_update_sub);
+        m_update_sub = nullptr;
+    }
+    m_update_observer = fn;
+    m_update_observer_user = user;
+    if (fn && m_doc) m_update_sub = ydoc_observe_updates_v1(m_doc, this, on_update_event);
+    omp_unset_lock(&m_lock);
+}
+
 char* Document::get_text_content() {
-    if (!m_doc || !m_text) {
+    omp_set_lock(&m_lock);
+    if (!m_text && !materialize_locked()) {
+        omp_unset_lock(&m_lock);
         return nullptr;
     }
-
     YTransaction* txn = ydoc_read_transaction(m_doc);
     const char* content = ytext_string(m_text, txn);
 
@@ -148,5 +861,6 @@ char* Document::get_text_content() {
     }
 
     ytransaction_commit(txn);
+    omp_unset_lock(&m_lock);
     return result;
 }
@@ -0,0 +1,212 @@
+#include "epoch.h"
+#include <omp.h>
+#include <stdlib.h>
+#include <vector>
+
+// Reclaim every this many retires on a thread (and on server ticks), so a
+// retire is a push onto the thread's own list
+#define EPOCH_RECLAIM_INTERVAL 64
+
+struct Retired {
+    void* ptr;
+    void (*free_fn)(void*);
+    uint64_t epoch;
+};
+
+// Per-thread record, linked once and never unlinked. A thread releases its
+// record when it exits and a new thread claims a released one, so the list
+// grows to the peak number of threads, not to the number ever started.
+struct EpochRecord {
+    uint64_t local;                 // Epoch observed on entry, 0 while outside
+    int depth;                      // Nesting depth (owner thread only)
+    int owned;                      // 1 while a live thread holds the record
+    std::vector<Retired> retired;   // Retired by the owner, oldest first (owner only)
+    int pending;                    // retired.size(), for epoch_pending
+    int since_reclaim;
+    EpochRecord* next;
+};
+
+// Starts at 1 so that local == 0 means "not in a critical section"
+static uint64_t g_epoch = 1;
+static EpochRecord* g_records = nullptr;
+static thread_local EpochRecord* t_record = nullptr;
+
+// Objects left behind by exited threads, freed by whichever thread reclaims next
+static omp_lock_t g_orphan_lock;
+static std::vector<Retired> g_orphans;
+static int g_orphan_count = 0;
+
+static void release_record();
+
+// Releases the thread's record when the thread exits (armed on first use,
+// which also registers the destructor)
+struct EpochRecordOwner {
+    bool armed;
+    ~EpochRecordOwner() {
+        if (armed) release_record();
+    }
+};
+static thread_local EpochRecordOwner t_owner;
+
+static EpochRecord* get_record() {
+    EpochRecord* rec = t_record;
+    if (rec) return rec;
+
+    // Reuse a record released by an exited thread
+    for (rec = __atomic_load_n(&g_records, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        int free_slot = 0;
+        if (__atomic_load_n(&rec->owned, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&rec->owned, &free_slot, 1, false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (!rec) {
+        rec = new EpochRecord();
+        rec->owned = 1;
+        EpochRecord* head = __atomic_load_n(&g_records, __ATOMIC_ACQUIRE);
+        do {
+            rec->next = head;
+        } while (!__atomic_compare_exchange_n(&g_records, &head, rec, false,
+                                              __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    }
+    t_record = rec;
+    t_owner.armed = true;
+    return rec;
+}
+
+static void release_record() {
+    EpochRecord* rec = t_record;
+    if (!rec) return;
+    t_record = nullptr;
+
+    if (!rec->retired.empty()) {
+        omp_set_lock(&g_orphan_lock);
+        g_orphans.insert(g_orphans.end(), rec->retired.begin(), rec->retired.end());
+        __atomic_store_n(&g_orphan_count, (int)g_orphans.size(), __ATOMIC_RELAXED);
+        omp_unset_lock(&g_orphan_lock);
+        rec->retired.clear();
+        __atomic_store_n(&rec->pending, 0, __ATOMIC_RELAXED);
+    }
+    rec->depth = 0;
+    rec->since_reclaim = 0;
+    __atomic_store_n(&rec->local, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->owned, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_enter() {
+    EpochRecord* rec = get_record();
+    if (rec->depth++ > 0) return;
+
+    // Publish the observed epoch before any shared pointer is loaded
+    uint64_t e = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&rec->local, e, __ATOMIC_SEQ_CST);
+}
+
+void epoch_exit() {
+    EpochRecord* rec = t_record;
+    if (--rec->depth > 0) return;
+    __atomic_store_n(&rec->local, 0, __ATOMIC_RELEASE);
+}
+
+// Advance when every active reader has observed the current epoch
+static uint64_t try_advance() {
+    uint64_t e = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+    for (EpochRecord* rec = __atomic_load_n(&g_records, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        uint64_t local = __atomic_load_n(&rec->local, __ATOMIC_SEQ_CST);
+        if (local != 0 && local != e) return e;
+    }
+    __atomic_compare_exchange_n(&g_epoch, &e, e + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+}
+
+// Move entries retired at least two epochs before e from list to ready
+static void take_ready(std::vector<Retired>* list, uint64_t e, std::vector<Retired>* ready) {
+    size_t keep = 0;
+    for (size_t i = 0; i < list->size(); i++) {
+        if ((*list)[i].epoch + 2 <= e) {
+            ready->push_back((*list)[i]);
+        } else {
+            (*list)[keep++] = (*list)[i];
+        }
+    }
+    list->resize(keep);
+}
+
+void epoch_init() {
+    omp_init_lock(&g_orphan_lock);
+}
+
+void epoch_destroy() {
+    epoch_drain();
+    omp_destroy_lock(&g_orphan_lock);
+}
+
+void epoch_retire(void* ptr, void (*free_fn)(void*)) {
+    if (!ptr) return;
+
+    EpochRecord* rec = get_record();
+    Retired r;
+    r.ptr = ptr;
+    r.free_fn = free_fn;
+    r.epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+    rec->retired.push_back(r);
+    __atomic_store_n(&rec->pending, (int)rec->retired.size(), __ATOMIC_RELAXED);
+
+    if (++rec->since_reclaim >= EPOCH_RECLAIM_INTERVAL) epoch_reclaim();
+}
+
+void epoch_reclaim() {
+    EpochRecord* rec = get_record();
+    rec->since_reclaim = 0;
+    bool orphans = __atomic_load_n(&g_orphan_count, __ATOMIC_RELAXED) > 0;
+    if (rec->retired.empty() && !orphans) return;
+
+    std::vector<Retired> ready;
+    uint64_t e = try_advance();
+    take_ready(&rec->retired, e, &ready);
+    __atomic_store_n(&rec->pending, (int)rec->retired.size(), __ATOMIC_RELAXED);
+
+    if (orphans && omp_test_lock(&g_orphan_lock)) {
+        take_ready(&g_orphans, e, &ready);
+        __atomic_store_n(&g_orphan_count, (int)g_orphans.size(), __ATOMIC_RELAXED);
+        omp_unset_lock(&g_orphan_lock);
+    }
+
+    // Free after the lists are consistent; free functions may retire more objects
+    for (size_t i = 0; i < ready.size(); i++) {
+        ready[i].free_fn(ready[i].ptr);
+    }
+}
+
+void epoch_drain() {
+    std::vector<Retired> all;
+
+    // Free functions may retire more objects, so repeat until nothing is left
+    do {
+        all.clear();
+        omp_set_lock(&g_orphan_lock);
+        all.swap(g_orphans);
+        __atomic_store_n(&g_orphan_count, 0, __ATOMIC_RELAXED);
+        omp_unset_lock(&g_orphan_lock);
+
+        // No readers or retiring threads remain, so every list can be taken
+        for (EpochRecord* rec = __atomic_load_n(&g_records, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+            all.insert(all.end(), rec->retired.begin(), rec->retired.end());
+            rec->retired.clear();
+            __atomic_store_n(&rec->pending, 0, __ATOMIC_RELAXED);
+        }
+
+        for (size_t i = 0; i < all.size(); i++) {
+            all[i].free_fn(all[i].ptr);
+        }
+    } while (!all.empty());
+}
+
+int epoch_pending() {
+    int n = __atomic_load_n(&g_orphan_count, __ATOMIC_RELAXED);
+    for (EpochRecord* rec = __atomic_load_n(&g_records, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        n += __atomic_load_n(&rec->pending, __ATOMIC_RELAXED);
+    }
+    return n;
+}
@@ -0,0 +1,969 @@
+#include "epoll_server.h"
+#include "allocstat.h"
+#include "peer.h"
+#include "room.h"
+#include "admission.h"
+#include "protocol.h"
+#include "ws_frame.h"
+#include "tls.h"
+#include "overload.h"
+#include "trace.h"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#define EPOLL_MAX_EVENTS 256
+#define WRITE_BATCH 64                      // Messages per writev (header + payload iovecs)
+#define MAX_HANDSHAKE_LEN 8192
+#define MAX_MESSAGE_LEN (64 * 1024 * 1024)
+#define RX_GROW_STEP (64 * 1024)            // Reserve at most this far past the bytes received
+
+struct Reactor;
+
+enum ConnState {
+    CONN_TLS_HANDSHAKE,
+    CONN_HANDSHAKE,
+    CONN_OPEN,
+    CONN_CLOSING                // Handshake refused: response queued, nothing more is read
+};
+
+struct EpollConn {
+    int fd;
+    Reactor* reactor;
+    Peer* peer;                 // Set once the WebSocket handshake completes
+    ConnState state;
+    bool writable;              // False after writev hit EAGAIN, until EPOLLOUT
+    bool wake_queued;           // On reactor->wake_list (guarded by wake_lock)
+    bool close_after_flush;     // Close frame or error response queued
+
+    // TLS (wss://): null for plain connections
+    SSL* ssl;
+    bool ktls_send;             // Kernel encrypts writes, so plain writev still applies
+
+    // Receive buffer, pre-sized from ServerOptions::rx_buffer_size
+    uint8_t* rx;
+    size_t rx_len;
+    size_t rx_cap;
+
+    // Fragmented message reassembly
+    uint8_t* frag;
+    size_t frag_len;
+    size_t frag_cap;
+    uint8_t frag_opcode;
+
+    // Control bytes (handshake response, pong, close) sent ahead of queued messages
+    uint8_t* ctrl;
+    size_t ctrl_len;
+    size_t ctrl_cap;
+    uint8_t* ctrl_out;          // Control bytes owned by the in-flight batch
+    size_t ctrl_out_cap;
+
+    // In-flight writev batch
+    struct iovec iov[WRITE_BATCH + 1];
+    int iov_count;
+    int iov_index;
+    PendingMessage* batch[WRITE_BATCH];
+    int batch_count;
+
+    EpollConn* prev;
+    EpollConn* next;
+};
+
+struct Reactor {
+    int id;
+    int epfd;
+    int listen_fd;
+    int wake_fd;
+    int probe_fd;               // Lag probe timer (absolute CLOCK_MONOTONIC deadlines)
+    int loop_id;
+    uint64_t probe_due;
+    uint64_t next_drain;        // Earliest wake list flush while batching (us)
+    const ServerOptions* opts;
+    volatile int* running;
+    SSL_CTX* tls_ctx;           // Shared across reactors (tickets valid on any of them)
+
+    // Connections whose peer queue needs flushing, pushed by any thread
+    omp_lock_t wake_lock;
+    std::vector<EpollConn*> wake_list;
+    std::vector<EpollConn*> ready;
+
+    EpollConn* conns;           // All connections owned by this reactor
+    int conn_count;
+};
+
+static thread_local Reactor* t_reactor = nullptr;
+
+static void conn_close(EpollConn* c);
+
+// Transport hook: may be called from any thread (broadcast from another reactor)
+static void epoll_request_write(Peer* p) {
+    EpollConn* c = (EpollConn*)p->conn;
+    Reactor* r = c->reactor;
+    bool notify = false;
+
+    omp_set_lock(&r->wake_lock);
+    if (!c->wake_queued) {
+        c->wake_queued = true;
+        r->wake_list.push_back(c);
+        // The owning reactor drains its own pushes before waiting again;
+        // other threads only need to wake it for the first entry
+        notify = (r != t_reactor) && r->wake_list.size() == 1;
+    }
+    omp_unset_lock(&r->wake_lock);
+
+    if (notify) {
+        uint64_t one = 1;
+        ssize_t n = write(r->wake_fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+static const PeerTransport g_epoll_transport = {
+    "epoll",
+    epoll_request_write
+};
+
+static void schedule_flush(EpollConn* c) {
+    Reactor* r = c->reactor;
+    omp_set_lock(&r->wake_lock);
+    if (!c->wake_queued) {
+        c->wake_queued = true;
+        r->wake_list.push_back(c);
+    }
+    omp_unset_lock(&r->wake_lock);
+}
+
+static bool reserve(uint8_t** buf, size_t* cap, size_t needed) {
+    if (needed <= *cap) return true;
+    size_t new_cap = *cap ? *cap : 256;
+    while (new_cap < needed) new_cap *= 2;
+    uint8_t* p = (uint8_t*)tagged_realloc(*buf, new_cap, ALLOC_PEER);
+    if (!p) return false;
+    *buf = p;
+    *cap = new_cap;
+    return true;
+}
+
+static void append_ctrl(EpollConn* c, const void* data, size_t len) {
+    if (!reserve(&c->ctrl, &c->ctrl_cap, c->ctrl_len + len)) return;
+    memcpy(c->ctrl + c->ctrl_len, data, len);
+    c->ctrl_len += len;
+}
+
+static void send_control(EpollConn* c, uint8_t opcode, const uint8_t* payload, size_t len) {
+    uint8_t header[WS_MAX_HEADER_LEN];
+    size_t header_len = ws_encode_frame_header(opcode, len, nullptr, header);
+    append_ctrl(c, header, header_len);
+    if (len > 0) append_ctrl(c, payload, len);
+    schedule_flush(c);
+}
+
+// Send a close frame with status code, then close once it is written
+static void conn_fail(EpollConn* c, uint16_t code) {
+    if (c->close_after_flush) return;
+    uint8_t payload[2] = { (uint8_t)(code >> 8), (uint8_t)(code & 0xFF) };
+    send_control(c, WS_OP_CLOSE, payload, sizeof(payload));
+    c->close_after_flush = true;
+}
+
+static void finish_batch(EpollConn* c) {
+    for (int i = 0; i < c->batch_count; i++) {
+        peer_free_message(c->batch[i]);
+    }
+    c->batch_count = 0;
+    c->iov_count = 0;
+    c->iov_index = 0;
+}
+
+// Gather control bytes and up to WRITE_BATCH queued messages into one iovec array
+static bool build_batch(EpollConn* c) {
+    if (c->ctrl_len > 0) {
+        uint8_t* tmp = c->ctrl_out;
+        size_t tmp_cap = c->ctrl_out_cap;
+        c->ctrl_out = c->ctrl;
+        c->ctrl_out_cap = c->ctrl_cap;
+        c->iov[c->iov_count].iov_base = c->ctrl_out;
+        c->iov[c->iov_count].iov_len = c->ctrl_len;
+        c->iov_count++;
+        c->ctrl = tmp;
+        c->ctrl_cap = tmp_cap;
+        c->ctrl_len = 0;
+    }
+
+    // No data frames may follow a close frame
+    if (c->state == CONN_OPEN && !c->close_after_flush && c->peer) {
+        while (c->batch_count < WRITE_BATCH) {
+            PendingMessage* msg = peer_dequeue_message(c->peer);
+            if (!msg) break;
+
+            // Frames are pre-encoded and shared across peers: one iovec each
+            c->iov[c->iov_count].iov_base = msg->frame->data;
+            c->iov[c->iov_count].iov_len = msg->frame->len;
+            c->iov_count++;
+            c->batch[c->batch_count++] = msg;
+        }
+    }
+
+    return c->iov_count > 0;
+}
+
+// Map an OpenSSL result onto read/write conventions (-1 + EAGAIN when blocked)
+static ssize_t ssl_result(EpollConn* c, int n) {
+    int err = SSL_get_error(c->ssl, n);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (err == SSL_ERROR_ZERO_RETURN) return 0;
+    ERR_clear_error();
+    errno = EIO;
+    return -1;
+}
+
+// Returns bytes read, 0 on EOF, -1 with errno set
+static ssize_t conn_read(EpollConn* c, uint8_t* buf, size_t len) {
+    if (!c->ssl) return read(c->fd, buf, len);
+    int n = SSL_read(c->ssl, buf, len > INT_MAX ? INT_MAX : (int)len);
+    return n > 0 ? n : ssl_result(c, n);
+}
+
+// Returns bytes written, -1 with errno set
+static ssize_t conn_writev(EpollConn* c, const struct iovec* iov, int count) {
+    if (!c->ssl || c->ktls_send) return writev(c->fd, iov, count);
+
+    // Userspace TLS: one SSL_write per iovec (partial writes enabled)
+    ssize_t total = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = iov[i].iov_len;
+        if (len == 0) continue;
+        int n = SSL_write(c->ssl, iov[i].iov_base, len > INT_MAX ? INT_MAX : (int)len);
+        if (n <= 0) return total > 0 ? total : ssl_result(c, n);
+        total += n;
+        if ((size_t)n < len) break;
+    }
+    return total;
+}
+
+// Write as much as the socket accepts; returns false if the connection was closed
+static bool conn_flush(EpollConn* c) {
+    if (c->state == CONN_TLS_HANDSHAKE) return true;
+
+    while (c->writable) {
+        if (c->iov_index >= c->iov_count) {
+            finish_batch(c);
+            if (!build_batch(c)) break;
+        }
+
+        ssize_t n = conn_writev(c, c->iov + c->iov_index, c->iov_count - c->iov_index);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                c->writable = false;
+                return true;
+            }
+            conn_close(c);
+            return false;
+        }
+        TRACE(write, c->peer ? c->peer->id : 0, n);
+
+        size_t left = (size_t)n;
+        while (left > 0) {
+            struct iovec* v = &c->iov[c->iov_index];
+            if (left >= v->iov_len) {
+                left -= v->iov_len;
+                c->iov_index++;
+            } else {
+                v->iov_base = (uint8_t*)v->iov_base + left;
+                v->iov_len -= left;
+                left = 0;
+            }
+        }
+    }
+
+    if (c->close_after_flush && c->iov_index >= c->iov_count && c->ctrl_len == 0) {
+        conn_close(c);
+        return false;
+    }
+    return true;
+}
+
+static bool header_equals(const char* name, size_t name_len, const char* expected) {
+    return strlen(expected) == name_len && strncasecmp(name, expected, name_len) == 0;
+}
+
+// Case-insensitive substring match within a header value
+static bool value_contains(const char* value, size_t len, const char* token) {
+    size_t tlen = strlen(token);
+    for (size_t i = 0; i + tlen <= len; i++) {
+        if (strncasecmp(value + i, token, tlen) == 0) return true;
+    }
+    return false;
+}
+
+// Overloaded: the client should retry once the loops catch up
+static void refuse_handshake(EpollConn* c) {
+    static const char* response =
+        "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+    append_ctrl(c, response, strlen(response));
+    c->state = CONN_CLOSING;
+    c->close_after_flush = true;
+    schedule_flush(c);
+}
+
+// A request pipelined behind a refused one must not reach handle_handshake,
+// so the connection leaves CONN_HANDSHAKE for good
+static void reject_handshake(EpollConn* c) {
+    static const char* response =
+        "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    append_ctrl(c, response, strlen(response));
+    c->state = CONN_CLOSING;
+    c->close_after_flush = true;
+    schedule_flush(c);
+}
+
+// Parse the HTTP upgrade request in rx[0..request_len) and answer it
+static void handle_handshake(EpollConn* c, size_t request_len) {
+    const char* req = (const char*)c->rx;
+    const char* end = req + request_len;
+
+    if (request_len < 4 || strncmp(req, "GET ", 4) != 0) {
+        reject_handshake(c);
+        return;
+    }
+
+    const char* key = nullptr;
+    size_t key_len = 0;
+    bool upgrade = false;
+    bool offers_protocol = false;
+    bool mux = false;
+
+    // Skip request line, then walk "Name: value\r\n" lines
+    const char* line = (const char*)memchr(req, '\n', request_len);
+    while (line && line + 1 < end) {
+        line++;
+        const char* eol = (const char*)memchr(line, '\n', end - line);
+        if (!eol) break;
+
+        const char* colon = (const char*)memchr(line, ':', eol - line);
+        if (colon) {
+            const char* value = colon + 1;
+            while (value < eol && (*value == ' ' || *value == '\t')) value++;
+            const char* value_end = eol;
+            while (value_end > value && (value_end[-1] == '\r' || value_end[-1] == ' ')) value_end--;
+            size_t name_len = colon - line;
+            size_t value_len = value_end - value;
+
+            if (header_equals(line, name_len, "Sec-WebSocket-Key")) {
+                key = value;
+                key_len = value_len;
+            } else if (header_equals(line, name_len, "Upgrade")) {
+                upgrade = value_contains(value, value_len, "websocket");
+            } else if (header_equals(line, name_len, "Sec-WebSocket-Protocol")) {
+                // The multiplexed protocol wins when a client offers both
+                mux = value_contains(value, value_len, MUX_PROTOCOL_NAME);
+                offers_protocol = mux || value_contains(value, value_len, "crdt-protocol");
+            }
+        }
+        line = eol;
+    }
+
+    if (!upgrade || !key || key_len == 0 || key_len > 64) {
+        reject_handshake(c);
+        return;
+    }
+    if (overload_refuse_join()) {
+        refuse_handshake(c);
+        return;
+    }
+
+    // Request path selects the room: "GET <path> HTTP/1.1"
+    char path[256];
+    const char* path_start = req + 4;
+    size_t path_len = 0;
+    while (path_start + path_len < end && path_start[path_len] != ' ' &&
+           path_start[path_len] != '\r' && path_start[path_len] != '\n') {
+        path_len++;
+    }
+    if (path_len == 0 || path_len >= sizeof(path)) {
+        path_start = "/";
+        path_len = 1;
+    }
+    memcpy(path, path_start, path_len);
+    path[path_len] = '\0';
+
+    // Room limit: refuse a path that would need a new room
+    if (!mux && !rooms_admit(path)) {
+        refuse_handshake(c);
+        return;
+    }
+
+    char accept[WS_ACCEPT_LEN];
+    ws_compute_accept(key, key_len, accept);
+
+    int wait_ms = 0;
+    int position = admission_join_position(mux ? nullptr : rooms_find(path), &wait_ms);
+
+    char response[384];
+    int n = snprintf(response, sizeof(response),
+                     "HTTP/1.1 101 Switching Protocols\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Accept: %s\r\n"
+                     "%s"
+                     "X-Sync-Queue-Depth: %d\r\n"
+                     "X-Sync-Queue-Position: %d\r\n"
+                     "X-Sync-Wait-Ms: %d\r\n"
+                     "\r\n",
+                     accept,
+                     !offers_protocol ? "" :
+                     mux ? "Sec-WebSocket-Protocol: " MUX_PROTOCOL_NAME "\r\n" :
+                     "Sec-WebSocket-Protocol: crdt-protocol\r\n",
+                     admission_queue_depth(), position, wait_ms);
+    append_ctrl(c, response, (size_t)n);
+    schedule_flush(c);
+
+    c->state = CONN_OPEN;
+    c->peer = peers_add(&g_epoll_transport, c);
+    if (!server_on_open(c->peer, path, mux)) {
+        c->peer = nullptr;
+        conn_fail(c, 1013);     // Try Again Later
+    }
+}
+
+static void handle_frame(EpollConn* c, const WsFrameHeader* h, uint8_t* payload) {
+    size_t len = (size_t)h->payload_len;
+
+    switch (h->opcode) {
+        case WS_OP_TEXT:
+        case WS_OP_BINARY:
+            if (c->frag_opcode) {
+                conn_fail(c, 1002);
+            } else if (h->fin) {
+                // Unfragmented message: dispatch straight from the receive buffer
+                server_on_message(c->peer, payload, len);
+            } else if (reserve(&c->frag, &c->frag_cap, len)) {
+                memcpy(c->frag, payload, len);
+                c->frag_len = len;
+                c->frag_opcode = h->opcode;
+            } else {
+                conn_fail(c, 1009);
+            }
+            break;
+
+        case WS_OP_CONTINUATION:
+            if (!c->frag_opcode) {
+                conn_fail(c, 1002);
+            } else if (c->frag_len + len > MAX_MESSAGE_LEN ||
+                       !reserve(&c->frag, &c->frag_cap, c->frag_len + len)) {
+                conn_fail(c, 1009);
+            } else {
+                memcpy(c->frag + c->frag_len, payload, len);
+                c->frag_len += len;
+                if (h->fin) {
+                    server_on_message(c->peer, c->frag, c->frag_len);
+                    c->frag_len = 0;
+                    c->frag_opcode = 0;
+                }
+            }
+            break;
+
+        case WS_OP_PING:
+            send_control(c, WS_OP_PONG, payload, len);
+            break;
+
+        case WS_OP_PONG:
+            break;
+
+        case WS_OP_CLOSE:
+            // Echo the status code and close once it is written
+            send_control(c, WS_OP_CLOSE, payload, len >= 2 ? 2 : 0);
+            c->close_after_flush = true;
+            break;
+
+        default:
+            conn_fail(c, 1002);
+            break;
+    }
+}
+
+// Consume complete handshake/frames from rx; returns bytes still needed for the next frame
+static size_t process_rx(EpollConn* c) {
+    size_t pos = 0;
+    size_t needed = 0;
+
+    if (c->state == CONN_HANDSHAKE) {
+        const uint8_t* end = (const uint8_t*)memmem(c->rx, c->rx_len, "\r\n\r\n", 4);
+        if (!end) {
+            if (c->rx_len > MAX_HANDSHAKE_LEN) reject_handshake(c);
+            return 0;
+        }
+        pos = (end - c->rx) + 4;
+        handle_handshake(c, pos);
+    }
+
+    while (c->state == CONN_OPEN && !c->close_after_flush) {
+        WsFrameHeader h;
+        int r = ws_parse_frame_header(c->rx + pos, c->rx_len - pos, &h);
+        if (r == 0) break;
+        if (r < 0 || !h.masked) {
+            conn_fail(c, 1002);
+            break;
+        }
+        if (h.payload_len > MAX_MESSAGE_LEN) {
+            conn_fail(c, 1009);
+            break;
+        }
+
+        size_t frame_len = h.header_len + (size_t)h.payload_len;
+        if (c->rx_len - pos < frame_len) {
+            needed = frame_len;
+            break;
+        }
+
+        uint8_t* payload = c->rx + pos + h.header_len;
+        ws_apply_mask(payload, (size_t)h.payload_len, h.mask_key, 0);
+        pos += frame_len;
+        handle_frame(c, &h, payload);
+    }
+
+    if (c->close_after_flush) {
+        c->rx_len = 0;
+        return 0;
+    }
+
+    if (pos > 0) {
+        memmove(c->rx, c->rx + pos, c->rx_len - pos);
+        c->rx_len -= pos;
+    }
+    return needed;
+}
+
+// Advance a non-blocking TLS handshake; returns false if the connection was closed
+static bool conn_tls_handshake(EpollConn* c) {
+    ERR_clear_error();
+    int r = SSL_do_handshake(c->ssl);
+    if (r == 1) {
+        c->state = CONN_HANDSHAKE;
+        c->ktls_send = tls_ktls_send_enabled(c->ssl);
+        tls_record_handshake(c->ssl);
+        return true;
+    }
+
+    int err = SSL_get_error(c->ssl, r);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return true;
+
+    ERR_clear_error();
+    conn_close(c);
+    return false;
+}
+
+// Drain the socket (edge-triggered); returns false if the connection was closed
+static bool conn_on_readable(EpollConn* c) {
+    if (c->state == CONN_TLS_HANDSHAKE) {
+        if (!conn_tls_handshake(c)) return false;
+        if (c->state == CONN_TLS_HANDSHAKE) return true;
+    }
+
+    for (;;) {
+        if (c->rx_len == c->rx_cap && !reserve(&c->rx, &c->rx_cap, c->rx_cap * 2)) {
+            conn_close(c);
+            return false;
+        }
+
+        ssize_t n = conn_read(c, c->rx + c->rx_len, c->rx_cap - c->rx_len);
+        if (n > 0) {
+            c->rx_len += (size_t)n;
+            size_t needed = process_rx(c);
+            if (c->state == CONN_CLOSING) return true;     // Only the refusal is left to send
+            // Grow only for frames larger than the pre-sized buffer, and only
+            // ahead of bytes that arrived: a header alone claims up to
+            // MAX_MESSAGE_LEN, and a full buffer doubles anyway
+            if (needed > c->rx_cap) {
+                size_t target = std::min(needed, c->rx_len + RX_GROW_STEP);
+                if (!reserve(&c->rx, &c->rx_cap, target)) {
+                    conn_close(c);
+                    return false;
+                }
+            }
+            // Give back memory from an oversized frame once it has been consumed
+            size_t base = c->reactor->opts->rx_buffer_size;
+            if (c->rx_len == 0 && c->rx_cap > base * 4) {
+                uint8_t* p = (uint8_t*)tagged_realloc(c->rx, base, ALLOC_PEER);
+                if (p) {
+                    c->rx = p;
+                    c->rx_cap = base;
+                }
+            }
+            continue;
+        }
+        if (n == 0) {
+            conn_close(c);
+            return false;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+
+        conn_close(c);
+        return false;
+    }
+}
+
+static void conn_close(EpollConn* c) {
+    Reactor* r = c->reactor;
+
+    if (c->peer) {
+        Peer* peer = c->peer;
+        c->peer = nullptr;
+        server_on_close(peer);
+    }
+
+    // After peers_remove no other thread can reach this connection
+    omp_set_lock(&r->wake_lock);
+    if (c->wake_queued) {
+        for (size_t i = 0; i < r->wake_list.size(); i++) {
+            if (r->wake_list[i] == c) {
+                r->wake_list.erase(r->wake_list.begin() + i);
+                break;
+            }
+        }
+        c->wake_queued = false;
+    }
+    omp_unset_lock(&r->wake_lock);
+
+    if (c->ssl) {
+        // Best-effort close_notify; never wait for the peer's reply
+        if (c->state != CONN_TLS_HANDSHAKE) SSL_shutdown(c->ssl);
+        SSL_free(c->ssl);
+        ERR_clear_error();
+    }
+
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+    close(c->fd);
+
+    if (c->prev) c->prev->next = c->next;
+    else r->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+    r->conn_count--;
+
+    finish_batch(c);
+    tagged_free(c->rx, ALLOC_PEER);
+    tagged_free(c->frag, ALLOC_PEER);
+    tagged_free(c->ctrl, ALLOC_PEER);
+    tagged_free(c->ctrl_out, ALLOC_PEER);
+    tagged_free(c, ALLOC_PEER);
+}
+
+static void accept_connections(Reactor* r) {
+    for (;;) {
+        int fd = accept4(r->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("[Epoll] accept4");
+            }
+            return;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        EpollConn* c = (EpollConn*)tagged_calloc(1, sizeof(EpollConn), ALLOC_PEER);
+        c->fd = fd;
+        c->reactor = r;
+        c->state = CONN_HANDSHAKE;
+        c->writable = true;
+        c->rx_cap = r->opts->rx_buffer_size;
+        c->rx = (uint8_t*)tagged_malloc(c->rx_cap, ALLOC_PEER);
+
+        if (r->tls_ctx) {
+            c->ssl = SSL_new(r->tls_ctx);
+            if (!c->ssl || SSL_set_fd(c->ssl, fd) != 1) {
+                fprintf(stderr, "[Epoll] Failed to create TLS session\n");
+                if (c->ssl) SSL_free(c->ssl);
+                close(fd);
+                tagged_free(c->rx, ALLOC_PEER);
+                tagged_free(c, ALLOC_PEER);
+                continue;
+            }
+            SSL_set_accept_state(c->ssl);
+            c->state = CONN_TLS_HANDSHAKE;
+        }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("[Epoll] epoll_ctl");
+            close(fd);
+            tagged_free(c->rx, ALLOC_PEER);
+            tagged_free(c, ALLOC_PEER);
+            continue;
+        }
+
+        c->next = r->conns;
+        if (r->conns) r->conns->prev = c;
+        r->conns = c;
+        r->conn_count++;
+    }
+}
+
+// Flush every connection queued by broadcasts, including ones queued while draining
+static void drain_wake_list(Reactor* r) {
+    for (;;) {
+        omp_set_lock(&r->wake_lock);
+        r->ready.swap(r->wake_list);
+        for (size_t i = 0; i < r->ready.size(); i++) {
+            r->ready[i]->wake_queued = false;
+        }
+        omp_unset_lock(&r->wake_lock);
+
+        if (r->ready.empty()) break;
+
+        for (size_t i = 0; i < r->ready.size(); i++) {
+            conn_flush(r->ready[i]);
+        }
+        r->ready.clear();
+    }
+}
+
+static int create_listener(int port) {
+    int one = 1;
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd >= 0) {
+        int zero = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons((uint16_t)port);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, SOMAXCONN) == 0) {
+            return fd;
+        }
+        close(fd);
+    }
+
+    // IPv4-only fallback
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    struct sockaddr_in addr4;
+    memset(&addr4, 0, sizeof(addr4));
+    addr4.sin_family = AF_INET;
+    addr4.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr4.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr*)&addr4, sizeof(addr4)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool reactor_init(Reactor* r, int id, const ServerOptions* opts, volatile int* running,
+                         SSL_CTX* tls_ctx) {
+    r->id = id;
+    r->opts = opts;
+    r->running = running;
+    r->tls_ctx = tls_ctx;
+    r->conns = nullptr;
+    r->conn_count = 0;
+    r->next_drain = 0;
+    omp_init_lock(&r->wake_lock);
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    r->listen_fd = create_listener(opts->port);
+    r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    r->probe_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (r->epfd < 0 || r->listen_fd < 0 || r->wake_fd < 0 || r->probe_fd < 0) {
+        fprintf(stderr, "[Epoll] Reactor %d failed to initialize: %s\n", id, strerror(errno));
+        return false;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &r->listen_fd;
+    epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->listen_fd, &ev);
+
+    ev.data.ptr = &r->wake_fd;
+    epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wake_fd, &ev);
+
+    ev.data.ptr = &r->probe_fd;
+    epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->probe_fd, &ev);
+
+    char name[32];
+    snprintf(name, sizeof(name), "epoll-%d", id);
+    r->loop_id = overload_register_loop(name);
+    return true;
+}
+
+// One-shot probe at an absolute deadline
+static void arm_probe(Reactor* r, uint64_t due_us) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t)(due_us / 1000000);
+    its.it_value.tv_nsec = (long)(due_us % 1000000) * 1000;
+    timerfd_settime(r->probe_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+    r->probe_due = due_us;
+}
+
+static void reactor_destroy(Reactor* r) {
+    if (r->epfd >= 0) close(r->epfd);
+    if (r->listen_fd >= 0) close(r->listen_fd);
+    if (r->wake_fd >= 0) close(r->wake_fd);
+    if (r->probe_fd >= 0) close(r->probe_fd);
+    omp_destroy_lock(&r->wake_lock);
+}
+
+static void reactor_loop(Reactor* r, bool pin_cpu) {
+    t_reactor = r;
+
+    if (pin_cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(r->id, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    arm_probe(r, overload_first_due());
+    int timeout_ms = 50;
+
+    while (*r->running) {
+        int n = epoll_wait(r->epfd, events, EPOLL_MAX_EVENTS, timeout_ms);
+        if (n < 0 && errno != EINTR) {
+            perror("[Epoll] epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void* tag = events[i].data.ptr;
+
+            if (tag == &r->listen_fd) {
+                accept_connections(r);
+                continue;
+            }
+            if (tag == &r->wake_fd) {
+                uint64_t count;
+                ssize_t rd = read(r->wake_fd, &count, sizeof(count));
+                (void)rd;
+                continue;
+            }
+            if (tag == &r->probe_fd) {
+                uint64_t expirations;
+                ssize_t rd = read(r->probe_fd, &expirations, sizeof(expirations));
+                (void)rd;
+                arm_probe(r, overload_probe(r->loop_id, r->probe_due));
+                continue;
+            }
+
+            EpollConn* c = (EpollConn*)tag;
+            uint32_t ev = events[i].events;
+
+            if (ev & EPOLLOUT) {
+                c->writable = true;
+                if (!conn_flush(c)) continue;
+            }
+            // TLS may need to read or finish its handshake after a write became possible
+            if ((ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) || c->ssl) {
+                if (!conn_on_readable(c)) continue;
+            }
+        }
+
+        // Admission deadlines may admit joins owned by any reactor
+        server_on_tick();
+
+        // Overloaded: let broadcasts pile up per connection for a batch window
+        // so each flush is one larger write instead of one per loop pass
+        timeout_ms = 50;
+        int window_ms = overload_batch_window_ms();
+        if (window_ms == 0) {
+            drain_wake_list(r);
+            continue;
+        }
+        uint64_t now = overload_now_us();
+        if (now >= r->next_drain) {
+            drain_wake_list(r);
+            r->next_drain = now + (uint64_t)window_ms * 1000;
+            continue;
+        }
+        omp_set_lock(&r->wake_lock);
+        bool pending = !r->wake_list.empty();
+        omp_unset_lock(&r->wake_lock);
+        if (pending) {
+            overload_count_deferred_flush();
+            timeout_ms = (int)((r->next_drain - now + 999) / 1000);
+        }
+    }
+
+    // Shutdown: close everything this reactor owns
+    while (r->conns) {
+        conn_close(r->conns);
+    }
+    t_reactor = nullptr;
+}
+
+int epoll_server_run(const ServerOptions& opts, volatile int* running) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    int threads = opts.threads > 0 ? opts.threads : (int)cpus;
+    bool pin_cpu = threads <= cpus;
+
+    SSL_CTX* tls_ctx = nullptr;
+    if (opts.tls_enabled()) {
+        tls_ctx = tls_create_server_ctx(opts);
+        if (!tls_ctx) return 1;
+    }
+
+    std::vector<Reactor> reactors(threads);
+    for (int i = 0; i < threads; i++) {
+        if (!reactor_init(&reactors[i], i, &opts, running, tls_ctx)) {
+            for (int j = 0; j <= i; j++) reactor_destroy(&reactors[j]);
+            tls_destroy_server_ctx(tls_ctx);
+            return 1;
+        }
+    }
+
+    printf("[Server] Listening on port %d (epoll, %d reactor%s%s)\n",
+           opts.port, threads, threads == 1 ? "" : "s", tls_ctx ? ", wss" : "");
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) {
+        workers.push_back(std::thread(reactor_loop, &reactors[i], pin_cpu));
+    }
+    reactor_loop(&reactors[0], pin_cpu);
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    for (int i = 0; i < threads; i++) {
+        reactor_destroy(&reactors[i]);
+    }
+    tls_destroy_server_ctx(tls_ctx);
+    return 0;
+}
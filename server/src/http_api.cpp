@@ -0,0 +1,418 @@
+#include "http_api.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define HTTP_MAX_REQUEST (1024 * 1024)
+#define HTTP_IO_TIMEOUT_MS 2000
+
+struct HttpRoute {
+    std::string method;
+    std::string path;
+    HttpHandler fn;
+    HttpStreamHandler stream_fn;
+    void* user;
+};
+
+struct HttpStream {
+    int fd;
+    bool failed;
+};
+
+// A running stream handler and the request it owns
+struct StreamSlot {
+    std::thread thread;
+    std::atomic<bool> done;
+    HttpStream stream;
+    std::string method;
+    std::string path;
+    std::string query;
+    std::string headers;
+    std::string body;
+};
+
+static std::vector<HttpRoute> g_routes;
+static std::thread g_thread;
+static std::atomic<bool> g_running(false);
+static int g_listen_fd = -1;
+static StreamSlot g_streams[HTTP_STREAMS_MAX];
+
+static void add_route(const char* method, const char* path, HttpHandler fn, HttpStreamHandler stream_fn,
+                      void* user) {
+    HttpRoute route;
+    route.method = method;
+    route.path = path;
+    route.fn = fn;
+    route.stream_fn = stream_fn;
+    route.user = user;
+    g_routes.push_back(route);
+}
+
+void http_api_route(const char* method, const char* path, HttpHandler fn, void* user) {
+    add_route(method, path, fn, nullptr, user);
+}
+
+void http_api_stream_route(const char* method, const char* path, HttpStreamHandler fn, void* user) {
+    add_route(method, path, nullptr, fn, user);
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool http_query_param(const char* query, const char* name, std::string* out) {
+    size_t name_len = strlen(name);
+    const char* p = query;
+    while (p && *p) {
+        const char* end = strchr(p, '&');
+        if (!end) end = p + strlen(p);
+        const char* eq = (const char*)memchr(p, '=', end - p);
+        const char* key_end = eq ? eq : end;
+        if ((size_t)(key_end - p) == name_len && strncmp(p, name, name_len) == 0) {
+            out->clear();
+            for (const char* v = eq ? eq + 1 : end; v < end; v++) {
+                if (*v == '+') {
+                    out->push_back(' ');
+                } else if (*v == '%' && v + 2 < end && hex_value(v[1]) >= 0 && hex_value(v[2]) >= 0) {
+                    out->push_back((char)(hex_value(v[1]) * 16 + hex_value(v[2])));
+                    v += 2;
+                } else {
+                    out->push_back(*v);
+                }
+            }
+            return true;
+        }
+        p = *end ? end + 1 : nullptr;
+    }
+    return false;
+}
+
+bool http_header(const HttpRequest& req, const char* name, std::string* out) {
+    size_t name_len = strlen(name);
+    const char* p = req.headers;
+    while (p && *p) {
+        const char* end = strstr(p, "\r\n");
+        if (!end) end = p + strlen(p);
+        if ((size_t)(end - p) > name_len && p[name_len] == ':' && strncasecmp(p, name, name_len) == 0) {
+            const char* v = p + name_len + 1;
+            while (v < end && (*v == ' ' || *v == '\t')) v++;
+            const char* v_end = end;
+            while (v_end > v && (v_end[-1] == ' ' || v_end[-1] == '\t')) v_end--;
+            out->assign(v, v_end - v);
+            return true;
+        }
+        p = *end ? end + 2 : nullptr;
+    }
+    return false;
+}
+
+void http_json_string(std::string* out, const char* s, size_t len) {
+    out->push_back('"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            out->push_back('\\');
+            out->push_back((char)c);
+        } else if (c == '\n') {
+            out->append("\\n");
+        } else if (c == '\r') {
+            out->append("\\r");
+        } else if (c == '\t') {
+            out->append("\\t");
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out->append(esc);
+        } else {
+            out->push_back((char)c);
+        }
+    }
+    out->push_back('"');
+}
+
+static const char* status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 410: return "Gone";
+        case 413: return "Payload Too Large";
+        case 503: return "Service Unavailable";
+        default: return status < 400 ? "OK" : "Error";
+    }
+}
+
+static bool write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static void send_response(int fd, const HttpResponse& resp) {
+    char header[256];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %d %s\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Connection: close\r\n",
+                     resp.status, status_text(resp.status), resp.content_type, resp.body.size());
+    if (write_all(fd, header, (size_t)n) && write_all(fd, resp.headers.data(), resp.headers.size()) &&
+        write_all(fd, "\r\n", 2)) {
+        write_all(fd, resp.body.data(), resp.body.size());
+    }
+}
+
+static void send_error(int fd, int status, const char* message) {
+    HttpResponse resp;
+    resp.status = status;
+    resp.body = "{\"error\":";
+    http_json_string(&resp.body, message, strlen(message));
+    resp.body += "}";
+    send_response(fd, resp);
+}
+
+// Read headers plus Content-Length bytes of body; returns header length (0 on failure)
+static size_t read_request(int fd, std::string* buf, size_t* body_len) {
+    char chunk[4096];
+    size_t header_len = 0;
+    *body_len = 0;
+
+    for (;;) {
+        if (header_len == 0) {
+            size_t end = buf->find("\r\n\r\n");
+            if (end != std::string::npos) {
+                header_len = end + 4;
+                const char* cl = strcasestr(buf->c_str(), "\r\nContent-Length:");
+                if (cl && (size_t)(cl - buf->c_str()) < header_len) {
+                    *body_len = (size_t)strtoul(cl + 17, nullptr, 10);
+                }
+                if (*body_len > HTTP_MAX_REQUEST) return 0;
+            }
+        }
+        if (header_len > 0 && buf->size() >= header_len + *body_len) return header_len;
+        if (buf->size() > HTTP_MAX_REQUEST) return 0;
+
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        buf->append(chunk, (size_t)n);
+    }
+}
+
+bool http_stream_begin(HttpStream* stream, int status, const char* content_type) {
+    char header[256];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %d %s\r\n"
+                     "Content-Type: %s\r\n"
+                     "Transfer-Encoding: chunked\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "Connection: close\r\n"
+                     "\r\n",
+                     status, status_text(status), content_type);
+    if (!write_all(stream->fd, header, (size_t)n)) stream->failed = true;
+    return !stream->failed;
+}
+
+bool http_stream_write(HttpStream* stream, const char* data, size_t len) {
+    if (stream->failed) return false;
+    if (len == 0) return true;
+
+    char size_line[24];
+    int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    if (!write_all(stream->fd, size_line, (size_t)n) || !write_all(stream->fd, data, len) ||
+        !write_all(stream->fd, "\r\n", 2)) {
+        stream->failed = true;
+    }
+    return !stream->failed;
+}
+
+bool http_stream_running(const HttpStream* stream) {
+    return g_running && !stream->failed;
+}
+
+static void run_stream(StreamSlot* slot, HttpStreamHandler fn, void* user) {
+    HttpRequest req;
+    req.method = slot->method.c_str();
+    req.path = slot->path.c_str();
+    req.query = slot->query.c_str();
+    req.headers = slot->headers.c_str();
+    req.body = (const uint8_t*)slot->body.data();
+    req.body_len = slot->body.size();
+
+    fn(req, &slot->stream, user);
+
+    // Terminating chunk, then close
+    if (!slot->stream.failed) write_all(slot->stream.fd, "0\r\n\r\n", 5);
+    close(slot->stream.fd);
+    slot->done = true;
+}
+
+// Hand the connection to a stream thread; false when all slots are busy
+static bool start_stream(int fd, const HttpRoute& route, const std::string& method, const std::string& path,
+                         const std::string& query, const std::string& headers, const std::string& body) {
+    for (int i = 0; i < HTTP_STREAMS_MAX; i++) {
+        StreamSlot* slot = &g_streams[i];
+        if (slot->thread.joinable()) {
+            if (!slot->done) continue;
+            slot->thread.join();
+        }
+
+        // Streams block on writes with SO_SNDTIMEO; a consumer that stops reading is dropped
+        slot->done = false;
+        slot->stream.fd = fd;
+        slot->stream.failed = false;
+        slot->method = method;
+        slot->path = path;
+        slot->query = query;
+        slot->headers = headers;
+        slot->body = body;
+        slot->thread = std::thread(run_stream, slot, route.stream_fn, route.user);
+        return true;
+    }
+    return false;
+}
+
+// Returns true if the connection was handed to a stream thread (which closes it)
+static bool serve_connection(int fd) {
+    struct timeval tv;
+    tv.tv_sec = HTTP_IO_TIMEOUT_MS / 1000;
+    tv.tv_usec = (HTTP_IO_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string buf;
+    size_t body_len = 0;
+    size_t header_len = read_request(fd, &buf, &body_len);
+    if (header_len == 0) {
+        send_error(fd, 400, "malformed request");
+        return false;
+    }
+
+    // "METHOD /path?query HTTP/1.1"
+    size_t line_end = buf.find("\r\n");
+    std::string line = buf.substr(0, line_end);
+    std::string headers = buf.substr(line_end + 2, header_len - 2 - (line_end + 2));
+    size_t sp1 = line.find(' ');
+    size_t sp2 = sp1 == std::string::npos ? std::string::npos : line.find(' ', sp1 + 1);
+    if (sp2 == std::string::npos) {
+        send_error(fd, 400, "malformed request line");
+        return false;
+    }
+    std::string method = line.substr(0, sp1);
+    std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    size_t q = target.find('?');
+    std::string path = target.substr(0, q);
+    std::string query = q == std::string::npos ? "" : target.substr(q + 1);
+
+    bool path_known = false;
+    for (size_t i = 0; i < g_routes.size(); i++) {
+        const HttpRoute& route = g_routes[i];
+        if (route.path != path) continue;
+        path_known = true;
+        if (route.method != method) continue;
+
+        if (route.stream_fn) {
+            if (start_stream(fd, route, method, path, query, headers, buf.substr(header_len, body_len))) return true;
+            send_error(fd, 503, "too many streams");
+            return false;
+        }
+
+        HttpRequest req;
+        req.method = method.c_str();
+        req.path = path.c_str();
+        req.query = query.c_str();
+        req.headers = headers.c_str();
+        req.body = (const uint8_t*)buf.data() + header_len;
+        req.body_len = body_len;
+
+        HttpResponse resp;
+        route.fn(req, &resp, route.user);
+        send_response(fd, resp);
+        return false;
+    }
+
+    if (path_known) send_error(fd, 405, "method not allowed");
+    else send_error(fd, 404, "not found");
+    return false;
+}
+
+static void http_loop() {
+    while (g_running) {
+        struct pollfd pfd;
+        pfd.fd = g_listen_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 200) <= 0) continue;
+
+        int fd = accept4(g_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        if (!serve_connection(fd)) close(fd);
+    }
+}
+
+bool http_api_start(int port) {
+    if (port <= 0) {
+        g_routes.clear();
+        return true;
+    }
+
+    // Loopback only: the API exposes document contents and internals
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        fprintf(stderr, "[HTTP] Failed to listen on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    g_listen_fd = fd;
+    g_running = true;
+    g_thread = std::thread(http_loop);
+    printf("[HTTP] API listening on 127.0.0.1:%d\n", port);
+    return true;
+}
+
+void http_api_stop() {
+    if (!g_running) return;
+    g_running = false;
+    g_thread.join();
+    for (int i = 0; i < HTTP_STREAMS_MAX; i++) {
+        if (g_streams[i].thread.joinable()) g_streams[i].thread.join();
+    }
+    close(g_listen_fd);
+    g_listen_fd = -1;
+    g_routes.clear();
+}
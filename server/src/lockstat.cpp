@@ -0,0 +1,251 @@
+#include "lockstat.h"
+#include "threadstat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Table slots 0..LOCK_CLASS_COUNT-1 collect sites past LOCKSTAT_MAX_SITES, per class
+#define SITE_SLOTS (LOCK_CLASS_COUNT + LOCKSTAT_MAX_SITES)
+
+struct SiteCounters {
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t wait_max_ns;
+    uint64_t hold_samples;
+    uint64_t hold_ns;
+    uint64_t hold_max_ns;
+    uint64_t wait_hist[LOCKSTAT_BUCKETS];
+    uint64_t hold_hist[LOCKSTAT_BUCKETS];
+};
+
+// Per-thread table (threadstat.h)
+struct LockThreadCounters {
+    SiteCounters sites[SITE_SLOTS];
+    uint32_t tick;              // Acquisitions so far, picks the hold samples
+    int owned;
+    LockThreadCounters* next;
+};
+
+static LockSite* g_sites[SITE_SLOTS];
+static int g_site_class[SITE_SLOTS];
+static int g_next_slot = LOCK_CLASS_COUNT;
+static LockThreadCounters* g_threads = nullptr;
+static thread_local LockThreadCounters* t_counters = nullptr;
+static thread_local ThreadStatOwner t_owner;
+
+static const char* CLASS_NAMES[LOCK_CLASS_COUNT] = { "peers", "peer", "rooms", "members" };
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void release_counters() {
+    threadstat_release(t_counters);
+    t_counters = nullptr;
+}
+
+static LockThreadCounters* get_counters() {
+    if (!t_counters) {
+        t_counters = threadstat_attach(&g_threads);
+        t_owner.release = release_counters;
+    }
+    return t_counters;
+}
+
+// Give a site its slot; a thread that loses the race uses the winner's
+static int register_site(LockSite* site, int cls) {
+    int slot = __atomic_fetch_add(&g_next_slot, 1, __ATOMIC_RELAXED);
+    if (slot < SITE_SLOTS) {
+        g_site_class[slot] = cls;
+        __atomic_store_n(&g_sites[slot], site, __ATOMIC_RELEASE);
+    } else {
+        slot = cls;
+    }
+
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&site->id, &expected, slot + 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return slot + 1;
+    }
+    if (slot >= LOCK_CLASS_COUNT) __atomic_store_n(&g_sites[slot], (LockSite*)nullptr, __ATOMIC_RELEASE);
+    return expected;
+}
+
+static int bucket_of(uint64_t ns) {
+    return threadstat_bucket(ns, 6, LOCKSTAT_BUCKETS);
+}
+
+void profiled_lock_init(ProfiledLock* l, LockClass cls) {
+    omp_init_lock(&l->lock);
+    l->cls = cls;
+    l->holder = nullptr;
+    l->acquired_ns = 0;
+}
+
+void profiled_lock_destroy(ProfiledLock* l) {
+    omp_destroy_lock(&l->lock);
+}
+
+void profiled_lock_acquire(ProfiledLock* l, LockSite* site) {
+    int id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+    if (!id) id = register_site(site, l->cls);
+    LockThreadCounters* t = get_counters();
+    SiteCounters* c = &t->sites[id - 1];
+    bool sample = (++t->tick & (LOCKSTAT_HOLD_SAMPLE - 1)) == 0;
+
+    uint64_t got = 0;
+    if (!omp_test_lock(&l->lock)) {
+        uint64_t start = now_ns();
+        omp_set_lock(&l->lock);
+        got = now_ns();
+        uint64_t wait = got - start;
+        threadstat_bump(&c->contended, 1);
+        threadstat_bump(&c->wait_ns, wait);
+        threadstat_raise_max(&c->wait_max_ns, wait);
+        threadstat_bump(&c->wait_hist[bucket_of(wait)], 1);
+    } else if (sample) {
+        got = now_ns();
+    }
+    threadstat_bump(&c->acquisitions, 1);
+    l->holder = site;
+    l->acquired_ns = sample ? got : 0;
+}
+
+void profiled_lock_release(ProfiledLock* l) {
+    LockSite* site = l->holder;
+    uint64_t acquired = l->acquired_ns;
+    l->holder = nullptr;
+    if (!acquired || !site) {
+        omp_unset_lock(&l->lock);
+        return;
+    }
+    uint64_t hold = now_ns() - acquired;
+    omp_unset_lock(&l->lock);
+
+    SiteCounters* c = &get_counters()->sites[__atomic_load_n(&site->id, __ATOMIC_ACQUIRE) - 1];
+    threadstat_bump(&c->hold_samples, 1);
+    threadstat_bump(&c->hold_ns, hold);
+    threadstat_raise_max(&c->hold_max_ns, hold);
+    threadstat_bump(&c->hold_hist[bucket_of(hold)], 1);
+}
+
+const char* lockstat_class_name(int cls) {
+    return cls >= 0 && cls < LOCK_CLASS_COUNT ? CLASS_NAMES[cls] : "unknown";
+}
+
+uint64_t lockstat_bucket_ns(int bucket) {
+    return 64ull << bucket;
+}
+
+uint64_t lockstat_quantile_ns(const uint64_t* hist, double q) {
+    uint64_t total = 0;
+    for (int b = 0; b < LOCKSTAT_BUCKETS; b++) total += hist[b];
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < LOCKSTAT_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) return lockstat_bucket_ns(b);
+    }
+    return lockstat_bucket_ns(LOCKSTAT_BUCKETS - 1);
+}
+
+static void add_counters(LockStats* out, const SiteCounters* c) {
+    out->acquisitions += __atomic_load_n(&c->acquisitions, __ATOMIC_RELAXED);
+    out->contended += __atomic_load_n(&c->contended, __ATOMIC_RELAXED);
+    out->wait_ns += __atomic_load_n(&c->wait_ns, __ATOMIC_RELAXED);
+    out->hold_samples += __atomic_load_n(&c->hold_samples, __ATOMIC_RELAXED);
+    out->hold_ns += __atomic_load_n(&c->hold_ns, __ATOMIC_RELAXED);
+    uint64_t wait_max = __atomic_load_n(&c->wait_max_ns, __ATOMIC_RELAXED);
+    uint64_t hold_max = __atomic_load_n(&c->hold_max_ns, __ATOMIC_RELAXED);
+    if (wait_max > out->wait_max_ns) out->wait_max_ns = wait_max;
+    if (hold_max > out->hold_max_ns) out->hold_max_ns = hold_max;
+    for (int b = 0; b < LOCKSTAT_BUCKETS; b++) {
+        out->wait_hist[b] += __atomic_load_n(&c->wait_hist[b], __ATOMIC_RELAXED);
+        out->hold_hist[b] += __atomic_load_n(&c->hold_hist[b], __ATOMIC_RELAXED);
+    }
+}
+
+static void merge_slot(LockStats* out, int slot) {
+    for (LockThreadCounters* t = __atomic_load_n(&g_threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+        add_counters(out, &t->sites[slot]);
+    }
+}
+
+static void add_stats(LockStats* out, const LockStats& s) {
+    out->acquisitions += s.acquisitions;
+    out->contended += s.contended;
+    out->wait_ns += s.wait_ns;
+    out->hold_samples += s.hold_samples;
+    out->hold_ns += s.hold_ns;
+    if (s.wait_max_ns > out->wait_max_ns) out->wait_max_ns = s.wait_max_ns;
+    if (s.hold_max_ns > out->hold_max_ns) out->hold_max_ns = s.hold_max_ns;
+    for (int b = 0; b < LOCKSTAT_BUCKETS; b++) {
+        out->wait_hist[b] += s.wait_hist[b];
+        out->hold_hist[b] += s.hold_hist[b];
+    }
+}
+
+int lockstat_get(LockStats classes[LOCK_CLASS_COUNT], LockStats* sites, int max_sites) {
+    memset(classes, 0, sizeof(LockStats) * LOCK_CLASS_COUNT);
+    for (int cls = 0; cls < LOCK_CLASS_COUNT; cls++) classes[cls].cls = cls;
+
+    int count = 0;
+    int slots = __atomic_load_n(&g_next_slot, __ATOMIC_RELAXED);
+    if (slots > SITE_SLOTS) slots = SITE_SLOTS;
+    for (int slot = 0; slot < slots; slot++) {
+        LockStats s;
+        memset(&s, 0, sizeof(s));
+        if (slot < LOCK_CLASS_COUNT) {
+            s.cls = slot;
+            s.file = "(other)";
+            s.func = "";
+        } else {
+            LockSite* site = __atomic_load_n(&g_sites[slot], __ATOMIC_ACQUIRE);
+            if (!site) continue;
+            s.cls = g_site_class[slot];
+            s.file = site->file;
+            s.func = site->func;
+            s.line = site->line;
+        }
+        merge_slot(&s, slot);
+        if (s.acquisitions == 0) continue;
+
+        add_stats(&classes[s.cls], s);
+        if (sites && count < max_sites) sites[count++] = s;
+    }
+    return count;
+}
+
+void lockstat_print_stats() {
+    LockStats classes[LOCK_CLASS_COUNT];
+    LockStats sites[SITE_SLOTS];
+    int count = lockstat_get(classes, sites, SITE_SLOTS);
+
+    for (int cls = 0; cls < LOCK_CLASS_COUNT; cls++) {
+        const LockStats& c = classes[cls];
+        if (c.acquisitions == 0) continue;
+        printf("[Locks] %s: %llu acquisitions, %llu contended (%.2f%%), wait %.1f us total, %.1f us max; "
+               "hold p50 < %llu ns, p99 < %llu ns, max %.1f us\n",
+               lockstat_class_name(cls), (unsigned long long)c.acquisitions,
+               (unsigned long long)c.contended, 100.0 * c.contended / c.acquisitions,
+               c.wait_ns / 1000.0, c.wait_max_ns / 1000.0,
+               (unsigned long long)lockstat_quantile_ns(c.hold_hist, 0.5),
+               (unsigned long long)lockstat_quantile_ns(c.hold_hist, 0.99), c.hold_max_ns / 1000.0);
+
+        const LockStats* worst = nullptr;
+        for (int i = 0; i < count; i++) {
+            if (sites[i].cls != cls || sites[i].contended == 0) continue;
+            if (!worst || sites[i].wait_ns > worst->wait_ns) worst = &sites[i];
+        }
+        if (worst) {
+            printf("[Locks]   most waited on at %s (%s:%d): %llu contended, %.1f us\n", worst->func,
+                   worst->file, worst->line, (unsigned long long)worst->contended, worst->wait_ns / 1000.0);
+        }
+    }
+}
@@ -1,25 +1,112 @@
 #include "server.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+static void print_usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [port] [--engine lws|epoll] [--threads N] [--rx-buffer BYTES] [--quiet]\n"
+                    "       [--max-rooms N]\n"
+                    "       [--tls-cert PEM --tls-key PEM] [--no-ktls]\n"
+                    "       [--sync-room-limit N] [--sync-limit N] [--sync-max-wait MS]\n"
+                    "       [--overload-lag BATCH,AWARENESS,JOINS] [--no-shed] [--talkers-window S]\n"
+                    "       [--http-port N] [--search] [--render] [--cdc MB]\n", prog);
+}
 
 int main(int argc, char* argv[]) {
-    int port = 9000;
+    ServerOptions opts;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
 
-    if (argc > 1) {
-        port = atoi(argv[1]);
-        if (port <= 0 || port > 65535) {
-            fprintf(stderr, "Invalid port: %s\n", argv[1]);
-            fprintf(stderr, "Usage: %s [port]\n", argv[0]);
+        if (strcmp(arg, "--engine") == 0 && i + 1 < argc) {
+            const char* engine = argv[++i];
+            if (strcmp(engine, "lws") == 0) {
+                opts.engine = ENGINE_LWS;
+            } else if (strcmp(engine, "epoll") == 0) {
+                opts.engine = ENGINE_EPOLL;
+            } else {
+                fprintf(stderr, "Unknown engine: %s\n", engine);
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(arg, "--threads") == 0 && i + 1 < argc) {
+            opts.threads = atoi(argv[++i]);
+        } else if (strcmp(arg, "--rx-buffer") == 0 && i + 1 < argc) {
+            long size = atol(argv[++i]);
+            if (size < 1024) {
+                fprintf(stderr, "Invalid receive buffer size: %s\n", argv[i]);
+                return 1;
+            }
+            opts.rx_buffer_size = (size_t)size;
+        } else if (strcmp(arg, "--max-rooms") == 0 && i + 1 < argc) {
+            opts.max_rooms = atoi(argv[++i]);
+            if (opts.max_rooms < 0) {
+                fprintf(stderr, "Invalid room limit: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(arg, "--tls-cert") == 0 && i + 1 < argc) {
+            opts.tls_cert = argv[++i];
+        } else if (strcmp(arg, "--tls-key") == 0 && i + 1 < argc) {
+            opts.tls_key = argv[++i];
+        } else if (strcmp(arg, "--no-ktls") == 0) {
+            opts.tls_ktls = false;
+        } else if (strcmp(arg, "--sync-room-limit") == 0 && i + 1 < argc) {
+            opts.admission.per_room = atoi(argv[++i]);
+        } else if (strcmp(arg, "--sync-limit") == 0 && i + 1 < argc) {
+            opts.admission.per_process = atoi(argv[++i]);
+        } else if (strcmp(arg, "--sync-max-wait") == 0 && i + 1 < argc) {
+            opts.admission.max_wait_ms = atoi(argv[++i]);
+        } else if (strcmp(arg, "--overload-lag") == 0 && i + 1 < argc) {
+            OverloadLimits& o = opts.overload;
+            if (sscanf(argv[++i], "%d,%d,%d", &o.batch_lag_ms, &o.awareness_lag_ms, &o.join_lag_ms) != 3 ||
+                o.batch_lag_ms < 1 || o.awareness_lag_ms < o.batch_lag_ms || o.join_lag_ms < o.awareness_lag_ms) {
+                fprintf(stderr, "Invalid overload thresholds (ascending ms): %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(arg, "--no-shed") == 0) {
+            opts.overload.shed = false;
+        } else if (strcmp(arg, "--talkers-window") == 0 && i + 1 < argc) {
+            opts.talkers_window = atoi(argv[++i]);
+        } else if (strcmp(arg, "--http-port") == 0 && i + 1 < argc) {
+            opts.http_port = atoi(argv[++i]);
+        } else if (strcmp(arg, "--search") == 0) {
+            opts.search_index = true;
+        } else if (strcmp(arg, "--render") == 0) {
+            opts.render_preview = true;
+        } else if (strcmp(arg, "--cdc") == 0 && i + 1 < argc) {
+            long mb = atol(argv[++i]);
+            if (mb < 1) {
+                fprintf(stderr, "Invalid change feed buffer: %s\n", argv[i]);
+                return 1;
+            }
+            opts.cdc_buffer = (size_t)mb << 20;
+        } else if (strcmp(arg, "--quiet") == 0) {
+            opts.log_messages = false;
+        } else if (arg[0] != '-') {
+            opts.port = atoi(arg);
+            if (opts.port <= 0 || opts.port > 65535) {
+                fprintf(stderr, "Invalid port: %s\n", arg);
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else {
+            print_usage(argv[0]);
             return 1;
         }
     }
 
+    if ((opts.tls_cert != nullptr) != (opts.tls_key != nullptr)) {
+        fprintf(stderr, "--tls-cert and --tls-key must be given together\n");
+        return 1;
+    }
+
     printf("========================================\n");
     printf("CRDT WebSocket Server v2\n");
     printf("========================================\n");
-    printf("Starting server on port %d...\n", port);
+    printf("Starting server on port %d (%s engine%s)...\n", opts.port,
+           opts.engine == ENGINE_EPOLL ? "epoll" : "lws", opts.tls_enabled() ? ", TLS" : "");
 
-    int result = server_run(port);
+    int result = server_run(opts);
 
     printf("========================================\n");
     return result;
@@ -0,0 +1,270 @@
+#include "overload.h"
+#include <omp.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+
+struct LoopState {
+    OverloadLoopStats stats;
+    uint64_t next_due;          // Deadline of the armed probe (0 = none yet)
+};
+
+static omp_lock_t g_lock;       // Guards loops and the level bookkeeping
+static OverloadLimits g_limits;
+static LoopState g_loops[OVERLOAD_MAX_LOOPS];
+static int g_loop_count = 0;
+
+static std::atomic<int> g_level(OVERLOAD_NONE);
+static uint64_t g_last_over[4];         // Last time a lag reached each level's threshold
+static uint64_t g_level_since = 0;
+static uint64_t g_ms_at[4];
+static uint64_t g_transitions = 0;
+
+static std::atomic<uint64_t> g_deferred_flushes(0);
+static std::atomic<uint64_t> g_awareness_shed(0);
+static std::atomic<uint64_t> g_joins_refused(0);
+
+static const char* level_name(int level) {
+    switch (level) {
+        case OVERLOAD_BATCH: return "batch";
+        case OVERLOAD_SHED_AWARENESS: return "shed_awareness";
+        case OVERLOAD_REFUSE_JOINS: return "refuse_joins";
+        default: return "none";
+    }
+}
+
+uint64_t overload_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void overload_init(const OverloadLimits& limits) {
+    omp_init_lock(&g_lock);
+    g_limits = limits;
+    if (g_limits.probe_ms < 1) g_limits.probe_ms = 1;
+    memset(g_loops, 0, sizeof(g_loops));
+    g_loop_count = 0;
+    g_level.store(OVERLOAD_NONE);
+    memset(g_last_over, 0, sizeof(g_last_over));
+    memset(g_ms_at, 0, sizeof(g_ms_at));
+    g_level_since = overload_now_us();
+    g_transitions = 0;
+    g_deferred_flushes.store(0);
+    g_awareness_shed.store(0);
+    g_joins_refused.store(0);
+}
+
+void overload_destroy() {
+    omp_destroy_lock(&g_lock);
+}
+
+int overload_register_loop(const char* name) {
+    omp_set_lock(&g_lock);
+    int id = -1;
+    if (g_loop_count < OVERLOAD_MAX_LOOPS) {
+        id = g_loop_count++;
+        snprintf(g_loops[id].stats.name, sizeof(g_loops[id].stats.name), "%s", name);
+    }
+    omp_unset_lock(&g_lock);
+    return id;
+}
+
+uint64_t overload_first_due() {
+    return overload_now_us() + (uint64_t)g_limits.probe_ms * 1000;
+}
+
+static int bucket_of(uint64_t lag_us) {
+    int b = 0;
+    for (uint64_t v = lag_us >> 7; v != 0 && b < OVERLOAD_BUCKETS - 1; v >>= 1) b++;
+    return b;
+}
+
+// Note every threshold this lag reaches (caller holds g_lock)
+static void note_lag_locked(uint64_t now, uint64_t lag_us) {
+    const int thresholds[4] = { 0, g_limits.batch_lag_ms, g_limits.awareness_lag_ms,
+                                g_limits.join_lag_ms };
+    for (int level = OVERLOAD_BATCH; level <= OVERLOAD_REFUSE_JOINS; level++) {
+        if (lag_us >= (uint64_t)thresholds[level] * 1000) g_last_over[level] = now;
+    }
+}
+
+uint64_t overload_probe(int loop, uint64_t due_us) {
+    uint64_t now = overload_now_us();
+    uint64_t lag_us = now > due_us ? now - due_us : 0;
+    uint64_t next = now + (uint64_t)g_limits.probe_ms * 1000;
+    if (loop < 0) return next;
+
+    omp_set_lock(&g_lock);
+    LoopState* l = &g_loops[loop];
+    l->stats.probes++;
+    l->stats.lag_us_total += lag_us;
+    if (lag_us > l->stats.lag_us_max) l->stats.lag_us_max = lag_us;
+    l->stats.buckets[bucket_of(lag_us)]++;
+    l->next_due = next;
+    note_lag_locked(now, lag_us);
+
+    // A loop stuck in one callback never gets to report; its overdue probe counts as lag
+    const char* worst = l->stats.name;
+    uint64_t worst_lag = lag_us;
+    for (int i = 0; i < g_loop_count; i++) {
+        uint64_t due = g_loops[i].next_due;
+        if (i == loop || due == 0 || now <= due) continue;
+        note_lag_locked(now, now - due);
+        if (now - due > worst_lag) {
+            worst_lag = now - due;
+            worst = g_loops[i].stats.name;
+        }
+    }
+
+    int level = OVERLOAD_NONE;
+    uint64_t cooldown_us = (uint64_t)g_limits.cooldown_ms * 1000;
+    for (int k = OVERLOAD_REFUSE_JOINS; k > OVERLOAD_NONE; k--) {
+        if (g_last_over[k] != 0 && now - g_last_over[k] < cooldown_us) {
+            level = k;
+            break;
+        }
+    }
+
+    int old = g_level.load();
+    if (level != old) {
+        g_ms_at[old] += (now - g_level_since) / 1000;
+        g_level_since = now;
+        g_transitions++;
+        g_level.store(level);
+        if (level > old) {
+            printf("[Overload] Level %s -> %s (%s lag %.1f ms)%s\n", level_name(old), level_name(level),
+                   worst, worst_lag / 1000.0, g_limits.shed ? "" : " [not shedding]");
+        } else {
+            printf("[Overload] Level %s -> %s (recovered)\n", level_name(old), level_name(level));
+        }
+    }
+    omp_unset_lock(&g_lock);
+    return next;
+}
+
+OverloadLevel overload_level() {
+    return g_limits.shed ? (OverloadLevel)g_level.load(std::memory_order_relaxed) : OVERLOAD_NONE;
+}
+
+int overload_batch_window_ms() {
+    return overload_level() >= OVERLOAD_BATCH ? g_limits.batch_window_ms : 0;
+}
+
+bool overload_shed_awareness() {
+    if (overload_level() < OVERLOAD_SHED_AWARENESS) return false;
+    g_awareness_shed.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool overload_refuse_join() {
+    if (overload_level() < OVERLOAD_REFUSE_JOINS) return false;
+    g_joins_refused.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void overload_count_deferred_flush() {
+    g_deferred_flushes.fetch_add(1, std::memory_order_relaxed);
+}
+
+void overload_get_stats(OverloadStats* out, OverloadLoopStats* loops, int max_loops) {
+    uint64_t now = overload_now_us();
+    omp_set_lock(&g_lock);
+    out->level = (OverloadLevel)g_level.load();
+    out->loops = g_loop_count;
+    out->transitions = g_transitions;
+    memcpy(out->ms_at, g_ms_at, sizeof(out->ms_at));
+    out->ms_at[out->level] += (now - g_level_since) / 1000;
+    if (loops) {
+        for (int i = 0; i < g_loop_count && i < max_loops; i++) loops[i] = g_loops[i].stats;
+    }
+    omp_unset_lock(&g_lock);
+    out->deferred_flushes = g_deferred_flushes.load();
+    out->awareness_shed = g_awareness_shed.load();
+    out->joins_refused = g_joins_refused.load();
+}
+
+void overload_print_stats() {
+    OverloadStats s;
+    static OverloadLoopStats loops[OVERLOAD_MAX_LOOPS];
+    overload_get_stats(&s, loops, OVERLOAD_MAX_LOOPS);
+
+    uint64_t probes = 0, total = 0, max = 0;
+    for (int i = 0; i < s.loops; i++) {
+        probes += loops[i].probes;
+        total += loops[i].lag_us_total;
+        if (loops[i].lag_us_max > max) max = loops[i].lag_us_max;
+    }
+    if (probes == 0) return;
+
+    printf("[Overload] Loop lag avg %.2f ms max %.1f ms over %llu probes on %d loop(s)\n",
+           total / 1000.0 / probes, max / 1000.0, (unsigned long long)probes, s.loops);
+    if (s.transitions > 0) {
+        printf("[Overload] %llu level change(s); %llu ms batching, %llu ms shedding awareness, "
+               "%llu ms refusing joins; %llu flushes deferred, %llu awareness updates shed, "
+               "%llu joins refused\n",
+               (unsigned long long)s.transitions, (unsigned long long)s.ms_at[OVERLOAD_BATCH],
+               (unsigned long long)s.ms_at[OVERLOAD_SHED_AWARENESS],
+               (unsigned long long)s.ms_at[OVERLOAD_REFUSE_JOINS],
+               (unsigned long long)s.deferred_flushes, (unsigned long long)s.awareness_shed,
+               (unsigned long long)s.joins_refused);
+    }
+}
+
+void overload_handle_http(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)req;
+    (void)user;
+    OverloadStats s;
+    static thread_local OverloadLoopStats t_loops[OVERLOAD_MAX_LOOPS];
+    overload_get_stats(&s, t_loops, OVERLOAD_MAX_LOOPS);
+
+    std::string& out = resp->body;
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "{\"level\":\"%s\",\"shedding\":%s,\"limits\":{\"probe_ms\":%d,\"batch_lag_ms\":%d,"
+             "\"awareness_lag_ms\":%d,\"join_lag_ms\":%d,\"batch_window_ms\":%d,\"cooldown_ms\":%d},",
+             level_name(s.level), g_limits.shed ? "true" : "false", g_limits.probe_ms,
+             g_limits.batch_lag_ms, g_limits.awareness_lag_ms, g_limits.join_lag_ms,
+             g_limits.batch_window_ms, g_limits.cooldown_ms);
+    out.append(buf);
+    snprintf(buf, sizeof(buf),
+             "\"transitions\":%llu,\"ms_at\":{\"none\":%llu,\"batch\":%llu,\"shed_awareness\":%llu,"
+             "\"refuse_joins\":%llu},",
+             (unsigned long long)s.transitions, (unsigned long long)s.ms_at[0],
+             (unsigned long long)s.ms_at[1], (unsigned long long)s.ms_at[2],
+             (unsigned long long)s.ms_at[3]);
+    out.append(buf);
+    snprintf(buf, sizeof(buf),
+             "\"deferred_flushes\":%llu,\"awareness_shed\":%llu,\"joins_refused\":%llu,\"loops\":[",
+             (unsigned long long)s.deferred_flushes, (unsigned long long)s.awareness_shed,
+             (unsigned long long)s.joins_refused);
+    out.append(buf);
+
+    for (int i = 0; i < s.loops && i < OVERLOAD_MAX_LOOPS; i++) {
+        const OverloadLoopStats& l = t_loops[i];
+        if (i > 0) out.push_back(',');
+        out.append("{\"name\":");
+        http_json_string(&out, l.name, strlen(l.name));
+        snprintf(buf, sizeof(buf), ",\"probes\":%llu,\"lag_us_avg\":%llu,\"lag_us_max\":%llu,\"histogram\":[",
+                 (unsigned long long)l.probes,
+                 (unsigned long long)(l.probes ? l.lag_us_total / l.probes : 0),
+                 (unsigned long long)l.lag_us_max);
+        out.append(buf);
+        // Per-bucket counts: {"lt_us": upper bound (null = open-ended), "count": n}
+        for (int b = 0; b < OVERLOAD_BUCKETS; b++) {
+            if (b > 0) out.push_back(',');
+            if (b < OVERLOAD_BUCKETS - 1) {
+                snprintf(buf, sizeof(buf), "{\"lt_us\":%llu,\"count\":%llu}",
+                         (unsigned long long)(128ULL << b), (unsigned long long)l.buckets[b]);
+            } else {
+                snprintf(buf, sizeof(buf), "{\"lt_us\":null,\"count\":%llu}",
+                         (unsigned long long)l.buckets[b]);
+            }
+            out.append(buf);
+        }
+        out.append("]}");
+    }
+    out.append("]}");
+}
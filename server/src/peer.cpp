@@ -1,174 +1,341 @@
 #include "peer.h"
+#include "allocstat.h"
+#include "epoch.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <string.h>
 
 Peer* g_peers = nullptr;
-omp_lock_t g_peers_lock;
+ProfiledLock g_peers_lock;
+static int g_peer_count = 0;
+static uint32_t g_next_peer_id = 1;
+static void (*g_sync_drained)(Peer* p) = nullptr;
+static void (*g_dequeued)(Peer* p, size_t len) = nullptr;
+
+// Scheduler weights: bytes of credit a class earns per round
+static const size_t QUEUE_QUANTUM = 4096;
+static const size_t QUEUE_WEIGHT[PEER_QUEUE_COUNT] = {
+    2,      // PEER_QUEUE_SYNC
+    8,      // PEER_QUEUE_DOC
+    1       // PEER_QUEUE_AWARENESS
+};
+
+// Unlink every pending message (caller holds p->lock); returns them as one list
+static PendingMessage* take_all_messages(Peer* p) {
+    PendingMessage* all = nullptr;
+    for (int c = PEER_QUEUE_COUNT - 1; c >= 0; c--) {
+        PeerQueue* q = &p->queues[c];
+        if (q->tail) {
+            q->tail->next = all;
+            all = q->head;
+        }
+        q->head = nullptr;
+        q->tail = nullptr;
+        q->count = 0;
+        q->bytes = 0;
+        q->deficit = 0;
+    }
+    p->queued_bytes = 0;
+    return all;
+}
+
+static void free_message_list(PendingMessage* msg) {
+    while (msg) {
+        PendingMessage* next_msg = msg->next;
+        peer_free_message(msg);
+        msg = next_msg;
+    }
+}
 
 void peers_init() {
-    omp_init_lock(&g_peers_lock);
+    profiled_lock_init(&g_peers_lock, LOCK_CLASS_PEERS);
     g_peers = nullptr;
+    g_peer_count = 0;
 }
 
 void peers_destroy() {
-    omp_set_lock(&g_peers_lock);
+    LOCK_ACQUIRE(&g_peers_lock);
 
     Peer* p = g_peers;
     while (p) {
         Peer* next = p->next;
 
         // Free pending messages
-        omp_set_lock(&p->lock);
-        PendingMessage* msg = p->pending_queue;
-        while (msg) {
-            PendingMessage* next_msg = msg->next;
-            free(msg->data);
-            free(msg);
-            msg = next_msg;
-        }
-        omp_unset_lock(&p->lock);
-
-        if (p->awareness_json) {
-            free(p->awareness_json);
-            p->awareness_json = nullptr;
-            p->awareness_len = 0;
+        LOCK_ACQUIRE(&p->lock);
+        PendingMessage* msg = take_all_messages(p);
+        LOCK_RELEASE(&p->lock);
+        free_message_list(msg);
+
+        if (p->awareness_frame) {
+            ws_frame_release(p->awareness_frame);
+            p->awareness_frame = nullptr;
         }
 
-        omp_destroy_lock(&p->lock);
-        free(p);
+        profiled_lock_destroy(&p->lock);
+        tagged_free(p, ALLOC_PEER);
         p = next;
     }
 
     g_peers = nullptr;
-    omp_unset_lock(&g_peers_lock);
-    omp_destroy_lock(&g_peers_lock);
+    g_peer_count = 0;
+    LOCK_RELEASE(&g_peers_lock);
+    profiled_lock_destroy(&g_peers_lock);
 }
 
-Peer* peers_add(struct lws* wsi) {
-    Peer* p = (Peer*)calloc(1, sizeof(Peer));
-    p->wsi = wsi;
-    p->synced = false;
-    p->pending_queue = nullptr;
+Peer* peers_add(const PeerTransport* transport, void* conn) {
+    Peer* p = (Peer*)tagged_calloc(1, sizeof(Peer), ALLOC_PEER);
+    p->transport = transport;
+    p->conn = conn;
+    p->room = nullptr;
+    p->room_slot = -1;
+    p->editor = false;
+    p->closed = false;
+    p->admission = 0;
     p->client_id = 0;
-    p->awareness_json = nullptr;
-    p->awareness_len = 0;
-    omp_init_lock(&p->lock);
-
-    omp_set_lock(&g_peers_lock);
+    p->awareness_frame = nullptr;
+    p->mux = false;
+    p->channel = 0;
+    p->mux_parent = nullptr;
+    p->mux_children = nullptr;
+    p->mux_sibling = nullptr;
+    p->mux_cursor = nullptr;
+    profiled_lock_init(&p->lock, LOCK_CLASS_PEER);
+
+    LOCK_ACQUIRE(&g_peers_lock);
+    p->id = g_next_peer_id++;
     p->next = g_peers;
     g_peers = p;
-    omp_unset_lock(&g_peers_lock);
+    g_peer_count++;
+    LOCK_RELEASE(&g_peers_lock);
 
     return p;
 }
 
-void peers_remove(struct lws* wsi) {
-    omp_set_lock(&g_peers_lock);
+// Called once no reader can still hold the peer
+static void peer_free(void* ptr) {
+    Peer* p = (Peer*)ptr;
+    if (p->awareness_frame) ws_frame_release(p->awareness_frame);
+    profiled_lock_destroy(&p->lock);
+    tagged_free(p, ALLOC_PEER);
+}
+
+void peers_remove(Peer* peer) {
+    LOCK_ACQUIRE(&g_peers_lock);
 
     Peer** pp = &g_peers;
     while (*pp) {
-        Peer* p = *pp;
-        if (p->wsi == wsi) {
-            *pp = p->next;
-
-            // Free pending messages
-            omp_set_lock(&p->lock);
-            PendingMessage* msg = p->pending_queue;
-            while (msg) {
-                PendingMessage* next_msg = msg->next;
-                free(msg->data);
-                free(msg);
-                msg = next_msg;
-            }
-            omp_unset_lock(&p->lock);
-
-            if (p->awareness_json) {
-                free(p->awareness_json);
-                p->awareness_json = nullptr;
-                p->awareness_len = 0;
-            }
-
-            omp_destroy_lock(&p->lock);
-            free(p);
+        if (*pp == peer) {
+            *pp = peer->next;
+            g_peer_count--;
             break;
         }
-        pp = &p->next;
+        pp = &(*pp)->next;
     }
 
-    omp_unset_lock(&g_peers_lock);
+    LOCK_RELEASE(&g_peers_lock);
+
+    // Stop further queueing (and transport wakeups) before the connection goes away
+    LOCK_ACQUIRE(&peer->lock);
+    peer->closed = true;
+    PendingMessage* msg = take_all_messages(peer);
+    LOCK_RELEASE(&peer->lock);
+
+    free_message_list(msg);
+
+    epoch_retire(peer, peer_free);
 }
 
-Peer* peers_find(struct lws* wsi) {
-    omp_set_lock(&g_peers_lock);
+int peers_count() {
+    LOCK_ACQUIRE(&g_peers_lock);
+    int count = g_peer_count;
+    LOCK_RELEASE(&g_peers_lock);
+    return count;
+}
 
-    Peer* p = g_peers;
-    while (p) {
-        if (p->wsi == wsi) {
-            omp_unset_lock(&g_peers_lock);
-            return p;
-        }
-        p = p->next;
+void peer_queue_message(Peer* p, PeerQueueClass cls, const uint8_t* data, size_t len) {
+    WsSharedFrame* frame = ws_frame_create(WS_OP_BINARY, data, len);
+    if (!frame) return;
+    peer_queue_frame(p, cls, frame);
+    ws_frame_release(frame);
+}
+
+// Append to a class FIFO and wake the transport (caller holds p->lock)
+static void enqueue_locked(Peer* p, PeerQueueClass cls, WsSharedFrame* frame, uint32_t key) {
+    PendingMessage* msg = (PendingMessage*)tagged_malloc(sizeof(PendingMessage), ALLOC_QUEUE);
+    ws_frame_retain(frame);
+    msg->frame = frame;
+    msg->coalesce_key = key;
+    msg->next = nullptr;
+
+    PeerQueue* q = &p->queues[cls];
+    if (!q->head) {
+        q->head = msg;
+    } else {
+        q->tail->next = msg;
     }
+    q->tail = msg;
+    q->count++;
+    q->bytes += frame->len;
+    p->queued_bytes += frame->len;
+    TRACE(enqueue, p->id, (int)cls, frame->len, p->queued_bytes);
+
+    // Request writable callback from the owning transport; done under the lock
+    // so it cannot race with the connection being closed and freed
+    p->transport->request_write(p);
+}
 
-    omp_unset_lock(&g_peers_lock);
-    return nullptr;
+void peer_queue_frame(Peer* p, PeerQueueClass cls, WsSharedFrame* frame) {
+    LOCK_ACQUIRE(&p->lock);
+    if (!p->closed) {
+        enqueue_locked(p, cls, frame, 0);
+    }
+    LOCK_RELEASE(&p->lock);
 }
 
-int peers_count() {
-    omp_set_lock(&g_peers_lock);
+void peer_queue_awareness(Peer* p, WsSharedFrame* frame, uint32_t client_id, bool removal) {
+    WsSharedFrame* displaced = nullptr;
 
-    int count = 0;
-    Peer* p = g_peers;
-    while (p) {
-        count++;
-        p = p->next;
+    LOCK_ACQUIRE(&p->lock);
+
+    if (p->closed) {
+        LOCK_RELEASE(&p->lock);
+        return;
     }
 
-    omp_unset_lock(&g_peers_lock);
-    return count;
+    // Only the newest state per client matters: replace in place, keeping its position
+    PeerQueue* q = &p->queues[PEER_QUEUE_AWARENESS];
+    for (PendingMessage* m = q->head; m && client_id != 0; m = m->next) {
+        if (m->coalesce_key == client_id) {
+            displaced = m->frame;
+            ws_frame_retain(frame);
+            m->frame = frame;
+            q->bytes = q->bytes - displaced->len + frame->len;
+            p->queued_bytes = p->queued_bytes - displaced->len + frame->len;
+            p->awareness_coalesced++;
+            break;
+        }
+    }
+
+    if (!displaced) {
+        // Under backlog, presence is the first thing to give
+        if (!removal && p->queued_bytes >= PEER_AWARENESS_DROP_BYTES) {
+            p->awareness_dropped++;
+        } else {
+            enqueue_locked(p, PEER_QUEUE_AWARENESS, frame, client_id);
+        }
+    }
+
+    LOCK_RELEASE(&p->lock);
+
+    if (displaced) ws_frame_release(displaced);
 }
 
-void peer_queue_message(Peer* p, const uint8_t* data, size_t len) {
-    PendingMessage* msg = (PendingMessage*)malloc(sizeof(PendingMessage));
-    msg->data = (uint8_t*)malloc(len);
-    memcpy(msg->data, data, len);
-    msg->len = len;
-    msg->next = nullptr;
+static PendingMessage* dequeue_own(Peer* p) {
+    LOCK_ACQUIRE(&p->lock);
 
-    omp_set_lock(&p->lock);
+    if (p->queued_bytes == 0) {
+        LOCK_RELEASE(&p->lock);
+        return nullptr;
+    }
 
-    if (!p->pending_queue) {
-        p->pending_queue = msg;
-    } else {
-        // Append to end
-        PendingMessage* tail = p->pending_queue;
-        while (tail->next) {
-            tail = tail->next;
+    // Deficit round-robin over the classes: each visit grants weight * quantum
+    // bytes of credit, and a class sends while its head frame fits the credit.
+    // Classes overtake each other (DOC may pass a queued SYNC_STEP2; see
+    // PeerQueueClass), each class stays FIFO.
+    PendingMessage* msg = nullptr;
+    bool sync_drained = false;
+    while (!msg) {
+        PeerQueue* q = &p->queues[p->queue_turn];
+
+        if (q->head) {
+            size_t len = q->head->frame->len;
+            bool alone = q->bytes == p->queued_bytes;
+            if (q->deficit >= len || alone) {
+                msg = q->head;
+                q->head = msg->next;
+                if (!q->head) q->tail = nullptr;
+                q->count--;
+                q->bytes -= len;
+                p->queued_bytes -= len;
+                q->deficit = (q->head && q->deficit > len) ? q->deficit - len : 0;
+                sync_drained = p->queue_turn == PEER_QUEUE_SYNC && !q->head;
+                break;
+            }
+        } else {
+            q->deficit = 0;
         }
-        tail->next = msg;
+
+        p->queue_turn = (p->queue_turn + 1) % PEER_QUEUE_COUNT;
+        PeerQueue* next = &p->queues[p->queue_turn];
+        if (next->head) next->deficit += QUEUE_WEIGHT[p->queue_turn] * QUEUE_QUANTUM;
     }
 
-    omp_unset_lock(&p->lock);
+    LOCK_RELEASE(&p->lock);
+    msg->next = nullptr;
 
-    // Request writable callback
-    lws_callback_on_writable(p->wsi);
+    void (*sent)(Peer*, size_t) = __atomic_load_n(&g_dequeued, __ATOMIC_ACQUIRE);
+    if (sent) sent(p, msg->frame->len);
+    void (*hook)(Peer*) = __atomic_load_n(&g_sync_drained, __ATOMIC_ACQUIRE);
+    if (sync_drained && hook) hook(p);
+    return msg;
 }
 
 PendingMessage* peer_dequeue_message(Peer* p) {
-    omp_set_lock(&p->lock);
+    PendingMessage* msg = dequeue_own(p);
+    if (msg || !p->mux_children) return msg;
+
+    // One message per channel per visit, so a large sync on one channel does not
+    // stall the others
+    Peer* start = p->mux_cursor ? p->mux_cursor : p->mux_children;
+    Peer* c = start;
+    do {
+        Peer* next = c->mux_sibling ? c->mux_sibling : p->mux_children;
+        msg = dequeue_own(c);
+        if (msg) {
+            p->mux_cursor = next;
+            return msg;
+        }
+        c = next;
+    } while (c != start);
 
-    PendingMessage* msg = p->pending_queue;
-    if (msg) {
-        p->pending_queue = msg->next;
+    return nullptr;
+}
+
+void peer_attach_channel(Peer* parent, Peer* child, uint32_t channel) {
+    child->channel = channel;
+    child->mux_parent = parent;
+    child->mux_sibling = parent->mux_children;
+    parent->mux_children = child;
+}
+
+void peer_detach_channel(Peer* parent, Peer* child) {
+    Peer** link = &parent->mux_children;
+    while (*link && *link != child) {
+        link = &(*link)->mux_sibling;
     }
+    if (*link) *link = child->mux_sibling;
+    if (parent->mux_cursor == child) parent->mux_cursor = child->mux_sibling;
+    child->mux_sibling = nullptr;
+}
 
-    omp_unset_lock(&p->lock);
-    return msg;
+Peer* peer_find_channel(Peer* parent, uint32_t channel) {
+    for (Peer* c = parent->mux_children; c; c = c->mux_sibling) {
+        if (c->channel == channel) return c;
+    }
+    return nullptr;
+}
+
+void peers_on_sync_drained(void (*fn)(Peer* p)) {
+    __atomic_store_n(&g_sync_drained, fn, __ATOMIC_RELEASE);
+}
+
+void peers_on_dequeue(void (*fn)(Peer* p, size_t len)) {
+    __atomic_store_n(&g_dequeued, fn, __ATOMIC_RELEASE);
 }
 
 void peer_free_message(PendingMessage* msg) {
     if (msg) {
-        free(msg->data);
-        free(msg);
+        ws_frame_release(msg->frame);
+        tagged_free(msg, ALLOC_QUEUE);
     }
 }
@@ -1,4 +1,5 @@
 #include "protocol.h"
+#include "allocstat.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -65,7 +66,7 @@ uint8_t* encode_sync_step1(const uint8_t* state_vector, size_t sv_len, size_t* o
     size_t varint_len = encode_varuint((uint32_t)sv_len, varint_buf);
 
     size_t total_len = 1 + varint_len + sv_len;
-    uint8_t* buffer = (uint8_t*)malloc(total_len);
+    uint8_t* buffer = (uint8_t*)tagged_malloc(total_len, ALLOC_PROTOCOL);
 
     size_t pos = 0;
     buffer[pos++] = MSG_SYNC_STEP1;
@@ -114,7 +115,7 @@ uint8_t* encode_sync_step2(const uint8_t* update, size_t update_len, size_t* out
     size_t varint_len = encode_varuint((uint32_t)update_len, varint_buf);
 
     size_t total_len = 1 + varint_len + update_len;
-    uint8_t* buffer = (uint8_t*)malloc(total_len);
+    uint8_t* buffer = (uint8_t*)tagged_malloc(total_len, ALLOC_PROTOCOL);
 
     size_t pos = 0;
     buffer[pos++] = MSG_SYNC_STEP2;
@@ -176,7 +177,7 @@ uint8_t* encode_awareness(uint32_t client_id, const char* state_json, size_t jso
     size_t payload_len_var = encode_varuint((uint32_t)payload_len, payload_len_buf);
 
     size_t total_len = 1 + payload_len_var + payload_len;
-    uint8_t* buf = (uint8_t*)malloc(total_len);
+    uint8_t* buf = (uint8_t*)tagged_malloc(total_len, ALLOC_PROTOCOL);
 
     size_t pos = 0;
     buf[pos++] = MSG_AWARENESS;
@@ -247,7 +248,7 @@ bool decode_awareness(const uint8_t* data, size_t len, uint32_t* client_id, char
     *json_len = jlen;
 
     if (jlen > 0) {
-        *state_json = (char*)malloc(jlen + 1);
+        *state_json = (char*)tagged_malloc(jlen + 1, ALLOC_PROTOCOL);
         memcpy(*state_json, payload, jlen);
         (*state_json)[jlen] = '\0';
     } else {
@@ -256,3 +257,111 @@ bool decode_awareness(const uint8_t* data, size_t len, uint32_t* client_id, char
 
     return true;
 }
+
+// Multiplexed message: [varuint channel][message]
+uint8_t* encode_mux_message(uint32_t channel, const uint8_t* msg, size_t msg_len, size_t* out_len) {
+    uint8_t channel_buf[5];
+    size_t channel_len = encode_varuint(channel, channel_buf);
+
+    size_t total_len = channel_len + msg_len;
+    uint8_t* buffer = (uint8_t*)tagged_malloc(total_len, ALLOC_PROTOCOL);
+    memcpy(buffer, channel_buf, channel_len);
+    if (msg && msg_len > 0) {
+        memcpy(buffer + channel_len, msg, msg_len);
+    }
+
+    *out_len = total_len;
+    return buffer;
+}
+
+const uint8_t* decode_mux_message(const uint8_t* data, size_t len, uint32_t* channel, size_t* msg_len) {
+    uint32_t ch = 0;
+    size_t channel_len = decode_varuint(data, len, &ch);
+    if (channel_len == 0 || channel_len >= len) {
+        fprintf(stderr, "[Protocol] Invalid multiplexed message (%zu bytes)\n", len);
+        return NULL;
+    }
+
+    *channel = ch;
+    *msg_len = len - channel_len;
+    return data + channel_len;
+}
+
+// Control message: [0][type][varuint channel]?[varuint path_len][path]?
+static uint8_t* encode_mux_control(MuxControlType type, bool has_channel, uint32_t channel,
+                                   const char* path, size_t path_len, size_t* out_len) {
+    uint8_t channel_buf[5];
+    size_t channel_len = has_channel ? encode_varuint(channel, channel_buf) : 0;
+    uint8_t path_len_buf[5];
+    size_t path_len_var = path ? encode_varuint((uint32_t)path_len, path_len_buf) : 0;
+
+    size_t total_len = 2 + channel_len + path_len_var + (path ? path_len : 0);
+    uint8_t* buffer = (uint8_t*)tagged_malloc(total_len, ALLOC_PROTOCOL);
+
+    size_t pos = 0;
+    buffer[pos++] = MUX_CONTROL_CHANNEL;
+    buffer[pos++] = (uint8_t)type;
+    memcpy(buffer + pos, channel_buf, channel_len);
+    pos += channel_len;
+    if (path) {
+        memcpy(buffer + pos, path_len_buf, path_len_var);
+        pos += path_len_var;
+        memcpy(buffer + pos, path, path_len);
+    }
+
+    *out_len = total_len;
+    return buffer;
+}
+
+uint8_t* encode_mux_subscribe(const char* path, size_t path_len, size_t* out_len) {
+    return encode_mux_control(MUX_SUBSCRIBE, false, 0, path, path_len, out_len);
+}
+
+uint8_t* encode_mux_subscribed(uint32_t channel, const char* path, size_t path_len, size_t* out_len) {
+    return encode_mux_control(MUX_SUBSCRIBED, true, channel, path, path_len, out_len);
+}
+
+uint8_t* encode_mux_unsubscribe(uint32_t channel, size_t* out_len) {
+    return encode_mux_control(MUX_UNSUBSCRIBE, true, channel, NULL, 0, out_len);
+}
+
+uint8_t* encode_mux_refused(MuxRefuseReason reason, const char* path, size_t path_len, size_t* out_len) {
+    return encode_mux_control(MUX_REFUSED, true, (uint32_t)reason, path ? path : "", path ? path_len : 0, out_len);
+}
+
+bool decode_mux_control(const uint8_t* msg, size_t len, MuxControlType* type,
+                        uint32_t* channel, const char** path, size_t* path_len) {
+    if (len < 1 || msg[0] > MUX_REFUSED) {
+        fprintf(stderr, "[Protocol] Unknown mux control message\n");
+        return false;
+    }
+    *type = (MuxControlType)msg[0];
+
+    size_t pos = 1;
+    if (*type != MUX_SUBSCRIBE) {
+        size_t n = decode_varuint(msg + pos, len - pos, channel);
+        if (n == 0) {
+            fprintf(stderr, "[Protocol] Failed to decode mux channel\n");
+            return false;
+        }
+        pos += n;
+    }
+
+    if (*type != MUX_UNSUBSCRIBE) {
+        uint32_t plen = 0;
+        size_t n = decode_varuint(msg + pos, len - pos, &plen);
+        if (n == 0 || len - pos - n < plen) {
+            fprintf(stderr, "[Protocol] Incomplete mux path\n");
+            return false;
+        }
+        pos += n;
+        *path = (const char*)(msg + pos);
+        *path_len = plen;
+    }
+
+    return true;
+}
+
+void protocol_free(void* buf) {
+    tagged_free(buf, ALLOC_PROTOCOL);
+}
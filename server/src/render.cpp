@@ -0,0 +1,856 @@
+#include "render.h"
+#include "room.h"
+#include <omp.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Quill attribute, value as text ("true" for flags, numbers printed)
+struct Attr {
+    std::string key;
+    std::string value;
+};
+
+typedef std::vector<Attr> Attrs;    // Sorted by key
+
+// Text with one set of inline formats, or an embed (one position)
+struct Run {
+    std::string text;           // Text, or the embed's value (image URL, formula, ...)
+    std::string embed;          // Embed type ("image", "video", "formula"), "" for text
+    Attrs attrs;
+
+    uint32_t length() const { return embed.empty() ? (uint32_t)text.size() : 1; }
+};
+
+struct Line {
+    std::vector<Run> runs;
+    Attrs attrs;                // Block format: attributes of the terminating "\n"
+    uint32_t len;               // Positions before the newline
+    bool terminated;            // Ends with "\n" (every line but the last)
+    bool dirty;
+    std::string html;           // Block element; <li> for list items, escaped text for code lines
+    std::string md;             // Inline Markdown; raw text for code lines
+};
+
+struct RenderDoc {
+    Room* room;
+    std::vector<Line> lines;    // Never empty; the last line is unterminated
+    uint64_t key_version;       // Document version etag was computed for (0 = none)
+    std::string etag;           // Hash of the canonical state vector
+    bool cached[2];             // By RenderFormat: out[] matches the mirror
+    std::string out[2];
+};
+
+static omp_lock_t g_lock;       // Guards everything below (leaf, taken under Document locks)
+static std::vector<RenderDoc*> g_docs;  // By room id
+static uint64_t g_hits = 0;
+static uint64_t g_misses = 0;
+static uint64_t g_lines_rendered = 0;
+
+static RenderDoc* doc_for(Room* room) {
+    if (room->id >= g_docs.size()) g_docs.resize(room->id + 1, nullptr);
+    RenderDoc*& doc = g_docs[room->id];
+    if (!doc) {
+        doc = new RenderDoc();
+        doc->room = room;
+        doc->key_version = 0;
+        doc->cached[RENDER_HTML] = false;
+        doc->cached[RENDER_MARKDOWN] = false;
+        Line empty;
+        empty.len = 0;
+        empty.terminated = false;
+        empty.dirty = true;
+        doc->lines.push_back(empty);
+    }
+    return doc;
+}
+
+// ---- Attributes ----
+
+static const std::string* attr_get(const Attrs& attrs, const char* key) {
+    for (size_t i = 0; i < attrs.size(); i++) {
+        if (attrs[i].key == key) return &attrs[i].value;
+    }
+    return nullptr;
+}
+
+// Scalar value as text; false for null, false and values Quill does not use as formats
+static bool scalar_value(const YOutput* value, std::string* out) {
+    if (!value) return false;
+    char buf[32];
+    switch (value->tag) {
+        case Y_JSON_STR: {
+            const char* s = youtput_read_string(value);
+            if (!s) return false;
+            out->assign(s);
+            return true;
+        }
+        case Y_JSON_BOOL: {
+            const uint8_t* b = youtput_read_bool(value);
+            if (!b || !*b) return false;
+            out->assign("true");
+            return true;
+        }
+        case Y_JSON_INT: {
+            const int64_t* n = youtput_read_long(value);
+            if (!n) return false;
+            snprintf(buf, sizeof(buf), "%lld", (long long)*n);
+            out->assign(buf);
+            return true;
+        }
+        case Y_JSON_NUM: {
+            const double* n = youtput_read_float(value);
+            if (!n) return false;
+            snprintf(buf, sizeof(buf), "%g", *n);
+            out->assign(buf);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Apply a delta's attributes: set values, remove null ones
+static void merge_attrs(Attrs* attrs, const YDeltaAttr* src, uint32_t count) {
+    std::string value;
+    for (uint32_t i = 0; i < count; i++) {
+        const char* key = src[i].key;
+        Attrs::iterator it = attrs->begin();
+        while (it != attrs->end() && it->key < key) ++it;
+        bool present = it != attrs->end() && it->key == key;
+
+        if (!scalar_value(src[i].value, &value)) {
+            if (present) attrs->erase(it);
+        } else if (present) {
+            it->value = value;
+        } else {
+            Attr attr;
+            attr.key = key;
+            attr.value = value;
+            attrs->insert(it, attr);
+        }
+    }
+}
+
+static bool same_attrs(const Attrs& a, const Attrs& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].key != b[i].key || a[i].value != b[i].value) return false;
+    }
+    return true;
+}
+
+// ---- Mirror ----
+
+// Index of the run starting at off, splitting the run that spans it
+static size_t split_at(Line* line, uint32_t off) {
+    uint32_t pos = 0;
+    for (size_t i = 0; i < line->runs.size(); i++) {
+        if (pos == off) return i;
+        uint32_t len = line->runs[i].length();
+        if (off < pos + len) {
+            Run tail = line->runs[i];
+            tail.text.erase(0, off - pos);
+            line->runs[i].text.resize(off - pos);
+            line->runs.insert(line->runs.begin() + i + 1, tail);
+            return i + 1;
+        }
+        pos += len;
+    }
+    return line->runs.size();
+}
+
+// Merge neighbouring text runs with equal formats
+static void coalesce(Line* line) {
+    std::vector<Run>& runs = line->runs;
+    size_t out = 0;
+    for (size_t i = 0; i < runs.size(); i++) {
+        if (runs[i].length() == 0) continue;
+        if (out > 0 && runs[out - 1].embed.empty() && runs[i].embed.empty() &&
+            same_attrs(runs[out - 1].attrs, runs[i].attrs)) {
+            runs[out - 1].text += runs[i].text;
+            continue;
+        }
+        if (out != i) runs[out] = runs[i];
+        out++;
+    }
+    runs.resize(out);
+}
+
+static void insert_run(Line* line, uint32_t off, const Run& run) {
+    if (run.length() == 0) return;
+    size_t i = split_at(line, off);
+    line->runs.insert(line->runs.begin() + i, run);
+    line->len += run.length();
+    coalesce(line);
+}
+
+static void format_range(Line* line, uint32_t off, uint32_t len, const YDeltaAttr* attrs, uint32_t count) {
+    size_t begin = split_at(line, off);
+    size_t end = split_at(line, off + len);
+    for (size_t i = begin; i < end; i++) merge_attrs(&line->runs[i].attrs, attrs, count);
+    coalesce(line);
+}
+
+static void erase_range(Line* line, uint32_t off, uint32_t len) {
+    size_t begin = split_at(line, off);
+    size_t end = split_at(line, off + len);
+    line->runs.erase(line->runs.begin() + begin, line->runs.begin() + end);
+    line->len -= len;
+    coalesce(line);
+}
+
+// Split lines[index] at off: the head ends with a new "\n" carrying attrs, the
+// tail keeps the original terminator
+static void split_line(RenderDoc* doc, size_t index, uint32_t off, const Attrs& attrs) {
+    Line* line = &doc->lines[index];
+    size_t split = split_at(line, off);
+
+    Line tail;
+    tail.runs.assign(line->runs.begin() + split, line->runs.end());
+    tail.attrs = line->attrs;
+    tail.len = line->len - off;
+    tail.terminated = line->terminated;
+    tail.dirty = true;
+
+    line->runs.resize(split);
+    line->attrs = attrs;
+    line->len = off;
+    line->terminated = true;
+    line->dirty = true;
+    doc->lines.insert(doc->lines.begin() + index + 1, tail);
+}
+
+// Remove the "\n" of lines[index], joining the next line onto it
+static void join_next(RenderDoc* doc, size_t index) {
+    Line* line = &doc->lines[index];
+    Line* next = &doc->lines[index + 1];
+    line->runs.insert(line->runs.end(), next->runs.begin(), next->runs.end());
+    line->len += next->len;
+    line->attrs = next->attrs;
+    line->terminated = next->terminated;
+    line->dirty = true;
+    coalesce(line);
+    doc->lines.erase(doc->lines.begin() + index + 1);
+}
+
+// Room text observer: apply the delta to the mirror, marking touched lines dirty
+static void on_text(Room* room, const YDelta* delta, uint32_t len) {
+    omp_set_lock(&g_lock);
+    RenderDoc* doc = doc_for(room);
+
+    size_t li = 0;              // Cursor: line index and position in it
+    uint32_t off = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        const YDelta& d = delta[i];
+
+        if (d.tag == Y_EVENT_CHANGE_RETAIN || d.tag == Y_EVENT_CHANGE_DELETE) {
+            bool erase = d.tag == Y_EVENT_CHANGE_DELETE;
+            uint32_t n = d.len;
+            while (n > 0) {
+                Line* line = &doc->lines[li];
+                if (off < line->len) {
+                    uint32_t k = std::min(n, line->len - off);
+                    if (erase) {
+                        erase_range(line, off, k);
+                        line->dirty = true;
+                    } else {
+                        if (d.attributes_len > 0) {
+                            format_range(line, off, k, d.attributes, d.attributes_len);
+                            line->dirty = true;
+                        }
+                        off += k;
+                    }
+                    n -= k;
+                } else if (line->terminated) {
+                    if (erase) {
+                        join_next(doc, li);
+                    } else {
+                        if (d.attributes_len > 0) {
+                            merge_attrs(&line->attrs, d.attributes, d.attributes_len);
+                            line->dirty = true;
+                        }
+                        li++;
+                        off = 0;
+                    }
+                    n--;
+                } else {
+                    break;      // Past the end of the mirror
+                }
+            }
+        } else if (d.tag == Y_EVENT_CHANGE_ADD && d.insert) {
+            Run run;
+            merge_attrs(&run.attrs, d.attributes, d.attributes_len);
+
+            if (d.insert->tag != Y_JSON_STR) {
+                // Embeds are {type: value} maps, e.g. {"image": url}
+                if (d.insert->tag == Y_JSON_MAP && d.insert->len > 0) {
+                    const YMapEntry* entry = youtput_read_json_map(d.insert);
+                    run.embed = entry[0].key;
+                    scalar_value(entry[0].value, &run.text);
+                } else {
+                    run.embed = "unknown";
+                }
+                insert_run(&doc->lines[li], off, run);
+                doc->lines[li].dirty = true;
+                off++;
+                continue;
+            }
+
+            // Text between newlines goes into the current line; each "\n" splits it
+            const char* s = youtput_read_string(d.insert);
+            const char* end = s ? s + strlen(s) : s;
+            while (s && s <= end) {
+                const char* nl = (const char*)memchr(s, '\n', end - s);
+                const char* seg_end = nl ? nl : end;
+                run.text.assign(s, seg_end - s);
+                insert_run(&doc->lines[li], off, run);
+                doc->lines[li].dirty = true;
+                off += (uint32_t)run.text.size();
+                if (!nl) break;
+                split_line(doc, li, off, run.attrs);
+                li++;
+                off = 0;
+                s = nl + 1;
+            }
+        }
+    }
+
+    doc->cached[RENDER_HTML] = false;
+    doc->cached[RENDER_MARKDOWN] = false;
+    omp_unset_lock(&g_lock);
+}
+
+// ---- Rendering ----
+
+static void html_escape(std::string* out, const std::string& s) {
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        switch (c) {
+            case '&': out->append("&amp;"); break;
+            case '<': out->append("&lt;"); break;
+            case '>': out->append("&gt;"); break;
+            case '"': out->append("&quot;"); break;
+            default: out->push_back(c); break;
+        }
+    }
+}
+
+static void md_escape(std::string* out, const std::string& s) {
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (strchr("\\`*_[]<>#|~", c)) out->push_back('\\');
+        out->push_back(c);
+    }
+}
+
+// Links and embed sources: only web, mail and relative URLs (as Quill's sanitizer)
+static std::string safe_url(const std::string& url) {
+    size_t colon = url.find(':');
+    if (colon == std::string::npos || url.find_first_of("/?#") < colon) return url;
+    std::string scheme = url.substr(0, colon);
+    for (size_t i = 0; i < scheme.size(); i++) scheme[i] = (char)tolower((unsigned char)scheme[i]);
+    if (scheme == "http" || scheme == "https" || scheme == "mailto" || scheme == "tel") return url;
+    return "about:blank";
+}
+
+// Markdown link target: percent-encode what would end it or split it
+static void md_url(std::string* out, const std::string& url) {
+    static const char HEX[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < url.size(); i++) {
+        unsigned char c = (unsigned char)url[i];
+        if (c <= ' ' || c == 0x7F || strchr("()<>\\", c)) {
+            out->push_back('%');
+            out->push_back(HEX[c >> 4]);
+            out->push_back(HEX[c & 15]);
+        } else {
+            out->push_back((char)c);
+        }
+    }
+}
+
+// Color and background values as Quill's formats produce them: #hex, rgb() /
+// rgba() with numbers, or a color name. Anything else could extend the style
+// attribute with more declarations, so the run is rendered without it.
+static bool safe_color(const std::string& v) {
+    if (v.empty() || v.size() > 32) return false;
+    if (v[0] == '#') {
+        size_t n = v.size() - 1;
+        if (n != 3 && n != 4 && n != 6 && n != 8) return false;
+        for (size_t i = 1; i < v.size(); i++) {
+            if (!isxdigit((unsigned char)v[i])) return false;
+        }
+        return true;
+    }
+    size_t open = 0;
+    if (v.compare(0, 4, "rgb(") == 0) open = 4;
+    else if (v.compare(0, 5, "rgba(") == 0) open = 5;
+    if (open) {
+        if (v[v.size() - 1] != ')') return false;
+        for (size_t i = open; i + 1 < v.size(); i++) {
+            char c = v[i];
+            if (!isdigit((unsigned char)c) && !strchr(" ,.%", c)) return false;
+        }
+        return true;
+    }
+    for (size_t i = 0; i < v.size(); i++) {
+        if (!isalpha((unsigned char)v[i])) return false;
+    }
+    return true;
+}
+
+static bool has_flag(const Attrs& attrs, const char* key) {
+    const std::string* v = attr_get(attrs, key);
+    return v && *v == "true";
+}
+
+static void render_run_html(std::string* out, const Run& run) {
+    if (!run.embed.empty()) {
+        if (run.embed == "image") {
+            out->append("<img src=\"");
+            html_escape(out, safe_url(run.text));
+            out->append("\">");
+        } else if (run.embed == "video") {
+            out->append("<iframe class=\"ql-video\" frameborder=\"0\" allowfullscreen=\"true\" src=\"");
+            html_escape(out, safe_url(run.text));
+            out->append("\"></iframe>");
+        } else if (run.embed == "formula") {
+            out->append("<span class=\"ql-formula\">");
+            html_escape(out, run.text);
+            out->append("</span>");
+        }
+        return;
+    }
+
+    const Attrs& a = run.attrs;
+    const std::string* link = attr_get(a, "link");
+    const std::string* script = attr_get(a, "script");
+    const std::string* color = attr_get(a, "color");
+    const std::string* background = attr_get(a, "background");
+    if (color && !safe_color(*color)) color = nullptr;
+    if (background && !safe_color(*background)) background = nullptr;
+    const char* script_tag = script ? (*script == "sub" ? "sub" : *script == "super" ? "sup" : nullptr) : nullptr;
+
+    if (link) {
+        out->append("<a href=\"");
+        html_escape(out, safe_url(*link));
+        out->append("\" rel=\"noopener noreferrer\" target=\"_blank\">");
+    }
+    if (color || background) {
+        out->append("<span style=\"");
+        if (color) {
+            out->append("color: ");
+            html_escape(out, *color);
+            out->append(";");
+        }
+        if (background) {
+            out->append(color ? " background-color: " : "background-color: ");
+            html_escape(out, *background);
+            out->append(";");
+        }
+        out->append("\">");
+    }
+    if (script_tag) {
+        out->append("<");
+        out->append(script_tag);
+        out->append(">");
+    }
+    if (has_flag(a, "bold")) out->append("<strong>");
+    if (has_flag(a, "italic")) out->append("<em>");
+    if (has_flag(a, "underline")) out->append("<u>");
+    if (has_flag(a, "strike")) out->append("<s>");
+    if (has_flag(a, "code")) out->append("<code>");
+
+    html_escape(out, run.text);
+
+    if (has_flag(a, "code")) out->append("</code>");
+    if (has_flag(a, "strike")) out->append("</s>");
+    if (has_flag(a, "underline")) out->append("</u>");
+    if (has_flag(a, "italic")) out->append("</em>");
+    if (has_flag(a, "bold")) out->append("</strong>");
+    if (script_tag) {
+        out->append("</");
+        out->append(script_tag);
+        out->append(">");
+    }
+    if (color || background) out->append("</span>");
+    if (link) out->append("</a>");
+}
+
+static void render_run_md(std::string* out, const Run& run) {
+    if (!run.embed.empty()) {
+        if (run.embed == "image") {
+            out->append("![](");
+            md_url(out, safe_url(run.text));
+            out->append(")");
+        } else if (run.embed == "video") {
+            out->append("[video](");
+            md_url(out, safe_url(run.text));
+            out->append(")");
+        } else if (run.embed == "formula") {
+            // TeX keeps its backslashes; only the delimiter and line breaks
+            // could end the span
+            out->append("$");
+            for (size_t i = 0; i < run.text.size(); i++) {
+                char c = run.text[i];
+                if (c == '$') out->append("\\$");
+                else if (c == '\n' || c == '\r') out->push_back(' ');
+                else out->push_back(c);
+            }
+            out->append("$");
+        }
+        return;
+    }
+
+    // Emphasis markers must hug the text, so surrounding spaces stay outside
+    const std::string& text = run.text;
+    size_t lead = text.find_first_not_of(' ');
+    if (lead == std::string::npos) {
+        out->append(text);
+        return;
+    }
+    size_t trail = text.find_last_not_of(' ') + 1;
+    out->append(text, 0, lead);
+
+    const Attrs& a = run.attrs;
+    const std::string* link = attr_get(a, "link");
+    bool code = has_flag(a, "code");
+    bool bold = has_flag(a, "bold");
+    bool italic = has_flag(a, "italic");
+    bool strike = has_flag(a, "strike");
+
+    if (link) out->append("[");
+    if (strike) out->append("~~");
+    if (bold) out->append("**");
+    if (italic) out->append("*");
+    if (code) {
+        // A backtick inside needs a longer fence (CommonMark code spans)
+        bool tick = text.find('`', lead) < trail;
+        out->append(tick ? "`` " : "`");
+        out->append(text, lead, trail - lead);
+        out->append(tick ? " ``" : "`");
+    } else {
+        md_escape(out, text.substr(lead, trail - lead));
+    }
+    if (italic) out->append("*");
+    if (bold) out->append("**");
+    if (strike) out->append("~~");
+    if (link) {
+        out->append("](");
+        md_url(out, safe_url(*link));
+        out->append(")");
+    }
+
+    out->append(text, trail, std::string::npos);
+}
+
+// Quill's block classes (align, indent, direction)
+static void block_classes(std::string* out, const Attrs& attrs) {
+    std::string classes;
+    const std::string* align = attr_get(attrs, "align");
+    const std::string* indent = attr_get(attrs, "indent");
+    if (align) classes += " ql-align-" + *align;
+    if (indent) classes += " ql-indent-" + *indent;
+    if (attr_get(attrs, "direction")) classes += " ql-direction-rtl";
+    if (classes.empty()) return;
+    out->append(" class=\"");
+    html_escape(out, classes.substr(1));
+    out->append("\"");
+}
+
+static void render_line(Line* line) {
+    line->html.clear();
+    line->md.clear();
+    const Attrs& a = line->attrs;
+
+    if (attr_get(a, "code-block")) {
+        for (size_t i = 0; i < line->runs.size(); i++) {
+            if (!line->runs[i].embed.empty()) continue;
+            html_escape(&line->html, line->runs[i].text);
+            line->md += line->runs[i].text;
+        }
+        line->dirty = false;
+        return;
+    }
+
+    std::string inner;
+    for (size_t i = 0; i < line->runs.size(); i++) {
+        render_run_html(&inner, line->runs[i]);
+        render_run_md(&line->md, line->runs[i]);
+    }
+    if (inner.empty()) inner = "<br>";
+
+    const std::string* header = attr_get(a, "header");
+    const std::string* list = attr_get(a, "list");
+    const char* tag = "p";
+    char header_tag[4];
+    if (header && (*header)[0] >= '1' && (*header)[0] <= '6' && header->size() == 1) {
+        snprintf(header_tag, sizeof(header_tag), "h%c", (*header)[0]);
+        tag = header_tag;
+    } else if (list) {
+        tag = "li";
+    } else if (attr_get(a, "blockquote")) {
+        tag = "blockquote";
+    }
+
+    line->html += "<";
+    line->html += tag;
+    block_classes(&line->html, a);
+    line->html += ">";
+    line->html += inner;
+    line->html += "</";
+    line->html += tag;
+    line->html += ">";
+    line->dirty = false;
+}
+
+// List type of a line, "" when it is not a list item
+static std::string list_type(const Line& line) {
+    const std::string* list = attr_get(line.attrs, "list");
+    if (!list || attr_get(line.attrs, "code-block")) return std::string();
+    return *list;
+}
+
+static int indent_of(const Line& line) {
+    const std::string* indent = attr_get(line.attrs, "indent");
+    return indent ? std::max(0, std::min(atoi(indent->c_str()), 8)) : 0;
+}
+
+static void assemble_html(const RenderDoc* doc, std::string* out) {
+    out->clear();
+    std::string open_list;      // List type of the open <ul>/<ol>
+    bool in_code = false;
+
+    for (size_t i = 0; i < doc->lines.size(); i++) {
+        const Line& line = doc->lines[i];
+        if (!line.terminated && line.len == 0) break;   // Trailing empty line
+
+        bool code = attr_get(line.attrs, "code-block") != nullptr;
+        std::string list = list_type(line);
+
+        if (in_code && !code) {
+            out->append("</pre>");
+            in_code = false;
+        }
+        if (!open_list.empty() && list != open_list) {
+            out->append(open_list == "ordered" ? "</ol>" : "</ul>");
+            open_list.clear();
+        }
+
+        if (code) {
+            if (!in_code) out->append("<pre class=\"ql-syntax\" spellcheck=\"false\">");
+            in_code = true;
+            out->append(line.html);
+            out->append("\n");
+            continue;
+        }
+        if (!list.empty() && open_list.empty()) {
+            if (list == "ordered") out->append("<ol>");
+            else if (list == "bullet") out->append("<ul>");
+            else out->append(list == "checked" ? "<ul data-checked=\"true\">" : "<ul data-checked=\"false\">");
+            open_list = list;
+        }
+        out->append(line.html);
+    }
+    if (in_code) out->append("</pre>");
+    if (!open_list.empty()) out->append(open_list == "ordered" ? "</ol>" : "</ul>");
+}
+
+static void assemble_markdown(const RenderDoc* doc, std::string* out) {
+    out->clear();
+    bool in_code = false;
+    bool prev_list = false;
+    int numbers[9] = { 0 };     // Ordered list counters by indent
+
+    for (size_t i = 0; i < doc->lines.size(); i++) {
+        const Line& line = doc->lines[i];
+        if (!line.terminated && line.len == 0) break;
+
+        bool code = attr_get(line.attrs, "code-block") != nullptr;
+        std::string list = list_type(line);
+
+        if (in_code && !code) {
+            out->append("```\n");
+            in_code = false;
+        }
+        if (code) {
+            if (!in_code) out->append(out->empty() ? "```\n" : "\n```\n");
+            in_code = true;
+            out->append(line.md);
+            out->append("\n");
+            prev_list = false;
+            continue;
+        }
+
+        // Blocks are separated by a blank line, list items by a newline
+        if (!out->empty()) out->append(list.empty() || !prev_list ? "\n" : "");
+        if (list.empty()) memset(numbers, 0, sizeof(numbers));
+
+        const std::string* header = attr_get(line.attrs, "header");
+        if (!list.empty()) {
+            int indent = indent_of(line);
+            out->append((size_t)indent * 3, ' ');
+            for (int d = indent + 1; d < 9; d++) numbers[d] = 0;
+            if (list == "ordered") {
+                char num[16];
+                snprintf(num, sizeof(num), "%d. ", ++numbers[indent]);
+                out->append(num);
+            } else if (list == "checked") {
+                out->append("- [x] ");
+            } else if (list == "unchecked") {
+                out->append("- [ ] ");
+            } else {
+                out->append("- ");
+            }
+        } else if (header) {
+            int level = std::max(1, std::min(atoi(header->c_str()), 6));
+            out->append((size_t)level, '#');
+            out->append(" ");
+        } else if (attr_get(line.attrs, "blockquote")) {
+            out->append("> ");
+        }
+        out->append(line.md);
+        out->append("\n");
+        prev_list = !list.empty();
+    }
+    if (in_code) out->append("```\n");
+}
+
+// Hash of the canonical state vector: the same document state gives the same
+// tag across requests and processes
+static std::string state_vector_tag(Room* room) {
+    static thread_local std::vector<uint64_t> t_entries;
+    size_t sv_len = 0;
+    uint8_t* sv = room->doc.get_state_vector(&sv_len);
+    doc_canonical_state_vector(sv, sv_len, t_entries);
+    free(sv);
+
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < t_entries.size(); i++) {
+        for (int b = 0; b < 8; b++) {
+            h ^= (t_entries[i] >> (b * 8)) & 0xFF;
+            h *= 1099511628211ULL;
+        }
+    }
+    char tag[24];
+    snprintf(tag, sizeof(tag), "\"%016llx\"", (unsigned long long)h);
+    return tag;
+}
+
+// Cached render plus the state vector tag; false when the room does not exist
+static bool render_cached(const char* name, RenderFormat format, std::string* out, std::string* etag) {
+    Room* room = rooms_find(name);
+    if (!room) return false;
+    // A clone's mirror fills in when its YDoc is built
+    if (!room->doc.is_materialized()) room->doc.materialize();
+
+    // Version first: the mirror read afterwards covers at least this version
+    uint64_t version = room->doc.version();
+    omp_set_lock(&g_lock);
+    RenderDoc* doc = doc_for(room);
+    if (doc->key_version != version) {
+        omp_unset_lock(&g_lock);
+        std::string tag = state_vector_tag(room);
+        omp_set_lock(&g_lock);
+        doc->key_version = version;
+        doc->etag = tag;
+    }
+    *etag = doc->etag;
+
+    if (doc->cached[format]) {
+        g_hits++;
+    } else {
+        for (size_t i = 0; i < doc->lines.size(); i++) {
+            if (!doc->lines[i].dirty) continue;
+            render_line(&doc->lines[i]);
+            g_lines_rendered++;
+        }
+        if (format == RENDER_HTML) assemble_html(doc, &doc->out[format]);
+        else assemble_markdown(doc, &doc->out[format]);
+        doc->cached[format] = true;
+        g_misses++;
+    }
+    *out = doc->out[format];
+    omp_unset_lock(&g_lock);
+    return true;
+}
+
+void render_init() {
+    omp_init_lock(&g_lock);
+    rooms_add_text_observer(on_text);
+}
+
+void render_destroy() {
+    omp_set_lock(&g_lock);
+    for (size_t i = 0; i < g_docs.size(); i++) {
+        delete g_docs[i];
+    }
+    g_docs.clear();
+    g_hits = 0;
+    g_misses = 0;
+    g_lines_rendered = 0;
+    omp_unset_lock(&g_lock);
+    omp_destroy_lock(&g_lock);
+}
+
+bool render_room(const char* room, RenderFormat format, std::string* out) {
+    std::string etag;
+    return render_cached(room, format, out, &etag);
+}
+
+void render_get_stats(RenderStats* out) {
+    memset(out, 0, sizeof(*out));
+    omp_set_lock(&g_lock);
+    for (size_t i = 0; i < g_docs.size(); i++) {
+        if (!g_docs[i]) continue;
+        out->rooms++;
+        out->lines += g_docs[i]->lines.size();
+    }
+    out->hits = g_hits;
+    out->misses = g_misses;
+    out->lines_rendered = g_lines_rendered;
+    omp_unset_lock(&g_lock);
+}
+
+void render_handle_http(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)user;
+    std::string room;
+    if (!http_query_param(req.query, "room", &room) || room.empty()) {
+        resp->status = 400;
+        resp->body = "{\"error\":\"missing room\"}";
+        return;
+    }
+    std::string format_str;
+    RenderFormat format = RENDER_HTML;
+    if (http_query_param(req.query, "format", &format_str)) {
+        if (format_str == "markdown" || format_str == "md") {
+            format = RENDER_MARKDOWN;
+        } else if (format_str != "html") {
+            resp->status = 400;
+            resp->body = "{\"error\":\"format must be html or markdown\"}";
+            return;
+        }
+    }
+
+    std::string body;
+    std::string etag;
+    if (!render_cached(room.c_str(), format, &body, &etag)) {
+        resp->status = 404;
+        resp->body = "{\"error\":\"no such room\"}";
+        return;
+    }
+
+    // Previews revalidate with the tag and skip the body while the state is unchanged
+    resp->headers = "ETag: " + etag + "\r\nCache-Control: no-cache\r\n";
+    std::string match;
+    if (http_header(req, "If-None-Match", &match) && match == etag) {
+        resp->status = 304;
+        return;
+    }
+    resp->content_type = format == RENDER_HTML ? "text/html; charset=utf-8" : "text/markdown; charset=utf-8";
+    resp->body.swap(body);
+}
@@ -0,0 +1,425 @@
+#include "room.h"
+#include "allocstat.h"
+#include "epoch.h"
+#include "peer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static Room* g_rooms = nullptr;
+static std::unordered_map<std::string, Room*> g_room_index;    // By name (g_rooms_lock)
+static ProfiledLock g_rooms_lock;
+static const char* g_shared_type = "quill";
+static int g_room_count = 0;
+static int g_room_limit = 0;
+static uint64_t g_rooms_refused = 0;
+static uint64_t g_listener_id = 0;
+static RoomTextFn g_text_observers[ROOM_TEXT_OBSERVERS_MAX];
+static int g_text_observer_count = 0;
+static RoomDocUpdateFn g_update_observers[ROOM_UPDATE_OBSERVERS_MAX];
+static int g_update_observer_count = 0;
+
+// One allocation per snapshot: header, then each column cache-line aligned
+static size_t align_up(size_t n) {
+    return (n + 63) & ~(size_t)63;
+}
+
+static RoomPeerSet* peer_set_alloc(int count, uint64_t version) {
+    size_t rows = count > 0 ? (size_t)count : 1;
+    size_t header = align_up(sizeof(RoomPeerSet));
+    size_t peers_bytes = align_up(rows * sizeof(Peer*));
+    size_t byte_col = align_up(rows);
+
+    uint8_t* block = nullptr;
+    if (posix_memalign((void**)&block, 64, header + peers_bytes + 2 * byte_col) != 0) {
+        return nullptr;
+    }
+    tagged_adopt(block, ALLOC_PEER);
+
+    RoomPeerSet* set = (RoomPeerSet*)block;
+    set->version = version;
+    set->count = count;
+    set->peers = (Peer**)(block + header);
+    set->sync = block + header + peers_bytes;
+    set->peer_class = set->sync + byte_col;
+    return set;
+}
+
+static void peer_set_copy_rows(RoomPeerSet* dst, const RoomPeerSet* src, int rows) {
+    memcpy(dst->peers, src->peers, rows * sizeof(Peer*));
+    memcpy(dst->sync, src->sync, rows);
+    memcpy(dst->peer_class, src->peer_class, rows);
+}
+
+static void peer_set_free(void* ptr) {
+    tagged_free(ptr, ALLOC_PEER);
+}
+
+void rooms_init(const char* shared_type_name) {
+    profiled_lock_init(&g_rooms_lock, LOCK_CLASS_ROOMS);
+    g_rooms = nullptr;
+    g_room_index.clear();
+    g_room_count = 0;
+    g_room_limit = 0;
+    g_rooms_refused = 0;
+    g_shared_type = shared_type_name;
+    g_text_observer_count = 0;
+    g_update_observer_count = 0;
+}
+
+void rooms_set_limit(int max_rooms) {
+    g_room_limit = max_rooms > 0 ? max_rooms : 0;
+}
+
+bool rooms_add_text_observer(RoomTextFn fn) {
+    if (g_text_observer_count == ROOM_TEXT_OBSERVERS_MAX) return false;
+    g_text_observers[g_text_observer_count++] = fn;
+    return true;
+}
+
+bool rooms_add_update_observer(RoomDocUpdateFn fn) {
+    if (g_update_observer_count == ROOM_UPDATE_OBSERVERS_MAX) return false;
+    g_update_observers[g_update_observer_count++] = fn;
+    return true;
+}
+
+static void room_text_event(void* user, const YDelta* delta, uint32_t len) {
+    Room* room = (Room*)user;
+    for (int i = 0; i < g_text_observer_count; i++) {
+        g_text_observers[i](room, delta, len);
+    }
+}
+
+static void room_update_event(void* user, const uint8_t* update, uint32_t len) {
+    Room* room = (Room*)user;
+    for (int i = 0; i < g_update_observer_count; i++) {
+        g_update_observers[i](room, update, len);
+    }
+}
+
+void rooms_destroy() {
+    LOCK_ACQUIRE(&g_rooms_lock);
+
+    Room* room = g_rooms;
+    while (room) {
+        Room* next = room->next;
+        peer_set_free(room->members);
+        free(room->listeners);
+        profiled_lock_destroy(&room->members_lock);
+        free(room->name);
+        delete room;
+        room = next;
+    }
+
+    g_rooms = nullptr;
+    g_room_index.clear();
+    g_room_count = 0;
+    LOCK_RELEASE(&g_rooms_lock);
+    profiled_lock_destroy(&g_rooms_lock);
+}
+
+static const char* room_name(const char* path, size_t* name_len) {
+    *name_len = strcspn(path, "?#");
+    if (*name_len == 0) {
+        *name_len = 1;
+        return "/";
+    }
+    return path;
+}
+
+static Room* find_locked(const char* name, size_t name_len) {
+    static thread_local std::string t_key;
+    t_key.assign(name, name_len);
+    std::unordered_map<std::string, Room*>::const_iterator it = g_room_index.find(t_key);
+    return it == g_room_index.end() ? nullptr : it->second;
+}
+
+Room* rooms_find(const char* path) {
+    size_t name_len;
+    const char* name = room_name(path, &name_len);
+    LOCK_ACQUIRE(&g_rooms_lock);
+    Room* room = find_locked(name, name_len);
+    LOCK_RELEASE(&g_rooms_lock);
+    return room;
+}
+
+static bool at_limit_locked() {
+    return g_room_limit > 0 && g_room_count >= g_room_limit;
+}
+
+// Create and publish a room (caller holds g_rooms_lock); snapshot = initial state.
+// nullptr when the room limit is reached.
+static Room* create_locked(const char* name, size_t name_len, DocSnapshot* snapshot) {
+    if (at_limit_locked()) {
+        g_rooms_refused++;
+        return nullptr;
+    }
+    Room* room = new Room();
+    room->name = strndup(name, name_len);
+    room->id = (uint32_t)g_room_count + 1;
+    if (snapshot) room->doc.init_from_snapshot(g_shared_type, snapshot);
+    else room->doc.init(g_shared_type);
+    room->members = peer_set_alloc(0, 0);
+    profiled_lock_init(&room->members_lock, LOCK_CLASS_MEMBERS);
+    room->syncs_active = 0;
+    room->syncs_waiting = 0;
+    room->listeners = nullptr;
+    if (g_text_observer_count > 0) room->doc.observe_text(room_text_event, room);
+    if (g_update_observer_count > 0) room->doc.observe_updates(room_update_event, room);
+
+    // Publish fully initialized (rooms_for_each walks without the lock)
+    room->next = g_rooms;
+    __atomic_store_n(&g_rooms, room, __ATOMIC_RELEASE);
+    g_room_index[std::string(name, name_len)] = room;
+    g_room_count++;
+    return room;
+}
+
+Room* rooms_get(const char* path) {
+    size_t name_len;
+    const char* name = room_name(path, &name_len);
+
+    LOCK_ACQUIRE(&g_rooms_lock);
+    Room* room = find_locked(name, name_len);
+    if (room) {
+        LOCK_RELEASE(&g_rooms_lock);
+        return room;
+    }
+    room = create_locked(name, name_len, nullptr);
+    LOCK_RELEASE(&g_rooms_lock);
+
+    if (!room) {
+        fprintf(stderr, "[Room] Room limit (%d) reached, refusing '%.*s'\n", g_room_limit, (int)name_len, name);
+        return nullptr;
+    }
+    printf("[Room] Created room '%s'\n", room->name);
+    return room;
+}
+
+bool rooms_admit(const char* path) {
+    size_t name_len;
+    const char* name = room_name(path, &name_len);
+
+    LOCK_ACQUIRE(&g_rooms_lock);
+    bool ok = !at_limit_locked() || find_locked(name, name_len) != nullptr;
+    if (!ok) g_rooms_refused++;
+    LOCK_RELEASE(&g_rooms_lock);
+    return ok;
+}
+
+Room* rooms_clone(const char* path, DocSnapshot* snapshot) {
+    size_t name_len;
+    const char* name = room_name(path, &name_len);
+
+    LOCK_ACQUIRE(&g_rooms_lock);
+    if (find_locked(name, name_len)) {
+        LOCK_RELEASE(&g_rooms_lock);
+        return nullptr;
+    }
+    Room* room = create_locked(name, name_len, snapshot);
+    LOCK_RELEASE(&g_rooms_lock);
+    // Observers (search, render, change feed) are subscribed when the YDoc is
+    // built, on the first write or render, and see the copy as its first change
+    return room;
+}
+
+int rooms_count() {
+    LOCK_ACQUIRE(&g_rooms_lock);
+    int count = g_room_count;
+    LOCK_RELEASE(&g_rooms_lock);
+    return count;
+}
+
+uint64_t rooms_refused() {
+    LOCK_ACQUIRE(&g_rooms_lock);
+    uint64_t refused = g_rooms_refused;
+    LOCK_RELEASE(&g_rooms_lock);
+    return refused;
+}
+
+void rooms_for_each(void (*fn)(Room* room, void* user), void* user) {
+    Room* room = __atomic_load_n(&g_rooms, __ATOMIC_ACQUIRE);
+    while (room) {
+        fn(room, user);
+        room = room->next;
+    }
+}
+
+void room_join(Room* room, Peer* peer) {
+    room_join_many(room, &peer, 1);
+}
+
+void room_join_many(Room* room, Peer* const* peers, int count) {
+    if (count <= 0) return;
+    LOCK_ACQUIRE(&room->members_lock);
+
+    RoomPeerSet* old_set = room->members;
+    int n = old_set->count;
+    RoomPeerSet* set = peer_set_alloc(n + count, old_set->version + 1);
+    peer_set_copy_rows(set, old_set, n);
+    for (int i = 0; i < count; i++) {
+        set->peers[n + i] = peers[i];
+        set->sync[n + i] = PEER_SYNC_PENDING;
+        set->peer_class[n + i] = PEER_CLASS_VIEWER;
+        peers[i]->room_slot = n + i;
+    }
+    __atomic_store_n(&room->members, set, __ATOMIC_RELEASE);
+
+    LOCK_RELEASE(&room->members_lock);
+
+    epoch_retire(old_set, peer_set_free);
+}
+
+void room_leave(Room* room, Peer* peer) {
+    LOCK_ACQUIRE(&room->members_lock);
+
+    RoomPeerSet* old_set = room->members;
+    int slot = peer->room_slot;
+    if (slot < 0 || slot >= old_set->count || old_set->peers[slot] != peer) {
+        LOCK_RELEASE(&room->members_lock);
+        return;
+    }
+
+    // Swap-remove: the last row moves into the vacated slot
+    int last = old_set->count - 1;
+    RoomPeerSet* set = peer_set_alloc(last, old_set->version + 1);
+    peer_set_copy_rows(set, old_set, last);
+    if (slot != last) {
+        set->peers[slot] = old_set->peers[last];
+        set->sync[slot] = old_set->sync[last];
+        set->peer_class[slot] = old_set->peer_class[last];
+        set->peers[slot]->room_slot = slot;
+    }
+    peer->room_slot = -1;
+    __atomic_store_n(&room->members, set, __ATOMIC_RELEASE);
+
+    LOCK_RELEASE(&room->members_lock);
+
+    epoch_retire(old_set, peer_set_free);
+}
+
+void room_set_sync(Room* room, Peer* peer, PeerSyncState state) {
+    LOCK_ACQUIRE(&room->members_lock);
+    RoomPeerSet* set = room->members;
+    int slot = peer->room_slot;
+    if (slot >= 0 && slot < set->count && set->peers[slot] == peer) {
+        __atomic_store_n(&set->sync[slot], (uint8_t)state, __ATOMIC_RELEASE);
+    }
+    LOCK_RELEASE(&room->members_lock);
+}
+
+void room_set_class(Room* room, Peer* peer, PeerClass peer_class) {
+    LOCK_ACQUIRE(&room->members_lock);
+    RoomPeerSet* set = room->members;
+    int slot = peer->room_slot;
+    if (slot >= 0 && slot < set->count && set->peers[slot] == peer) {
+        __atomic_store_n(&set->peer_class[slot], (uint8_t)peer_class, __ATOMIC_RELEASE);
+    }
+    LOCK_RELEASE(&room->members_lock);
+}
+
+RoomPeerSet* room_members(Room* room) {
+    return __atomic_load_n(&room->members, __ATOMIC_ACQUIRE);
+}
+
+static RoomListenerSet* listener_set_alloc(int count) {
+    size_t size = sizeof(RoomListenerSet) + (count > 1 ? count - 1 : 0) * sizeof(RoomListener);
+    RoomListenerSet* set = (RoomListenerSet*)malloc(size);
+    set->count = count;
+    return set;
+}
+
+uint64_t room_add_listener(Room* room, RoomUpdateFn fn, void* user) {
+    uint64_t id = __atomic_add_fetch(&g_listener_id, 1, __ATOMIC_RELAXED);
+
+    LOCK_ACQUIRE(&room->members_lock);
+    RoomListenerSet* old_set = room->listeners;
+    int n = old_set ? old_set->count : 0;
+    RoomListenerSet* set = listener_set_alloc(n + 1);
+    if (n > 0) memcpy(set->items, old_set->items, n * sizeof(RoomListener));
+    set->items[n].id = id;
+    set->items[n].fn = fn;
+    set->items[n].user = user;
+    __atomic_store_n(&room->listeners, set, __ATOMIC_RELEASE);
+    LOCK_RELEASE(&room->members_lock);
+
+    if (old_set) epoch_retire(old_set, free);
+    return id;
+}
+
+bool room_remove_listener(Room* room, uint64_t id, void** user_out) {
+    LOCK_ACQUIRE(&room->members_lock);
+    RoomListenerSet* old_set = room->listeners;
+    int n = old_set ? old_set->count : 0;
+    int slot = 0;
+    while (slot < n && old_set->items[slot].id != id) slot++;
+    if (slot == n) {
+        LOCK_RELEASE(&room->members_lock);
+        return false;
+    }
+    if (user_out) *user_out = old_set->items[slot].user;
+
+    RoomListenerSet* set = nullptr;
+    if (n > 1) {
+        set = listener_set_alloc(n - 1);
+        memcpy(set->items, old_set->items, slot * sizeof(RoomListener));
+        memcpy(set->items + slot, old_set->items + slot + 1, (n - slot - 1) * sizeof(RoomListener));
+    }
+    __atomic_store_n(&room->listeners, set, __ATOMIC_RELEASE);
+    LOCK_RELEASE(&room->members_lock);
+
+    epoch_retire(old_set, free);
+    return true;
+}
+
+void room_publish_update(Room* room, const uint8_t* update, size_t len) {
+    if (!__atomic_load_n(&room->listeners, __ATOMIC_RELAXED)) return;
+
+    EpochGuard guard;
+    RoomListenerSet* set = __atomic_load_n(&room->listeners, __ATOMIC_ACQUIRE);
+    for (int i = 0; set && i < set->count; i++) {
+        set->items[i].fn(room, update, len, set->items[i].user);
+    }
+}
+
+// Branch-free and alias-free, in fixed blocks of 16 rows so -O2 vectorizes it
+// (one SSE compare per block) without needing the dynamic cost model
+#define FILTER_BLOCK 16
+
+static void filter_rows(const uint8_t* __restrict sync, const uint8_t* __restrict cls, int n,
+                        uint8_t min_sync, uint8_t class_mask, uint8_t* __restrict keep) {
+    int i = 0;
+    for (; i + FILTER_BLOCK <= n; i += FILTER_BLOCK) {
+        for (int j = 0; j < FILTER_BLOCK; j++) {
+            keep[i + j] = (uint8_t)((sync[i + j] >= min_sync) & ((cls[i + j] & class_mask) != 0));
+        }
+    }
+    for (; i < n; i++) {
+        keep[i] = (uint8_t)((sync[i] >= min_sync) & ((cls[i] & class_mask) != 0));
+    }
+}
+
+int room_select(const RoomPeerSet* set, bool synced_only, uint8_t class_mask,
+                const Peer* exclude, uint32_t* out) {
+    static thread_local std::vector<uint8_t> t_keep;
+
+    int n = set->count;
+    if ((int)t_keep.size() < n) t_keep.resize(n < 1024 ? 1024 : n * 2);
+
+    // Pass 1: byte-wise filter over the sync/class columns
+    uint8_t* keep = t_keep.data();
+    filter_rows(set->sync, set->peer_class, n,
+                synced_only ? PEER_SYNC_DONE : PEER_SYNC_PENDING, class_mask, keep);
+
+    // Pass 2: compact into row indices (branch-free append)
+    Peer* const* peers = set->peers;
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        out[count] = (uint32_t)i;
+        count += keep[i] & (peers[i] != exclude);
+    }
+    return count;
+}
@@ -0,0 +1,451 @@
+#include "search.h"
+#include "room.h"
+#include "protocol.h"
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define SEARCH_TERM_MAX 64              // Longer words are indexed by their prefix
+#define SEARCH_CHANGES_MAX 64           // Change buffer entries before a merge
+#define SEARCH_DEFAULT_LIMIT 20
+#define SEARCH_LIMIT_MAX 1000
+
+// One word of a room's text
+struct Token {
+    uint32_t start;
+    uint32_t len;
+    uint32_t term;
+};
+
+struct DocIndex {
+    Room* room;
+    omp_lock_t lock;                            // Guards text and tokens (taken before g_lock)
+    std::string text;                           // Mirror of the shared text
+    std::vector<Token> tokens;                  // Sorted by start, non-overlapping
+    std::unordered_map<uint32_t, uint32_t> tf;  // Term -> occurrences
+};
+
+// New term frequency for a room; tf 0 removes it from the list
+struct PostingChange {
+    uint32_t room_id;
+    uint32_t tf;
+};
+
+// Rooms containing a term, sorted by id: packed (gap, tf) varint pairs plus
+// changes not merged yet (sorted, at most one per room, override packed)
+struct PostingList {
+    std::vector<uint8_t> packed;
+    std::vector<PostingChange> changes;
+};
+
+struct Posting {
+    uint32_t room_id;
+    uint32_t tf;
+};
+
+static omp_lock_t g_lock;       // Guards everything below and DocIndex::tf (leaf)
+static std::unordered_map<std::string, uint32_t> g_term_ids;
+static std::vector<PostingList> g_postings;
+static std::vector<DocIndex*> g_docs;   // By room id
+static uint64_t g_token_count = 0;
+static uint64_t g_deltas = 0;
+static uint64_t g_reindexed_bytes = 0;
+
+static bool is_word_byte(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+// Split text[start, end) into normalized words; fn(start, len, term) per word
+template <typename Fn>
+static void tokenize(const char* text, size_t start, size_t end, Fn fn) {
+    char term[SEARCH_TERM_MAX];
+    size_t i = start;
+    while (i < end) {
+        while (i < end && !is_word_byte((unsigned char)text[i])) i++;
+        size_t word = i;
+        size_t term_len = 0;
+        while (i < end && is_word_byte((unsigned char)text[i])) {
+            char c = text[i++];
+            if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+            if (term_len < SEARCH_TERM_MAX) term[term_len++] = c;
+        }
+        if (i > word) fn((uint32_t)word, (uint32_t)(i - word), term, term_len);
+    }
+}
+
+static uint32_t intern_term(const char* term, size_t len) {
+    std::string key(term, len);
+    std::unordered_map<std::string, uint32_t>::iterator it = g_term_ids.find(key);
+    if (it != g_term_ids.end()) return it->second;
+
+    uint32_t id = (uint32_t)g_postings.size();
+    g_term_ids[key] = id;
+    g_postings.push_back(PostingList());
+    return id;
+}
+
+static void decode_packed(const std::vector<uint8_t>& packed, std::vector<Posting>* out) {
+    size_t pos = 0;
+    uint32_t room_id = 0;
+    while (pos < packed.size()) {
+        uint32_t gap = 0, tf = 0;
+        pos += decode_varuint(&packed[pos], packed.size() - pos, &gap);
+        pos += decode_varuint(&packed[pos], packed.size() - pos, &tf);
+        room_id += gap;
+        Posting p = { room_id, tf };
+        out->push_back(p);
+    }
+}
+
+// Packed entries with the change buffer applied
+static void decode_postings(const std::vector<uint8_t>& packed, const std::vector<PostingChange>& changes,
+                            std::vector<Posting>* out) {
+    std::vector<Posting> base;
+    decode_packed(packed, &base);
+
+    out->clear();
+    size_t i = 0, j = 0;
+    while (i < base.size() || j < changes.size()) {
+        if (j == changes.size() || (i < base.size() && base[i].room_id < changes[j].room_id)) {
+            out->push_back(base[i++]);
+            continue;
+        }
+        if (i < base.size() && base[i].room_id == changes[j].room_id) i++;
+        if (changes[j].tf > 0) {
+            Posting p = { changes[j].room_id, changes[j].tf };
+            out->push_back(p);
+        }
+        j++;
+    }
+}
+
+static void merge_changes(PostingList* list) {
+    std::vector<Posting> merged;
+    decode_postings(list->packed, list->changes, &merged);
+
+    list->packed.clear();
+    uint8_t buf[10];
+    uint32_t prev = 0;
+    for (size_t i = 0; i < merged.size(); i++) {
+        size_t n = encode_varuint(merged[i].room_id - prev, buf);
+        n += encode_varuint(merged[i].tf, buf + n);
+        list->packed.insert(list->packed.end(), buf, buf + n);
+        prev = merged[i].room_id;
+    }
+    list->changes.clear();
+}
+
+static void set_posting(uint32_t term, uint32_t room_id, uint32_t tf) {
+    PostingList* list = &g_postings[term];
+    PostingChange change = { room_id, tf };
+
+    std::vector<PostingChange>::iterator it = std::lower_bound(
+        list->changes.begin(), list->changes.end(), change,
+        [](const PostingChange& a, const PostingChange& b) { return a.room_id < b.room_id; });
+    if (it != list->changes.end() && it->room_id == room_id) {
+        it->tf = tf;
+    } else {
+        list->changes.insert(it, change);
+    }
+
+    if (list->changes.size() > SEARCH_CHANGES_MAX) merge_changes(list);
+}
+
+static DocIndex* doc_for(Room* room) {
+    if (room->id >= g_docs.size()) g_docs.resize(room->id + 1, nullptr);
+    DocIndex*& doc = g_docs[room->id];
+    if (!doc) {
+        doc = new DocIndex();
+        doc->room = room;
+        omp_init_lock(&doc->lock);
+    }
+    return doc;
+}
+
+// Re-tokenize the edited span [lo, hi) (new text coordinates) together with
+// the words touching it, then shift the tokens after it by shift bytes
+static void reindex(DocIndex* doc, uint32_t lo, uint32_t hi, int64_t shift) {
+    static thread_local std::vector<Token> t_tokens;
+    static thread_local std::vector<std::pair<uint32_t, int> > t_counts;
+
+    uint32_t hi_old = (uint32_t)((int64_t)hi - shift);
+
+    // Words ending at or after lo and starting at or before hi_old may merge with the edit
+    std::vector<Token>& tokens = doc->tokens;
+    std::vector<Token>::iterator first = std::partition_point(tokens.begin(), tokens.end(),
+        [lo](const Token& t) { return t.start + t.len < lo; });
+    std::vector<Token>::iterator last = std::partition_point(first, tokens.end(),
+        [hi_old](const Token& t) { return t.start <= hi_old; });
+
+    uint32_t wlo = lo;
+    uint32_t whi_old = hi_old;
+    if (first != last) {
+        wlo = std::min(lo, first->start);
+        whi_old = std::max(hi_old, (last - 1)->start + (last - 1)->len);
+    }
+    uint32_t whi = (uint32_t)((int64_t)whi_old + shift);
+    if (whi > doc->text.size()) whi = (uint32_t)doc->text.size();
+
+    t_counts.clear();
+    for (std::vector<Token>::iterator t = first; t != last; ++t) {
+        t_counts.push_back(std::make_pair(t->term, -1));
+    }
+
+    t_tokens.clear();
+    tokenize(doc->text.data(), wlo, whi, [&](uint32_t start, uint32_t len, const char* term, size_t term_len) {
+        Token t = { start, len, intern_term(term, term_len) };
+        t_tokens.push_back(t);
+        t_counts.push_back(std::make_pair(t.term, 1));
+    });
+
+    for (std::vector<Token>::iterator t = last; t != tokens.end(); ++t) {
+        t->start = (uint32_t)((int64_t)t->start + shift);
+    }
+    g_token_count += t_tokens.size();
+    g_token_count -= (uint64_t)(last - first);
+    size_t at = first - tokens.begin();
+    tokens.erase(first, last);
+    tokens.insert(tokens.begin() + at, t_tokens.begin(), t_tokens.end());
+    g_reindexed_bytes += whi - wlo;
+
+    // Net change per term, one postings update each
+    std::sort(t_counts.begin(), t_counts.end());
+    for (size_t i = 0; i < t_counts.size();) {
+        uint32_t term = t_counts[i].first;
+        int delta = 0;
+        for (; i < t_counts.size() && t_counts[i].first == term; i++) delta += t_counts[i].second;
+        if (delta == 0) continue;
+
+        uint32_t& tf = doc->tf[term];
+        tf = (uint32_t)((int64_t)tf + delta);
+        set_posting(term, doc->room->id, tf);
+        if (tf == 0) doc->tf.erase(term);
+    }
+}
+
+// Room text observer: apply the delta to the mirror, then re-tokenize the span it touched
+static void on_text(Room* room, const YDelta* delta, uint32_t len) {
+    omp_set_lock(&g_lock);
+    DocIndex* doc = doc_for(room);
+    omp_unset_lock(&g_lock);
+
+    // Document locks serialize a room's deltas; the doc lock keeps queries
+    // reading the tokens from seeing the mirror mid-edit
+    omp_set_lock(&doc->lock);
+
+    uint32_t pos = 0;
+    uint32_t lo = UINT32_MAX;
+    uint32_t hi = 0;
+    int64_t shift = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        const YDelta& d = delta[i];
+        if (pos > doc->text.size()) pos = (uint32_t)doc->text.size();
+
+        if (d.tag == Y_EVENT_CHANGE_RETAIN) {
+            pos += d.len;
+        } else if (d.tag == Y_EVENT_CHANGE_DELETE) {
+            uint32_t n = std::min(d.len, (uint32_t)doc->text.size() - pos);
+            doc->text.erase(pos, n);
+            lo = std::min(lo, pos);
+            hi = std::max(hi, pos);
+            shift -= n;
+        } else if (d.tag == Y_EVENT_CHANGE_ADD && d.insert) {
+            // Embeds take one position; index them as a word break
+            const char* str = d.insert->tag == Y_JSON_STR ? youtput_read_string(d.insert) : nullptr;
+            size_t n = str ? strlen(str) : 1;
+            doc->text.insert(pos, str ? str : " ", n);
+            lo = std::min(lo, pos);
+            pos += (uint32_t)n;
+            hi = std::max(hi, pos);
+            shift += (int64_t)n;
+        }
+    }
+
+    if (lo != UINT32_MAX) {
+        omp_set_lock(&g_lock);
+        reindex(doc, lo, hi, shift);
+        g_deltas++;
+        omp_unset_lock(&g_lock);
+    }
+    omp_unset_lock(&doc->lock);
+}
+
+void search_init() {
+    omp_init_lock(&g_lock);
+    rooms_add_text_observer(on_text);
+}
+
+void search_destroy() {
+    omp_set_lock(&g_lock);
+    for (size_t i = 0; i < g_docs.size(); i++) {
+        if (!g_docs[i]) continue;
+        omp_destroy_lock(&g_docs[i]->lock);
+        delete g_docs[i];
+    }
+    g_docs.clear();
+    g_term_ids.clear();
+    g_postings.clear();
+    g_token_count = 0;
+    g_deltas = 0;
+    g_reindexed_bytes = 0;
+    omp_unset_lock(&g_lock);
+    omp_destroy_lock(&g_lock);
+}
+
+// Copy of one term's postings, taken under the lock and decoded outside it
+struct TermPostings {
+    std::vector<uint8_t> packed;
+    std::vector<PostingChange> changes;
+    std::vector<Posting> decoded;
+};
+
+int search_query(const char* query, size_t len, SearchHit* hits, int max_hits, int* total) {
+    std::vector<std::string> words;
+    tokenize(query, 0, len, [&](uint32_t, uint32_t, const char* term, size_t term_len) {
+        words.push_back(std::string(term, term_len));
+    });
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    *total = 0;
+    if (words.empty()) return 0;
+
+    std::vector<TermPostings> lists(words.size());
+    std::vector<uint32_t> term_ids(words.size());
+    omp_set_lock(&g_lock);
+    for (size_t i = 0; i < words.size(); i++) {
+        std::unordered_map<std::string, uint32_t>::iterator it = g_term_ids.find(words[i]);
+        if (it == g_term_ids.end()) {
+            omp_unset_lock(&g_lock);
+            return 0;
+        }
+        term_ids[i] = it->second;
+        lists[i].packed = g_postings[it->second].packed;
+        lists[i].changes = g_postings[it->second].changes;
+    }
+    omp_unset_lock(&g_lock);
+
+    // Intersect, smallest list first
+    for (size_t i = 0; i < lists.size(); i++) {
+        decode_postings(lists[i].packed, lists[i].changes, &lists[i].decoded);
+    }
+    std::vector<size_t> order(lists.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return lists[a].decoded.size() < lists[b].decoded.size();
+    });
+
+    std::vector<Posting> matches = lists[order[0]].decoded;
+    for (size_t k = 1; k < order.size() && !matches.empty(); k++) {
+        const std::vector<Posting>& other = lists[order[k]].decoded;
+        size_t out = 0, j = 0;
+        for (size_t i = 0; i < matches.size(); i++) {
+            while (j < other.size() && other[j].room_id < matches[i].room_id) j++;
+            if (j == other.size()) break;
+            if (other[j].room_id == matches[i].room_id) {
+                matches[out].room_id = matches[i].room_id;
+                matches[out].tf = matches[i].tf + other[j].tf;
+                out++;
+            }
+        }
+        matches.resize(out);
+    }
+
+    *total = (int)matches.size();
+    int count = std::min(max_hits, (int)matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + count, matches.end(),
+                      [](const Posting& a, const Posting& b) {
+                          return a.tf != b.tf ? a.tf > b.tf : a.room_id < b.room_id;
+                      });
+
+    // Positions for the returned hits only, under each room's own lock so the
+    // token scans do not hold up edits to other rooms
+    std::vector<DocIndex*> docs(count);
+    omp_set_lock(&g_lock);
+    for (int i = 0; i < count; i++) docs[i] = g_docs[matches[i].room_id];
+    omp_unset_lock(&g_lock);
+
+    for (int i = 0; i < count; i++) {
+        DocIndex* doc = docs[i];
+        hits[i].room_id = matches[i].room_id;
+        hits[i].room = doc->room->name;
+        hits[i].score = matches[i].tf;
+        hits[i].position = 0;
+        omp_set_lock(&doc->lock);
+        for (size_t t = 0; t < doc->tokens.size(); t++) {
+            if (std::find(term_ids.begin(), term_ids.end(), doc->tokens[t].term) != term_ids.end()) {
+                hits[i].position = doc->tokens[t].start;
+                break;
+            }
+        }
+        omp_unset_lock(&doc->lock);
+    }
+
+    return count;
+}
+
+void search_get_stats(SearchStats* out) {
+    memset(out, 0, sizeof(*out));
+    omp_set_lock(&g_lock);
+    for (size_t i = 0; i < g_docs.size(); i++) {
+        if (g_docs[i]) out->rooms++;
+    }
+    out->terms = (uint32_t)g_postings.size();
+    out->tokens = g_token_count;
+    for (size_t i = 0; i < g_postings.size(); i++) {
+        out->postings_bytes += g_postings[i].packed.size() +
+                               g_postings[i].changes.size() * sizeof(PostingChange);
+    }
+    out->deltas = g_deltas;
+    out->reindexed_bytes = g_reindexed_bytes;
+    omp_unset_lock(&g_lock);
+}
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void search_handle_http(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)user;
+    std::string q;
+    if (!http_query_param(req.query, "q", &q) || q.empty()) {
+        resp->status = 400;
+        resp->body = "{\"error\":\"missing q\"}";
+        return;
+    }
+    int limit = SEARCH_DEFAULT_LIMIT;
+    std::string limit_str;
+    if (http_query_param(req.query, "limit", &limit_str)) {
+        limit = std::max(1, std::min(atoi(limit_str.c_str()), SEARCH_LIMIT_MAX));
+    }
+
+    uint64_t start = now_us();
+    std::vector<SearchHit> hits(limit);
+    int total = 0;
+    int count = search_query(q.data(), q.size(), hits.data(), limit, &total);
+    uint64_t took = now_us() - start;
+
+    std::string& out = resp->body;
+    out = "{\"query\":";
+    http_json_string(&out, q.data(), q.size());
+    char buf[96];
+    snprintf(buf, sizeof(buf), ",\"total\":%d,\"took_us\":%llu,\"hits\":[", total, (unsigned long long)took);
+    out += buf;
+    for (int i = 0; i < count; i++) {
+        if (i > 0) out += ",";
+        out += "{\"room\":";
+        http_json_string(&out, hits[i].room, strlen(hits[i].room));
+        snprintf(buf, sizeof(buf), ",\"id\":%u,\"score\":%u,\"position\":%u}",
+                 hits[i].room_id, hits[i].score, hits[i].position);
+        out += buf;
+    }
+    out += "]}";
+}
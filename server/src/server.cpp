@@ -1,255 +1,647 @@
 #include "server.h"
 #include "peer.h"
-#include "document.h"
+#include "room.h"
+#include "epoch.h"
+#include "admission.h"
 #include "protocol.h"
+#include "epoll_server.h"
+#include "tls.h"
+#include "http_api.h"
+#include "search.h"
+#include "cdc.h"
+#include "render.h"
+#include "clone.h"
+#include "overload.h"
+#include "talkers.h"
+#include "admin.h"
+#include "lockstat.h"
+#include "allocstat.h"
+#include "trace.h"
 #include <libwebsockets.h>
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <vector>
 
 static volatile int g_running = 1;
 static struct lws_context* g_context = nullptr;
-static Document g_document;
-
-// Helper to duplicate JSON strings safely
-static char* dup_json(const char* src, size_t len) {
-    if (!src || len == 0) return nullptr;
-    char* out = (char*)malloc(len + 1);
-    memcpy(out, src, len);
-    out[len] = '\0';
-    return out;
-}
+static bool g_log_messages = true;
+static const ServerOptions* g_opts = nullptr;
+
+// Per-message logging, disabled for load tests (--quiet)
+#define LOG_MSG(...) do { if (g_log_messages) printf(__VA_ARGS__); } while (0)
+
+static_assert(LWS_PRE <= WS_FRAME_HEADROOM, "shared frames need LWS_PRE bytes of headroom");
+
+// Per-session state stored by lws (per_session_data_size)
+struct LwsSession {
+    Peer* peer;
+    bool batched;           // On g_batched, waiting for the batch window
+};
 
 void signal_handler(int sig) {
     printf("\n[Server] Received signal %d, shutting down...\n", sig);
     g_running = 0;
 }
 
-void server_broadcast(const uint8_t* data, size_t len, struct lws* exclude) {
-    if (len == 0) return;
+// Channel peers: writes go out through the multiplexed connection
+static void channel_request_write(Peer* p) {
+    Peer* parent = p->mux_parent;
+    parent->transport->request_write(parent);
+}
 
-    omp_set_lock(&g_peers_lock);
+static const PeerTransport g_channel_transport = {
+    "channel",
+    channel_request_write
+};
+
+// Same message wrapped for a channel (channel ids are per room, so one copy
+// serves every multiplexed subscriber of the room)
+static WsSharedFrame* mux_frame_create(uint32_t channel, const WsSharedFrame* frame) {
+    size_t msg_len = 0;
+    uint8_t* msg = encode_mux_message(channel, frame->data + frame->header_len,
+                                      frame->len - frame->header_len, &msg_len);
+    if (!msg) return nullptr;
+    WsSharedFrame* mux = ws_frame_create_tagged(WS_OP_BINARY, msg, msg_len, (AllocTag)frame->tag);
+    protocol_free(msg);
+    return mux;
+}
 
+// Frame to queue for p: the plain one, or its channel copy (created on first use)
+static WsSharedFrame* frame_for(Peer* p, WsSharedFrame* frame, WsSharedFrame** mux) {
+    if (p->channel == 0) return frame;
+    if (!*mux) *mux = mux_frame_create(p->channel, frame);
+    return *mux;
+}
+
+// Hand one pre-encoded frame to every recipient.
+// Filters the room's member columns without locks, then queues to the selected
+// rows; joins and leaves proceed concurrently and only affect later broadcasts.
+// Document updates go to synced peers only; awareness (awareness_client != 0)
+// goes to everyone and is coalesced per client in each peer's queue.
+static int broadcast_frame(Room* room, WsSharedFrame* frame, Peer* exclude,
+                           uint32_t awareness_client, bool awareness_removal) {
+    static thread_local std::vector<uint32_t> t_rows;
+
+    bool awareness = awareness_client != 0;
+    WsSharedFrame* mux = nullptr;
     int count = 0;
-    Peer* p = g_peers;
-    while (p) {
-        if (p->wsi != exclude && p->synced) {
-            peer_queue_message(p, data, len);
-            count++;
+    {
+        EpochGuard guard;
+        RoomPeerSet* members = room_members(room);
+        if ((int)t_rows.size() < members->count) t_rows.resize(members->count);
+
+        count = room_select(members, !awareness, PEER_CLASS_ANY, exclude, t_rows.data());
+        for (int i = 0; i < count; i++) {
+            Peer* p = members->peers[t_rows[i]];
+            WsSharedFrame* f = frame_for(p, frame, &mux);
+            if (!f) continue;
+            if (awareness) {
+                peer_queue_awareness(p, f, awareness_client, awareness_removal);
+            } else {
+                peer_queue_frame(p, PEER_QUEUE_DOC, f);
+            }
         }
-        p = p->next;
     }
 
-    omp_unset_lock(&g_peers_lock);
+    if (mux) ws_frame_release(mux);
+    TRACE(broadcast, room->id, frame->len, count, awareness);
+    return count;
+}
+
+void server_broadcast(Room* room, const uint8_t* data, size_t len, Peer* exclude) {
+    if (len == 0) return;
 
+    WsSharedFrame* frame = ws_frame_create(WS_OP_BINARY, data, len);
+    if (!frame) return;
+
+    int count = broadcast_frame(room, frame, exclude, 0, false);
+    ws_frame_release(frame);
     if (count > 0) {
-        printf("[Server] Broadcast %zu bytes to %d peer(s)\n", len, count);
+        LOG_MSG("[Server] Broadcast %zu bytes to %d peer(s)\n", len, count);
     }
 }
 
-static int callback_crdt(struct lws* wsi, enum lws_callback_reasons reason,
-                         void* user, void* in, size_t len) {
-    switch (reason) {
-        case LWS_CALLBACK_ESTABLISHED: {
-            printf("[Server] Client connected (total: %d)\n", peers_count() + 1);
-            Peer* peer = peers_add(wsi);
-
-            // Don't send state immediately - wait for client's SYNC_STEP1 for proper differential sync
-            // This eliminates race conditions between initial sync and concurrent updates
-            peer->synced = false;
-
-            // Send existing awareness states to the new peer
-            omp_set_lock(&g_peers_lock);
-            Peer* p = g_peers;
-            while (p) {
-                if (p != peer && p->client_id != 0 && p->awareness_json && p->awareness_len > 0) {
-                    size_t msg_len = 0;
-                    uint8_t* msg = encode_awareness(p->client_id, p->awareness_json, p->awareness_len, &msg_len);
-                    if (msg && msg_len > 0) {
-                        peer_queue_message(peer, msg, msg_len);
-                        free(msg);
-                    }
-                }
-                p = p->next;
+void server_set_log_messages(bool enabled) {
+    g_log_messages = enabled;
+}
+
+// Send the room's current awareness states to a peer (references the stored frames)
+static void replay_awareness(Peer* peer) {
+    EpochGuard guard;
+    RoomPeerSet* members = room_members(peer->room);
+    for (int i = 0; i < members->count; i++) {
+        Peer* p = members->peers[i];
+        if (p == peer) continue;
+
+        // Take a reference under the owner's lock, queue after releasing it (no nested peer locks)
+        WsSharedFrame* frame = nullptr;
+        uint32_t client_id = 0;
+        LOCK_ACQUIRE(&p->lock);
+        if (p->client_id != 0 && p->awareness_frame) {
+            client_id = p->client_id;
+            frame = p->awareness_frame;
+            ws_frame_retain(frame);
+        }
+        LOCK_RELEASE(&p->lock);
+
+        if (frame) {
+            WsSharedFrame* mux = nullptr;
+            WsSharedFrame* f = frame_for(peer, frame, &mux);
+            if (f) peer_queue_awareness(peer, f, client_id, false);
+            if (mux) ws_frame_release(mux);
+            ws_frame_release(frame);
+        }
+    }
+}
+
+// Admission callback: one reply for peers of the same room with the same state vector
+static void serve_initial_sync(Peer** peers, int count, const uint8_t* sv, size_t sv_len) {
+    Room* room = peers[0]->room;
+
+    // Mark synced before reading the state: any update applied from here on
+    // reaches these peers as a broadcast, so none can fall between the two
+    for (int i = 0; i < count; i++) {
+        room_set_sync(room, peers[i], PEER_SYNC_DONE);
+    }
+
+    // Diff against the state vector, shared with earlier joiners that sent the same one
+    WsSharedFrame* frame = room->doc.get_sync_reply(sv, sv_len);
+    WsSharedFrame* mux = nullptr;
+
+    for (int i = 0; i < count; i++) {
+        WsSharedFrame* f = frame ? frame_for(peers[i], frame, &mux) : nullptr;
+        if (f) peer_queue_frame(peers[i], PEER_QUEUE_SYNC, f);
+        replay_awareness(peers[i]);
+    }
+
+    if (mux) ws_frame_release(mux);
+    if (frame) {
+        LOG_MSG("[Server] Sent initial state (%zu bytes) as SYNC_STEP2 to %d peer(s)\n", frame->len, count);
+        ws_frame_release(frame);
+    }
+}
+
+bool server_on_open(Peer* peer, const char* path, bool mux) {
+    if (mux) {
+        // Rooms are joined per channel through MUX_SUBSCRIBE
+        peer->mux = true;
+        TRACE(connect, peer->id, 0, 1);
+        printf("[Server] Multiplexed client connected (total: %d)\n", peers_count());
+        return true;
+    }
+
+    // The handshake checked rooms_admit, but another join may have taken the
+    // last free room since
+    Room* room = rooms_get(path);
+    if (!room) {
+        peers_remove(peer);
+        return false;
+    }
+    peer->room = room;
+
+    // Don't send state immediately - wait for client's SYNC_STEP1 for proper differential sync.
+    // Its reply (and the awareness replay) goes through admission control.
+    room_join(room, peer);
+    TRACE(connect, peer->id, room->id, 0);
+
+    printf("[Server] Client connected to '%s' (total: %d)\n", room->name, peers_count());
+    return true;
+}
+
+// Take a peer out of its room: pending sync, membership, then its awareness state
+static void leave_room(Peer* peer) {
+    admission_cancel(peer);
+
+    Room* room = peer->room;
+    room_leave(room, peer);
+
+    // Broadcast awareness removal if client_id known
+    if (peer->client_id != 0) {
+        size_t msg_len = 0;
+        uint8_t* msg = encode_awareness(peer->client_id, nullptr, 0, &msg_len);
+        WsSharedFrame* frame = msg ? ws_frame_create_tagged(WS_OP_BINARY, msg, msg_len, ALLOC_AWARENESS) : nullptr;
+        if (frame) {
+            broadcast_frame(room, frame, peer, peer->client_id, true);
+            ws_frame_release(frame);
+        }
+        protocol_free(msg);
+    }
+}
+
+static void close_channel(Peer* parent, Peer* child) {
+    TRACE(disconnect, child->id, child->room->id);
+    peer_detach_channel(parent, child);
+    leave_room(child);
+    peers_remove(child);
+}
+
+void server_on_close(Peer* peer) {
+    TRACE(disconnect, peer->id, peer->room ? peer->room->id : 0);
+    if (peer->mux) {
+        while (peer->mux_children) {
+            close_channel(peer, peer->mux_children);
+        }
+        peers_remove(peer);
+        printf("[Server] Multiplexed client disconnected (remaining: %d)\n", peers_count());
+        return;
+    }
+
+    printf("[Server] Client disconnected (remaining: %d)\n", peers_count() - 1);
+
+    leave_room(peer);
+    peers_remove(peer);
+}
+
+static int count_channels(Peer* peer) {
+    int n = 0;
+    for (Peer* c = peer->mux_children; c; c = c->mux_sibling) n++;
+    return n;
+}
+
+static void refuse_subscribe(Peer* peer, MuxRefuseReason reason, const char* path, size_t path_len) {
+    size_t reply_len = 0;
+    uint8_t* reply = encode_mux_refused(reason, path, path_len, &reply_len);
+    if (reply) {
+        peer_queue_message(peer, PEER_QUEUE_SYNC, reply, reply_len);
+        protocol_free(reply);
+    }
+    LOG_MSG("[Server] Refused mux subscription to '%.*s' (reason %d)\n", (int)path_len, path, reason);
+}
+
+// Channel 0 of a multiplexed connection: subscribe / unsubscribe rooms
+static void handle_mux_control(Peer* peer, const uint8_t* msg, size_t len) {
+    MuxControlType type;
+    uint32_t channel = 0;
+    const char* path = nullptr;
+    size_t path_len = 0;
+    if (!decode_mux_control(msg, len, &type, &channel, &path, &path_len)) {
+        fprintf(stderr, "[Server] Failed to decode mux control message (%zu bytes)\n", len);
+        return;
+    }
+
+    if (type == MUX_SUBSCRIBE) {
+        // Truncating would subscribe to a different room
+        if (path_len > MUX_MAX_PATH) {
+            refuse_subscribe(peer, MUX_REFUSED_PATH, path, MUX_MAX_PATH);
+            return;
+        }
+        char name[MUX_MAX_PATH + 1];
+        memcpy(name, path, path_len);
+        name[path_len] = '\0';
+
+        // Repeating a subscription is always answered; a new one is a join
+        Room* room = rooms_find(name);
+        Peer* child = room ? peer_find_channel(peer, room->id) : nullptr;
+        if (!child) {
+            if (count_channels(peer) >= MUX_MAX_CHANNELS) {
+                refuse_subscribe(peer, MUX_REFUSED_CHANNELS, name, path_len);
+                return;
+            }
+            if (overload_refuse_join()) {
+                refuse_subscribe(peer, MUX_REFUSED_OVERLOAD, name, path_len);
+                return;
             }
-            omp_unset_lock(&g_peers_lock);
+            if (!room) room = rooms_get(name);
+            if (!room) {
+                refuse_subscribe(peer, MUX_REFUSED_ROOMS, name, path_len);
+                return;
+            }
+        }
 
-            break;
+        // Confirm on the connection's own queue first: it drains ahead of the
+        // channel, so the client learns the id before the channel's first message
+        size_t reply_len = 0;
+        uint8_t* reply = encode_mux_subscribed(room->id, room->name, strlen(room->name), &reply_len);
+        if (reply) {
+            peer_queue_message(peer, PEER_QUEUE_SYNC, reply, reply_len);
+            protocol_free(reply);
         }
+        if (child) return;     // Already subscribed: just repeat the id
 
-        case LWS_CALLBACK_CLOSED: {
-            printf("[Server] Client disconnected (remaining: %d)\n", peers_count() - 1);
-
-            // Broadcast awareness removal if client_id known
-            Peer* peer = peers_find(wsi);
-            if (peer && peer->client_id != 0) {
-                size_t msg_len = 0;
-                uint8_t* msg = encode_awareness(peer->client_id, nullptr, 0, &msg_len);
-                if (msg && msg_len > 0) {
-                    omp_set_lock(&g_peers_lock);
-                    Peer* p = g_peers;
-                    while (p) {
-                        if (p->wsi != wsi) {
-                            peer_queue_message(p, msg, msg_len);
-                        }
-                        p = p->next;
+        child = peers_add(&g_channel_transport, nullptr);
+        child->room = room;
+        peer_attach_channel(peer, child, room->id);
+        room_join(room, child);
+        TRACE(connect, child->id, room->id, 1);
+
+        LOG_MSG("[Server] Channel %u subscribed to '%s'\n", room->id, room->name);
+    }
+    else if (type == MUX_UNSUBSCRIBE) {
+        Peer* child = peer_find_channel(peer, channel);
+        if (child) {
+            close_channel(peer, child);
+            LOG_MSG("[Server] Channel %u unsubscribed\n", channel);
+        }
+    }
+    else {
+        fprintf(stderr, "[Server] Unexpected mux control type: %d\n", type);
+    }
+}
+
+static void handle_room_message(Peer* peer, const uint8_t* data, size_t len);
+
+void server_on_message(Peer* peer, const uint8_t* data, size_t len) {
+    if (len == 0) return;
+
+    if (peer->mux) {
+        uint32_t channel = 0;
+        size_t msg_len = 0;
+        const uint8_t* msg = decode_mux_message(data, len, &channel, &msg_len);
+        if (!msg) {
+            fprintf(stderr, "[Server] Failed to decode mux message (%zu bytes)\n", len);
+            return;
+        }
+        if (channel == MUX_CONTROL_CHANNEL) {
+            handle_mux_control(peer, msg, msg_len);
+            return;
+        }
+
+        Peer* child = peer_find_channel(peer, channel);
+        if (!child) {
+            fprintf(stderr, "[Server] Message for unknown channel %u\n", channel);
+            return;
+        }
+        if (msg_len > 0) handle_room_message(child, msg, msg_len);
+        return;
+    }
+
+    handle_room_message(peer, data, len);
+}
+
+// One protocol message for the room the peer (or channel) joined
+static void handle_room_message(Peer* peer, const uint8_t* data, size_t len) {
+    Document& document = peer->room->doc;
+    talkers_record(TALK_IN, peer, len);
+
+    // Parse message type
+    MessageType msg_type = parse_message_type(data, len);
+    TRACE(receive, peer->id, (int)msg_type, len);
+
+    if (msg_type == MSG_SYNC_STEP1) {
+        LOG_MSG("[Server] Received SYNC_STEP1 (%zu bytes)\n", len);
+        if (g_log_messages) {
+            // Log first few bytes for debugging
+            printf("[Server] SYNC_STEP1 bytes:");
+            for (size_t i = 0; i < len && i < 16; i++) {
+                printf(" %02x", (unsigned char)data[i]);
+            }
+            printf("\n");
+        }
+
+        // Reply with the diff against the client's state vector, paced by admission control
+        size_t sv_len = 0;
+        const uint8_t* sv = decode_sync_step1(data, len, &sv_len);
+        admission_submit(peer, sv, sv ? sv_len : 0);
+    }
+    else if (msg_type == MSG_SYNC_STEP2) {
+        LOG_MSG("[Server] Received SYNC_STEP2 (%zu bytes)\n", len);
+
+        // Client sending update - try to decode and apply
+        size_t update_len = 0;
+        const uint8_t* update = decode_sync_step2(data, len, &update_len);
+
+        if (update && update_len > 0) {
+            // Apply to document
+            TRACE(apply_start, peer->room->id, update_len);
+            uint8_t* v1 = nullptr;      // Set for a v2 update: subscribers take v1
+            size_t v1_len = 0;
+            bool applied = document.apply_update(update, update_len, &v1, &v1_len);
+            TRACE(apply_end, peer->room->id, update_len, applied);
+            if (applied) {
+                LOG_MSG("[Server] Applied update (%zu bytes)\n", update_len);
+
+                if (!peer->editor) {
+                    peer->editor = true;
+                    room_set_class(peer->room, peer, PEER_CLASS_EDITOR);
+                }
+
+                if (g_log_messages) {
+                    // Debug: print current content
+                    char* content = document.get_text_content();
+                    if (content) {
+                        printf("[Server] Document content: \"%s\"\n", content);
+                        free(content);
                     }
-                    omp_unset_lock(&g_peers_lock);
-                    free(msg);
                 }
+
+                // Broadcast to other clients (send original encoded message)
+                server_broadcast(peer->room, data, len, peer);
+
+                // In-process subscribers (libcrdtcore embedders)
+                room_publish_update(peer->room, v1 ? v1 : update, v1 ? v1_len : update_len);
+                free(v1);
+            } else {
+                fprintf(stderr, "[Server] Failed to apply update\n");
+            }
+        } else {
+            fprintf(stderr, "[Server] Failed to decode SYNC_STEP2 message (%zu bytes)\n", len);
+            // Log first few bytes for debugging
+            fprintf(stderr, "[Server] Message bytes:");
+            for (size_t i = 0; i < len && i < 16; i++) {
+                fprintf(stderr, " %02x", data[i]);
+            }
+            fprintf(stderr, "\n");
+        }
+    }
+    else if (msg_type == MSG_AWARENESS) {
+        uint32_t client_id = 0;
+        char* state_json = nullptr;
+        size_t json_len = 0;
+
+        if (decode_awareness(data, len, &client_id, &state_json, &json_len)) {
+            if (json_len > 0 && state_json) {
+                LOG_MSG("[Server] Awareness update from client %u: %.*s\n",
+                        client_id, (int)json_len, state_json);
+            } else {
+                LOG_MSG("[Server] Awareness removal for client %u\n", client_id);
             }
 
-            peers_remove(wsi);
-            break;
+            if (state_json) protocol_free(state_json);
+
+            // One frame for the broadcast and the replay to later joiners
+            WsSharedFrame* frame = ws_frame_create_tagged(WS_OP_BINARY, data, len, ALLOC_AWARENESS);
+            if (!frame) return;
+
+            // Replace stored awareness
+            LOCK_ACQUIRE(&peer->lock);
+            peer->client_id = client_id;
+            WsSharedFrame* old_frame = peer->awareness_frame;
+            peer->awareness_frame = nullptr;
+            if (json_len > 0) {
+                ws_frame_retain(frame);
+                peer->awareness_frame = frame;
+            }
+            LOCK_RELEASE(&peer->lock);
+
+            if (old_frame) ws_frame_release(old_frame);
+
+            // Broadcast to other peers (awareness is independent of sync status);
+            // under overload only removals go out, joiners still replay the stored state
+            if (json_len == 0 || !overload_shed_awareness()) {
+                broadcast_frame(peer->room, frame, peer, client_id, json_len == 0);
+            }
+            ws_frame_release(frame);
+        } else {
+            fprintf(stderr, "[Server] Failed to decode AWARENESS message\n");
         }
+    }
+    else {
+        fprintf(stderr, "[Server] Unknown message type: %d\n", msg_type);
+    }
+}
 
-        case LWS_CALLBACK_RECEIVE: {
-            if (len == 0) break;
+void server_on_tick() {
+    admission_tick();
+    // Retired objects wait for the thread's next reclaim; an idle loop frees them here
+    epoch_reclaim();
+}
 
-            const uint8_t* data = (const uint8_t*)in;
+// BATCH level (overload.h): write requests wait for the batch window, so a
+// connection's broadcasts go out in one writeable burst instead of one each
+static std::vector<struct lws*> g_batched;
+static lws_sorted_usec_list_t g_batch_sul;
+static bool g_batch_armed = false;
+
+static void lws_flush_batched(lws_sorted_usec_list_t* sul) {
+    (void)sul;
+    g_batch_armed = false;
+    for (size_t i = 0; i < g_batched.size(); i++) {
+        ((LwsSession*)lws_wsi_user(g_batched[i]))->batched = false;
+        lws_callback_on_writable(g_batched[i]);
+    }
+    g_batched.clear();
+}
 
-            // Parse message type
-            MessageType msg_type = parse_message_type(data, len);
+// lws transport: writes are driven by LWS_CALLBACK_SERVER_WRITEABLE on the service thread
+static void lws_request_write(Peer* p) {
+    struct lws* wsi = (struct lws*)p->conn;
+    int window_ms = overload_batch_window_ms();
+    if (window_ms == 0) {
+        lws_callback_on_writable(wsi);
+        return;
+    }
 
-            if (msg_type == MSG_SYNC_STEP1) {
-                printf("[Server] Received SYNC_STEP1 (%zu bytes)\n", len);
-                // Log first few bytes for debugging
-                printf("[Server] SYNC_STEP1 bytes:");
-                for (size_t i = 0; i < len && i < 16; i++) {
-                    printf(" %02x", (unsigned char)data[i]);
-                }
-                printf("\n");
+    LwsSession* session = (LwsSession*)lws_wsi_user(wsi);
+    if (session->batched) return;
+    session->batched = true;
+    g_batched.push_back(wsi);
+    if (!g_batch_armed) {
+        g_batch_armed = true;
+        overload_count_deferred_flush();
+        lws_sul_schedule(g_context, 0, &g_batch_sul, lws_flush_batched, window_ms * LWS_US_PER_MS);
+    }
+}
 
-                // Send proper initial state from Yrs
-                size_t state_len = 0;
-                uint8_t* state = g_document.get_state_as_update(&state_len);
+static const PeerTransport g_lws_transport = {
+    "lws",
+    lws_request_write
+};
 
-                size_t msg_len = 0;
-                uint8_t* msg = encode_sync_step2(state, state_len, &msg_len);
+// Shared by both subprotocols; mux selects the multiplexed framing
+static int handle_lws(struct lws* wsi, enum lws_callback_reasons reason,
+                      void* user, void* in, size_t len, bool mux) {
+    LwsSession* session = (LwsSession*)user;
 
-                Peer* peer = peers_find(wsi);
-                if (peer) {
-                    peer_queue_message(peer, msg, msg_len);
-                    peer->synced = true;
-                }
+    switch (reason) {
+        case LWS_CALLBACK_OPENSSL_LOAD_EXTRA_SERVER_VERIFY_CERTS: {
+            // Vhost TLS setup: user is the vhost's SSL_CTX
+            tls_configure_server_ctx((struct ssl_ctx_st*)user, *g_opts);
+            break;
+        }
 
-                printf("[Server] Sent initial state (%zu bytes) as SYNC_STEP2\n", state_len);
+        case LWS_CALLBACK_FILTER_PROTOCOL_CONNECTION: {
+            // Overloaded: drop the upgrade, the client retries with backoff
+            if (overload_refuse_join()) return -1;
+            // Room limit: refuse a path that would need a new room
+            if (!mux) {
+                char path[256];
+                if (lws_hdr_copy(wsi, path, sizeof(path), WSI_TOKEN_GET_URI) <= 0) strcpy(path, "/");
+                if (!rooms_admit(path)) return -1;
+            }
+            break;
+        }
 
-                free(msg);
-                if (state) free(state);
+        case LWS_CALLBACK_ADD_HEADERS: {
+            // Upgrade response: joins waiting for a sync slot, and where this
+            // client would queue if it synced now
+            struct lws_process_html_args* args = (struct lws_process_html_args*)in;
+            char path[256];
+            if (lws_hdr_copy(wsi, path, sizeof(path), WSI_TOKEN_GET_URI) <= 0) strcpy(path, "/");
+            int wait_ms = 0;
+            int position = admission_join_position(mux ? nullptr : rooms_find(path), &wait_ms);
+            const char* names[3] = { "x-sync-queue-depth:", "x-sync-queue-position:", "x-sync-wait-ms:" };
+            int values[3] = { admission_queue_depth(), position, wait_ms };
+            for (int i = 0; i < 3; i++) {
+                char value[16];
+                int n = snprintf(value, sizeof(value), "%d", values[i]);
+                lws_add_http_header_by_name(wsi, (const unsigned char*)names[i],
+                                            (const unsigned char*)value, n, (unsigned char**)&args->p,
+                                            (unsigned char*)args->p + args->max_len);
             }
-            else if (msg_type == MSG_SYNC_STEP2) {
-                printf("[Server] Received SYNC_STEP2 (%zu bytes)\n", len);
-
-                // Client sending update - try to decode and apply
-                size_t update_len = 0;
-                const uint8_t* update = decode_sync_step2(data, len, &update_len);
-
-                if (update && update_len > 0) {
-                    // Apply to document
-                    if (g_document.apply_update(update, update_len)) {
-                        printf("[Server] Applied update (%zu bytes)\n", update_len);
-
-                        // Debug: print current content
-                        char* content = g_document.get_text_content();
-                        if (content) {
-                            printf("[Server] Document content: \"%s\"\n", content);
-                            free(content);
-                        }
-
-                        // Broadcast to other clients (send original encoded message)
-                        server_broadcast(data, len, wsi);
-                    } else {
-                        fprintf(stderr, "[Server] Failed to apply update\n");
-                    }
-                } else {
-                    fprintf(stderr, "[Server] Failed to decode SYNC_STEP2 message (%zu bytes)\n", len);
-                    // Log first few bytes for debugging
-                    fprintf(stderr, "[Server] Message bytes:");
-                    for (size_t i = 0; i < len && i < 16; i++) {
-                        fprintf(stderr, " %02x", data[i]);
-                    }
-                    fprintf(stderr, "\n");
-                }
+            break;
+        }
+
+        case LWS_CALLBACK_ESTABLISHED: {
+            if (g_opts->tls_enabled()) {
+                tls_record_handshake((struct ssl_st*)lws_get_ssl(wsi));
             }
-            else if (msg_type == MSG_AWARENESS) {
-                uint32_t client_id = 0;
-                char* state_json = nullptr;
-                size_t json_len = 0;
-
-                if (decode_awareness(data, len, &client_id, &state_json, &json_len)) {
-                    Peer* peer = peers_find(wsi);
-                    if (peer) {
-                        peer->client_id = client_id;
-
-                        // Replace stored awareness
-                        if (peer->awareness_json) {
-                            free(peer->awareness_json);
-                            peer->awareness_json = nullptr;
-                            peer->awareness_len = 0;
-                        }
-                        if (json_len > 0 && state_json) {
-                            peer->awareness_json = state_json;
-                            peer->awareness_len = json_len;
-                            printf("[Server] Awareness update from client %u: %.*s\n",
-                                   client_id, (int)json_len, peer->awareness_json);
-                        } else {
-                            // Removal
-                            printf("[Server] Awareness removal for client %u\n", client_id);
-                            if (state_json) free(state_json);
-                        }
-
-                        // Broadcast to other peers (awareness is independent of sync status)
-                        omp_set_lock(&g_peers_lock);
-                        Peer* p = g_peers;
-                        while (p) {
-                            if (p->wsi != wsi) {
-                                peer_queue_message(p, data, len);
-                            }
-                            p = p->next;
-                        }
-                        omp_unset_lock(&g_peers_lock);
-                    } else {
-                        if (state_json) free(state_json);
-                    }
-                } else {
-                    fprintf(stderr, "[Server] Failed to decode AWARENESS message\n");
-                }
+            char path[256];
+            if (lws_hdr_copy(wsi, path, sizeof(path), WSI_TOKEN_GET_URI) <= 0) {
+                strcpy(path, "/");
+            }
+            session->peer = peers_add(&g_lws_transport, wsi);
+            if (!server_on_open(session->peer, path, mux)) {
+                session->peer = nullptr;
+                return -1;
+            }
+            break;
+        }
+
+        case LWS_CALLBACK_CLOSED: {
+            if (session->batched) {
+                g_batched.erase(std::find(g_batched.begin(), g_batched.end(), wsi));
+                session->batched = false;
             }
-            else {
-                fprintf(stderr, "[Server] Unknown message type: %d\n", msg_type);
+            if (session->peer) {
+                server_on_close(session->peer);
+                session->peer = nullptr;
             }
+            break;
+        }
 
+        case LWS_CALLBACK_RECEIVE: {
+            if (session->peer) {
+                server_on_message(session->peer, (const uint8_t*)in, len);
+            }
             break;
         }
 
         case LWS_CALLBACK_SERVER_WRITEABLE: {
-            Peer* peer = peers_find(wsi);
+            Peer* peer = session->peer;
             if (!peer) break;
 
             PendingMessage* msg = peer_dequeue_message(peer);
             if (!msg) break;
 
-            // Allocate buffer with LWS_PRE space
-            uint8_t* buf = (uint8_t*)malloc(LWS_PRE + msg->len);
-            memcpy(buf + LWS_PRE, msg->data, msg->len);
-
-            int written = lws_write(wsi, buf + LWS_PRE, msg->len, LWS_WRITE_BINARY);
+            // The frame already carries its WebSocket header: write it raw,
+            // straight from the shared buffer (headroom covers LWS_PRE)
+            WsSharedFrame* frame = msg->frame;
+            int written = lws_write(wsi, frame->data, frame->len, LWS_WRITE_RAW);
 
             if (written < 0) {
                 fprintf(stderr, "[Server] Write failed\n");
             } else {
-                printf("[Server] Sent %d bytes to client\n", written);
+                TRACE(write, peer->id, written);
+                LOG_MSG("[Server] Sent %d bytes to client\n", written);
             }
 
-            free(buf);
             peer_free_message(msg);
 
             // Check for more pending messages
-            if (peers_find(wsi)) {
-                lws_callback_on_writable(wsi);
-            }
+            lws_callback_on_writable(wsi);
 
             break;
         }
@@ -261,38 +653,61 @@ static int callback_crdt(struct lws* wsi, enum lws_callback_reasons reason,
     return 0;
 }
 
+static int callback_crdt(struct lws* wsi, enum lws_callback_reasons reason,
+                         void* user, void* in, size_t len) {
+    return handle_lws(wsi, reason, user, in, len, false);
+}
+
+static int callback_crdt_mux(struct lws* wsi, enum lws_callback_reasons reason,
+                             void* user, void* in, size_t len) {
+    return handle_lws(wsi, reason, user, in, len, true);
+}
+
 static struct lws_protocols protocols[] = {
     {
         "crdt-protocol",
         callback_crdt,
-        0,
+        sizeof(LwsSession),
+        4096,
+        0, nullptr, 0
+    },
+    {
+        MUX_PROTOCOL_NAME,
+        callback_crdt_mux,
+        sizeof(LwsSession),
         4096,
         0, nullptr, 0
     },
     { nullptr, nullptr, 0, 0, 0, nullptr, 0 }
 };
 
-int server_run(int port) {
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+// Lag probe of the lws service thread
+static lws_sorted_usec_list_t g_probe_sul;
+static int g_probe_loop = -1;
+static uint64_t g_probe_due = 0;
 
-    // Initialize subsystems
-    peers_init();
-
-    if (!g_document.init("quill")) {
-        fprintf(stderr, "[Server] Failed to initialize document\n");
-        return 1;
-    }
+static void lws_probe(lws_sorted_usec_list_t* sul) {
+    g_probe_due = overload_probe(g_probe_loop, g_probe_due);
+    uint64_t now = overload_now_us();
+    lws_sul_schedule(g_context, 0, sul, lws_probe, (lws_usec_t)(g_probe_due > now ? g_probe_due - now : 0));
+}
 
+static int run_lws(const ServerOptions& opts) {
     // Create WebSocket context
     struct lws_context_creation_info info;
     memset(&info, 0, sizeof(info));
-    info.port = port;
+    info.port = opts.port;
     info.protocols = protocols;
     info.gid = -1;
     info.uid = -1;
     info.options = LWS_SERVER_OPTION_VALIDATE_UTF8 | LWS_SERVER_OPTION_EXPLICIT_VHOSTS;
 
+    if (opts.tls_enabled()) {
+        info.options |= LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+        info.ssl_cert_filepath = opts.tls_cert;
+        info.ssl_private_key_filepath = opts.tls_key;
+    }
+
     g_context = lws_create_context(&info);
     if (!g_context) {
         fprintf(stderr, "[Server] Failed to create context\n");
@@ -306,24 +721,176 @@ int server_run(int port) {
         return 1;
     }
 
-    printf("[Server] Listening on port %d\n", port);
+    printf("[Server] Listening on port %d (lws%s)\n", opts.port, opts.tls_enabled() ? ", wss" : "");
 
     // Main event loop
+    g_probe_loop = overload_register_loop("lws");
+    g_probe_due = overload_first_due();
+    memset(&g_probe_sul, 0, sizeof(g_probe_sul));
+    memset(&g_batch_sul, 0, sizeof(g_batch_sul));
+    lws_sul_schedule(g_context, 0, &g_probe_sul, lws_probe,
+                     (lws_usec_t)(g_probe_due - overload_now_us()));
     while (g_running) {
         lws_service(g_context, 50);
+        server_on_tick();
     }
 
-    // Cleanup
-    printf("\n[Server] Shutting down...\n");
+    lws_context_destroy(g_context);
+    g_context = nullptr;
+    return 0;
+}
+
+struct YrsEstimate {
+    int documents;
+    uint64_t bytes;
+};
 
-    char* content = g_document.get_text_content();
+static void add_yrs_estimate(Room* room, void* user) {
+    YrsEstimate* e = (YrsEstimate*)user;
+    DocStats d;
+    room->doc.get_stats(&d);
+    if (d.materialized) e->documents++;
+    e->bytes += allocstat_yrs_estimate((uint64_t)d.base_bytes + d.tail_bytes, d.materialized);
+}
+
+static void print_room_content(Room* room, void* user) {
+    (void)user;
+    char* content = room->doc.get_text_content();
     if (content) {
-        printf("[Server] Final content: \"%s\"\n", content);
+        printf("[Server] Final content of '%s': \"%s\"\n", room->name, content);
         free(content);
     }
 
-    lws_context_destroy(g_context);
+    uint64_t hits = 0, misses = 0;
+    room->doc.get_reply_stats(&hits, &misses);
+    if (hits + misses > 0) {
+        printf("[Server] Sync reply cache of '%s': %llu hits, %llu misses\n", room->name,
+               (unsigned long long)hits, (unsigned long long)misses);
+    }
+}
+
+int server_run(const ServerOptions& opts) {
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    g_log_messages = opts.log_messages;
+    g_opts = &opts;
+
+    // Initialize subsystems
+    epoch_init();
+    peers_init();
+    rooms_init("quill");
+    rooms_set_limit(opts.max_rooms);
+    admission_init(opts.admission, serve_initial_sync);
+    overload_init(opts.overload);
+    http_api_route("GET", "/lag", overload_handle_http, nullptr);
+    http_api_route("GET", "/admin/rooms", admin_handle_rooms, nullptr);
+    http_api_route("GET", "/admin/room", admin_handle_room, nullptr);
+    http_api_route("GET", "/admin/peer", admin_handle_peer, nullptr);
+    http_api_route("GET", "/admin/locks", admin_handle_locks, nullptr);
+    http_api_route("GET", "/admin/memory", admin_handle_memory, nullptr);
+    http_api_route("GET", "/admin/alloc", admin_handle_alloc, nullptr);
+    if (opts.talkers_window > 0) {
+        talkers_init(opts.talkers_window);
+        http_api_route("GET", "/admin/top", talkers_handle_http, nullptr);
+    }
+    if (opts.search_index) {
+        search_init();
+        http_api_route("GET", "/search", search_handle_http, nullptr);
+    }
+    http_api_route("POST", "/clone", clone_handle_http, nullptr);
+    if (opts.render_preview) {
+        render_init();
+        http_api_route("GET", "/render", render_handle_http, nullptr);
+    }
+    if (opts.cdc_buffer > 0) {
+        cdc_init(opts.cdc_buffer);
+        http_api_stream_route("GET", "/cdc", cdc_handle_stream, nullptr);
+    }
+
+    int result = http_api_start(opts.http_port) ? 0 : 1;
+    if (result == 0) {
+        if (opts.engine == ENGINE_EPOLL) {
+            result = epoll_server_run(opts, &g_running);
+        } else {
+            result = run_lws(opts);
+        }
+    }
+    http_api_stop();
+    if (result != 0) {
+        admission_destroy();
+        peers_destroy();
+        if (opts.search_index) search_destroy();
+        if (opts.render_preview) render_destroy();
+        if (opts.cdc_buffer > 0) cdc_destroy();
+        overload_destroy();
+        talkers_destroy();
+        epoch_destroy();
+        rooms_destroy();
+        return result;
+    }
+
+    // Cleanup
+    printf("\n[Server] Shutting down...\n");
+
+    rooms_for_each(print_room_content, nullptr);
+    if (rooms_refused() > 0) {
+        printf("[Room] %llu join(s) refused at the room limit (%d)\n",
+               (unsigned long long)rooms_refused(), opts.max_rooms);
+    }
+    admission_print_stats();
+    overload_print_stats();
+    talkers_print_stats();
+    lockstat_print_stats();
+    allocstat_print_stats();
+    YrsEstimate yrs = { 0, 0 };
+    rooms_for_each(add_yrs_estimate, &yrs);
+    if (yrs.documents > 0) {
+        printf("[Alloc] libyrs (estimated): %.1f KB in %d live document(s)\n", yrs.bytes / 1024.0, yrs.documents);
+    }
+    if (opts.search_index) {
+        SearchStats s;
+        search_get_stats(&s);
+        printf("[Search] %u room(s), %u terms, %llu tokens, %llu bytes of postings; "
+               "%llu deltas re-tokenized %llu bytes\n",
+               s.rooms, s.terms, (unsigned long long)s.tokens, (unsigned long long)s.postings_bytes,
+               (unsigned long long)s.deltas, (unsigned long long)s.reindexed_bytes);
+    }
+    CloneStats clones;
+    clone_get_stats(&clones);
+    if (clones.clones + clones.uploads > 0) {
+        printf("[Clone] %llu room(s) cloned, %llu from uploaded snapshots\n",
+               (unsigned long long)clones.clones, (unsigned long long)clones.uploads);
+    }
+    if (opts.render_preview) {
+        RenderStats s;
+        render_get_stats(&s);
+        printf("[Render] %u room(s), %llu lines; %llu cached, %llu assembled, %llu lines re-rendered\n",
+               s.rooms, (unsigned long long)s.lines, (unsigned long long)s.hits,
+               (unsigned long long)s.misses, (unsigned long long)s.lines_rendered);
+    }
+    if (opts.cdc_buffer > 0) {
+        CdcStats s;
+        cdc_get_stats(&s);
+        printf("[CDC] %llu record(s), %llu evicted, %zu bytes retained (seq %llu..%llu)\n",
+               (unsigned long long)s.records, (unsigned long long)s.evicted, s.bytes,
+               (unsigned long long)s.oldest, (unsigned long long)s.newest);
+    }
+
+    admission_destroy();
     peers_destroy();
+    if (opts.search_index) search_destroy();
+    if (opts.render_preview) render_destroy();
+    if (opts.cdc_buffer > 0) cdc_destroy();
+    overload_destroy();
+    talkers_destroy();
+    epoch_destroy();
+    rooms_destroy();
+
+    if (opts.tls_enabled()) {
+        tls_print_stats();
+    }
 
     printf("[Server] Shutdown complete\n");
     return 0;
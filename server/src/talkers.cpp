@@ -0,0 +1,406 @@
+#include "talkers.h"
+#include "peer.h"
+#include "room.h"
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define TALK_KINDS 3
+#define TALK_DEPTH 4
+#define TALK_WIDTH 512          // Power of two; 9 hash bits per row
+#define TALK_TOP 16
+#define TALK_MAX_N 100
+
+enum TalkKind {
+    KIND_PEER = 0,
+    KIND_CLIENT = 1,
+    KIND_ROOM = 2
+};
+
+enum TalkMetric {
+    METRIC_BYTES = 0,
+    METRIC_MESSAGES = 1
+};
+
+static const char* KIND_NAMES[TALK_KINDS] = { "peer", "client", "room" };
+
+// Written by the owning thread only (relaxed load + store), read by reports
+struct Candidate {
+    std::atomic<uint64_t> key;  // 0 = empty (ids and client ids start at 1)
+    std::atomic<uint64_t> est;
+};
+
+struct Sketch {
+    std::atomic<uint64_t> cells[TALK_DEPTH][TALK_WIDTH][2];    // [bytes, messages]
+    Candidate top[2][TALK_TOP];                                 // Per metric
+    int min_slot[2];                                            // Owner only
+    int last_slot[2];                                           // Owner only: last entry updated
+};
+
+struct Slot {
+    std::atomic<uint64_t> window;   // Window number it counts (0 = being reset)
+    Sketch sketches[2][TALK_KINDS];
+};
+
+struct ThreadTalkers {
+    Slot slots[2];                  // Alternating windows
+    ThreadTalkers* next;
+};
+
+static omp_lock_t g_lock;           // Guards the thread list (appended once per thread)
+static ThreadTalkers* g_threads = nullptr;
+static bool g_enabled = false;
+static uint64_t g_window_ms = 10000;
+static thread_local ThreadTalkers* t_talkers = nullptr;
+
+static uint64_t window_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t ms = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+    return ms / g_window_ms + 1;
+}
+
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static size_t column(uint64_t hash, int row) {
+    return (size_t)(hash >> (row * 16)) & (TALK_WIDTH - 1);
+}
+
+static ThreadTalkers* attach_thread() {
+    ThreadTalkers* t = (ThreadTalkers*)calloc(1, sizeof(ThreadTalkers));
+    omp_set_lock(&g_lock);
+    t->next = g_threads;
+    g_threads = t;
+    omp_unset_lock(&g_lock);
+    t_talkers = t;
+    return t;
+}
+
+static void reset_slot(Slot* s, uint64_t window) {
+    s->window.store(0, std::memory_order_relaxed);
+    for (int dir = 0; dir < 2; dir++) {
+        for (int kind = 0; kind < TALK_KINDS; kind++) {
+            Sketch* sk = &s->sketches[dir][kind];
+            for (int d = 0; d < TALK_DEPTH; d++) {
+                for (int c = 0; c < TALK_WIDTH; c++) {
+                    sk->cells[d][c][0].store(0, std::memory_order_relaxed);
+                    sk->cells[d][c][1].store(0, std::memory_order_relaxed);
+                }
+            }
+            for (int m = 0; m < 2; m++) {
+                for (int i = 0; i < TALK_TOP; i++) {
+                    sk->top[m][i].key.store(0, std::memory_order_relaxed);
+                    sk->top[m][i].est.store(0, std::memory_order_relaxed);
+                }
+                sk->min_slot[m] = 0;
+                sk->last_slot[m] = 0;
+            }
+        }
+    }
+    s->window.store(window, std::memory_order_release);
+}
+
+// Keep key in the metric's top-k if its estimate beats the smallest entry
+static void offer(Sketch* s, int metric, uint64_t key, uint64_t est) {
+    Candidate* top = s->top[metric];
+    int min = s->min_slot[metric];
+    // Estimates only grow, so a key at or below the smallest entry is not in the
+    // table (or ties it): the common case for everything but the heavy hitters
+    if (est <= top[min].est.load(std::memory_order_relaxed)) return;
+
+    // A flooding key repeats: try the entry updated last before scanning
+    int hit = s->last_slot[metric];
+    if (top[hit].key.load(std::memory_order_relaxed) != key) {
+        hit = -1;
+        for (int i = 0; i < TALK_TOP; i++) {
+            if (top[i].key.load(std::memory_order_relaxed) == key) {
+                hit = i;
+                break;
+            }
+        }
+    }
+    if (hit < 0) {
+        top[min].key.store(key, std::memory_order_relaxed);
+        hit = min;
+    }
+    top[hit].est.store(est, std::memory_order_relaxed);
+    s->last_slot[metric] = hit;
+    if (hit != min) return;
+
+    for (int i = 0; i < TALK_TOP; i++) {
+        if (top[i].est.load(std::memory_order_relaxed) < top[min].est.load(std::memory_order_relaxed)) min = i;
+    }
+    s->min_slot[metric] = min;
+}
+
+static void add(Sketch* s, uint64_t key, uint64_t bytes) {
+    uint64_t hash = mix(key);
+    uint64_t est_bytes = UINT64_MAX;
+    uint64_t est_msgs = UINT64_MAX;
+    for (int d = 0; d < TALK_DEPTH; d++) {
+        std::atomic<uint64_t>* cell = s->cells[d][column(hash, d)];
+        uint64_t b = cell[0].load(std::memory_order_relaxed) + bytes;
+        uint64_t m = cell[1].load(std::memory_order_relaxed) + 1;
+        cell[0].store(b, std::memory_order_relaxed);
+        cell[1].store(m, std::memory_order_relaxed);
+        if (b < est_bytes) est_bytes = b;
+        if (m < est_msgs) est_msgs = m;
+    }
+    offer(s, METRIC_BYTES, key, est_bytes);
+    offer(s, METRIC_MESSAGES, key, est_msgs);
+}
+
+static void on_dequeue(Peer* peer, size_t len) {
+    talkers_record(TALK_OUT, peer, len);
+}
+
+void talkers_init(int window_s) {
+    omp_init_lock(&g_lock);
+    g_window_ms = (uint64_t)(window_s > 0 ? window_s : 10) * 1000;
+    g_threads = nullptr;
+    g_enabled = true;
+    peers_on_dequeue(on_dequeue);
+}
+
+void talkers_destroy() {
+    if (!g_enabled) return;
+    peers_on_dequeue(nullptr);
+    g_enabled = false;
+    omp_set_lock(&g_lock);
+    while (g_threads) {
+        ThreadTalkers* next = g_threads->next;
+        free(g_threads);
+        g_threads = next;
+    }
+    omp_unset_lock(&g_lock);
+    omp_destroy_lock(&g_lock);
+}
+
+void talkers_record(TalkDirection dir, const Peer* peer, size_t len) {
+    if (!g_enabled) return;
+    ThreadTalkers* t = t_talkers ? t_talkers : attach_thread();
+
+    uint64_t window = window_now();
+    Slot* slot = &t->slots[window & 1];
+    if (slot->window.load(std::memory_order_relaxed) != window) reset_slot(slot, window);
+
+    Sketch* sketches = slot->sketches[dir];
+    add(&sketches[KIND_PEER], peer->id, len);
+    uint32_t client = __atomic_load_n(&peer->client_id, __ATOMIC_RELAXED);
+    if (client != 0) add(&sketches[KIND_CLIENT], client, len);
+    if (peer->room) add(&sketches[KIND_ROOM], peer->room->id, len);
+}
+
+// Sum of every live slot of every thread
+struct Merged {
+    std::vector<uint64_t> cells;                // [dir][kind][row][column][metric]
+    std::vector<uint64_t> keys[2][TALK_KINDS];  // Union of the threads' candidates
+    uint64_t totals[2][2];                      // [dir][metric]
+};
+
+static size_t cell_index(int dir, int kind, int row, size_t col, int metric) {
+    return ((((size_t)dir * TALK_KINDS + kind) * TALK_DEPTH + row) * TALK_WIDTH + col) * 2 + metric;
+}
+
+static void merge(Merged* m) {
+    m->cells.assign((size_t)2 * TALK_KINDS * TALK_DEPTH * TALK_WIDTH * 2, 0);
+    memset(m->totals, 0, sizeof(m->totals));
+    uint64_t now = window_now();
+
+    omp_set_lock(&g_lock);
+    ThreadTalkers* threads = g_threads;
+    omp_unset_lock(&g_lock);
+
+    // Threads are only ever prepended, so the list from the head is stable
+    for (ThreadTalkers* t = threads; t; t = t->next) {
+        for (int s = 0; s < 2; s++) {
+            const Slot* slot = &t->slots[s];
+            uint64_t window = slot->window.load(std::memory_order_acquire);
+            if (window == 0 || (window != now && window + 1 != now)) continue;
+
+            for (int dir = 0; dir < 2; dir++) {
+                for (int kind = 0; kind < TALK_KINDS; kind++) {
+                    const Sketch* sk = &slot->sketches[dir][kind];
+                    uint64_t* out = &m->cells[cell_index(dir, kind, 0, 0, 0)];
+                    for (int d = 0; d < TALK_DEPTH; d++) {
+                        for (int c = 0; c < TALK_WIDTH; c++) {
+                            *out++ += sk->cells[d][c][0].load(std::memory_order_relaxed);
+                            *out++ += sk->cells[d][c][1].load(std::memory_order_relaxed);
+                        }
+                    }
+                    for (int metric = 0; metric < 2; metric++) {
+                        for (int i = 0; i < TALK_TOP; i++) {
+                            uint64_t key = sk->top[metric][i].key.load(std::memory_order_relaxed);
+                            if (key != 0) m->keys[dir][kind].push_back(key);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (int dir = 0; dir < 2; dir++) {
+        // Every message counts once per row of the peer sketch
+        for (int c = 0; c < TALK_WIDTH; c++) {
+            m->totals[dir][METRIC_BYTES] += m->cells[cell_index(dir, KIND_PEER, 0, c, METRIC_BYTES)];
+            m->totals[dir][METRIC_MESSAGES] += m->cells[cell_index(dir, KIND_PEER, 0, c, METRIC_MESSAGES)];
+        }
+        for (int kind = 0; kind < TALK_KINDS; kind++) {
+            std::vector<uint64_t>& keys = m->keys[dir][kind];
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        }
+    }
+}
+
+static uint64_t estimate(const Merged& m, int dir, int kind, int metric, uint64_t key) {
+    uint64_t hash = mix(key);
+    uint64_t est = UINT64_MAX;
+    for (int d = 0; d < TALK_DEPTH; d++) {
+        uint64_t v = m.cells[cell_index(dir, kind, d, column(hash, d), metric)];
+        if (v < est) est = v;
+    }
+    return est;
+}
+
+struct Ranked {
+    uint64_t key;
+    uint64_t count;
+    bool operator<(const Ranked& o) const { return count != o.count ? count > o.count : key < o.key; }
+};
+
+static void rank(const Merged& m, int dir, int kind, int metric, size_t n, std::vector<Ranked>* out) {
+    out->clear();
+    const std::vector<uint64_t>& keys = m.keys[dir][kind];
+    for (size_t i = 0; i < keys.size(); i++) {
+        Ranked r = { keys[i], estimate(m, dir, kind, metric, keys[i]) };
+        if (r.count > 0) out->push_back(r);
+    }
+    std::sort(out->begin(), out->end());
+    if (out->size() > n) out->resize(n);
+}
+
+// Live peer details by id, for labelling the report
+struct PeerLabel {
+    std::string room;
+    uint32_t client_id;
+    bool channel;
+};
+
+static void collect_room_name(Room* room, void* user) {
+    std::unordered_map<uint64_t, std::string>* names = (std::unordered_map<uint64_t, std::string>*)user;
+    (*names)[room->id] = room->name;
+}
+
+void talkers_print_stats() {
+    if (!g_enabled) return;
+    Merged m;
+    merge(&m);
+    if (m.totals[TALK_IN][METRIC_MESSAGES] + m.totals[TALK_OUT][METRIC_MESSAGES] == 0) return;
+
+    std::unordered_map<uint64_t, std::string> room_names;
+    rooms_for_each(collect_room_name, &room_names);
+    std::vector<Ranked> ranked;
+    for (int dir = 0; dir < 2; dir++) {
+        rank(m, dir, KIND_ROOM, METRIC_BYTES, 1, &ranked);
+        if (ranked.empty()) continue;
+        uint64_t total = m.totals[dir][METRIC_BYTES];
+        printf("[Talkers] Top %s room (last %llu s): '%s' %llu of %llu bytes (%.1f%%)\n",
+               dir == TALK_IN ? "inbound" : "outbound",
+               (unsigned long long)(2 * g_window_ms / 1000), room_names[ranked[0].key].c_str(),
+               (unsigned long long)ranked[0].count, (unsigned long long)total,
+               total ? 100.0 * ranked[0].count / total : 0.0);
+    }
+}
+
+void talkers_handle_http(const HttpRequest& req, HttpResponse* resp, void* user) {
+    (void)user;
+    size_t n = 10;
+    std::string param;
+    if (http_query_param(req.query, "n", &param)) {
+        int v = atoi(param.c_str());
+        n = v < 1 ? 1 : (v > TALK_MAX_N ? TALK_MAX_N : (size_t)v);
+    }
+
+    Merged m;
+    merge(&m);
+
+    std::unordered_map<uint64_t, std::string> room_names;
+    rooms_for_each(collect_room_name, &room_names);
+    std::unordered_map<uint64_t, PeerLabel> peers;
+    LOCK_ACQUIRE(&g_peers_lock);
+    for (Peer* p = g_peers; p; p = p->next) {
+        PeerLabel& label = peers[p->id];
+        label.room = p->room ? p->room->name : "";
+        label.client_id = __atomic_load_n(&p->client_id, __ATOMIC_RELAXED);
+        label.channel = p->mux_parent != nullptr;
+    }
+    LOCK_RELEASE(&g_peers_lock);
+
+    static const char* DIR_NAMES[2] = { "in", "out" };
+    static const char* METRIC_NAMES[2] = { "bytes", "messages" };
+    std::string& out = resp->body;
+    char buf[160];
+    snprintf(buf, sizeof(buf), "{\"window_s\":%llu", (unsigned long long)(g_window_ms / 1000));
+    out.append(buf);
+
+    std::vector<Ranked> ranked;
+    for (int dir = 0; dir < 2; dir++) {
+        snprintf(buf, sizeof(buf), ",\"%s\":{\"bytes\":%llu,\"messages\":%llu", DIR_NAMES[dir],
+                 (unsigned long long)m.totals[dir][METRIC_BYTES],
+                 (unsigned long long)m.totals[dir][METRIC_MESSAGES]);
+        out.append(buf);
+        for (int kind = 0; kind < TALK_KINDS; kind++) {
+            snprintf(buf, sizeof(buf), ",\"%s\":{", KIND_NAMES[kind]);
+            out.append(buf);
+            for (int metric = 0; metric < 2; metric++) {
+                rank(m, dir, kind, metric, n, &ranked);
+                uint64_t total = m.totals[dir][metric];
+                snprintf(buf, sizeof(buf), "%s\"%s\":[", metric ? "," : "", METRIC_NAMES[metric]);
+                out.append(buf);
+                for (size_t i = 0; i < ranked.size(); i++) {
+                    const Ranked& r = ranked[i];
+                    snprintf(buf, sizeof(buf), "%s{\"id\":%llu,\"count\":%llu,\"share\":%.4f",
+                             i ? "," : "", (unsigned long long)r.key, (unsigned long long)r.count,
+                             total ? (double)r.count / total : 0.0);
+                    out.append(buf);
+                    if (kind == KIND_ROOM) {
+                        std::unordered_map<uint64_t, std::string>::const_iterator it = room_names.find(r.key);
+                        if (it != room_names.end()) {
+                            out.append(",\"name\":");
+                            http_json_string(&out, it->second.data(), it->second.size());
+                        }
+                    } else if (kind == KIND_PEER) {
+                        std::unordered_map<uint64_t, PeerLabel>::const_iterator it = peers.find(r.key);
+                        if (it == peers.end()) {
+                            out.append(",\"connected\":false");
+                        } else {
+                            out.append(",\"connected\":true,\"room\":");
+                            http_json_string(&out, it->second.room.data(), it->second.room.size());
+                            snprintf(buf, sizeof(buf), ",\"client\":%u,\"channel\":%s", it->second.client_id,
+                                     it->second.channel ? "true" : "false");
+                            out.append(buf);
+                        }
+                    }
+                    out.push_back('}');
+                }
+                out.push_back(']');
+            }
+            out.push_back('}');
+        }
+        out.push_back('}');
+    }
+    out.push_back('}');
+}
@@ -0,0 +1,78 @@
+#include "tls.h"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <atomic>
+#include <stdio.h>
+
+static std::atomic<unsigned long> g_handshakes(0);
+static std::atomic<unsigned long> g_resumed(0);
+static std::atomic<unsigned long> g_ktls_send(0);
+
+static const unsigned char SESSION_ID_CONTEXT[] = "crdt-server";
+
+void tls_configure_server_ctx(SSL_CTX* ctx, const ServerOptions& opts) {
+    // Stateless tickets let reconnecting clients skip the full handshake;
+    // the server-side cache covers clients that resume by session id
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+    SSL_CTX_set_timeout(ctx, opts.tls_session_timeout);
+    SSL_CTX_set_num_tickets(ctx, 2);
+
+#ifdef SSL_OP_ENABLE_KTLS
+    // Kernel TLS: after the handshake, socket writes are encrypted in the kernel,
+    // so the epoll engine keeps its writev path (falls back silently if unsupported)
+    if (opts.tls_ktls) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+}
+
+SSL_CTX* tls_create_server_ctx(const ServerOptions& opts) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+        fprintf(stderr, "[TLS] Failed to create SSL_CTX\n");
+        return nullptr;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, opts.tls_cert) != 1) {
+        fprintf(stderr, "[TLS] Failed to load certificate '%s'\n", opts.tls_cert);
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, opts.tls_key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        fprintf(stderr, "[TLS] Failed to load private key '%s'\n", opts.tls_key);
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+
+    tls_configure_server_ctx(ctx, opts);
+    return ctx;
+}
+
+void tls_destroy_server_ctx(SSL_CTX* ctx) {
+    if (ctx) SSL_CTX_free(ctx);
+}
+
+bool tls_ktls_send_enabled(SSL* ssl) {
+    if (!ssl) return false;
+    return BIO_get_ktls_send(SSL_get_wbio(ssl)) != 0;
+}
+
+void tls_record_handshake(SSL* ssl) {
+    if (!ssl) return;
+    g_handshakes++;
+    if (SSL_session_reused(ssl)) g_resumed++;
+    if (tls_ktls_send_enabled(ssl)) g_ktls_send++;
+}
+
+void tls_print_stats() {
+    printf("[TLS] Handshakes: %lu (resumed: %lu, kTLS send: %lu)\n",
+           g_handshakes.load(), g_resumed.load(), g_ktls_send.load());
+}
@@ -0,0 +1,280 @@
+#include "ws_frame.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+int ws_parse_frame_header(const uint8_t* data, size_t len, WsFrameHeader* out) {
+    if (len < 2) return 0;
+
+    uint8_t b0 = data[0];
+    uint8_t b1 = data[1];
+
+    // No extensions are negotiated, so RSV bits must be clear
+    if (b0 & 0x70) return -1;
+
+    out->fin = (b0 & 0x80) != 0;
+    out->opcode = b0 & 0x0F;
+    out->masked = (b1 & 0x80) != 0;
+
+    size_t pos = 2;
+    uint64_t payload_len = b1 & 0x7F;
+
+    if (payload_len == 126) {
+        if (len < pos + 2) return 0;
+        payload_len = ((uint64_t)data[2] << 8) | data[3];
+        pos += 2;
+    } else if (payload_len == 127) {
+        if (len < pos + 8) return 0;
+        payload_len = 0;
+        for (int i = 0; i < 8; i++) {
+            payload_len = (payload_len << 8) | data[pos + i];
+        }
+        if (payload_len >> 63) return -1;
+        pos += 8;
+    }
+
+    // Control frames must be final and fit in a single short frame
+    if ((out->opcode & 0x08) && (!out->fin || payload_len > 125)) return -1;
+
+    if (out->masked) {
+        if (len < pos + 4) return 0;
+        memcpy(out->mask_key, data + pos, 4);
+        pos += 4;
+    }
+
+    out->payload_len = payload_len;
+    out->header_len = pos;
+    return 1;
+}
+
+size_t ws_encode_frame_header(uint8_t opcode, uint64_t payload_len,
+                              const uint8_t* mask_key, uint8_t* out) {
+    size_t pos = 0;
+    uint8_t mask_bit = mask_key ? 0x80 : 0x00;
+
+    out[pos++] = (uint8_t)(0x80 | (opcode & 0x0F));
+
+    if (payload_len < 126) {
+        out[pos++] = (uint8_t)(mask_bit | payload_len);
+    } else if (payload_len <= 0xFFFF) {
+        out[pos++] = (uint8_t)(mask_bit | 126);
+        out[pos++] = (uint8_t)(payload_len >> 8);
+        out[pos++] = (uint8_t)(payload_len & 0xFF);
+    } else {
+        out[pos++] = (uint8_t)(mask_bit | 127);
+        for (int i = 7; i >= 0; i--) {
+            out[pos++] = (uint8_t)(payload_len >> (i * 8));
+        }
+    }
+
+    if (mask_key) {
+        memcpy(out + pos, mask_key, 4);
+        pos += 4;
+    }
+
+    return pos;
+}
+
+void ws_apply_mask(uint8_t* data, size_t len, const uint8_t mask_key[4], size_t offset) {
+    size_t i = 0;
+
+    // Bring the key into phase, then unmask 8 bytes at a time
+    while (i < len && ((offset + i) & 3) != 0) {
+        data[i] ^= mask_key[(offset + i) & 3];
+        i++;
+    }
+
+    uint32_t key32;
+    memcpy(&key32, mask_key, 4);
+    uint64_t key64 = ((uint64_t)key32 << 32) | key32;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, data + i, 8);
+        chunk ^= key64;
+        memcpy(data + i, &chunk, 8);
+    }
+
+    for (; i < len; i++) {
+        data[i] ^= mask_key[(offset + i) & 3];
+    }
+}
+
+// Server frames are unmasked, so the header never exceeds 10 bytes
+#define WS_SERVER_HEADER_MAX 10
+
+WsSharedFrame* ws_frame_create(uint8_t opcode, const uint8_t* payload, size_t payload_len) {
+    return ws_frame_create_tagged(opcode, payload, payload_len, ALLOC_FRAME);
+}
+
+WsSharedFrame* ws_frame_create_tagged(uint8_t opcode, const uint8_t* payload, size_t payload_len, AllocTag tag) {
+    // One allocation: struct, headroom, header slot, payload
+    WsSharedFrame* f = (WsSharedFrame*)tagged_malloc(sizeof(WsSharedFrame) + WS_FRAME_HEADROOM +
+                                                     WS_SERVER_HEADER_MAX + payload_len, tag);
+    if (!f) return nullptr;
+
+    uint8_t* body = (uint8_t*)(f + 1) + WS_FRAME_HEADROOM + WS_SERVER_HEADER_MAX;
+    if (payload_len > 0) memcpy(body, payload, payload_len);
+
+    // Right-align the header against the payload so data stays contiguous
+    uint8_t header[WS_SERVER_HEADER_MAX];
+    size_t header_len = ws_encode_frame_header(opcode, payload_len, nullptr, header);
+    memcpy(body - header_len, header, header_len);
+
+    f->refs = 1;
+    f->tag = tag;
+    f->data = body - header_len;
+    f->len = header_len + payload_len;
+    f->header_len = header_len;
+    return f;
+}
+
+void ws_frame_retain(WsSharedFrame* frame) {
+    __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+}
+
+void ws_frame_release(WsSharedFrame* frame) {
+    if (frame && __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        tagged_free(frame, (AllocTag)frame->tag);
+    }
+}
+
+// Minimal SHA-1 (only used for the handshake accept key)
+struct Sha1 {
+    uint32_t h[5];
+    uint8_t block[64];
+    size_t block_len;
+    uint64_t total_len;
+};
+
+static inline uint32_t rol32(uint32_t v, int n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+static void sha1_init(Sha1* s) {
+    s->h[0] = 0x67452301;
+    s->h[1] = 0xEFCDAB89;
+    s->h[2] = 0x98BADCFE;
+    s->h[3] = 0x10325476;
+    s->h[4] = 0xC3D2E1F0;
+    s->block_len = 0;
+    s->total_len = 0;
+}
+
+static void sha1_block(Sha1* s, const uint8_t* b) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)b[i * 4] << 24) | ((uint32_t)b[i * 4 + 1] << 16) |
+               ((uint32_t)b[i * 4 + 2] << 8) | b[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = s->h[0], bb = s->h[1], c = s->h[2], d = s->h[3], e = s->h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (bb & c) | (~bb & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = bb ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (bb & c) | (bb & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = bb ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rol32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol32(bb, 30);
+        bb = a;
+        a = t;
+    }
+
+    s->h[0] += a;
+    s->h[1] += bb;
+    s->h[2] += c;
+    s->h[3] += d;
+    s->h[4] += e;
+}
+
+static void sha1_update(Sha1* s, const uint8_t* data, size_t len) {
+    s->total_len += len;
+    while (len > 0) {
+        size_t n = 64 - s->block_len;
+        if (n > len) n = len;
+        memcpy(s->block + s->block_len, data, n);
+        s->block_len += n;
+        data += n;
+        len -= n;
+        if (s->block_len == 64) {
+            sha1_block(s, s->block);
+            s->block_len = 0;
+        }
+    }
+}
+
+static void sha1_final(Sha1* s, uint8_t digest[20]) {
+    uint64_t bits = s->total_len * 8;
+    uint8_t pad = 0x80;
+    sha1_update(s, &pad, 1);
+    pad = 0;
+    while (s->block_len != 56) {
+        sha1_update(s, &pad, 1);
+    }
+    uint8_t len_be[8];
+    for (int i = 0; i < 8; i++) {
+        len_be[i] = (uint8_t)(bits >> (56 - i * 8));
+    }
+    sha1_update(s, len_be, 8);
+
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (uint8_t)(s->h[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(s->h[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(s->h[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)s->h[i];
+    }
+}
+
+size_t ws_base64_encode(const uint8_t* data, size_t len, char* out) {
+    static const char* table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t pos = 0;
+    size_t i = 0;
+
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        out[pos++] = table[(v >> 18) & 0x3F];
+        out[pos++] = table[(v >> 12) & 0x3F];
+        out[pos++] = table[(v >> 6) & 0x3F];
+        out[pos++] = table[v & 0x3F];
+    }
+
+    if (i < len) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+        out[pos++] = table[(v >> 18) & 0x3F];
+        out[pos++] = table[(v >> 12) & 0x3F];
+        out[pos++] = (i + 1 < len) ? table[(v >> 6) & 0x3F] : '=';
+        out[pos++] = '=';
+    }
+
+    out[pos] = '\0';
+    return pos;
+}
+
+void ws_compute_accept(const char* key, size_t key_len, char out[WS_ACCEPT_LEN]) {
+    Sha1 sha;
+    uint8_t digest[20];
+
+    sha1_init(&sha);
+    sha1_update(&sha, (const uint8_t*)key, key_len);
+    sha1_update(&sha, (const uint8_t*)WS_GUID, strlen(WS_GUID));
+    sha1_final(&sha, digest);
+
+    ws_base64_encode(digest, sizeof(digest), out);
+}
@@ -0,0 +1,1072 @@
+// CRDT server load generator
+//
+// Opens N WebSocket connections, syncs each one (SYNC_STEP1), then has W of
+// them append text to the shared "quill" YText at a fixed rate. Every insert
+// carries its send timestamp, so each delivery to the other peers yields one
+// end-to-end latency sample (same host, CLOCK_MONOTONIC).
+//
+// With --tls, connections use wss:// (certificates are not verified, so a
+// self-signed test certificate works) and reuse a session ticket from an earlier
+// handshake, which exercises the server's session resumption.
+//
+// With --mux M, each connection speaks the multiplexed protocol and subscribes
+// to M rooms (<path>0 .. <path>M-1); writers rotate their updates over them.
+//
+// Long runs (scripts/soak.sh) add churn on top of the steady load:
+//   --rooms K         plain connections join one of K rooms (<path>0 .. <path>K-1)
+//   --churn N         close and reopen N connections per second, each as a new
+//                     Yjs client in a random room
+//   --awareness R     every synced client sends R awareness updates per second
+//   --paste-every N   every Nth update of a writer is a --paste-size paste
+//   --trim            each update deletes the writer's previous insert, so
+//                     documents stay small and only tombstones accumulate
+//   --report-every S  print the last S seconds' counters and latency
+//                     percentiles every S seconds (one JSON line with --json)
+//
+// Usage: crdt_loadgen [--host H] [--port P] [--path /] [--clients N]
+//                     [--writers W] [--rate R] [--size BYTES] [--duration SEC]
+//                     [--threads T] [--tls] [--mux M] [--label NAME] [--json]
+//                     [--rooms K] [--churn N] [--awareness R] [--paste-every N]
+//                     [--paste-size BYTES] [--trim] [--report-every SEC]
+
+#include "protocol.h"
+#include "ws_frame.h"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define MARKER "LG"
+#define MARKER_LEN 2
+#define STAMP_LEN 16
+#define REPORT_SAMPLES 2000000  // Latency reservoir for the final summary with --report-every
+
+struct LoadOptions {
+    const char* host = "127.0.0.1";
+    int port = 9000;
+    const char* path = "/";
+    int clients = 100;
+    int writers = 1;
+    double rate = 50.0;         // Updates per second per writer
+    int size = 32;              // Inserted bytes per update (>= marker + stamp)
+    double duration = 10.0;     // Seconds of measured load
+    int threads = 1;
+    bool tls = false;
+    int mux = 0;                // Rooms per connection over MUX_PROTOCOL_NAME (0 = plain)
+    const char* label = "";
+    bool json = false;
+    int rooms = 0;              // Plain connections spread over this many rooms (0 = path itself)
+    double churn = 0;           // Reconnects per second, all threads together
+    double awareness = 0;       // Awareness updates per second per synced client
+    int paste_every = 0;        // Every Nth writer update is a paste (0 = never)
+    int paste_size = 16384;
+    bool trim = false;          // Delete the previous insert with each update
+    double report_every = 0;    // Interval reports (seconds, 0 = final summary only)
+};
+
+enum ClientState {
+    CLIENT_CONNECTING,
+    CLIENT_TLS,
+    CLIENT_HANDSHAKE,
+    CLIENT_OPEN,
+    CLIENT_DEAD
+};
+
+// One subscribed room of a multiplexed connection
+struct MuxChannel {
+    char path[128];
+    uint32_t id;                // Assigned by MUX_SUBSCRIBED (0 = pending)
+    bool synced;
+    uint32_t clock;
+    uint32_t last_len;          // Our previous insert ends at clock (--trim)
+};
+
+struct Client {
+    int fd;
+    SSL* ssl;                   // null unless --tls
+    ClientState state;
+    bool writer;
+    bool synced;                // Received the SYNC_STEP2 reply to our SYNC_STEP1
+    char path[128];             // Request path (room) of a plain connection
+    uint32_t yjs_client;
+    uint32_t clock;
+    uint32_t last_len;
+    uint32_t updates;           // Sent so far (--paste-every)
+    double next_send;
+    double next_awareness;
+
+    std::vector<MuxChannel> channels;   // --mux only
+    int channels_synced;
+    uint32_t send_turn;
+
+    std::vector<uint8_t> rx;
+    std::vector<uint8_t> tx;
+    size_t tx_pos;
+};
+
+// Counters as of one report, and the latency samples since the previous one
+struct ReportSlot {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t bytes_received = 0;
+    uint64_t errors = 0;
+    uint64_t awareness = 0;
+    uint64_t reconnects = 0;
+    std::vector<uint32_t> latency_us;
+};
+
+struct ThreadStats {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t bytes_received = 0;
+    uint64_t errors = 0;
+    uint64_t awareness = 0;
+    uint64_t reconnects = 0;
+    std::vector<uint32_t> latency_us;   // With --report-every: since the last report only
+
+    // Filled by the thread when it sees a new g_report_seq, then read by main
+    ReportSlot report;
+    std::atomic<uint32_t> report_seq{0};
+};
+
+static LoadOptions g_opts;
+static thread_local unsigned t_seed = 1;
+static std::atomic<int> g_synced(0);
+static std::atomic<int> g_failed(0);
+static std::atomic<bool> g_measuring(false);
+static std::atomic<bool> g_stop(false);
+static std::atomic<uint32_t> g_report_seq(0);
+
+// TLS client context plus the most recent session, shared so later connections resume
+static SSL_CTX* g_tls_ctx = nullptr;
+static SSL_SESSION* g_tls_session = nullptr;
+static std::mutex g_tls_session_lock;
+static std::atomic<int> g_tls_handshakes(0);
+static std::atomic<int> g_tls_resumed(0);
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t put_varuint(uint32_t v, uint8_t* out) {
+    return encode_varuint(v, out);
+}
+
+// Yjs V1 update with a single ContentString item appended after our previous item,
+// optionally deleting del_len of our own characters from del_clock
+static std::vector<uint8_t> encode_text_update(uint32_t client, uint32_t clock,
+                                               const char* text, size_t text_len,
+                                               uint32_t del_clock, uint32_t del_len) {
+    std::vector<uint8_t> out(48 + text_len);
+    size_t pos = 0;
+
+    pos += put_varuint(1, &out[pos]);        // one client block
+    pos += put_varuint(1, &out[pos]);        // one struct
+    pos += put_varuint(client, &out[pos]);
+    pos += put_varuint(clock, &out[pos]);
+
+    if (clock == 0) {
+        // First item: no origin, parent is the root type "quill"
+        out[pos++] = 0x04;
+        pos += put_varuint(1, &out[pos]);
+        pos += put_varuint(5, &out[pos]);
+        memcpy(&out[pos], "quill", 5);
+        pos += 5;
+    } else {
+        // Left origin = our own last character
+        out[pos++] = 0x84;
+        pos += put_varuint(client, &out[pos]);
+        pos += put_varuint(clock - 1, &out[pos]);
+    }
+
+    pos += put_varuint((uint32_t)text_len, &out[pos]);
+    memcpy(&out[pos], text, text_len);
+    pos += text_len;
+
+    if (del_len == 0) {
+        pos += put_varuint(0, &out[pos]);    // empty delete set
+    } else {
+        pos += put_varuint(1, &out[pos]);    // one client, one range
+        pos += put_varuint(client, &out[pos]);
+        pos += put_varuint(1, &out[pos]);
+        pos += put_varuint(del_clock, &out[pos]);
+        pos += put_varuint(del_len, &out[pos]);
+    }
+    out.resize(pos);
+    return out;
+}
+
+static int on_new_session(SSL* ssl, SSL_SESSION* session) {
+    (void)ssl;
+    std::lock_guard<std::mutex> guard(g_tls_session_lock);
+    if (g_tls_session) SSL_SESSION_free(g_tls_session);
+    g_tls_session = session;
+    return 1;   // We keep the reference
+}
+
+static bool tls_init() {
+    g_tls_ctx = SSL_CTX_new(TLS_client_method());
+    if (!g_tls_ctx) return false;
+    SSL_CTX_set_verify(g_tls_ctx, SSL_VERIFY_NONE, nullptr);
+    SSL_CTX_set_mode(g_tls_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_session_cache_mode(g_tls_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(g_tls_ctx, on_new_session);
+    return true;
+}
+
+static bool tls_start(Client* c) {
+    c->ssl = SSL_new(g_tls_ctx);
+    if (!c->ssl || SSL_set_fd(c->ssl, c->fd) != 1) return false;
+    SSL_set_connect_state(c->ssl);
+    SSL_set_tlsext_host_name(c->ssl, g_opts.host);
+
+    std::lock_guard<std::mutex> guard(g_tls_session_lock);
+    if (g_tls_session) SSL_set_session(c->ssl, g_tls_session);
+    return true;
+}
+
+// Returns -1 on failure, 0 while in progress, 1 when complete
+static int tls_handshake(Client* c) {
+    int r = SSL_do_handshake(c->ssl);
+    if (r == 1) {
+        g_tls_handshakes++;
+        if (SSL_session_reused(c->ssl)) g_tls_resumed++;
+        return 1;
+    }
+    int err = SSL_get_error(c->ssl, r);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return 0;
+    ERR_clear_error();
+    return -1;
+}
+
+// read()/write() conventions over plain or TLS sockets (-1 + EAGAIN when blocked)
+static ssize_t ssl_result(Client* c, int n) {
+    int err = SSL_get_error(c->ssl, n);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (err == SSL_ERROR_ZERO_RETURN) return 0;
+    ERR_clear_error();
+    errno = EIO;
+    return -1;
+}
+
+static ssize_t client_read(Client* c, uint8_t* buf, size_t len) {
+    if (!c->ssl) return read(c->fd, buf, len);
+    int n = SSL_read(c->ssl, buf, (int)len);
+    return n > 0 ? n : ssl_result(c, n);
+}
+
+static ssize_t client_write(Client* c, const uint8_t* buf, size_t len) {
+    if (!c->ssl) return write(c->fd, buf, len);
+    int n = SSL_write(c->ssl, buf, (int)std::min(len, (size_t)1 << 30));
+    return n > 0 ? n : ssl_result(c, n);
+}
+
+static void queue_frame(Client* c, uint8_t opcode, const uint8_t* payload, size_t len) {
+    uint8_t header[WS_MAX_HEADER_LEN];
+    uint8_t mask[4];
+    uint32_t r = (uint32_t)rand_r(&t_seed);
+    memcpy(mask, &r, 4);
+
+    size_t header_len = ws_encode_frame_header(opcode, len, mask, header);
+    size_t start = c->tx.size();
+    c->tx.insert(c->tx.end(), header, header + header_len);
+    c->tx.insert(c->tx.end(), payload, payload + len);
+    ws_apply_mask(&c->tx[start + header_len], len, mask, 0);
+}
+
+static bool flush_tx(Client* c) {
+    while (c->tx_pos < c->tx.size()) {
+        ssize_t n = client_write(c, &c->tx[c->tx_pos], c->tx.size() - c->tx_pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+        c->tx_pos += (size_t)n;
+    }
+    c->tx.clear();
+    c->tx_pos = 0;
+    return true;
+}
+
+// Queue one protocol message, wrapped for its channel on multiplexed connections
+static void queue_message(Client* c, uint32_t channel, const uint8_t* msg, size_t len) {
+    if (g_opts.mux <= 0) {
+        queue_frame(c, WS_OP_BINARY, msg, len);
+        return;
+    }
+    size_t mux_len = 0;
+    uint8_t* mux = encode_mux_message(channel, msg, len, &mux_len);
+    queue_frame(c, WS_OP_BINARY, mux, mux_len);
+    protocol_free(mux);
+}
+
+static void queue_sync_step1(Client* c, uint32_t channel) {
+    // Empty state vector: ask for the full document
+    uint8_t sv[1] = { 0 };
+    size_t msg_len = 0;
+    uint8_t* msg = encode_sync_step1(sv, sizeof(sv), &msg_len);
+    queue_message(c, channel, msg, msg_len);
+    protocol_free(msg);
+}
+
+static void send_update(Client* c, ThreadStats* stats) {
+    size_t size = g_opts.size;
+    if (g_opts.paste_every > 0 && ++c->updates % g_opts.paste_every == 0) size = g_opts.paste_size;
+    std::vector<char> text(size, 'x');
+    char stamp[STAMP_LEN + 1];
+    snprintf(stamp, sizeof(stamp), "%016llx", (unsigned long long)now_ns());
+    memcpy(&text[0], MARKER, MARKER_LEN);
+    memcpy(&text[MARKER_LEN], stamp, STAMP_LEN);
+
+    // Each room has its own document, so its own clock for our client id
+    uint32_t* clock = &c->clock;
+    uint32_t* last_len = &c->last_len;
+    uint32_t channel = 0;
+    if (g_opts.mux > 0) {
+        MuxChannel* ch = &c->channels[c->send_turn++ % c->channels.size()];
+        clock = &ch->clock;
+        last_len = &ch->last_len;
+        channel = ch->id;
+    }
+
+    uint32_t del_len = g_opts.trim ? *last_len : 0;
+    std::vector<uint8_t> update = encode_text_update(c->yjs_client, *clock, &text[0], text.size(),
+                                                     *clock - del_len, del_len);
+    *clock += (uint32_t)text.size();
+    *last_len = (uint32_t)text.size();
+
+    size_t msg_len = 0;
+    uint8_t* msg = encode_sync_step2(&update[0], update.size(), &msg_len);
+    queue_message(c, channel, msg, msg_len);
+    protocol_free(msg);
+    stats->sent++;
+}
+
+// Cursor moves and presence, as an editor's awareness sends them
+static void send_awareness(Client* c, ThreadStats* stats) {
+    uint32_t channel = 0;
+    if (g_opts.mux > 0) {
+        if (c->channels.empty() || c->channels[0].id == 0) return;
+        channel = c->channels[0].id;
+    }
+    char json[160];
+    uint32_t anchor = (uint32_t)rand_r(&t_seed) % (c->clock + 1);
+    int json_len = snprintf(json, sizeof(json),
+                            "{\"user\":{\"name\":\"loadgen-%u\",\"color\":\"#30bced\"},"
+                            "\"cursor\":{\"anchor\":%u,\"head\":%u}}",
+                            c->yjs_client, anchor, anchor + (uint32_t)rand_r(&t_seed) % 8);
+    size_t msg_len = 0;
+    uint8_t* msg = encode_awareness(c->yjs_client, json, (size_t)json_len, &msg_len);
+    queue_message(c, channel, msg, msg_len);
+    protocol_free(msg);
+    stats->awareness++;
+}
+
+// Live update from another client: one latency sample
+static void on_update(const uint8_t* data, size_t len, ThreadStats* stats) {
+    if (!g_measuring) return;
+    stats->received++;
+    stats->bytes_received += len;
+
+    const uint8_t* m = (const uint8_t*)memmem(data, len, MARKER, MARKER_LEN);
+    if (!m || (size_t)(m - data) + MARKER_LEN + STAMP_LEN > len) return;
+
+    char stamp[STAMP_LEN + 1];
+    memcpy(stamp, m + MARKER_LEN, STAMP_LEN);
+    stamp[STAMP_LEN] = '\0';
+    uint64_t sent_ns = strtoull(stamp, nullptr, 16);
+    uint64_t now = now_ns();
+    if (sent_ns > 0 && now >= sent_ns) {
+        stats->latency_us.push_back((uint32_t)((now - sent_ns) / 1000));
+    }
+}
+
+// Multiplexed connection: channel 0 confirms subscriptions, others carry room traffic
+static void on_mux_message(Client* c, const uint8_t* data, size_t len, ThreadStats* stats) {
+    uint32_t channel = 0;
+    size_t msg_len = 0;
+    const uint8_t* msg = decode_mux_message(data, len, &channel, &msg_len);
+    if (!msg) return;
+
+    if (channel == MUX_CONTROL_CHANNEL) {
+        MuxControlType type;
+        uint32_t id = 0;
+        const char* path = nullptr;
+        size_t path_len = 0;
+        if (!decode_mux_control(msg, msg_len, &type, &id, &path, &path_len)) return;
+        if (type == MUX_REFUSED) {
+            stats->errors++;
+            return;
+        }
+        if (type != MUX_SUBSCRIBED) return;
+        for (size_t i = 0; i < c->channels.size(); i++) {
+            MuxChannel* ch = &c->channels[i];
+            if (ch->id == 0 && strlen(ch->path) == path_len && memcmp(ch->path, path, path_len) == 0) {
+                ch->id = id;
+                queue_sync_step1(c, id);
+                break;
+            }
+        }
+        return;
+    }
+
+    if (msg_len == 0 || msg[0] != MSG_SYNC_STEP2) return;
+    for (size_t i = 0; i < c->channels.size(); i++) {
+        MuxChannel* ch = &c->channels[i];
+        if (ch->id != channel) continue;
+        if (!ch->synced) {
+            // Connection counts as synced once every room answered
+            ch->synced = true;
+            if (++c->channels_synced == (int)c->channels.size()) {
+                c->synced = true;
+                g_synced++;
+            }
+            return;
+        }
+        on_update(msg, msg_len, stats);
+        return;
+    }
+}
+
+static void on_message(Client* c, const uint8_t* data, size_t len, ThreadStats* stats) {
+    if (g_opts.mux > 0) {
+        on_mux_message(c, data, len, stats);
+        return;
+    }
+
+    if (len == 0 || data[0] != MSG_SYNC_STEP2) return;
+
+    if (!c->synced) {
+        // Reply to our SYNC_STEP1 (full state), not a live update
+        c->synced = true;
+        g_synced++;
+        return;
+    }
+
+    on_update(data, len, stats);
+}
+
+static void fail_client(Client* c, ThreadStats* stats) {
+    if (c->state == CLIENT_DEAD) return;
+    if (!c->synced) g_failed++;
+    c->state = CLIENT_DEAD;
+    if (c->ssl) {
+        SSL_free(c->ssl);
+        c->ssl = nullptr;
+    }
+    close(c->fd);
+    stats->errors++;
+}
+
+static void on_readable(Client* c, ThreadStats* stats) {
+    uint8_t buf[65536];
+
+    for (;;) {
+        ssize_t n = client_read(c, buf, sizeof(buf));
+        if (n == 0) {
+            fail_client(c, stats);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) fail_client(c, stats);
+            break;
+        }
+        c->rx.insert(c->rx.end(), buf, buf + n);
+    }
+
+    size_t pos = 0;
+
+    if (c->state == CLIENT_HANDSHAKE) {
+        const uint8_t* end = c->rx.empty() ? nullptr :
+            (const uint8_t*)memmem(&c->rx[0], c->rx.size(), "\r\n\r\n", 4);
+        if (!end) return;
+        if (c->rx.size() < 12 || memcmp(&c->rx[0], "HTTP/1.1 101", 12) != 0) {
+            fail_client(c, stats);
+            return;
+        }
+        pos = (end - &c->rx[0]) + 4;
+        c->state = CLIENT_OPEN;
+
+        if (g_opts.mux > 0) {
+            // Subscribe every room; each channel syncs once its id arrives
+            for (size_t i = 0; i < c->channels.size(); i++) {
+                size_t msg_len = 0;
+                uint8_t* msg = encode_mux_subscribe(c->channels[i].path, strlen(c->channels[i].path), &msg_len);
+                queue_frame(c, WS_OP_BINARY, msg, msg_len);     // Already on channel 0
+                protocol_free(msg);
+            }
+        } else {
+            queue_sync_step1(c, 0);
+        }
+    }
+
+    while (c->state == CLIENT_OPEN && pos < c->rx.size()) {
+        WsFrameHeader h;
+        int r = ws_parse_frame_header(&c->rx[pos], c->rx.size() - pos, &h);
+        if (r == 0) break;
+        if (r < 0) {
+            fail_client(c, stats);
+            return;
+        }
+        size_t frame_len = h.header_len + (size_t)h.payload_len;
+        if (c->rx.size() - pos < frame_len) break;
+
+        const uint8_t* payload = &c->rx[pos + h.header_len];
+        if (h.opcode == WS_OP_BINARY) {
+            on_message(c, payload, (size_t)h.payload_len, stats);
+        } else if (h.opcode == WS_OP_CLOSE) {
+            fail_client(c, stats);
+            return;
+        }
+        pos += frame_len;
+    }
+
+    if (pos > 0) c->rx.erase(c->rx.begin(), c->rx.begin() + pos);
+}
+
+static int connect_client(const struct sockaddr_storage* addr, socklen_t addr_len) {
+    int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (const struct sockaddr*)addr, addr_len) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void queue_handshake(Client* c) {
+    char key_raw[16];
+    for (int i = 0; i < 16; i++) key_raw[i] = (char)(rand_r(&t_seed) & 0xFF);
+    char key[32];
+    ws_base64_encode((const uint8_t*)key_raw, sizeof(key_raw), key);
+
+    char req[512];
+    int n = snprintf(req, sizeof(req),
+                     "GET %s HTTP/1.1\r\n"
+                     "Host: %s:%d\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: %s\r\n"
+                     "Sec-WebSocket-Version: 13\r\n"
+                     "%s"
+                     "\r\n",
+                     c->path, g_opts.host, g_opts.port, key,
+                     g_opts.mux > 0 ? "Sec-WebSocket-Protocol: " MUX_PROTOCOL_NAME "\r\n" : "");
+    c->tx.insert(c->tx.end(), req, req + n);
+}
+
+// One blocking wss handshake before the load starts; TLS 1.3 tickets arrive after
+// the handshake, so read the 101 response to be sure the session was captured
+static void tls_prime_session(const struct sockaddr_storage* addr, socklen_t addr_len) {
+    int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return;
+    if (connect(fd, (const struct sockaddr*)addr, addr_len) < 0) {
+        close(fd);
+        return;
+    }
+
+    Client c;
+    c.fd = fd;
+    c.ssl = nullptr;
+    c.tx_pos = 0;
+    snprintf(c.path, sizeof(c.path), "%s", g_opts.path);
+    if (tls_start(&c) && SSL_connect(c.ssl) == 1) {
+        queue_handshake(&c);
+        if (SSL_write(c.ssl, &c.tx[0], (int)c.tx.size()) > 0) {
+            char buf[512];
+            SSL_read(c.ssl, buf, sizeof(buf));
+        }
+        SSL_shutdown(c.ssl);
+    }
+    if (c.ssl) SSL_free(c.ssl);
+    ERR_clear_error();
+    close(fd);
+}
+
+// "<path><n>", or "<path>/<n>" when path does not end in '/'
+static void room_path(char* out, size_t size, int n) {
+    size_t plen = strlen(g_opts.path);
+    snprintf(out, size, "%s%s%d", g_opts.path, plen > 0 && g_opts.path[plen - 1] == '/' ? "" : "/", n);
+}
+
+// Fresh connection for client slot i, as a new Yjs client (room < 0 = path itself)
+static void open_client(Client* c, int i, int room, const struct sockaddr_storage* addr, socklen_t addr_len,
+                        ThreadStats* stats) {
+    c->fd = connect_client(addr, addr_len);
+    c->ssl = nullptr;
+    c->state = c->fd < 0 ? CLIENT_DEAD : CLIENT_CONNECTING;
+    c->writer = i < g_opts.writers;
+    c->synced = false;
+    if (room < 0) snprintf(c->path, sizeof(c->path), "%s", g_opts.path);
+    else room_path(c->path, sizeof(c->path), room);
+    c->yjs_client = ((uint32_t)rand_r(&t_seed) & 0x3FFFFFFF) | 1;
+    c->clock = 0;
+    c->last_len = 0;
+    c->updates = 0;
+    c->next_send = 0;
+    c->next_awareness = 0;
+    c->rx.clear();
+    c->tx.clear();
+    c->tx_pos = 0;
+    c->channels_synced = 0;
+    c->send_turn = (uint32_t)i;
+    c->channels.clear();
+    for (int m = 0; m < g_opts.mux; m++) {
+        MuxChannel ch;
+        memset(&ch, 0, sizeof(ch));
+        room_path(ch.path, sizeof(ch.path), m);
+        c->channels.push_back(ch);
+    }
+    if (c->fd < 0) {
+        g_failed++;
+        stats->errors++;
+    }
+}
+
+static void watch_client(int epfd, Client* c, size_t slot) {
+    if (c->state == CLIENT_DEAD) return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u64 = slot;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+// Churn: drop a connection (without the error count) and reconnect the slot
+static void reopen_client(int epfd, std::vector<Client>& clients, size_t slot, int index,
+                          const struct sockaddr_storage* addr, socklen_t addr_len, ThreadStats* stats) {
+    Client* c = &clients[slot];
+    if (c->synced) g_synced--;
+    if (c->state != CLIENT_DEAD) {
+        if (c->ssl) SSL_free(c->ssl);
+        close(c->fd);
+    }
+    int i = index + (int)slot * g_opts.threads;
+    int room = g_opts.rooms > 0 && g_opts.mux <= 0 ? (int)((uint32_t)rand_r(&t_seed) % g_opts.rooms) : -1;
+    open_client(c, i, room, addr, addr_len, stats);
+    watch_client(epfd, c, slot);
+    stats->reconnects++;
+}
+
+// Publish counters and this interval's samples for the report main is collecting
+static void hand_over_report(ThreadStats* stats, uint32_t seq) {
+    ReportSlot* r = &stats->report;
+    r->sent = stats->sent;
+    r->received = stats->received;
+    r->bytes_received = stats->bytes_received;
+    r->errors = stats->errors;
+    r->awareness = stats->awareness;
+    r->reconnects = stats->reconnects;
+    r->latency_us.swap(stats->latency_us);  // Main leaves the slot's vector empty
+    stats->report_seq.store(seq, std::memory_order_release);
+}
+
+static void run_thread(int index, const struct sockaddr_storage* addr, socklen_t addr_len,
+                       ThreadStats* stats) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Client> clients;
+    t_seed = (unsigned)now_ns() + index;
+
+    // Clients are striped across threads; the first W globally are writers
+    for (int i = index; i < g_opts.clients; i += g_opts.threads) {
+        Client c;
+        open_client(&c, i, g_opts.rooms > 0 && g_opts.mux <= 0 ? i % g_opts.rooms : -1, addr, addr_len, stats);
+        clients.push_back(c);
+    }
+
+    for (size_t i = 0; i < clients.size(); i++) watch_client(epfd, &clients[i], i);
+
+    double interval = g_opts.rate > 0 ? 1.0 / g_opts.rate : 0;
+    double awareness_interval = g_opts.awareness > 0 ? 1.0 / g_opts.awareness : 0;
+    double churn_per_thread = g_opts.churn / g_opts.threads;
+    double churn_credit = 0;
+    double last_loop = now_sec();
+    uint32_t report_seq = 0;
+    struct epoll_event events[256];
+
+    while (!g_stop) {
+        int timeout_ms = 1;
+        int n = epoll_wait(epfd, events, 256, timeout_ms);
+
+        for (int i = 0; i < n; i++) {
+            Client* c = &clients[events[i].data.u64];
+            if (c->state == CLIENT_DEAD) continue;
+
+            if (c->state == CLIENT_CONNECTING && (events[i].events & EPOLLOUT)) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                    fail_client(c, stats);
+                    continue;
+                }
+                if (g_opts.tls) {
+                    if (!tls_start(c)) {
+                        fail_client(c, stats);
+                        continue;
+                    }
+                    c->state = CLIENT_TLS;
+                } else {
+                    c->state = CLIENT_HANDSHAKE;
+                    queue_handshake(c);
+                }
+            }
+            if (c->state == CLIENT_TLS) {
+                int r = tls_handshake(c);
+                if (r < 0) {
+                    fail_client(c, stats);
+                    continue;
+                }
+                if (r == 0) continue;
+                c->state = CLIENT_HANDSHAKE;
+                queue_handshake(c);
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) || c->ssl) {
+                on_readable(c, stats);
+            }
+        }
+
+        double now = now_sec();
+        if (g_measuring && churn_per_thread > 0 && !clients.empty()) {
+            churn_credit += churn_per_thread * (now - last_loop);
+            while (churn_credit >= 1.0) {
+                churn_credit -= 1.0;
+                size_t slot = (size_t)rand_r(&t_seed) % clients.size();
+                reopen_client(epfd, clients, slot, index, addr, addr_len, stats);
+            }
+        }
+        last_loop = now;
+
+        if (g_measuring && awareness_interval > 0) {
+            for (size_t i = 0; i < clients.size(); i++) {
+                Client* c = &clients[i];
+                if (c->state != CLIENT_OPEN || !c->synced) continue;
+                // Random phase, so clients do not all send in the same tick
+                if (c->next_awareness == 0) {
+                    c->next_awareness = now + awareness_interval * (rand_r(&t_seed) % 1000) / 1000.0;
+                }
+                if (c->next_awareness < now - 1.0) c->next_awareness = now - 1.0;
+                while (c->next_awareness <= now) {
+                    send_awareness(c, stats);
+                    c->next_awareness += awareness_interval;
+                }
+            }
+        }
+
+        if (g_measuring && interval > 0) {
+            for (size_t i = 0; i < clients.size(); i++) {
+                Client* c = &clients[i];
+                if (!c->writer || c->state != CLIENT_OPEN || !c->synced) continue;
+                if (c->next_send == 0) c->next_send = now;
+                // Catch up without bursting more than one second of backlog
+                if (c->next_send < now - 1.0) c->next_send = now - 1.0;
+                while (c->next_send <= now) {
+                    send_update(c, stats);
+                    c->next_send += interval;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < clients.size(); i++) {
+            Client* c = &clients[i];
+            if (c->state >= CLIENT_HANDSHAKE && c->state != CLIENT_DEAD && !c->tx.empty()) {
+                if (!flush_tx(c)) fail_client(c, stats);
+            }
+        }
+
+        uint32_t seq = g_report_seq.load(std::memory_order_acquire);
+        if (seq != report_seq) {
+            hand_over_report(stats, seq);
+            report_seq = seq;
+        }
+    }
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        if (clients[i].state == CLIENT_DEAD) continue;
+        if (clients[i].ssl) SSL_free(clients[i].ssl);
+        close(clients[i].fd);
+    }
+    close(epfd);
+}
+
+static double percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t idx = (size_t)(p * (sorted.size() - 1));
+    return sorted[idx] / 1000.0;
+}
+
+// Keep a uniform sample of every latency seen (Algorithm R), so hours of
+// --report-every intervals summarize in bounded memory
+static void reservoir_add(std::vector<uint32_t>* reservoir, uint64_t* seen, const std::vector<uint32_t>& samples,
+                          unsigned* seed) {
+    for (size_t i = 0; i < samples.size(); i++) {
+        uint64_t n = ++*seen;
+        if (reservoir->size() < REPORT_SAMPLES) {
+            reservoir->push_back(samples[i]);
+        } else {
+            uint64_t j = (((uint64_t)rand_r(seed) << 31) ^ (uint64_t)rand_r(seed)) % n;
+            if (j < REPORT_SAMPLES) (*reservoir)[j] = samples[i];
+        }
+    }
+}
+
+// Collect one interval from every thread and print it
+static void report_interval(std::vector<ThreadStats>& stats, uint32_t seq, double t, double dt,
+                            ReportSlot* last, std::vector<uint32_t>* reservoir, uint64_t* seen,
+                            uint32_t* max_us, unsigned* seed) {
+    g_report_seq.store(seq, std::memory_order_release);
+    double wait_start = now_sec();
+    for (size_t i = 0; i < stats.size(); i++) {
+        while (stats[i].report_seq.load(std::memory_order_acquire) != seq && now_sec() - wait_start < 1.0) {
+            usleep(1000);
+        }
+    }
+
+    ReportSlot now;
+    std::vector<uint32_t> samples;
+    for (size_t i = 0; i < stats.size(); i++) {
+        ReportSlot* r = &stats[i].report;
+        if (stats[i].report_seq.load(std::memory_order_acquire) != seq) continue;  // Missed this round
+        now.sent += r->sent;
+        now.received += r->received;
+        now.bytes_received += r->bytes_received;
+        now.errors += r->errors;
+        now.awareness += r->awareness;
+        now.reconnects += r->reconnects;
+        samples.insert(samples.end(), r->latency_us.begin(), r->latency_us.end());
+        r->latency_us.clear();
+    }
+    reservoir_add(reservoir, seen, samples, seed);
+    std::sort(samples.begin(), samples.end());
+    if (!samples.empty() && samples.back() > *max_us) *max_us = samples.back();
+
+    double p50 = percentile(samples, 0.50);
+    double p90 = percentile(samples, 0.90);
+    double p99 = percentile(samples, 0.99);
+    double max = samples.empty() ? 0 : samples.back() / 1000.0;
+    uint64_t sent = now.sent - last->sent;
+    uint64_t received = now.received - last->received;
+    if (g_opts.json) {
+        printf("{\"label\":\"%s\",\"interval\":%u,\"t_s\":%.1f,\"synced\":%d,\"sent\":%llu,\"delivered\":%llu,"
+               "\"deliver_mb_per_s\":%.2f,\"awareness\":%llu,\"reconnects\":%llu,\"errors\":%llu,"
+               "\"latency_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}}\n",
+               g_opts.label, seq, t, g_synced.load(), (unsigned long long)sent, (unsigned long long)received,
+               (now.bytes_received - last->bytes_received) / dt / 1e6,
+               (unsigned long long)(now.awareness - last->awareness),
+               (unsigned long long)(now.reconnects - last->reconnects),
+               (unsigned long long)(now.errors - last->errors), p50, p90, p99, max);
+    } else {
+        printf("[%7.0fs] synced=%d sent=%llu delivered=%llu awareness=%llu reconnects=%llu errors=%llu "
+               "p50=%.3fms p99=%.3fms max=%.3fms\n",
+               t, g_synced.load(), (unsigned long long)sent, (unsigned long long)received,
+               (unsigned long long)(now.awareness - last->awareness),
+               (unsigned long long)(now.reconnects - last->reconnects),
+               (unsigned long long)(now.errors - last->errors), p50, p99, max);
+    }
+    fflush(stdout);
+    *last = now;
+}
+
+static bool parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--json") == 0) g_opts.json = true;
+        else if (strcmp(a, "--tls") == 0) g_opts.tls = true;
+        else if (strcmp(a, "--trim") == 0) g_opts.trim = true;
+        else if (!has_value) return false;
+        else if (strcmp(a, "--host") == 0) g_opts.host = argv[++i];
+        else if (strcmp(a, "--port") == 0) g_opts.port = atoi(argv[++i]);
+        else if (strcmp(a, "--path") == 0) g_opts.path = argv[++i];
+        else if (strcmp(a, "--clients") == 0) g_opts.clients = atoi(argv[++i]);
+        else if (strcmp(a, "--writers") == 0) g_opts.writers = atoi(argv[++i]);
+        else if (strcmp(a, "--rate") == 0) g_opts.rate = atof(argv[++i]);
+        else if (strcmp(a, "--size") == 0) g_opts.size = atoi(argv[++i]);
+        else if (strcmp(a, "--duration") == 0) g_opts.duration = atof(argv[++i]);
+        else if (strcmp(a, "--threads") == 0) g_opts.threads = atoi(argv[++i]);
+        else if (strcmp(a, "--mux") == 0) g_opts.mux = atoi(argv[++i]);
+        else if (strcmp(a, "--label") == 0) g_opts.label = argv[++i];
+        else if (strcmp(a, "--rooms") == 0) g_opts.rooms = atoi(argv[++i]);
+        else if (strcmp(a, "--churn") == 0) g_opts.churn = atof(argv[++i]);
+        else if (strcmp(a, "--awareness") == 0) g_opts.awareness = atof(argv[++i]);
+        else if (strcmp(a, "--paste-every") == 0) g_opts.paste_every = atoi(argv[++i]);
+        else if (strcmp(a, "--paste-size") == 0) g_opts.paste_size = atoi(argv[++i]);
+        else if (strcmp(a, "--report-every") == 0) g_opts.report_every = atof(argv[++i]);
+        else return false;
+    }
+    if (g_opts.size < MARKER_LEN + STAMP_LEN) g_opts.size = MARKER_LEN + STAMP_LEN;
+    if (g_opts.paste_size < MARKER_LEN + STAMP_LEN) g_opts.paste_size = MARKER_LEN + STAMP_LEN;
+    if (g_opts.threads < 1) g_opts.threads = 1;
+    if (g_opts.writers > g_opts.clients) g_opts.writers = g_opts.clients;
+    return g_opts.clients > 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_args(argc, argv)) {
+        fprintf(stderr,
+                "Usage: %s [--host H] [--port P] [--path /] [--clients N] [--writers W]\n"
+                "          [--rate R] [--size BYTES] [--duration SEC] [--threads T]\n"
+                "          [--tls] [--mux M] [--label NAME] [--json]\n"
+                "          [--rooms K] [--churn N] [--awareness R] [--paste-every N]\n"
+                "          [--paste-size BYTES] [--trim] [--report-every SEC]\n", argv[0]);
+        return 1;
+    }
+
+    if (g_opts.tls && !tls_init()) {
+        fprintf(stderr, "Failed to create TLS context\n");
+        return 1;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", g_opts.port);
+    if (getaddrinfo(g_opts.host, port_str, &hints, &res) != 0 || !res) {
+        fprintf(stderr, "Cannot resolve %s\n", g_opts.host);
+        return 1;
+    }
+    struct sockaddr_storage addr;
+    memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    socklen_t addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    if (g_opts.tls) tls_prime_session(&addr, addr_len);
+
+    std::vector<ThreadStats> stats(g_opts.threads);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < g_opts.threads; i++) {
+        threads.push_back(std::thread(run_thread, i, &addr, addr_len, &stats[i]));
+    }
+
+    // Wait (bounded) for every connection to sync before measuring
+    double connect_start = now_sec();
+    while (g_synced + g_failed < g_opts.clients && now_sec() - connect_start < 30.0) {
+        usleep(10000);
+    }
+    double connect_time = now_sec() - connect_start;
+
+    g_measuring = true;
+    double start = now_sec();
+    double next_report = start + g_opts.report_every;
+    uint32_t report_seq = 0;
+    ReportSlot last_report;
+    std::vector<uint32_t> reservoir;
+    uint64_t reservoir_seen = 0;
+    uint32_t reported_max_us = 0;
+    unsigned report_seed = (unsigned)now_ns();
+    while (now_sec() - start < g_opts.duration) {
+        usleep(10000);
+        if (g_opts.report_every > 0 && now_sec() >= next_report) {
+            report_interval(stats, ++report_seq, now_sec() - start, g_opts.report_every, &last_report,
+                            &reservoir, &reservoir_seen, &reported_max_us, &report_seed);
+            next_report += g_opts.report_every;
+        }
+    }
+    double elapsed = now_sec() - start;
+    g_measuring = false;
+    usleep(200000);     // Let in-flight deliveries land (not counted)
+    g_stop = true;
+
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+    ThreadStats total;
+    for (size_t i = 0; i < stats.size(); i++) {
+        total.sent += stats[i].sent;
+        total.received += stats[i].received;
+        total.bytes_received += stats[i].bytes_received;
+        total.errors += stats[i].errors;
+        total.awareness += stats[i].awareness;
+        total.reconnects += stats[i].reconnects;
+        if (g_opts.report_every > 0) {
+            reservoir_add(&reservoir, &reservoir_seen, stats[i].latency_us, &report_seed);
+            for (size_t k = 0; k < stats[i].latency_us.size(); k++) {
+                reported_max_us = std::max(reported_max_us, stats[i].latency_us[k]);
+            }
+        } else {
+            total.latency_us.insert(total.latency_us.end(),
+                                    stats[i].latency_us.begin(), stats[i].latency_us.end());
+        }
+    }
+    if (g_opts.report_every > 0) {
+        total.latency_us.swap(reservoir);
+        if (reported_max_us > 0) total.latency_us.push_back(reported_max_us);
+    }
+    std::sort(total.latency_us.begin(), total.latency_us.end());
+
+    double send_rate = total.sent / elapsed;
+    double deliver_rate = total.received / elapsed;
+    double p50 = percentile(total.latency_us, 0.50);
+    double p90 = percentile(total.latency_us, 0.90);
+    double p99 = percentile(total.latency_us, 0.99);
+    double max = total.latency_us.empty() ? 0 : total.latency_us.back() / 1000.0;
+
+    if (g_opts.json) {
+        printf("{\"label\":\"%s\",\"clients\":%d,\"synced\":%d,\"writers\":%d,"
+               "\"duration_s\":%.2f,\"connect_s\":%.3f,\"sent\":%llu,\"delivered\":%llu,"
+               "\"send_per_s\":%.1f,\"deliver_per_s\":%.1f,\"deliver_mb_per_s\":%.2f,"
+               "\"latency_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f},"
+               "\"tls_handshakes\":%d,\"tls_resumed\":%d,\"awareness\":%llu,\"reconnects\":%llu,\"errors\":%llu}\n",
+               g_opts.label, g_opts.clients, g_synced.load(), g_opts.writers,
+               elapsed, connect_time,
+               (unsigned long long)total.sent, (unsigned long long)total.received,
+               send_rate, deliver_rate, total.bytes_received / elapsed / 1e6,
+               p50, p90, p99, max, g_tls_handshakes.load(), g_tls_resumed.load(),
+               (unsigned long long)total.awareness, (unsigned long long)total.reconnects,
+               (unsigned long long)total.errors);
+    } else {
+        printf("%-10s clients=%d synced=%d writers=%d connect=%.2fs\n",
+               g_opts.label[0] ? g_opts.label : "loadgen",
+               g_opts.clients, g_synced.load(), g_opts.writers, connect_time);
+        printf("  sent      %llu updates (%.1f/s)\n", (unsigned long long)total.sent, send_rate);
+        printf("  delivered %llu messages (%.1f/s, %.2f MB/s)\n",
+               (unsigned long long)total.received, deliver_rate,
+               total.bytes_received / elapsed / 1e6);
+        printf("  latency   p50=%.3fms p90=%.3fms p99=%.3fms max=%.3fms\n", p50, p90, p99, max);
+        if (g_opts.tls) {
+            printf("  tls       %d handshakes (%d resumed)\n",
+                   g_tls_handshakes.load(), g_tls_resumed.load());
+        }
+        if (total.awareness || total.reconnects) {
+            printf("  churn     %llu awareness updates, %llu reconnects\n",
+                   (unsigned long long)total.awareness, (unsigned long long)total.reconnects);
+        }
+        printf("  errors    %llu\n", (unsigned long long)total.errors);
+    }
+
+    if (g_tls_session) SSL_SESSION_free(g_tls_session);
+    if (g_tls_ctx) SSL_CTX_free(g_tls_ctx);
+
+    return total.errors > 0 && g_synced == 0 ? 1 : 0;
+}
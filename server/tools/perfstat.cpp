@@ -0,0 +1,357 @@
+// Statistics for build-vs-build benchmark comparisons (scripts/perf_compare.sh)
+//
+//   crdt_perfstat get PATH...
+//       Reads benchmark output on stdin and prints the value at each PATH
+//       (dot separated, array indices as numbers: "cases.0.broadcast_ns_per_peer")
+//       of its last JSON line, one per line. Exits 1 if a path is missing.
+//
+//   crdt_perfstat compare [--alpha A] [--threshold PCT]
+//       Reads samples on stdin, one per line: metric <TAB> higher|lower <TAB>
+//       build <TAB> value. The first build seen is the baseline. For every metric
+//       it prints a Markdown row with both medians, the change, the Hodges-Lehmann
+//       shift (median of all pairwise differences, a robust effect size), the
+//       Mann-Whitney U two-sided p-value (exact for small samples without ties,
+//       normal approximation with tie correction otherwise), and the noise (CV)
+//       of each build. A metric regresses when it got worse, p < alpha (default
+//       0.05), and the shift is at least PCT percent of the baseline median
+//       (default 3). Exits 1 if any metric regressed.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#define EXACT_MAX 20            // Exact U distribution up to this many samples per build
+
+// ---- Minimal JSON reader: flattens scalars to "a.b.0.c" -> text ----
+
+struct JsonReader {
+    const char* p;
+    std::map<std::string, std::string>* out;
+    bool ok;
+};
+
+static void skip_ws(JsonReader* r) {
+    while (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r') r->p++;
+}
+
+static bool read_string(JsonReader* r, std::string* s) {
+    if (*r->p != '"') return false;
+    r->p++;
+    s->clear();
+    while (*r->p && *r->p != '"') {
+        if (*r->p == '\\' && r->p[1]) {
+            r->p++;
+            char c = *r->p;
+            s->push_back(c == 'n' ? '\n' : c == 't' ? '\t' : c);
+            if (c == 'u') r->p += 4;    // Not needed for benchmark output
+        } else {
+            s->push_back(*r->p);
+        }
+        r->p++;
+    }
+    if (*r->p != '"') return false;
+    r->p++;
+    return true;
+}
+
+static void read_value(JsonReader* r, const std::string& path);
+
+static std::string join(const std::string& path, const std::string& key) {
+    return path.empty() ? key : path + "." + key;
+}
+
+static void read_value(JsonReader* r, const std::string& path) {
+    skip_ws(r);
+    if (!r->ok) return;
+    if (*r->p == '{') {
+        r->p++;
+        skip_ws(r);
+        if (*r->p == '}') { r->p++; return; }
+        for (;;) {
+            std::string key;
+            skip_ws(r);
+            if (!read_string(r, &key)) { r->ok = false; return; }
+            skip_ws(r);
+            if (*r->p != ':') { r->ok = false; return; }
+            r->p++;
+            read_value(r, join(path, key));
+            if (!r->ok) return;
+            skip_ws(r);
+            if (*r->p == ',') { r->p++; continue; }
+            if (*r->p == '}') { r->p++; return; }
+            r->ok = false;
+            return;
+        }
+    }
+    if (*r->p == '[') {
+        r->p++;
+        skip_ws(r);
+        if (*r->p == ']') { r->p++; return; }
+        for (int i = 0;; i++) {
+            char index[16];
+            snprintf(index, sizeof(index), "%d", i);
+            read_value(r, join(path, index));
+            if (!r->ok) return;
+            skip_ws(r);
+            if (*r->p == ',') { r->p++; continue; }
+            if (*r->p == ']') { r->p++; return; }
+            r->ok = false;
+            return;
+        }
+    }
+    if (*r->p == '"') {
+        std::string s;
+        if (!read_string(r, &s)) { r->ok = false; return; }
+        (*r->out)[path] = s;
+        return;
+    }
+    // Number, true, false, null
+    const char* start = r->p;
+    while (*r->p && !strchr(",}] \t\r\n", *r->p)) r->p++;
+    if (r->p == start) { r->ok = false; return; }
+    std::string v(start, r->p - start);
+    if (v == "true") v = "1";
+    else if (v == "false") v = "0";
+    (*r->out)[path] = v;
+}
+
+static int cmd_get(int argc, char* argv[]) {
+    std::string line, last;
+    char buf[65536];
+    while (fgets(buf, sizeof(buf), stdin)) {
+        line += buf;
+        if (line.empty() || line[line.size() - 1] != '\n') continue;
+        if (line[0] == '{') last = line;
+        line.clear();
+    }
+    if (!line.empty() && line[0] == '{') last = line;
+    if (last.empty()) {
+        fprintf(stderr, "perfstat: no JSON line in input\n");
+        return 1;
+    }
+
+    std::map<std::string, std::string> values;
+    JsonReader r = { last.c_str(), &values, true };
+    read_value(&r, "");
+    if (!r.ok) {
+        fprintf(stderr, "perfstat: malformed JSON\n");
+        return 1;
+    }
+    int status = 0;
+    for (int i = 0; i < argc; i++) {
+        std::map<std::string, std::string>::const_iterator it = values.find(argv[i]);
+        if (it == values.end()) {
+            printf("nan\n");
+            status = 1;
+        } else {
+            printf("%s\n", it->second.c_str());
+        }
+    }
+    return status;
+}
+
+// ---- Statistics ----
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    if (n == 0) return NAN;
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static double cv_percent(const std::vector<double>& v) {
+    if (v.size() < 2) return 0;
+    double mean = 0;
+    for (size_t i = 0; i < v.size(); i++) mean += v[i];
+    mean /= v.size();
+    double var = 0;
+    for (size_t i = 0; i < v.size(); i++) var += (v[i] - mean) * (v[i] - mean);
+    var /= v.size() - 1;
+    return mean != 0 ? 100.0 * sqrt(var) / fabs(mean) : 0;
+}
+
+// Median of all pairwise differences b - a
+static double hodges_lehmann(const std::vector<double>& a, const std::vector<double>& b) {
+    std::vector<double> d;
+    d.reserve(a.size() * b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        for (size_t j = 0; j < b.size(); j++) d.push_back(b[j] - a[i]);
+    }
+    return median(d);
+}
+
+// Number of rankings of m + n untied samples giving each U, by the recurrence
+// c(m, n, u) = c(m - 1, n, u - n) + c(m, n - 1, u)
+static std::vector<double> u_counts(int m, int n) {
+    int max_u = m * n;
+    // counts[i][j] for the current m over all n' <= n, built up in m
+    std::vector<std::vector<double> > prev(n + 1, std::vector<double>(max_u + 1, 0));
+    for (int j = 0; j <= n; j++) prev[j][0] = 1;     // m = 0: U is always 0
+    for (int i = 1; i <= m; i++) {
+        std::vector<std::vector<double> > cur(n + 1, std::vector<double>(max_u + 1, 0));
+        cur[0][0] = 1;                                  // n = 0: U is always 0
+        for (int j = 1; j <= n; j++) {
+            for (int u = 0; u <= i * j; u++) {
+                double c = cur[j - 1][u];
+                if (u >= j) c += prev[j][u - j];
+                cur[j][u] = c;
+            }
+        }
+        prev.swap(cur);
+    }
+    return prev[n];
+}
+
+// Two-sided Mann-Whitney U test of a against b; returns the p-value
+static double mann_whitney(const std::vector<double>& a, const std::vector<double>& b) {
+    size_t na = a.size(), nb = b.size(), n = na + nb;
+    if (na == 0 || nb == 0) return 1.0;
+
+    std::vector<std::pair<double, int> > all;
+    for (size_t i = 0; i < na; i++) all.push_back(std::make_pair(a[i], 0));
+    for (size_t i = 0; i < nb; i++) all.push_back(std::make_pair(b[i], 1));
+    std::sort(all.begin(), all.end());
+
+    double rank_a = 0;
+    double tie_term = 0;
+    bool ties = false;
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        while (j < n && all[j].first == all[i].first) j++;
+        double avg = (i + 1 + j) / 2.0;            // Ranks i+1 .. j
+        for (size_t k = i; k < j; k++) {
+            if (all[k].second == 0) rank_a += avg;
+        }
+        double t = (double)(j - i);
+        if (t > 1) {
+            ties = true;
+            tie_term += t * t * t - t;
+        }
+        i = j;
+    }
+    double u = rank_a - na * (na + 1) / 2.0;
+    double mu = na * nb / 2.0;
+
+    if (!ties && na <= EXACT_MAX && nb <= EXACT_MAX) {
+        std::vector<double> counts = u_counts((int)na, (int)nb);
+        double total = 0, le = 0, ge = 0;
+        for (size_t k = 0; k < counts.size(); k++) {
+            total += counts[k];
+            if (k <= u) le += counts[k];
+            if (k >= u) ge += counts[k];
+        }
+        double p = 2 * std::min(le, ge) / total;
+        return p > 1 ? 1 : p;
+    }
+
+    double var = na * nb / 12.0 * ((n + 1) - tie_term / (n * (n - 1.0)));
+    if (var <= 0) return 1.0;
+    double z = (fabs(u - mu) - 0.5) / sqrt(var);
+    if (z < 0) z = 0;
+    return erfc(z / sqrt(2.0));
+}
+
+struct Metric {
+    std::string name;
+    bool higher_better;
+    std::vector<double> base;
+    std::vector<double> other;
+};
+
+static int cmd_compare(int argc, char* argv[]) {
+    double alpha = 0.05;
+    double threshold = 3.0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc) alpha = atof(argv[++i]);
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+        else {
+            fprintf(stderr, "perfstat: unknown compare option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    std::vector<Metric> metrics;
+    std::map<std::string, size_t> index;
+    std::string base_label, other_label;
+    char line[1024];
+    while (fgets(line, sizeof(line), stdin)) {
+        char* fields[4];
+        char* save = nullptr;
+        int n = 0;
+        for (char* tok = strtok_r(line, "\t\n", &save); tok && n < 4; tok = strtok_r(nullptr, "\t\n", &save)) {
+            fields[n++] = tok;
+        }
+        if (n < 4) continue;
+        char* end = nullptr;
+        double value = strtod(fields[3], &end);
+        if (end == fields[3] || isnan(value)) continue;
+
+        std::string build = fields[2];
+        if (base_label.empty()) base_label = build;
+        else if (build != base_label && other_label.empty()) other_label = build;
+        if (build != base_label && build != other_label) continue;
+
+        std::map<std::string, size_t>::iterator it = index.find(fields[0]);
+        if (it == index.end()) {
+            Metric m;
+            m.name = fields[0];
+            m.higher_better = strcmp(fields[1], "higher") == 0;
+            index[m.name] = metrics.size();
+            metrics.push_back(m);
+            it = index.find(fields[0]);
+        }
+        Metric& m = metrics[it->second];
+        (build == base_label ? m.base : m.other).push_back(value);
+    }
+    if (metrics.empty() || other_label.empty()) {
+        fprintf(stderr, "perfstat: need samples from two builds\n");
+        return 2;
+    }
+
+    printf("| Metric | Better | %s | %s | Change | Shift | p | CV %s | CV %s | Verdict |\n",
+           base_label.c_str(), other_label.c_str(), base_label.c_str(), other_label.c_str());
+    printf("|--------|--------|---:|---:|---:|---:|---:|---:|---:|---------|\n");
+    int regressions = 0, improvements = 0, unchanged = 0;
+    for (size_t i = 0; i < metrics.size(); i++) {
+        const Metric& m = metrics[i];
+        double ma = median(m.base);
+        double mb = median(m.other);
+        double change = ma != 0 ? 100.0 * (mb - ma) / fabs(ma) : 0;
+        double shift = ma != 0 ? 100.0 * hodges_lehmann(m.base, m.other) / fabs(ma) : 0;
+        double p = mann_whitney(m.base, m.other);
+        bool worse = m.higher_better ? shift < 0 : shift > 0;
+
+        const char* verdict = "no change";
+        if (m.base.size() < 3 || m.other.size() < 3) {
+            verdict = "too few trials";
+            unchanged++;
+        } else if (p < alpha && fabs(shift) >= threshold) {
+            verdict = worse ? "**REGRESSION**" : "improvement";
+            if (worse) regressions++;
+            else improvements++;
+        } else {
+            if (p < alpha) verdict = "below threshold";
+            unchanged++;
+        }
+        printf("| %s | %s | %.4g | %.4g | %+.1f%% | %+.1f%% | %.3g | %.1f%% | %.1f%% | %s |\n",
+               m.name.c_str(), m.higher_better ? "higher" : "lower", ma, mb, change, shift, p,
+               cv_percent(m.base), cv_percent(m.other), verdict);
+    }
+    printf("\n%d regression%s, %d improvement%s, %d unchanged (alpha %.3g, threshold %.1f%%)\n",
+           regressions, regressions == 1 ? "" : "s", improvements, improvements == 1 ? "" : "s", unchanged,
+           alpha, threshold);
+    return regressions > 0 ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "get") == 0) return cmd_get(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "compare") == 0) return cmd_compare(argc - 2, argv + 2);
+    fprintf(stderr, "Usage: %s get PATH... < output\n"
+                    "       %s compare [--alpha A] [--threshold PCT] < samples.tsv\n", argv[0], argv[0]);
+    return 2;
+}